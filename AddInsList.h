@@ -28,6 +28,14 @@
 #import "DetailsDelegate.h"
 
 @class DAArchive;
+@class ContentHashStore;
+@class ScanCache;
+@class FolderWatcher;
+@class ContentTable;
+@class FileSyncPlan;
+@class ArchiveSpool;
+@class InstallProgress;
+@class InstallBatch;
 
 @interface AddInsList : NSPersistentDocument
 {
@@ -37,6 +45,10 @@
 	NullStore *nullStore;
 	
 	NSOperationQueue *operationQueue;
+	NSManagedObjectContext *mainContext;
+	NSManagedObjectContext *ingestContext;
+	NSMutableArray *ingestQueue;
+	BOOL ingestScheduled;
 	BOOL isBusy;
 	NSString *statusMessage;
 	
@@ -48,6 +60,8 @@
 	
 	IBOutlet NSWindow *progressWindow;
 	IBOutlet NSProgressIndicator *progressIndicator;
+	IBOutlet NSTextField *progressLabel;
+	InstallProgress *installProgress;
 	
 	IBOutlet NSWindow *assignSheet;
 	IBOutlet NSArrayController *assignAddInController;
@@ -62,6 +76,21 @@
 	NSDictionary *contentsData;
 	
 	IBOutlet NSScrollView *optionsContainer;
+	
+	ContentHashStore *hashStore;
+	ScanCache *scanCache;
+	ContentTable *contentTable;
+	
+	FolderWatcher *watcher;
+	NSMutableSet *affectedItems;
+	BOOL checkAllMissing;
+	
+	NSMutableSet *dirtyItems;
+	NSMutableSet *dirtyConfigKeys;
+	NSOperationQueue *syncQueue;
+	NSOperation *lastSync;
+	NSMutableArray *syncErrors; /* Guarded by itself, added to on the sync queue. */
+	BOOL savePending;
 }
 
 + (AddInsList*)sharedAddInsList;
@@ -73,14 +102,19 @@
 
 - (void)selectItemWithUid:(NSString*)uid;
 
-- (void)addContents:(NSArray *)contents data:(NSArray*)data origURLs:(NSArray*)origURLs forPath:(NSString*)path type:(NSString*)pathType disabled:(BOOL)disabled;
+- (void)addContents:(NSArray *)contents data:(NSArray*)data origURLs:(NSArray*)origURLs forPath:(NSString*)path type:(NSString*)pathType disabled:(BOOL)disabled inContext:(NSManagedObjectContext*)moc followUps:(NSMutableArray*)followUps;
 - (void)addContentsForPath:(NSDictionary*)data;
+- (void)ingestPending;
+- (void)applyFollowUps:(NSArray*)followUps;
 
 @property(readonly) NSOperationQueue *queue;
+@property(readonly) ScanCache *scanCache;
+@property(readonly) ContentTable *contentTable;
 @property(readonly) BOOL isBusy;
 @property(readonly) NSString *statusMessage;
 
 - (void)updateOperationCount;
+- (void)updateMissingFiles;
 
 @property(copy) NSURL *backgroundURL;
 @property(copy) NSURL *randomScreenshotURL;
@@ -104,8 +138,17 @@
 
 @interface AddInsList (Installing)
 
+- (NSString*)installPath:(NSString*)path mainDirs:(NSArray*)mainDirs;
+- (Item*)insertItemNode:(NSXMLElement*)node error:(NSError**)error;
 - (BOOL)installItems:(NSArray*)items withArchive:(DAArchive*)archive name:(NSString*)name uncompressedSize:(int64_t)sz error:(NSError**)error;
-- (void)progressChanged:(ArchiveWrapper*)archive session:(NSModalSession)session;
+- (BOOL)installItems:(NSArray*)items withArchive:(DAArchive*)archive spool:(ArchiveSpool*)spool name:(NSString*)name uncompressedSize:(int64_t)sz error:(NSError**)error;
+- (NSArray*)stageItems:(NSArray*)items withArchive:(DAArchive*)archive spool:(ArchiveSpool*)spool name:(NSString*)name session:(NSModalSession)modal error:(NSError**)error;
+- (void)scanInstalledItems:(NSArray*)items message:(NSString*)msg;
+- (IBAction)cancelInstall:(id)sender;
+
+@property(readonly) ContentHashStore *hashStore;
+
+- (IBAction)dedupeInstallation:(id)sender;
 
 @end
 
@@ -120,6 +163,7 @@
 
 - (IBAction)toggleEnabled:(id)sender;
 - (void)enabledChanged:(Item*)item canInteract:(BOOL)canInteract;
+- (void)updateEnabled:(Item*)item canInteract:(BOOL)canInteract;
 - (void)askOverrideGameVersion:(Item*)item;
 - (void)answerOverrideGameVersion:(NSWindow *)sheet returnCode:(NSInteger)returnCode contextInfo:(void *)contextInfo;
 
@@ -128,6 +172,27 @@
 @end
 
 
+@interface AddInsList (Saving)
+
+- (void)contextObjectsChanged:(NSNotification*)note;
+- (void)planItem:(Item*)item into:(FileSyncPlan*)plan;
+- (void)planConfigKey:(ConfigKey*)key into:(FileSyncPlan*)plan;
+- (BOOL)syncFilesFromContext:(NSError **)error;
+- (void)syncItems:(NSSet*)items configKeys:(NSSet*)keys;
+- (void)retryConfigKeys:(NSSet*)keys;
+- (NSError*)takeSyncError;
+- (void)presentSyncErrors;
+/* Saves anything pending and waits for the files to be moved, as the game has to see them. */
+- (BOOL)waitForFileSync:(NSError **)error;
+
+/* Saves shortly, so a burst of edits is written once. */
+- (void)scheduleSave;
+/* Does a scheduled save right away, if there is one. */
+- (void)flushPendingSave;
+
+@end
+
+
 @interface AddInsList (Uninstalling)
 
 - (IBAction)askUninstall:(id)sender;
@@ -135,3 +200,61 @@
 - (BOOL)uninstall:(Item*)item error:(NSError**)error;
 
 @end
+
+
+@interface AddInsList (Consolidating)
+
+- (BOOL)consolidate:(Item*)item error:(NSError**)error;
+- (BOOL)expand:(Item*)item error:(NSError**)error;
+
+@end
+
+
+@interface AddInsList (Exporting)
+
+- (void)askExport:(Item*)item;
+- (NSData*)manifestForItem:(Item*)item error:(NSError**)error;
+- (NSArray*)exportFilesForItem:(Item*)item;
+- (BOOL)writeDazip:(NSURL*)url manifest:(NSData*)manifest files:(NSArray*)files error:(NSError**)error;
+
+@end
+
+
+@interface AddInsList (BatchInstalling)
+
+- (IBAction)askInstallDazips:(id)sender;
+- (void)installDazipsAtURLs:(NSArray*)urls;
+- (void)askInstallBatch:(InstallBatch*)batch;
+- (void)answerInstallBatch:(NSWindow *)sheet returnCode:(NSInteger)returnCode contextInfo:(void *)contextInfo;
+- (void)installBatch:(InstallBatch*)batch;
+
+@end
+
+
+@interface AddInsList (Watching)
+
+- (void)startWatching;
+- (NSArray*)scanComponentsForPath:(NSString*)path;
+- (void)retirePath:(NSString*)path disabled:(BOOL)disabled;
+- (void)filesChanged:(NSSet*)paths;
+
+@end
+
+
+@interface AddInsList (Conflicts)
+
+/*
+ * Item object IDs to the lower case content names they also have. Looked up
+ * per content name, so only the given contents matter for the time taken.
+ */
+- (NSDictionary*)conflictsForContents:(NSSet*)contents;
+- (NSDictionary*)conflictsForItem:(Item*)item;
+
+/* Contents are kept by content path, Addins/UID or Offers/UID for addins and offers. */
+- (NSString*)contentPathForItem:(Item*)item;
+- (Item*)itemForContentPath:(NSString*)path;
+- (NSDictionary*)itemsForConflicts:(NSDictionary*)conflicts;
+- (NSString*)describeConflicts:(NSDictionary*)conflicts;
+
+@end
+
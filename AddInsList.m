@@ -25,9 +25,28 @@
 #import "Scanner.h"
 #import "Game.h"
 #import "NullStore.h"
+#import "ContentHashStore.h"
+#import "ScanCache.h"
+#import "FolderWatcher.h"
+#import "ContentTable.h"
+#import "FileSyncPlan.h"
+#import "InstallStage.h"
+#import "InstallProgress.h"
+#import "InstallBatch.h"
 #import "base64.h"
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "erf.h"
+#include "zipwrite.h"
+
+/* How long to wait for more edits before a scheduled save. */
+#define SAVE_DELAY 0.3
+/* Files listed by name when some can't be synced, the rest are only counted. */
+#define SYNC_ERROR_LINES 10
 
 @implementation AddInsList
 
@@ -54,6 +73,11 @@ static NSPredicate *isREADME;
 	if (self != nil) {
 		if (!operationQueue)
 			operationQueue = [[NSOperationQueue alloc] init];
+		syncQueue = [[NSOperationQueue alloc] init];
+		[syncQueue setMaxConcurrentOperationCount:1];
+		syncErrors = [NSMutableArray array];
+		ingestQueue = [NSMutableArray array];
+		contentTable = [[ContentTable alloc] init];
 		[[self managedObjectContext] setUndoManager:nil];
 		
 		detailsTabSelected = 1;
@@ -67,6 +91,26 @@ static NSPredicate *isREADME;
     return self;
 }
 
+/*
+ * A main queue context, so that the ingest context's saves can be merged
+ * into it with performBlock:. What the user changed wins over scan results.
+ */
+- (NSManagedObjectContext*)managedObjectContext
+{
+	if (!mainContext)
+	{
+		mainContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
+		[mainContext setPersistentStoreCoordinator:[[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:[self managedObjectModel]]];
+		[mainContext setMergePolicy:NSMergeByPropertyObjectTrumpMergePolicy];
+		[super setManagedObjectContext:mainContext];
+		
+		dirtyItems = [NSMutableSet set];
+		dirtyConfigKeys = [NSMutableSet set];
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(contextObjectsChanged:) name:NSManagedObjectContextObjectsDidChangeNotification object:mainContext];
+	}
+	return mainContext;
+}
+
 - (BOOL)readFromURL:(NSURL *)absoluteURL ofType:(NSString *)typeName error:(NSError **)error
 {
 	NSURL *addinsURL = [absoluteURL URLByAppendingPathComponent:@"Settings/AddIns.xml"];
@@ -112,11 +156,36 @@ static NSPredicate *isREADME;
 			nullStore = store;
 	}
 	
-	/* Figure out what offers to show. */
+	scanCache = [[ScanCache alloc] initWithBaseURL:absoluteURL];
+	
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+		[InstallStage removeStaleStagingBelowURL:absoluteURL];
+	});
+	
+	/*
+	 * Scan results are applied in this context, off the main thread. It's on
+	 * the coordinator itself, so its fetches don't go through the main queue,
+	 * and its saves are merged into the main context.
+	 */
+	ingestContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+	[ingestContext setPersistentStoreCoordinator:[[self managedObjectContext] persistentStoreCoordinator]];
+	[ingestContext setMergePolicy:NSMergeByPropertyObjectTrumpMergePolicy];
+	[ingestContext setUndoManager:nil];
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(ingestContextDidSave:) name:NSManagedObjectContextDidSaveNotification object:ingestContext];
+	
+	/*
+	 * Figure out what offers to show, the ones not part of an addin. Same as
+	 * the addins fetched property, but with one fetch instead of one per offer.
+	 */
+	NSArray *addins = [[self managedObjectContext] executeFetchRequest:[[self managedObjectModel] fetchRequestTemplateForName:@"allAddIns"] error:nil];
+	NSSet *addinUIDs = [NSSet setWithArray:[addins valueForKey:@"UID"]];
 	NSArray *offers = [[self managedObjectContext] executeFetchRequest:[[self managedObjectModel] fetchRequestTemplateForName:@"allOffers"] error:nil];
 	for (OfferItem *offer in offers)
 	{
-		offer.displayed = [NSNumber numberWithBool:![[offer valueForKey:@"addins"] count]];
+		BOOL show = ![addinUIDs intersectsSet:[offer.PRCList valueForKey:@"microContentID"]];
+		
+		if ([offer.displayed boolValue] != show)
+			offer.displayed = [NSNumber numberWithBool:show];
 	}
 	
 	[self searchSpotlightForScreenshots:absoluteURL];
@@ -148,8 +217,6 @@ static NSPredicate *isREADME;
 		[launchGameButton setImage:[Game sharedGame].gameAppImage];
 	else if (object == itemsController)
 		[self itemsControllerChanged];
-	else if ([keyPath isEqualToString:@"uncompressedOffset"])
-		[self progressChanged:object session:context];
 	else if (object == operationQueue)
 		[self performSelectorOnMainThread:@selector(updateOperationCount) withObject:nil waitUntilDone:NO];
 	else if (object == [NSUserDefaultsController sharedUserDefaultsController])
@@ -159,6 +226,22 @@ static NSPredicate *isREADME;
 }
 
 
+- (void)close
+{
+	[self flushPendingSave];
+	[lastSync waitUntilFinished];
+	for (NSPersistentStore *store in [[mainContext persistentStoreCoordinator] persistentStores])
+	{
+		if ([store isKindOfClass:[DataStore class]])
+			[(DataStore*)store flushSnapshot];
+	}
+	[watcher stop];
+	watcher = nil;
+	[[NSNotificationCenter defaultCenter] removeObserver:self name:NSManagedObjectContextObjectsDidChangeNotification object:mainContext];
+	[[NSNotificationCenter defaultCenter] removeObserver:self name:NSManagedObjectContextDidSaveNotification object:ingestContext];
+	[super close];
+}
+
 - (void)windowControllerDidLoadNib:(NSWindowController *)windowController 
 {
     [super windowControllerDidLoadNib:windowController];
@@ -185,7 +268,9 @@ static NSPredicate *isREADME;
 	[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:scanAddinsURL message:@"addins" disabled:NO]];
 	[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:scanOffersURL message:@"offers" disabled:NO]];
 	[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:scanPackagesURL message:@"packages" disabled:NO]];
+	checkAllMissing = YES;
 	[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:scanDisabledPackagesURL message:@"disabled packages" disabled:YES]];
+	[self startWatching];
 	
 	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
 	[backgroundImage setAlphaValue:[defaults floatForKey:@"backgroundAlpha"]];
@@ -290,7 +375,11 @@ static NSPredicate *isREADME;
 	}
 }
 
-- (void)addContents:(NSArray *)contents data:(NSArray*)data origURLs:(NSArray*)origURLs forPath:(NSString*)path type:(NSString*)pathType disabled:(BOOL)disabled
+/*
+ * Runs on the ingest context queue. Anything that has to be done in the main
+ * context is added to followUps.
+ */
+- (void)addContents:(NSArray *)contents data:(NSArray*)data origURLs:(NSArray*)origURLs forPath:(NSString*)path type:(NSString*)pathType disabled:(BOOL)disabled inContext:(NSManagedObjectContext*)moc followUps:(NSMutableArray*)followUps
 {
 	NSArray *cparts = [path pathComponents];
 	NSFetchRequest *req;
@@ -301,12 +390,10 @@ static NSPredicate *isREADME;
 	{
 		req = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"itemWithUID" substitutionVariables:[NSDictionary dictionaryWithObject:[cparts objectAtIndex:1] forKey:@"UID"]];
 		
-		NSArray *items = [[self managedObjectContext] executeFetchRequest:req error:nil];
+		NSArray *items = [moc executeFetchRequest:req error:nil];
 		if ([items count])
 		{
 			item = [items objectAtIndex:0];
-			
-			/* XXX add contents here. */
 		}
 		else
 		{
@@ -316,7 +403,7 @@ static NSPredicate *isREADME;
 	else
 	{
 		req = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"path" substitutionVariables:[NSDictionary dictionaryWithObject:path forKey:@"path"]];
-		NSArray *paths = [[self managedObjectContext] executeFetchRequest:req error:nil];
+		NSArray *paths = [moc executeFetchRequest:req error:nil];
 		
 		if ([paths count])
 		{
@@ -328,9 +415,9 @@ static NSPredicate *isREADME;
 		else
 		{
 			/* An unknown path. */
-			item = [NSEntityDescription insertNewObjectForEntityForName:@"UnknownPath" inManagedObjectContext:[self managedObjectContext]];
-			pathObj = [NSEntityDescription insertNewObjectForEntityForName:@"Path" inManagedObjectContext:[self managedObjectContext]];
-			Text *title = [NSEntityDescription insertNewObjectForEntityForName:@"Text" inManagedObjectContext:[self managedObjectContext]];
+			item = [NSEntityDescription insertNewObjectForEntityForName:@"UnknownPath" inManagedObjectContext:moc];
+			pathObj = [NSEntityDescription insertNewObjectForEntityForName:@"Path" inManagedObjectContext:moc];
+			Text *title = [NSEntityDescription insertNewObjectForEntityForName:@"Text" inManagedObjectContext:moc];
 			
 			pathObj.path = path;
 			pathObj.type = pathType;
@@ -339,7 +426,7 @@ static NSPredicate *isREADME;
 			[title updateLocalizedValue:nil];
 			title.item = item;
 			item.Title = title;
-			item.modazipin = [NSEntityDescription insertNewObjectForEntityForName:@"Modazipin" inManagedObjectContext:[self managedObjectContext]];
+			item.modazipin = [NSEntityDescription insertNewObjectForEntityForName:@"Modazipin" inManagedObjectContext:moc];
 			item.Enabled = disabled ? [NSDecimalNumber zero] : [NSDecimalNumber one];
 			item.displayed = [NSNumber numberWithBool:YES];
 			[item.modazipin addPathsObject:pathObj];
@@ -355,30 +442,9 @@ static NSPredicate *isREADME;
 	
 	while ((content = [cenum nextObject]) && (d = [denum nextObject]) && (url = [uenum nextObject]))
 	{
-		if (pathObj)
-		{
-			NSManagedObject *contentObj;
-			req = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"contentWithNameAndPath" substitutionVariables:[NSDictionary dictionaryWithObjectsAndKeys:pathObj, @"path", content, @"name", nil]];
-			NSArray *contentObjs = [[self managedObjectContext] executeFetchRequest:req error:nil];
-			
-			if ([contentObjs count])
-			{
-				contentObj = [contentObjs objectAtIndex:0];
-			}
-			else
-			{
-				contentObj = [NSEntityDescription insertNewObjectForEntityForName:@"Content" inManagedObjectContext:[self managedObjectContext]];
-				
-				[contentObj setValue:content forKey:@"name"];
-				[contentObj setValue:pathObj forKey:@"path"];
-				
-				[[self managedObjectContext] assignObject:contentObj toPersistentStore:nullStore];
-				
-				[pathObj addContentsObject:contentObj];
-			}
-			
-			[contentObj setValue:[url filePathURL] forKey:@"URL"];
-		}
+		/* Addin and offer contents are kept under their folder, Addins/UID or Offers/UID. */
+		if (pathObj || [pathType isEqualToString:@"addin"])
+			[contentTable addContent:content URL:[url filePathURL] forPath:path];
 		
 		if (item)
 		{
@@ -389,7 +455,7 @@ static NSPredicate *isREADME;
 				readme = [NSString stringWithFormat:@"README:\n\n%@", [NSString stringWithContentsOfURL:url encoding:NSWindowsCP1252StringEncoding error:nil]];
 			
 			
-				Text *desc = !item.Description && readme ? [NSEntityDescription insertNewObjectForEntityForName:@"Text" inManagedObjectContext:[self managedObjectContext]] : nil;
+				Text *desc = !item.Description && readme ? [NSEntityDescription insertNewObjectForEntityForName:@"Text" inManagedObjectContext:moc] : nil;
 				if (desc)
 				{
 					desc.DefaultText = readme;
@@ -398,30 +464,119 @@ static NSPredicate *isREADME;
 				}
 			}
 	
-			/* Check if this is the image. */
-			if (item.Image && ![item valueForKey:@"imageData"] && [item.Image isEqualToString:[content stringByDeletingPathExtension]])
-			{
-				NSImage *img = [[NSImage alloc] initWithData:d];
-				[item setValue:[img TIFFRepresentation] forKey:@"imageData"];
-				[item updateInfo];
-				if ([[itemsController selectedObjects] indexOfObject:item] != NSNotFound)
-					[self performSelectorOnMainThread:@selector(reloadDetails) withObject:nil waitUntilDone:NO];
-			}
-			if ([content caseInsensitiveCompare:@"OverrideConfig.xml"] == NSOrderedSame && ![[item valueForKey:@"configSections"] count])
-			{
-				[self configurePersistentStoreCoordinatorForURL:[url fileReferenceURL] ofType:@"OverrideConfigStore" modelConfiguration:@"overrideconfig" storeOptions:[NSDictionary dictionaryWithObject:item forKey:@"item"] error:nil];
-				req = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"configSectionsForItem" substitutionVariables:[NSDictionary dictionaryWithObject:item forKey:@"item"]];
-				NSArray *sections = [[self managedObjectContext] executeFetchRequest:req error:nil];
-				
-				[item setValue:[NSSet setWithArray:sections] forKey:@"configSections"];
-			}
+			/*
+			 * Check if this is the image. The image data is transient, so it's set in the main context,
+			 * and only decoded there once it's known that the item doesn't have it yet.
+			 */
+			if (item.Image && [item.Image isEqualToString:[content stringByDeletingPathExtension]])
+				[followUps addObject:[NSDictionary dictionaryWithObjectsAndKeys:item, @"item", d, @"image", nil]];
+			/* Adding a store has to be done by the document. */
+			if ([content caseInsensitiveCompare:@"OverrideConfig.xml"] == NSOrderedSame)
+				[followUps addObject:[NSDictionary dictionaryWithObjectsAndKeys:item, @"item", [url fileReferenceURL], @"configURL", nil]];
+		}
+	}
+}
+
+/*
+ * Can be called from any thread. The results are applied in the ingest context,
+ * as many as have been queued at once, and then saved and merged into the main
+ * context.
+ */
+- (void)addContentsForPath:(NSDictionary*)data
+{
+	@synchronized(ingestQueue)
+	{
+		[ingestQueue addObject:data];
+		if (ingestScheduled)
+			return;
+		ingestScheduled = YES;
+	}
+	
+	[ingestContext performBlock:^{
+		[self ingestPending];
+	}];
+}
+
+- (void)ingestPending
+{
+	NSMutableArray *followUps = [NSMutableArray array];
+	NSArray *batch;
+	NSError *err = nil;
+	
+	@synchronized(ingestQueue)
+	{
+		batch = [NSArray arrayWithArray:ingestQueue];
+		[ingestQueue removeAllObjects];
+		ingestScheduled = NO;
+	}
+	
+	for (NSDictionary *data in batch)
+	{
+		@autoreleasepool
+		{
+			[self addContents:[data objectForKey:@"contents"] data:[data objectForKey:@"data"] origURLs:[data objectForKey:@"origurls"] forPath:[data objectForKey:@"path"] type:[data objectForKey:@"pathtype"] disabled:[[data objectForKey:@"disabled"] boolValue] inContext:ingestContext followUps:followUps];
 		}
 	}
+	
+	if (![ingestContext save:&err])
+		NSLog(@"Failed to apply scan results: %@", err);
+	
+	/* Inserted items only have permanent IDs once saved. */
+	NSMutableArray *applied = [NSMutableArray arrayWithCapacity:[followUps count]];
+	for (NSDictionary *f in followUps)
+	{
+		NSMutableDictionary *m = [NSMutableDictionary dictionaryWithDictionary:f];
+		
+		[m setObject:[[f objectForKey:@"item"] objectID] forKey:@"item"];
+		[applied addObject:m];
+	}
+	[ingestContext reset];
+	
+	/* After the merge, which is queued on the main context already. */
+	if ([applied count])
+	{
+		[mainContext performBlock:^{
+			[self applyFollowUps:applied];
+		}];
+	}
+}
+
+- (void)ingestContextDidSave:(NSNotification*)note
+{
+	[mainContext performBlock:^{
+		[mainContext mergeChangesFromContextDidSaveNotification:note];
+	}];
 }
 
-- (void)addContentsForPath:(NSDictionary*)data;
+- (void)applyFollowUps:(NSArray*)followUps
 {
-	[self addContents:[data objectForKey:@"contents"] data:[data objectForKey:@"data"] origURLs:[data objectForKey:@"origurls"] forPath:[data objectForKey:@"path"] type:[data objectForKey:@"pathtype"] disabled:[[data objectForKey:@"disabled"] boolValue]];
+	for (NSDictionary *f in followUps)
+	{
+		Item *item = (Item*)[[self managedObjectContext] existingObjectWithID:[f objectForKey:@"item"] error:nil];
+		NSData *image = [f objectForKey:@"image"];
+		NSURL *configURL = [f objectForKey:@"configURL"];
+		
+		if (!item)
+			continue;
+		
+		NSData *imageData = image && ![item valueForKey:@"imageData"] ? [[[NSImage alloc] initWithData:image] TIFFRepresentation] : nil;
+		
+		if (imageData)
+		{
+			[item setValue:imageData forKey:@"imageData"];
+			[item updateInfo];
+			if ([[itemsController selectedObjects] indexOfObject:item] != NSNotFound)
+				[self reloadDetails];
+		}
+		if (configURL && ![[item valueForKey:@"configSections"] count])
+		{
+			[self configurePersistentStoreCoordinatorForURL:configURL ofType:@"OverrideConfigStore" modelConfiguration:@"overrideconfig" storeOptions:[NSDictionary dictionaryWithObject:item forKey:@"item"] error:nil];
+			NSFetchRequest *req = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"configSectionsForItem" substitutionVariables:[NSDictionary dictionaryWithObject:item forKey:@"item"]];
+			NSArray *sections = [[self managedObjectContext] executeFetchRequest:req error:nil];
+			
+			[item setValue:[NSSet setWithArray:sections] forKey:@"configSections"];
+		}
+	}
 }
 
 - (NSOperationQueue*)queue
@@ -429,6 +584,9 @@ static NSPredicate *isREADME;
 	return operationQueue;
 }
 
+@synthesize scanCache;
+@synthesize contentTable;
+
 - (void)updateOperationCount
 {
 	if ([operationQueue operationCount])
@@ -466,25 +624,55 @@ static NSPredicate *isREADME;
 			statusMessage = @"";
 			[self didChangeValueForKey:@"statusMessage"];
 		}
+		[scanCache save:nil];
+		
+		/* Wait for the results still in the ingest context, and for them to be merged. */
+		[ingestContext performBlock:^{
+			[mainContext performBlock:^{
+				[self updateMissingFiles];
+			}];
+		}];
+	}
+}
+
+/*
+ * After a full scan all items are checked, after rescanning changed folders
+ * only the affected items.
+ */
+- (void)updateMissingFiles
+{
+	NSArray *items;
+	
+	if (checkAllMissing)
+	{
 		NSFetchRequest *req = [[self managedObjectModel] fetchRequestTemplateForName:@"itemsWithAnyPath"];
-		NSArray *items = [[self managedObjectContext] executeFetchRequest:req error:nil];
+		items = [[self managedObjectContext] executeFetchRequest:req error:nil];
+		checkAllMissing = NO;
+	}
+	else
+		items = [affectedItems allObjects];
+	[affectedItems removeAllObjects];
+	
+	NSMutableArray *missing = [NSMutableArray array];
+	
+	for (Item *item in items)
+	{
+		[missing removeAllObjects];
+		
+		if ([item isDeleted])
+			continue;
 		
-		NSMutableArray *missing = [NSMutableArray array];
+		for (Path *p in item.modazipin.paths)
+		{
+			if (![p.verified boolValue])
+				[missing addObject:p.path];
+		}
 		
-		for (Item *item in items)
+		NSString *missingFiles = [missing count] ? [missing componentsJoinedByString:@", "] : nil;
+		if (missingFiles != item.missingFiles && ![missingFiles isEqualToString:item.missingFiles])
 		{
-			[missing removeAllObjects];
-			
-			for (Path *p in item.modazipin.paths)
-			{
-				if (![p.verified boolValue])
-					[missing addObject:p.path];
-			}
-			if ([missing count])
-			{
-				item.missingFiles = [missing componentsJoinedByString:@", "];
-				[self performSelectorOnMainThread:@selector(reloadItem:) withObject:item waitUntilDone:NO];
-			}
+			item.missingFiles = missingFiles;
+			[self reloadItem:item];
 		}
 	}
 }
@@ -505,6 +693,36 @@ static NSPredicate *isREADME;
 		if ([selected count] == 1)
 			[self askAssign:[selected objectAtIndex:0]];
 	}
+	else if ([command isEqualToString:@"consolidate"] || [command isEqualToString:@"expand"])
+	{
+		NSArray *selected = [itemsController selectedObjects];
+		NSError *err = nil;
+		
+		if ([selected count] != 1)
+			return;
+		
+		Item *item = [selected objectAtIndex:0];
+		BOOL res;
+		
+		if ([command isEqualToString:@"consolidate"])
+			res = [self consolidate:item error:&err];
+		else
+			res = [self expand:item error:&err];
+		
+		if (!res && err)
+			[self presentError:err];
+		
+		[item updateInfo];
+		[self reloadDetails];
+		[self saveDocument:self];
+	}
+	else if ([command isEqualToString:@"export"])
+	{
+		NSArray *selected = [itemsController selectedObjects];
+		
+		if ([selected count] == 1)
+			[self askExport:[selected objectAtIndex:0]];
+	}
 }
 
 - (NSData*)dataForContent:(NSString *)content
@@ -562,97 +780,46 @@ static NSPredicate *isREADME;
 
 @implementation AddInsList (Installing)
 
-- (BOOL)installItems:(NSArray*)items withArchive:(DAArchive*)archive name:(NSString*)name uncompressedSize:(int64_t)sz error:(NSError**)error
+/*
+ * Members installing into Addins or Offers outside of the items' own folders
+ * are moved into the first one.
+ */
+- (NSString*)installPath:(NSString*)path mainDirs:(NSArray*)mainDirs
 {
-	NSURL *base = [self fileURL];
-	
-	if (!archive)
-		return NO;
+	if ([path rangeOfString:@"Addins/" options:NSCaseInsensitiveSearch | NSAnchoredSearch].length == 0
+		&& [path rangeOfString:@"Offers/" options:NSCaseInsensitiveSearch | NSAnchoredSearch].length == 0)
+		return path;
 	
-	NSMutableArray *mainDirs = [NSMutableArray arrayWithCapacity:[items count]];
-	for (NSXMLElement *node in items)
+	for (NSString *dir in mainDirs)
 	{
-		if ([[node name] isEqualToString:@"AddInItem"])
-			[mainDirs addObject:[NSString stringWithFormat:@"Addins/%@", [[node attributeForName:@"UID"] stringValue]]];
-		else if ([[node name] isEqualToString:@"OfferItem"])
-			[mainDirs addObject:[NSString stringWithFormat:@"Offers/%@", [[node attributeForName:@"UID"] stringValue]]];
+		if ([path rangeOfString:dir options:NSCaseInsensitiveSearch | NSAnchoredSearch].length != 0)
+			return path;
 	}
+	if (![mainDirs count])
+		return path;
 	
-	[progressIndicator setMaxValue:sz];
-	[progressIndicator setDoubleValue:0];
-	[progressWindow setTitle:[NSString stringWithFormat:@"Installing %@", name]];
-	NSModalSession modal = [NSApp beginModalSessionForWindow:progressWindow];
+	NSRange r = [path rangeOfString:@"/"];
 	
-	[archive addObserver:self forKeyPath:@"uncompressedOffset" options:0 context:modal];
+	return [NSString stringWithFormat:@"%@/%@", [mainDirs objectAtIndex:0], [path substringFromIndex:r.location + 1]];
+}
 
-	BOOL ret = YES;
-	for (DAArchiveMember *entry in archive)
+- (Item*)insertItemNode:(NSXMLElement*)node error:(NSError**)error
+{
+	Item *item = nil;
+	
+	if ([[node name] isEqualToString:@"AddInItem"])
 	{
-		NSString *path;
-		
-		if (entry.type == dmtManifest)
-			continue;
-		
-		path = entry.installPath;
-		
-		if ([path rangeOfString:@"Addins/" options:NSCaseInsensitiveSearch | NSAnchoredSearch].length != 0
-			|| [path rangeOfString:@"Offers/" options:NSCaseInsensitiveSearch | NSAnchoredSearch].length != 0)
-		{
-			BOOL matched = NO;
-			
-			for (NSString *dir in mainDirs)
-			{
-				if ([path rangeOfString:dir options:NSCaseInsensitiveSearch | NSAnchoredSearch].length != 0)
-				{
-					matched = YES;
-					break;
-				}
-			}
-			if (!matched && [mainDirs count])
-			{
-				/* Move the item into the first main dir. */
-				NSRange r = [path rangeOfString:@"/"];
-				
-				path = [NSString stringWithFormat:@"%@/%@", [mainDirs objectAtIndex:0], [path substringFromIndex:r.location + 1]];
-			}
-		}
+		item = [addinsStore insertAddInNode:node error:error intoContext:[self managedObjectContext]];
 		
-		NSURL *dst = [base URLByAppendingPathComponent:path];
-		/* XXX delete all files on error. */
-		if (![entry extractToURL:dst createDirectories:YES error:error])
-		{
-			ret = NO;
-			goto out;
-		}
+		if (item)
+			[[item valueForKey:@"offers"] setValue:[NSNumber numberWithBool:NO] forKey:@"displayed"];
 	}
-	
-	/* XXX delete all files and items on error. */
-	for (NSXMLElement *node in items)
+	else if ([[node name] isEqualToString:@"OfferItem"])
 	{
-		Item *item = nil;
+		item = [offersStore insertOfferNode:node error:error intoContext:[self managedObjectContext]];
 		
-		if ([[node name] isEqualToString:@"AddInItem"])
-		{
-			item = [addinsStore insertAddInNode:node error:error intoContext:[self managedObjectContext]];
-			
-			if (!item)
-			{
-				ret = NO;
-				goto out;
-			}
-
-			[[item valueForKey:@"offers"] setValue:[NSNumber numberWithBool:NO] forKey:@"displayed"];
-		}
-		else if ([[node name] isEqualToString:@"OfferItem"])
+		if (item)
 		{
-			item = [offersStore insertOfferNode:node error:error intoContext:[self managedObjectContext]];
-			
-			if (!item)
-			{
-				ret = NO;
-				goto out;
-			}
-
 			NSArray *related = [item valueForKey:@"addins"];
 			for (AddInItem *rel in related) {
 				[[self managedObjectContext] refreshObject:rel mergeChanges:NO];
@@ -661,50 +828,225 @@ static NSPredicate *isREADME;
 			}
 			item.displayed = [NSNumber numberWithBool:![related count]];
 		}
-		else if ([[node name] isEqualToString:@"OverrideItem"])
+	}
+	else if ([[node name] isEqualToString:@"OverrideItem"])
+		item = [overridesStore insertOverrideNode:node error:error intoContext:[self managedObjectContext]];
+	
+	return item;
+}
+
+- (BOOL)installItems:(NSArray*)items withArchive:(DAArchive*)archive name:(NSString*)name uncompressedSize:(int64_t)sz error:(NSError**)error
+{
+	return [self installItems:items withArchive:archive spool:nil name:name uncompressedSize:sz error:error];
+}
+
+/*
+ * Everything is extracted into a staging folder first. What was spooled
+ * when opening is used if it's still current, otherwise zip files are
+ * extracted several members at a time. Nothing ends up in the game folder
+ * unless all members could be extracted and the items inserted.
+ */
+- (BOOL)installItems:(NSArray*)items withArchive:(DAArchive*)archive spool:(ArchiveSpool*)spool name:(NSString*)name uncompressedSize:(int64_t)sz error:(NSError**)error
+{
+	[progressIndicator setMaxValue:sz];
+	[progressIndicator setDoubleValue:0];
+	[progressLabel setStringValue:@""];
+	[progressWindow setTitle:[NSString stringWithFormat:@"Installing %@", name]];
+	NSModalSession modal = [NSApp beginModalSessionForWindow:progressWindow];
+	
+	NSArray *inserted = [self stageItems:items withArchive:archive spool:spool name:name session:modal error:error];
+	
+	if (inserted)
+	{
+		[self scanInstalledItems:inserted message:name];
+		for (Item *item in inserted)
+			[self updateEnabled:item canInteract:NO];
+	}
+	
+	[self.hashStore save:nil];
+	[NSApp endModalSession:modal];
+	[progressWindow close];
+	
+	return inserted != nil;
+}
+
+/*
+ * The staging and inserting part of installItems:withArchive:spool:name:uncompressedSize:error:,
+ * for a progress window that's already up. The progress bar continues from
+ * where it is, so that several archives can share it. Returns the inserted
+ * items, which still have to be scanned.
+ */
+- (NSArray*)stageItems:(NSArray*)items withArchive:(DAArchive*)archive spool:(ArchiveSpool*)spool name:(NSString*)name session:(NSModalSession)modal error:(NSError**)error
+{
+	BOOL useSpool = spool && [spool isCurrent];
+	
+	if (!archive && !useSpool)
+		return nil;
+	
+	InstallStage *stage = [[InstallStage alloc] initWithBaseURL:[self fileURL] hashStore:self.hashStore error:error];
+	if (!stage)
+		return nil;
+	
+	NSMutableArray *mainDirs = [NSMutableArray arrayWithCapacity:[items count]];
+	for (NSXMLElement *node in items)
+	{
+		if ([[node name] isEqualToString:@"AddInItem"])
+			[mainDirs addObject:[NSString stringWithFormat:@"Addins/%@", [[node attributeForName:@"UID"] stringValue]]];
+		else if ([[node name] isEqualToString:@"OfferItem"])
+			[mainDirs addObject:[NSString stringWithFormat:@"Offers/%@", [[node attributeForName:@"UID"] stringValue]]];
+	}
+	
+	NSString *(^pathMap)(NSString*) = ^NSString *(NSString *installPath) {
+		return [self installPath:installPath mainDirs:mainDirs];
+	};
+	
+	/* Staging always runs in the background, the counters are only sampled here. */
+	BOOL isZip = !useSpool && [InstallStage isZipArchive:archive];
+	InstallProgress *progress = stage.progress;
+	double base = [progressIndicator doubleValue];
+	dispatch_group_t group = dispatch_group_create();
+	__block BOOL ret = YES;
+	__block NSError *err = nil;
+	
+	installProgress = progress;
+	dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		NSError *e = nil;
+		
+		if (useSpool)
+			ret = [stage stageSpool:spool pathMap:pathMap error:&e];
+		else if (isZip)
+			ret = [stage stageZipArchive:archive pathMap:pathMap error:&e];
+		else
+			ret = [stage stageArchive:archive pathMap:pathMap error:&e];
+		err = e;
+	});
+	while (dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, 100 * NSEC_PER_MSEC)))
+	{
+		[progress sample];
+		[progressIndicator setDoubleValue:base + progress.bytesOut];
+		[progressLabel setStringValue:[NSString stringWithFormat:@"%d files, %.1f MB (%.1f MB/s)",
+									   progress.membersDone, progress.bytesOut / (1024.0 * 1024.0),
+									   progress.bytesPerSecond / (1024.0 * 1024.0)]];
+		[NSApp runModalSession:modal];
+	}
+	dispatch_release(group);
+	installProgress = nil;
+	[progressIndicator setDoubleValue:base + progress.bytesOut];
+	
+	[progress logSummaryForName:name];
+	if (!ret && error)
+		*error = err;
+	
+	NSMutableArray *inserted = [NSMutableArray arrayWithCapacity:[items count]];
+	if (ret)
+	{
+		for (NSXMLElement *node in items)
 		{
-			item = [overridesStore insertOverrideNode:node error:error intoContext:[self managedObjectContext]];
+			Item *item = [self insertItemNode:node error:error];
 			
 			if (!item)
 			{
 				ret = NO;
-				goto out;
+				break;
 			}
+			[inserted addObject:item];
 		}
-		
-		if (item)
+	}
+	
+	if (ret)
+		ret = [stage commit:error];
+	else
+		[stage rollback];
+	
+	if (!ret)
+	{
+		for (Item *item in inserted)
+			[[self managedObjectContext] deleteObject:item];
+		return nil;
+	}
+	return inserted;
+}
+
+/* One scan for all the paths of the items, however many there are. */
+- (void)scanInstalledItems:(NSArray*)items message:(NSString*)msg
+{
+	NSMutableSet *seen = [NSMutableSet set];
+	NSMutableArray *urls = [NSMutableArray array];
+	
+	for (Item *item in items)
+	{
+		for (Path *p in item.modazipin.paths)
 		{
-			for (Path *p in item.modazipin.paths)
-			{
-				NSURL *url = [[self fileURL] URLByAppendingPathComponent:p.path];
-				[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:url message:name disabled:NO]];
-			}
-			[self enabledChanged:item canInteract:NO];
+			NSString *key = [p.path lowercaseString];
+			
+			if ([seen containsObject:key])
+				continue;
+			[seen addObject:key];
+			[urls addObject:[[self fileURL] URLByAppendingPathComponent:p.path]];
 		}
 	}
-
-out:
-	[archive removeObserver:self forKeyPath:@"uncompressedOffset"];
-	[NSApp endModalSession:modal];
-	[progressWindow close];
 	
-	return ret;
+	if ([urls count])
+		[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URLs:urls message:msg disabled:NO]];
 }
 
-- (void)progressChanged:(ArchiveWrapper*)archive session:(NSModalSession)modal
+- (IBAction)cancelInstall:(id)sender
 {
-	[progressIndicator setDoubleValue:archive.uncompressedOffset];
-	[progressIndicator displayIfNeeded];
-	[NSApp runModalSession:modal];
+	/* The staging stops at the next member and is rolled back. */
+	[installProgress cancel];
 }
 
-@end
-
-@implementation AddInsList (Editing)
-
-- (void)askAssign:(Item*)item
+- (ContentHashStore*)hashStore
 {
-	[NSApp beginSheet:assignSheet modalForWindow:[self windowForSheet] modalDelegate:self didEndSelector:@selector(verifyAssign:returnCode:contextInfo:) contextInfo:(__bridge void *)(item)];
+	if (!hashStore)
+		hashStore = [[ContentHashStore alloc] initWithBaseURL:[self fileURL]];
+	return hashStore;
+}
+
+- (IBAction)dedupeInstallation:(id)sender
+{
+	NSURL *base = [self fileURL];
+	NSMutableArray *dirs = [NSMutableArray array];
+	ContentHashStore *store = self.hashStore;
+	
+	for (NSString *dir in [NSArray arrayWithObjects:@"Addins", @"Offers", @"packages/core",
+						   @"Addins (disabled)", @"Offers (disabled)", @"packages (disabled)/core", nil])
+	{
+		NSURL *url = [base URLByAppendingPathComponent:dir];
+		
+		if ([url checkResourceIsReachableAndReturnError:nil])
+			[dirs addObject:url];
+	}
+	
+	[self willChangeValueForKey:@"statusMessage"];
+	statusMessage = @"Looking for duplicate files.";
+	[self didChangeValueForKey:@"statusMessage"];
+	
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+		NSError *err = nil;
+		int64_t freed = [store dedupeDirectories:dirs error:&err];
+		
+		dispatch_async(dispatch_get_main_queue(), ^{
+			[self willChangeValueForKey:@"statusMessage"];
+			statusMessage = @"";
+			[self didChangeValueForKey:@"statusMessage"];
+			
+			if (freed < 0)
+				[self presentError:err];
+			else
+				NSBeginAlertSheet(@"Duplicates removed", @"OK", nil, nil, [self windowForSheet], nil, NULL, NULL, NULL,
+								  @"Identical files are now shared, freeing %.1f MB.", freed / (1024.0 * 1024.0));
+		});
+	});
+}
+
+@end
+
+@implementation AddInsList (Editing)
+
+- (void)askAssign:(Item*)item
+{
+	[NSApp beginSheet:assignSheet modalForWindow:[self windowForSheet] modalDelegate:self didEndSelector:@selector(verifyAssign:returnCode:contextInfo:) contextInfo:(__bridge void *)(item)];
 }
 
 - (IBAction)closeAssign:(id)sender
@@ -770,6 +1112,13 @@ out:
 }
 
 - (void)enabledChanged:(Item *)item canInteract:(BOOL)canInteract
+{
+	[self updateEnabled:item canInteract:canInteract];
+	[self scheduleSave];
+}
+
+/* Like enabledChanged:canInteract:, but leaves saving to the caller. */
+- (void)updateEnabled:(Item *)item canInteract:(BOOL)canInteract
 {
 	if ([item.Enabled boolValue])
 	{
@@ -783,7 +1132,7 @@ out:
 			else
 			{
 				item.Enabled = [NSDecimalNumber zero];
-				[self enabledChanged:item canInteract:NO];
+				[self updateEnabled:item canInteract:NO];
 				return;
 			}
 		}
@@ -802,8 +1151,6 @@ out:
 	
 	if ([item class] == [AddInItem self])
 		[[item valueForKey:@"offers"] setValue:item.Enabled forKey:@"Enabled"];
-	
-	[self saveDocument:self];
 }
 
 - (void)askOverrideGameVersion:(Item*)item
@@ -859,136 +1206,282 @@ out:
 
 @implementation AddInsList (Saving)
 
-- (BOOL)syncFilesFromContext:(NSError **)error
+- (void)contextObjectsChanged:(NSNotification*)note
 {
-	NSURL *base = [self fileURL];	
-	NSArray *items = [[self managedObjectContext] executeFetchRequest:[[self managedObjectModel] fetchRequestTemplateForName:@"itemsWithAnyPath"] error:error];
-	NSMutableSet *movedItems = [NSMutableSet set];
+	NSDictionary *info = [note userInfo];
 	
-	if (!items)
-		return NO;
+	for (NSManagedObject *obj in [info objectForKey:NSInsertedObjectsKey])
+	{
+		if ([obj isKindOfClass:[Item class]])
+			[dirtyItems addObject:obj];
+	}
+	for (NSManagedObject *obj in [info objectForKey:NSUpdatedObjectsKey])
+	{
+		if ([obj isKindOfClass:[Item class]] && [[obj changedValues] objectForKey:@"Enabled"])
+			[dirtyItems addObject:obj];
+		else if ([obj isKindOfClass:[ConfigKey class]] && [[obj changedValues] objectForKey:@"DefaultValue"])
+			[dirtyConfigKeys addObject:obj];
+	}
+	for (NSManagedObject *obj in [info objectForKey:NSDeletedObjectsKey])
+	{
+		[dirtyItems removeObject:obj];
+		[dirtyConfigKeys removeObject:obj];
+	}
+}
+
+- (void)planItem:(Item*)item into:(FileSyncPlan*)plan
+{
+	NSURL *base = [self fileURL];
+	BOOL isEnabled = [item.Enabled boolValue];
+	NSString *title = item.Title.localizedValue;
 	
-	for (Item *item in items)
+	for (Path *path in item.modazipin.paths)
 	{
-		NSSet *paths = item.modazipin.paths;
-		BOOL isEnabled = [item.Enabled boolValue];
+		NSString *enabledPath = path.path;
+		NSRange slash = [enabledPath rangeOfString:@"/"];
+		NSString *disabledPath = [enabledPath stringByReplacingCharactersInRange:slash withString:@" (disabled)/"];
+		NSURL *expectedURL = [base URLByAppendingPathComponent:isEnabled ? enabledPath : disabledPath];
+		NSURL *otherURL = [base URLByAppendingPathComponent:isEnabled ? disabledPath : enabledPath];
 		
-		for (Path *path in paths)
-		{
-			NSString *enabledPath = path.path;
-			NSRange slash = [enabledPath rangeOfString:@"/"];
-			NSString *disabledPath = [enabledPath stringByReplacingCharactersInRange:slash withString:@" (disabled)/"];
-			NSURL *expectedURL = [base URLByAppendingPathComponent:isEnabled ? enabledPath : disabledPath];
-			NSURL *otherURL = [base URLByAppendingPathComponent:isEnabled ? disabledPath : enabledPath];
-			
-			if ([expectedURL checkResourceIsReachableAndReturnError:nil])
-				continue;
-			
-			if (![otherURL checkResourceIsReachableAndReturnError:nil])
-				continue; /* XXX more error handling */
-			
-			NSURL *dirURL = [expectedURL URLByDeletingLastPathComponent];
-			
-			[[NSFileManager defaultManager] createDirectoryAtPath:[dirURL path] withIntermediateDirectories:YES attributes:nil error:nil];
-			if (![[NSFileManager defaultManager] moveItemAtURL:otherURL toURL:expectedURL error:error])
-				(void)0; /* XXX do something here. */
-			else
-			{
-				[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:expectedURL message:item.Title.localizedValue disabled:!isEnabled]];
-				[movedItems addObject:item];
-			}
-		}
+		[plan moveFromURL:otherURL toURL:expectedURL completion:^(BOOL done, NSError *error) {
+			if (done)
+				[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:expectedURL message:title disabled:!isEnabled]];
+			else if (error)
+				[dirtyItems addObject:item]; /* Try again next save. */
+		}];
 	}
+}
+
+- (void)planConfigKey:(ConfigKey*)key into:(FileSyncPlan*)plan
+{
+	NSString *selectedValue = [key valueForKey:@"DefaultValue"];
+	NSString *originalFile = [key valueForKey:@"OriginalFile"];
 	
-	NSArray *configkeys = [[self managedObjectContext] executeFetchRequest:[[self managedObjectModel] fetchRequestTemplateForName:@"allConfigKeys"] error:error];
+	NSFetchRequest *selectedValueReq = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"configValueWithValueAndKey" substitutionVariables:[NSDictionary dictionaryWithObjectsAndKeys:selectedValue, @"value", key, @"key", nil]];
+	NSArray *selectedValues = [[self managedObjectContext] executeFetchRequest:selectedValueReq error:nil];
 	
-	if (!configkeys)
-		return NO;
+	if (![selectedValues count])
+	{
+		NSLog(@"Can't find selected value object for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
+		return;
+	}
+	if ([selectedValues count] > 1)
+		NSLog(@"Multipe selected value object for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
 	
-	for (ConfigKey *key in configkeys)
+	DataStoreObject *selectedValueObj = [selectedValues objectAtIndex:0];
+	
+	NSArray *itemPaths = [[[[key valueForKey:@"section"] valueForKey:@"item"] valueForKeyPath:@"modazipin.paths.path"] allObjects];
+	NSString *selectedFile = [selectedValueObj valueForKey:@"OptionsFile"];
+	NSArray *selectedPaths = [contentTable pathsWithContent:selectedFile inPaths:itemPaths];
+	NSArray *originalPaths = [contentTable pathsWithContent:originalFile inPaths:itemPaths];
+	
+	if (![selectedPaths count])
+	{
+		NSLog(@"Can't find selected contents for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
+		return;
+	}
+	if ([selectedPaths count] > 1)
+		NSLog(@"Multiple contents for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
+	if (![originalPaths count])
+	{
+		NSLog(@"Can't find original contents for key '%@' originalFile '%@'", [key valueForKey:@"Name"], originalFile);
+		return;
+	}
+	if ([originalPaths count] > 1)
+		NSLog(@"Multiple contents for key '%@' originalFile '%@'", [key valueForKey:@"Name"], originalFile);
+	
+	NSString *originalPath = [originalPaths objectAtIndex:0];
+	
+	NSURL *selectedURL = [[contentTable URLForContent:selectedFile inPath:[selectedPaths objectAtIndex:0]] filePathURL];
+	NSURL *originalURL = [[contentTable URLForContent:originalFile inPath:originalPath] filePathURL];
+	
+	if ([selectedURL isEqual:originalURL])
+		NSLog(@"Unexpected selected URL %@", selectedURL);
+	
+	[plan linkURL:originalURL toURL:selectedURL completion:^(BOOL done, NSError *error) {
+		if (done)
+			[contentTable addContent:originalFile URL:originalURL forPath:originalPath];
+		else if (error)
+			[dirtyConfigKeys addObject:key];
+	}];
+}
+
+/*
+ * Only the items and config keys changed since the last sync are looked at.
+ * The file operations are done in order on a serial queue of their own, so
+ * that the scans are all the operation queue has.
+ */
+- (BOOL)syncFilesFromContext:(NSError **)error
+{
+	NSSet *items = dirtyItems;
+	NSSet *keys = dirtyConfigKeys;
+	
+	dirtyItems = [NSMutableSet set];
+	dirtyConfigKeys = [NSMutableSet set];
+	
+	[self syncItems:items configKeys:keys];
+	return YES;
+}
+
+- (void)syncItems:(NSSet*)items configKeys:(NSSet*)keys
+{
+	FileSyncPlan *plan = [[FileSyncPlan alloc] init];
+	
+	for (Item *item in items)
+	{
+		if (![item.modazipin.paths count])
+			continue;
+		
+		[self planItem:item into:plan];
+	}
+	
+	NSMutableSet *deferred = [NSMutableSet set];
+	for (ConfigKey *key in keys)
 	{
-		if ([movedItems containsObject:[[key valueForKey:@"section"] valueForKey:@"item"]])
+		if ([items containsObject:[[key valueForKey:@"section"] valueForKey:@"item"]])
 		{
-			/* Can't update these now, since the paths are incorrect, but shouldn't have changed anyway. */
+			/* Paths might be about to move, do these once they've been scanned again. */
+			[deferred addObject:key];
 			continue;
 		}
 		
-		NSString *selectedValue = [key valueForKey:@"DefaultValue"];
-		NSString *originalFile = [key valueForKey:@"OriginalFile"];
-		
-		NSFetchRequest *selectedValueReq = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"configValueWithValueAndKey" substitutionVariables:[NSDictionary dictionaryWithObjectsAndKeys:selectedValue, @"value", key, @"key", nil]];
-		NSArray *selectedValues = [[self managedObjectContext] executeFetchRequest:selectedValueReq error:error];
+		[self planConfigKey:key into:plan];
+	}
+	
+	if (![plan count])
+	{
+		[self retryConfigKeys:deferred];
+		return;
+	}
+	
+	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		NSArray *failed = [plan perform];
 		
-		if (![selectedValues count])
+		/* Added to here rather than on the main thread, which might be waiting for this. */
+		if ([failed count])
 		{
-			NSLog(@"Can't find selected value object for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
-			continue; /* XXX error handling */
+			@synchronized(syncErrors)
+			{
+				[syncErrors addObjectsFromArray:failed];
+			}
+			dispatch_async(dispatch_get_main_queue(), ^{ [self presentSyncErrors]; });
 		}
-		if (![selectedValues count] > 1)
-			NSLog(@"Multipe selected value object for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
+		/* After the completions, which queue the scans of what was moved. */
+		dispatch_async(dispatch_get_main_queue(), ^{ [self retryConfigKeys:deferred]; });
+	}];
+	
+	lastSync = op;
+	[syncQueue addOperation:op];
+}
 
+/* Synced again once the scans queued so far are done, rather than on the next save. */
+- (void)retryConfigKeys:(NSSet*)keys
+{
+	if (![keys count])
+		return;
+	
+	NSBlockOperation *retry = [NSBlockOperation blockOperationWithBlock:^{
+		NSMutableSet *live = [NSMutableSet set];
 		
-		DataStoreObject *selectedValueObj = [selectedValues objectAtIndex:0];
-		
-		NSFetchRequest *selectedReq = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"contentWithNameAndItem" substitutionVariables:[NSDictionary dictionaryWithObjectsAndKeys:[selectedValueObj valueForKey:@"OptionsFile"], @"name", [[key valueForKey:@"section"] valueForKey:@"item"], @"item", nil]];
-		NSArray *selectedContents = [[self managedObjectContext] executeFetchRequest:selectedReq error:error];
-		
-		NSFetchRequest *originalReq = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"contentWithNameAndItem" substitutionVariables:[NSDictionary dictionaryWithObjectsAndKeys:originalFile, @"name", [[key valueForKey:@"section"] valueForKey:@"item"], @"item", nil]];
-		NSArray *originalContents = [[self managedObjectContext] executeFetchRequest:originalReq error:error];
-		
-		if (![selectedContents count])
-		{
-			NSLog(@"Can't find selected contents for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
-			continue;
-		}
-		if ([selectedContents count] > 1)
-			NSLog(@"Multiple contents for key '%@' selectedValue '%@'", [key valueForKey:@"Name"], selectedValue);
-		if (![originalContents count])
+		for (ConfigKey *key in keys)
 		{
-			NSLog(@"Can't find original contents for key '%@' originalFile '%@'", [key valueForKey:@"Name"], originalFile);
-			continue; /* XXX error handling. */
+			if (![key isDeleted] && [key managedObjectContext])
+				[live addObject:key];
 		}
-		if ([originalContents count] > 1)
-			NSLog(@"Multiple contents for key '%@' originalFile '%@'", [key valueForKey:@"Name"], originalFile);
-		
-		NSManagedObject *selectedContent = [selectedContents objectAtIndex:0];
-		NSManagedObject *originalContent = [originalContents objectAtIndex:0];
-		
-		/* If using file reference URLs this sometimes gives the wrong value. Bad caching? */
-		NSURL *selectedURL = [[selectedContent valueForKey:@"URL"] filePathURL];
-		
-		NSURL *originalURL = [[originalContent valueForKey:@"URL"] filePathURL];
-		
-		if ([selectedURL isEqual:originalURL])
-			NSLog(@"Unexpected selected URL %@", selectedURL);
-		
-		struct stat origSt;
-		struct stat selectedSt;
+		[self syncItems:[NSSet set] configKeys:live];
+	}];
+	
+	for (NSOperation *scan in [operationQueue operations])
+		[retry addDependency:scan];
+	[[NSOperationQueue mainQueue] addOperation:retry];
+}
+
+/* Takes the errors collected so far. */
+- (NSError*)takeSyncError
+{
+	NSArray *errors;
+	
+	@synchronized(syncErrors)
+	{
+		if (![syncErrors count])
+			return nil;
+		errors = [NSArray arrayWithArray:syncErrors];
+		[syncErrors removeAllObjects];
+	}
+	
+	/* One line per file, with why it failed. */
+	NSMutableArray *lines = [NSMutableArray array];
+	for (NSError *err in errors)
+	{
+		NSString *line = [err localizedDescription];
+		NSString *reason = [err localizedFailureReason];
 		
-		if (!stat([[selectedURL path] fileSystemRepresentation], &selectedSt)
-			&& !stat([[originalURL path] fileSystemRepresentation], &origSt))
+		if (reason && ![line hasSuffix:reason])
+			line = [NSString stringWithFormat:@"%@ %@", line, reason];
+		if ([lines count] == SYNC_ERROR_LINES)
 		{
-			if (origSt.st_dev == selectedSt.st_dev && origSt.st_ino == selectedSt.st_ino)
-			{
-				continue;
-			}
+			[lines addObject:[NSString stringWithFormat:@"And %lu more.", (unsigned long)([errors count] - SYNC_ERROR_LINES)]];
+			break;
 		}
-		
-		[[NSFileManager defaultManager] removeItemAtURL:originalURL error:error];
-		if (![[NSFileManager defaultManager] linkItemAtURL:selectedURL toURL:originalURL error:error])
-			(void)0; /* XXX do something here. */
-		NSLog(@"linked %@ to %@", originalURL, selectedURL);
-		
-		/* Need to clear its cached fileReferenceURL */
-		originalURL = [NSURL URLWithString:[originalURL absoluteString]];
-		[originalContent setValue:[originalURL fileReferenceURL] forKey:@"URL"];
+		[lines addObject:line];
 	}
+	[lines addObject:@"They will be tried again the next time the list is saved."];
 	
-	return YES;
+	return [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+																							  [errors count] == 1 ? @"A file could not be moved into place." : @"Some files could not be moved into place.", NSLocalizedDescriptionKey,
+																							  [lines componentsJoinedByString:@"\n"], NSLocalizedRecoverySuggestionErrorKey,
+																							  [errors objectAtIndex:0], NSUnderlyingErrorKey,
+																							  errors, NSDetailedErrorsKey,
+																							  nil]];
+}
+
+/* Once per failure, waitForFileSync: might have reported it already. */
+- (void)presentSyncErrors
+{
+	NSError *err = [self takeSyncError];
+	
+	if (err)
+		[self presentError:err modalForWindow:[self windowForSheet] delegate:nil didPresentSelector:NULL contextInfo:NULL];
+}
+
+- (BOOL)waitForFileSync:(NSError **)error
+{
+	[self flushPendingSave];
+	[lastSync waitUntilFinished];
+	
+	NSError *err = [self takeSyncError];
+	
+	if (!err)
+		return YES;
+	if (error)
+		*error = err;
+	return NO;
+}
+
+- (void)scheduleSave
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(flushPendingSave) object:nil];
+	savePending = YES;
+	[self performSelector:@selector(flushPendingSave) withObject:nil afterDelay:SAVE_DELAY inModes:[NSArray arrayWithObject:NSRunLoopCommonModes]];
+}
+
+- (void)flushPendingSave
+{
+	if (!savePending)
+		return;
+	
+	[self saveDocument:self];
 }
 
 - (BOOL)writeSafelyToURL:(NSURL *)absoluteURL ofType:(NSString *)typeName forSaveOperation:(NSSaveOperationType)saveOperation error:(NSError **)outError
 {
+	/* Any scheduled save is covered by this one. */
+	if (savePending)
+	{
+		[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(flushPendingSave) object:nil];
+		savePending = NO;
+	}
+	
 	BOOL res =  [self syncFilesFromContext:outError];
 	
 	if (!res)
@@ -1060,6 +1553,9 @@ out:
 	for (Path *path in paths)
 	{
 		NSString *enabledPath = path.path;
+		
+		[contentTable removeContentsForPath:enabledPath];
+		
 		NSRange slash = [enabledPath rangeOfString:@"/"];
 		NSString *disabledPath = [enabledPath stringByReplacingCharactersInRange:slash withString:@" (disabled)/"];
 		BOOL res;
@@ -1083,6 +1579,8 @@ out:
 	{
 		NSURL *itemURL = [[base URLByAppendingPathComponent:dir] URLByAppendingPathComponent:item.UID];
 		NSError *err = nil;
+		
+		[contentTable removeContentsForPath:[self contentPathForItem:item]];
 		BOOL res = [[NSFileManager defaultManager] removeItemAtURL:itemURL error:&err];
 		if (!res)
 			[self presentError:err];
@@ -1094,3 +1592,1032 @@ out:
 }
 
 @end
+
+
+@implementation AddInsList (Consolidating)
+
+static NSError *
+consolidateError(int eno, NSURL *url, NSString *msg)
+{
+	return [NSError errorWithDomain:NSPOSIXErrorDomain code:eno userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+																		  msg, NSLocalizedDescriptionKey,
+																		  url, NSURLErrorKey,
+																		  nil]];
+}
+
+/*
+ * Hidden file next to the ERF with the path of each packed file relative to
+ * the folder, one per line.
+ */
+static NSString *
+layoutNameForERF(NSString *erfName)
+{
+	return [NSString stringWithFormat:@".%@.layout", erfName];
+}
+
+/*
+ * Lowercased file name to relative path, nil if there is no layout. Paths
+ * leading out of the folder are ignored.
+ */
+static NSDictionary *
+readLayout(NSURL *url)
+{
+	NSString *str = [NSString stringWithContentsOfURL:url encoding:NSUTF8StringEncoding error:nil];
+	NSMutableDictionary *layout;
+	
+	if (!str)
+		return nil;
+	
+	layout = [NSMutableDictionary dictionary];
+	for (NSString *line in [str componentsSeparatedByString:@"\n"])
+	{
+		NSArray *comps = [line pathComponents];
+		
+		if (![line length] || [line isAbsolutePath] || [comps containsObject:@".."] || [comps containsObject:@"."])
+			continue;
+		[layout setObject:line forKey:[[line lastPathComponent] lowercaseString]];
+	}
+	return layout;
+}
+
+/*
+ * Where the path currently is, depending on if it's disabled or not.
+ */
+- (NSURL*)currentURLForPath:(Path*)path
+{
+	return [self currentURLForEnabledPath:path.path];
+}
+
+- (NSURL*)currentURLForEnabledPath:(NSString*)enabledPath
+{
+	NSURL *base = [self fileURL];
+	NSRange slash = [enabledPath rangeOfString:@"/"];
+	NSURL *url = [base URLByAppendingPathComponent:enabledPath];
+	
+	if ([url checkResourceIsReachableAndReturnError:nil] || slash.location == NSNotFound)
+		return url;
+	
+	return [base URLByAppendingPathComponent:[enabledPath stringByReplacingCharactersInRange:slash withString:@" (disabled)/"]];
+}
+
+- (BOOL)consolidate:(Item*)item error:(NSError**)error
+{
+	NSArray *keys = [NSArray arrayWithObjects:NSURLNameKey, NSURLIsRegularFileKey, NSURLIsDirectoryKey, nil];
+	
+	if (![item canConsolidate])
+		return YES;
+	
+	for (Path *path in item.modazipin.paths)
+	{
+		if (![path.type isEqualToString:@"dir"] || path.consolidated)
+			continue;
+		
+		NSURL *dirURL = [self currentURLForPath:path];
+		NSString *erfName = [[path.path lastPathComponent] stringByAppendingPathExtension:@"erf"];
+		NSURL *erfURL = [dirURL URLByAppendingPathComponent:erfName];
+		NSDirectoryEnumerator *enumer = [[NSFileManager defaultManager] enumeratorAtURL:dirURL includingPropertiesForKeys:keys options:0 errorHandler:nil];
+		NSMutableArray *files = [NSMutableArray array];
+		NSMutableArray *dirs = [NSMutableArray array];
+		NSMutableArray *datas = [NSMutableArray array];
+		NSMutableArray *names = [NSMutableArray array];
+		NSMutableArray *layout = [NSMutableArray array];
+		NSMutableSet *seen = [NSMutableSet set];
+		NSString *dirPath = [[dirURL path] stringByAppendingString:@"/"];
+		NSURL *url;
+		
+		while ((url = [enumer nextObject]))
+		{
+			NSDictionary *props = [url resourceValuesForKeys:keys error:nil];
+			NSString *name = [props objectForKey:NSURLNameKey];
+			
+			if ([[props objectForKey:NSURLIsDirectoryKey] boolValue])
+			{
+				[dirs addObject:url];
+				continue;
+			}
+			if (![[props objectForKey:NSURLIsRegularFileKey] boolValue])
+				continue;
+			
+			/* Left as is: hidden files, readmes and ERFs, which can't be nested. */
+			if ([name hasPrefix:@"."] || [isREADME evaluateWithObject:name]
+				|| [[name pathExtension] caseInsensitiveCompare:@"erf"] == NSOrderedSame)
+			{
+				if ([name caseInsensitiveCompare:erfName] == NSOrderedSame)
+				{
+					if (error)
+						*error = consolidateError(EEXIST, url, [NSString stringWithFormat:@"\"%@\" already exists.", name]);
+					return NO;
+				}
+				continue;
+			}
+			
+			/* The game sees the override folder as flat, so should we. */
+			if ([seen containsObject:[name lowercaseString]])
+			{
+				if (error)
+					*error = consolidateError(EEXIST, url, [NSString stringWithFormat:@"There is more than one file named \"%@\".", name]);
+				return NO;
+			}
+			[seen addObject:[name lowercaseString]];
+			
+			NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:error];
+			
+			if (!data)
+				return NO;
+			if ([data length] > UINT32_MAX)
+			{
+				if (error)
+					*error = consolidateError(EFBIG, url, [NSString stringWithFormat:@"\"%@\" is too large to be packed.", name]);
+				return NO;
+			}
+			
+			[files addObject:url];
+			[datas addObject:data];
+			[names addObject:name];
+			[layout addObject:[[url path] hasPrefix:dirPath] ? [[url path] substringFromIndex:[dirPath length]] : name];
+		}
+		
+		if (![files count])
+			continue;
+		
+		NSMutableData *entryData = [NSMutableData dataWithLength:[files count] * sizeof (struct erf_write_entry)];
+		struct erf_write_entry *entries = [entryData mutableBytes];
+		
+		for (NSUInteger i = 0 ; i < [files count] ; i++)
+		{
+			NSData *data = [datas objectAtIndex:i];
+			
+			entries[i].name = [[names objectAtIndex:i] cStringUsingEncoding:NSASCIIStringEncoding];
+			entries[i].data = [data bytes];
+			entries[i].length = (uint32_t)[data length];
+			
+			if (!entries[i].name || [[names objectAtIndex:i] length] > ERF_FILENAME_MAXLEN)
+			{
+				if (error)
+					*error = consolidateError(ENAMETOOLONG, [files objectAtIndex:i], [NSString stringWithFormat:@"The file name \"%@\" can't be stored in an ERF. Names have to be ascii and at most %d characters.", [names objectAtIndex:i], ERF_FILENAME_MAXLEN]);
+				return NO;
+			}
+		}
+		
+		/* Write next to the files and move into place, so that a failure leaves nothing behind. */
+		NSURL *tmpDir = [[NSFileManager defaultManager] URLForDirectory:NSItemReplacementDirectory inDomain:NSUserDomainMask appropriateForURL:dirURL create:YES error:error];
+		
+		if (!tmpDir)
+			return NO;
+		
+		NSURL *tmpURL = [tmpDir URLByAppendingPathComponent:erfName];
+		int fd = open([[tmpURL path] fileSystemRepresentation], O_RDWR | O_CREAT | O_EXCL, 0644);
+		
+		/* The game only reads V2.0. */
+		if (fd < 0 || erf_write_fd(fd, ERF_VERSION_2_0, entries, (uint32_t)[files count]))
+		{
+			int eno = errno;
+			
+			if (fd >= 0)
+				close(fd);
+			[[NSFileManager defaultManager] removeItemAtURL:tmpDir error:nil];
+			if (error)
+				*error = consolidateError(eno, erfURL, [NSString stringWithFormat:@"Failed to write \"%@\": %s.", erfName, strerror(eno)]);
+			return NO;
+		}
+		close(fd);
+		
+		/* The ERF is flat, this remembers where each file was so that expand can put it back. */
+		NSFileManager *fm = [NSFileManager defaultManager];
+		NSURL *layoutURL = [dirURL URLByAppendingPathComponent:layoutNameForERF(erfName)];
+		NSData *layoutData = [[[layout componentsJoinedByString:@"\n"] stringByAppendingString:@"\n"] dataUsingEncoding:NSUTF8StringEncoding];
+		
+		if (![layoutData writeToURL:layoutURL options:NSDataWritingAtomic error:error])
+		{
+			[fm removeItemAtURL:tmpDir error:nil];
+			return NO;
+		}
+		if (![fm moveItemAtURL:tmpURL toURL:erfURL error:error])
+		{
+			[fm removeItemAtURL:layoutURL error:nil];
+			[fm removeItemAtURL:tmpDir error:nil];
+			return NO;
+		}
+		
+		/* Let go of the mappings before moving the files. */
+		[datas removeAllObjects];
+		
+		/*
+		 * Move the files aside rather than removing them one by one, so that
+		 * if one can't be moved the ones that were can be put back.
+		 */
+		NSURL *asideDir = [tmpDir URLByAppendingPathComponent:@"files"];
+		NSMutableArray *aside = [NSMutableArray array];
+		BOOL ok = [fm createDirectoryAtURL:asideDir withIntermediateDirectories:NO attributes:nil error:error];
+		
+		for (NSUInteger i = 0 ; ok && i < [files count] ; i++)
+		{
+			NSURL *asideURL = [asideDir URLByAppendingPathComponent:[names objectAtIndex:i]];
+			
+			ok = [fm moveItemAtURL:[files objectAtIndex:i] toURL:asideURL error:error];
+			if (ok)
+				[aside addObject:asideURL];
+		}
+		if (!ok)
+		{
+			BOOL restored = YES;
+			
+			for (NSUInteger i = 0 ; i < [aside count] ; i++)
+				restored &= [fm moveItemAtURL:[aside objectAtIndex:i] toURL:[files objectAtIndex:i] error:nil];
+			
+			if (!restored)
+			{
+				/* Keep the ERF, it's the only complete copy left. */
+				if (error)
+					*error = consolidateError(EIO, dirURL, [NSString stringWithFormat:@"Failed to move the files packed into \"%@\" out of the way, and some could not be put back. They are in \"%@\".", erfName, [asideDir path]]);
+				path.consolidated = erfName;
+				return NO;
+			}
+			[fm removeItemAtURL:erfURL error:nil];
+			[fm removeItemAtURL:layoutURL error:nil];
+			[fm removeItemAtURL:tmpDir error:nil];
+			return NO;
+		}
+		[fm removeItemAtURL:tmpDir error:nil];
+		
+		/* Deepest first, rmdir leaves anything not empty alone. */
+		for (url in [dirs reverseObjectEnumerator])
+			rmdir([[url path] fileSystemRepresentation]);
+		
+		path.consolidated = erfName;
+		
+		[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:dirURL message:item.Title.localizedValue disabled:![item.Enabled boolValue]]];
+	}
+	
+	return YES;
+}
+
+- (BOOL)expand:(Item*)item error:(NSError**)error
+{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	
+	for (Path *path in item.modazipin.paths)
+	{
+		NSString *erfName = path.consolidated;
+		
+		if (!erfName)
+			continue;
+		
+		NSURL *dirURL = [self currentURLForPath:path];
+		NSURL *erfURL = [dirURL URLByAppendingPathComponent:erfName];
+		NSURL *layoutURL = [dirURL URLByAppendingPathComponent:layoutNameForERF(erfName)];
+		NSData *erfdata = [NSData dataWithContentsOfURL:erfURL options:NSDataReadingMapped error:error];
+		
+		if (!erfdata)
+			return NO;
+		
+		/* Without a layout, from before it was kept, the files go at the top. */
+		NSDictionary *layout = readLayout(layoutURL);
+		struct erf_cursor cursor;
+		struct erf_toc *toc = erf_toc_new(1024);
+		NSMutableArray *written = [NSMutableArray array];
+		NSMutableArray *created = [NSMutableArray array];
+		int r = -1;
+		
+		if (!toc)
+		{
+			if (error)
+				*error = consolidateError(ENOMEM, erfURL, @"Out of memory.");
+			return NO;
+		}
+		
+		/* Put things back the way they were, NO if something was left behind. */
+		BOOL (^rollback)(void) = ^{
+			BOOL clean = YES;
+			
+			for (NSURL *url in written)
+				clean &= [fm removeItemAtURL:url error:nil];
+			for (NSURL *url in [created reverseObjectEnumerator])
+				clean &= rmdir([[url path] fileSystemRepresentation]) == 0;
+			return clean;
+		};
+		
+		if (erf_cursor_init(&cursor, [erfdata bytes], [erfdata length]) == 0)
+		{
+			while ((r = erf_cursor_read(&cursor, toc)) > 0)
+			{
+				for (uint32_t i = 0 ; i < toc->count ; i++)
+				{
+					struct erf_file file = {NULL};
+					const void *out;
+					size_t outlen;
+					
+					if (toc->name[i] == ERF_TOC_NONAME)
+						continue;
+					
+					NSString *name = [NSString stringWithCString:toc->names + toc->name[i] encoding:NSASCIIStringEncoding];
+					NSString *relative = name ? [layout objectForKey:[name lowercaseString]] : nil;
+					NSURL *dst = name ? [dirURL URLByAppendingPathComponent:relative ? relative : name] : nil;
+					NSMutableData *buf = [NSMutableData dataWithLength:toc->compression[i] == ERF_COMP_NONE ? 0 : toc->unpacked_length[i]];
+					
+					file.data = (const char*)[erfdata bytes] + toc->offset[i];
+					file.length = toc->length[i];
+					file.unpacked_length = toc->unpacked_length[i];
+					file.compression = toc->compression[i];
+					
+					if (!dst || [dst checkResourceIsReachableAndReturnError:nil])
+					{
+						errno = EEXIST;
+						r = -1;
+						break;
+					}
+					if (relative && ![self createDirectoriesForURL:dst inURL:dirURL created:created error:error])
+					{
+						erf_toc_free(toc);
+						rollback();
+						return NO;
+					}
+					if (erf_file_read(&file, [buf mutableBytes], [buf length], &out, &outlen))
+					{
+						r = -1;
+						break;
+					}
+					if (![[NSData dataWithBytesNoCopy:(void*)out length:outlen freeWhenDone:NO] writeToURL:dst options:0 error:error])
+					{
+						erf_toc_free(toc);
+						rollback();
+						return NO;
+					}
+					[written addObject:dst];
+				}
+				if (r < 0)
+					break;
+			}
+		}
+		erf_toc_free(toc);
+		
+		if (r < 0)
+		{
+			int eno = errno;
+			
+			if (error)
+				*error = consolidateError(eno, erfURL, [NSString stringWithFormat:rollback() ? @"Failed to unpack \"%@\": %s." : @"Failed to unpack \"%@\": %s. Some of the unpacked files could not be removed again.", erfName, strerror(eno)]);
+			return NO;
+		}
+		
+		/* Only once the ERF is gone is the path expanded, otherwise undo. */
+		erfdata = nil;
+		if (![fm removeItemAtURL:erfURL error:error])
+		{
+			if (!rollback() && error)
+				*error = consolidateError(EIO, erfURL, [NSString stringWithFormat:@"Failed to remove \"%@\" after unpacking it, and some of the unpacked files could not be removed again.", erfName]);
+			return NO;
+		}
+		if (layout && ![fm removeItemAtURL:layoutURL error:error])
+			return NO;
+		
+		path.consolidated = nil;
+		
+		[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:dirURL message:item.Title.localizedValue disabled:![item.Enabled boolValue]]];
+	}
+	
+	return YES;
+}
+
+/*
+ * Creates the folders between base and url, remembering the ones it made.
+ */
+- (BOOL)createDirectoriesForURL:(NSURL*)url inURL:(NSURL*)base created:(NSMutableArray*)created error:(NSError**)error
+{
+	NSURL *parent = [url URLByDeletingLastPathComponent];
+	
+	if ([[[parent path] stringByStandardizingPath] isEqualToString:[[base path] stringByStandardizingPath]]
+		|| [parent checkResourceIsReachableAndReturnError:nil])
+		return YES;
+	if (![self createDirectoriesForURL:parent inURL:base created:created error:error])
+		return NO;
+	if (![[NSFileManager defaultManager] createDirectoryAtURL:parent withIntermediateDirectories:NO attributes:nil error:error])
+		return NO;
+	[created addObject:parent];
+	return YES;
+}
+
+@end
+
+
+@implementation AddInsList (Exporting)
+
+- (void)askExport:(Item*)item
+{
+	NSSavePanel *panel = [NSSavePanel savePanel];
+	
+	[panel setAllowedFileTypes:[NSArray arrayWithObject:@"dazip"]];
+	[panel setNameFieldStringValue:[item.UID stringByAppendingPathExtension:@"dazip"]];
+	[panel beginSheetModalForWindow:[self windowForSheet] completionHandler:^(NSInteger result) {
+		if (result != NSFileHandlingPanelOKButton)
+			return;
+		
+		NSError *err = nil;
+		NSData *manifest = [self manifestForItem:item error:&err];
+		NSArray *files = manifest ? [self exportFilesForItem:item] : nil;
+		NSURL *url = [panel URL];
+		NSString *name = item.Title.localizedValue;
+		
+		if (!manifest)
+		{
+			[self presentError:err];
+			return;
+		}
+		
+		[self willChangeValueForKey:@"statusMessage"];
+		statusMessage = [NSString stringWithFormat:@"Exporting %@.", name];
+		[self didChangeValueForKey:@"statusMessage"];
+		
+		dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			NSError *e = nil;
+			BOOL res = [self writeDazip:url manifest:manifest files:files error:&e];
+			
+			dispatch_async(dispatch_get_main_queue(), ^{
+				[self willChangeValueForKey:@"statusMessage"];
+				statusMessage = @"";
+				[self didChangeValueForKey:@"statusMessage"];
+				
+				if (!res)
+					[self presentError:e];
+			});
+		});
+	}];
+}
+
+/*
+ * The item node as it is in AddIns.xml or Offers.xml, less what we keep
+ * there ourselves, in a manifest of its own.
+ */
+- (NSData*)manifestForItem:(Item*)item error:(NSError**)error
+{
+	NSString *type, *listName;
+	
+	if ([item isKindOfClass:[AddInItem class]])
+	{
+		type = @"AddIn";
+		listName = @"AddInsList";
+	}
+	else if ([item isKindOfClass:[OfferItem class]])
+	{
+		type = @"Offer";
+		listName = @"OfferList";
+	}
+	else
+	{
+		if (error)
+			*error = consolidateError(EINVAL, nil, @"Only addins and offers can be exported.");
+		return nil;
+	}
+	
+	NSXMLElement *node = [item.node copy];
+	for (NSInteger i = (NSInteger)[node childCount] - 1 ; i >= 0 ; i--)
+	{
+		if ([[[node childAtIndex:i] name] isEqualToString:@"modazipin"])
+			[node removeChildAtIndex:i];
+	}
+	
+	NSXMLElement *list = [NSXMLElement elementWithName:listName];
+	[list addChild:node];
+	
+	NSXMLElement *root = [NSXMLElement elementWithName:@"Manifest"];
+	[root addAttribute:[NSXMLNode attributeWithName:@"Type" stringValue:type]];
+	[root addChild:list];
+	
+	NSXMLDocument *doc = [NSXMLNode documentWithRootElement:root];
+	[doc setVersion:@"1.0"];
+	[doc setCharacterEncoding:@"UTF-8"];
+	[doc setStandalone:YES];
+	
+	return [doc XMLDataWithOptions:NSXMLNodePrettyPrint];
+}
+
+/*
+ * Archive name -> file URL for everything the item installed, wherever it
+ * currently is. Names are as if enabled, as in the original dazip.
+ */
+- (NSArray*)exportFilesForItem:(Item*)item
+{
+	NSMutableArray *enabledPaths = [NSMutableArray array];
+	NSMutableDictionary *files = [NSMutableDictionary dictionary];
+	NSMutableArray *res = [NSMutableArray array];
+	NSArray *keys = [NSArray arrayWithObjects:NSURLIsRegularFileKey, NSURLIsDirectoryKey, nil];
+	
+	if ([item isKindOfClass:[AddInItem class]])
+		[enabledPaths addObject:[NSString stringWithFormat:@"Addins/%@", item.UID]];
+	else if ([item isKindOfClass:[OfferItem class]])
+		[enabledPaths addObject:[NSString stringWithFormat:@"Offers/%@", item.UID]];
+	for (Path *path in item.modazipin.paths)
+		[enabledPaths addObject:path.path];
+	
+	for (NSString *enabledPath in enabledPaths)
+	{
+		NSURL *url = [self currentURLForEnabledPath:enabledPath];
+		NSNumber *isDir = nil;
+		
+		if (![url getResourceValue:&isDir forKey:NSURLIsDirectoryKey error:nil])
+			continue;
+		
+		if (![isDir boolValue])
+		{
+			[files setObject:[NSArray arrayWithObjects:[@"Contents" stringByAppendingPathComponent:enabledPath], url, nil] forKey:[enabledPath lowercaseString]];
+			continue;
+		}
+		
+		NSDirectoryEnumerator *enumer = [[NSFileManager defaultManager] enumeratorAtURL:url includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles errorHandler:nil];
+		NSUInteger base = [[[url URLByStandardizingPath] path] length];
+		NSURL *fileURL;
+		
+		while ((fileURL = [enumer nextObject]))
+		{
+			NSNumber *isFile = nil;
+			
+			if (![fileURL getResourceValue:&isFile forKey:NSURLIsRegularFileKey error:nil] || ![isFile boolValue])
+				continue;
+			
+			NSString *rel = [enabledPath stringByAppendingString:[[[fileURL URLByStandardizingPath] path] substringFromIndex:base]];
+			[files setObject:[NSArray arrayWithObjects:[@"Contents" stringByAppendingPathComponent:rel], fileURL, nil] forKey:[rel lowercaseString]];
+		}
+	}
+	
+	/* Sorted, so that the archive comes out the same each time. */
+	for (NSString *key in [[files allKeys] sortedArrayUsingSelector:@selector(compare:)])
+		[res addObject:[files objectForKey:key]];
+	return res;
+}
+
+/*
+ * Written to a temporary file next to url, which is renamed into place once
+ * it's complete. Members that are compressed already are stored as is.
+ */
+- (BOOL)writeDazip:(NSURL*)url manifest:(NSData*)manifest files:(NSArray*)files error:(NSError**)error
+{
+	static NSSet *storedTypes;
+	NSString *tmpPath = [[url path] stringByAppendingString:@".XXXXXX"];
+	char *tmpl = strdup([tmpPath fileSystemRepresentation]);
+	int fd = tmpl ? mkstemp(tmpl) : -1;
+	struct zipwrite *zw = fd >= 0 ? zipwrite_new(fd, Z_DEFAULT_COMPRESSION) : NULL;
+	struct zipwrite_member *members = calloc([files count] + 1, sizeof(*members));
+	int res = -1;
+	
+	if (!storedTypes)
+		storedTypes = [NSSet setWithObjects:@"png", @"jpg", @"jpeg", @"ogg", @"mp3", @"fsb", @"bik", @"zip", @"dazip", @"rar", @"7z", @"gz", @"bz2", nil];
+	
+	if (zw && members)
+	{
+		members[0].name = "Manifest.xml";
+		members[0].data = [manifest bytes];
+		members[0].length = [manifest length];
+		
+		NSUInteger i = 1;
+		for (NSArray *file in files)
+		{
+			NSString *name = [file objectAtIndex:0];
+			
+			members[i].name = [name UTF8String];
+			members[i].path = [[[file objectAtIndex:1] path] fileSystemRepresentation];
+			members[i].store = [storedTypes containsObject:[[name pathExtension] lowercaseString]];
+			i++;
+		}
+		
+		res = zipwrite_add(zw, members, [files count] + 1);
+		if (!res)
+			res = zipwrite_finish(zw);
+	}
+	if (!res && fsync(fd))
+		res = -1;
+	
+	int eno = errno;
+	zipwrite_free(zw);
+	free(members);
+	if (fd >= 0 && close(fd) && !res)
+	{
+		eno = errno;
+		res = -1;
+	}
+	if (!res && rename(tmpl, [[url path] fileSystemRepresentation]))
+	{
+		eno = errno;
+		res = -1;
+	}
+	if (res && fd >= 0)
+		unlink(tmpl);
+	free(tmpl);
+	
+	if (res)
+	{
+		if (error)
+			*error = consolidateError(eno, url, [NSString stringWithFormat:@"Could not export \"%@\": %s.", [url lastPathComponent], strerror(eno)]);
+		return NO;
+	}
+	return YES;
+}
+
+@end
+
+
+@implementation AddInsList (BatchInstalling)
+
+- (IBAction)askInstallDazips:(id)sender
+{
+	NSOpenPanel *panel = [NSOpenPanel openPanel];
+	
+	[panel setAllowedFileTypes:[NSArray arrayWithObjects:@"dazip", @"daoverride", nil]];
+	[panel setAllowsMultipleSelection:YES];
+	[panel setMessage:@"Choose the addins to install. They are all checked before anything is installed."];
+	[panel beginSheetModalForWindow:[self windowForSheet] completionHandler:^(NSInteger result) {
+		if (result != NSFileHandlingPanelOKButton)
+			return;
+		
+		/* Let the panel go away before the summary sheet comes up. */
+		[panel orderOut:self];
+		[self installDazipsAtURLs:[panel URLs]];
+	}];
+}
+
+/*
+ * The manifests are read in the background, then checked here, since the
+ * checks need our context. Nothing is installed until the summary has been
+ * confirmed.
+ */
+- (void)installDazipsAtURLs:(NSArray*)urls
+{
+	InstallBatch *batch = [[InstallBatch alloc] initWithURLs:urls];
+	NSManagedObjectModel *model = [self managedObjectModel];
+	
+	[self willChangeValueForKey:@"statusMessage"];
+	statusMessage = [NSString stringWithFormat:@"Reading %lu %@.", (unsigned long)[urls count], [urls count] == 1 ? @"addin" : @"addins"];
+	[self didChangeValueForKey:@"statusMessage"];
+	
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		[batch readManifestsWithModel:model];
+		
+		dispatch_async(dispatch_get_main_queue(), ^{
+			[self willChangeValueForKey:@"statusMessage"];
+			statusMessage = @"";
+			[self didChangeValueForKey:@"statusMessage"];
+			
+			[batch checkAgainstList:self];
+			[self askInstallBatch:batch];
+		});
+	});
+}
+
+- (void)askInstallBatch:(InstallBatch*)batch
+{
+	if (![batch.accepted count])
+	{
+		NSBeginCriticalAlertSheet(@"Nothing to install", @"OK", nil, nil, [self windowForSheet], nil, NULL, NULL, NULL, @"%@", [batch describe]);
+		return;
+	}
+	
+	NSBeginAlertSheet(@"Install addins",
+					  @"Install",
+					  @"Cancel",
+					  nil,
+					  [self windowForSheet],
+					  self,
+					  @selector(answerInstallBatch:returnCode:contextInfo:),
+					  NULL,
+					  (void*)CFBridgingRetain(batch),
+					  @"%@",
+					  [batch describe]);
+}
+
+- (void)answerInstallBatch:(NSWindow *)sheet returnCode:(NSInteger)returnCode contextInfo:(void *)contextInfo
+{
+	InstallBatch *batch = CFBridgingRelease(contextInfo);
+	
+	if (returnCode != NSAlertDefaultReturn)
+		return;
+	
+	/* Let the sheet go away before the install progress window comes up. */
+	[sheet orderOut:self];
+	[self installBatch:batch];
+}
+
+/*
+ * All the accepted dazips go through one progress window. Each is staged and
+ * committed on its own, so a failing one doesn't take the others with it,
+ * but the scan, the hash store and the document are only saved once at the
+ * end instead of per dazip.
+ */
+- (void)installBatch:(InstallBatch*)batch
+{
+	NSArray *accepted = batch.accepted;
+	NSMutableArray *inserted = [NSMutableArray array];
+	NSMutableArray *failures = [NSMutableArray array];
+	NSUInteger i = 0;
+	int64_t done = 0;
+	BOOL cancelled = NO;
+	
+	[progressIndicator setMaxValue:batch.uncompressedSize];
+	[progressIndicator setDoubleValue:0];
+	[progressLabel setStringValue:@""];
+	[progressWindow setTitle:@"Installing"];
+	NSModalSession modal = [NSApp beginModalSessionForWindow:progressWindow];
+	
+	for (InstallBatchEntry *entry in accepted)
+	{
+		NSError *err = nil;
+		NSArray *items = nil;
+		
+		[progressWindow setTitle:[NSString stringWithFormat:@"Installing %lu of %lu: %@", (unsigned long)++i, (unsigned long)[accepted count], entry.title]];
+		
+		@autoreleasepool
+		{
+			DAArchive *archive = [entry.archiveClass archiveForReadingFromURL:entry.URL encoding:NSWindowsCP1252StringEncoding error:&err];
+			
+			if (archive)
+				items = [self stageItems:entry.nodes withArchive:archive spool:nil name:[entry.URL lastPathComponent] session:modal error:&err];
+		}
+		
+		if (items)
+			[inserted addObjectsFromArray:items];
+		else if ([[err domain] isEqualToString:NSCocoaErrorDomain] && [err code] == NSUserCancelledError)
+		{
+			cancelled = YES;
+			break;
+		}
+		else
+			[failures addObject:[NSString stringWithFormat:@"%@: %@", entry.title, err ? [err localizedDescription] : @"unknown error"]];
+		
+		/* A failed one was rolled back, but the bar moves on past it anyway. */
+		done += entry.uncompressedSize;
+		[progressIndicator setDoubleValue:done];
+	}
+	
+	[self scanInstalledItems:inserted message:@"installed addins"];
+	for (Item *item in inserted)
+		[self updateEnabled:item canInteract:NO];
+	
+	[self.hashStore save:nil];
+	[NSApp endModalSession:modal];
+	[progressWindow close];
+	
+	if ([inserted count])
+		[self saveDocument:self];
+	
+	if ([failures count])
+		NSBeginCriticalAlertSheet(@"Some addins were not installed", @"OK", nil, nil, [self windowForSheet], nil, NULL, NULL, NULL,
+								  @"%@", [failures componentsJoinedByString:@"\n"]);
+	else if (cancelled && [inserted count])
+		NSBeginAlertSheet(@"Install cancelled", @"OK", nil, nil, [self windowForSheet], nil, NULL, NULL, NULL,
+						  @"The addins installed before cancelling were kept.");
+}
+
+@end
+
+
+@implementation AddInsList (Watching)
+
+- (void)startWatching
+{
+	__unsafe_unretained AddInsList *doc = self;
+	
+	if (!affectedItems)
+		affectedItems = [NSMutableSet set];
+	
+	/* Unretained to not keep the document alive, the watcher is stopped on close. */
+	watcher = [[FolderWatcher alloc] initWithURL:[self fileURL] delay:1.0 handler:^(NSSet *paths) {
+		[doc filesChanged:paths];
+	}];
+	if (![watcher start])
+		watcher = nil;
+}
+
+/*
+ * Map a changed file to the folder to rescan. This is the content path folder
+ * the file is in, or the file itself if it's above that level.
+ */
+- (NSArray*)scanComponentsForPath:(NSString*)path
+{
+	NSArray *mparts = [[self fileURL] pathComponents];
+	NSArray *cparts = [path pathComponents];
+	NSUInteger depth;
+	
+	if ([cparts count] <= [mparts count] || ![[cparts subarrayWithRange:NSMakeRange(0, [mparts count])] isEqualToArray:mparts])
+		return nil;
+	cparts = [cparts subarrayWithRange:NSMakeRange([mparts count], [cparts count] - [mparts count])];
+	
+	NSString *top = [cparts objectAtIndex:0];
+	if ([top caseInsensitiveCompare:@"Addins"] == NSOrderedSame || [top caseInsensitiveCompare:@"Offers"] == NSOrderedSame)
+		depth = 2;
+	else if ([top caseInsensitiveCompare:@"packages"] == NSOrderedSame || [top caseInsensitiveCompare:@"packages (disabled)"] == NSOrderedSame)
+	{
+		/* Only core is scanned. */
+		if ([cparts count] == 1)
+			cparts = [cparts arrayByAddingObject:@"core"];
+		else if ([[cparts objectAtIndex:1] caseInsensitiveCompare:@"core"] != NSOrderedSame)
+			return nil;
+		depth = 4;
+	}
+	else
+		return nil;
+	
+	if ([cparts count] > depth)
+		cparts = [cparts subarrayWithRange:NSMakeRange(0, depth)];
+	return cparts;
+}
+
+/*
+ * Forget what was found for a path and anything below it, until it's
+ * rescanned. Only touches items enabled or disabled as the folder says.
+ */
+- (void)retirePath:(NSString*)path disabled:(BOOL)disabled
+{
+	NSArray *paths = [[self managedObjectContext] executeFetchRequest:[[self managedObjectModel] fetchRequestTemplateForName:@"allPaths"] error:nil];
+	NSPredicate *pred = [NSPredicate predicateWithFormat:@"path ==[c] %@ OR path BEGINSWITH[c] %@", path, [path stringByAppendingString:@"/"]];
+	
+	NSString *top = [[path pathComponents] objectAtIndex:0];
+	
+	/* Addins and offers have no paths, their contents are kept by folder. */
+	if ([top caseInsensitiveCompare:@"Addins"] == NSOrderedSame || [top caseInsensitiveCompare:@"Offers"] == NSOrderedSame)
+		[contentTable removeContentsBelowPath:path];
+	
+	for (Path *p in [paths filteredArrayUsingPredicate:pred])
+	{
+		Item *item = p.modazipin.item;
+		
+		if (item && [item.Enabled boolValue] == disabled)
+			continue;
+		
+		p.verified = [NSNumber numberWithBool:NO];
+		[contentTable removeContentsForPath:p.path];
+		
+		if (item)
+			[affectedItems addObject:item];
+	}
+}
+
+- (void)filesChanged:(NSSet*)paths
+{
+	NSMutableDictionary *scans = [NSMutableDictionary dictionary];
+	NSString *base = [[self fileURL] path];
+	
+	/* Events were lost, rescan everything. */
+	if ([paths containsObject:base])
+	{
+		paths = [NSSet setWithObjects:
+				 [base stringByAppendingPathComponent:@"Addins"],
+				 [base stringByAppendingPathComponent:@"Offers"],
+				 [base stringByAppendingPathComponent:@"packages/core"],
+				 [base stringByAppendingPathComponent:@"packages (disabled)/core"],
+				 nil];
+	}
+	
+	for (NSString *path in paths)
+	{
+		NSArray *cparts = [self scanComponentsForPath:path];
+		
+		if (cparts)
+			[scans setObject:cparts forKey:[NSString pathWithComponents:cparts]];
+	}
+	
+	for (NSString *key in [scans allKeys])
+	{
+		NSArray *cparts = [scans objectForKey:key];
+		NSUInteger i;
+		
+		/* Skip if a folder above is scanned anyway. */
+		for (i = 1 ; i < [cparts count] ; i++)
+		{
+			if ([scans objectForKey:[NSString pathWithComponents:[cparts subarrayWithRange:NSMakeRange(0, i)]]])
+				break;
+		}
+		if (i < [cparts count])
+			continue;
+		
+		NSURL *url = [[self fileURL] URLByAppendingPathComponent:key];
+		BOOL disabled = [isDisabled evaluateWithObject:[cparts objectAtIndex:0]];
+		NSString *top = [cparts objectAtIndex:0];
+		
+		if (disabled)
+			top = [top substringToIndex:[top length] - sizeof (" (disabled)") + 1];
+		[self retirePath:[NSString pathWithComponents:[[NSArray arrayWithObject:top] arrayByAddingObjectsFromArray:[cparts subarrayWithRange:NSMakeRange(1, [cparts count] - 1)]]] disabled:disabled];
+		
+		if ([url checkResourceIsReachableAndReturnError:nil])
+			[operationQueue addOperation:[[Scanner alloc] initWithDocument:self URL:url message:@"changes" disabled:disabled]];
+	}
+	
+	/* Nothing to rescan, so nothing else will trigger the check. */
+	if (![operationQueue operationCount] && [affectedItems count])
+		[self updateMissingFiles];
+}
+
+@end
+
+
+@implementation AddInsList (Conflicts)
+
+/* Where the contents of an addin or offer are, nil for other items. */
+- (NSString*)contentPathForItem:(Item*)item
+{
+	if ([item class] == [AddInItem self])
+		return [NSString stringWithFormat:@"Addins/%@", item.UID];
+	if ([item class] == [OfferItem self])
+		return [NSString stringWithFormat:@"Offers/%@", item.UID];
+	return nil;
+}
+
+/* The item owning a content path, either an addin or offer folder or a Path. */
+- (Item*)itemForContentPath:(NSString*)path
+{
+	NSArray *cparts = [path pathComponents];
+	NSString *top = [cparts objectAtIndex:0];
+	NSFetchRequest *req;
+	
+	if ([cparts count] == 2 && ([top caseInsensitiveCompare:@"Addins"] == NSOrderedSame || [top caseInsensitiveCompare:@"Offers"] == NSOrderedSame))
+	{
+		req = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"itemWithUID" substitutionVariables:[NSDictionary dictionaryWithObject:[cparts objectAtIndex:1] forKey:@"UID"]];
+		NSArray *items = [[self managedObjectContext] executeFetchRequest:req error:nil];
+		
+		return [items count] ? [items objectAtIndex:0] : nil;
+	}
+	
+	req = [[self managedObjectModel] fetchRequestFromTemplateWithName:@"path" substitutionVariables:[NSDictionary dictionaryWithObject:path forKey:@"path"]];
+	NSArray *pathObjs = [[self managedObjectContext] executeFetchRequest:req error:nil];
+	Path *pathObj = [pathObjs count] ? [pathObjs objectAtIndex:0] : nil;
+	
+	return pathObj.modazipin.item;
+}
+
+/* Only enabled items can conflict, the others aren't loaded by the game. */
+- (NSDictionary*)itemsForConflicts:(NSDictionary*)conflicts
+{
+	NSMutableDictionary *itemsByPath = [NSMutableDictionary dictionary];
+	NSMutableDictionary *res = [NSMutableDictionary dictionary];
+	
+	for (NSString *name in conflicts)
+	{
+		for (NSString *path in [conflicts objectForKey:name])
+		{
+			id oid = [itemsByPath objectForKey:path];
+			
+			if (!oid)
+			{
+				Item *item = [self itemForContentPath:path];
+				
+				if (item && [item.Enabled boolValue])
+					oid = [item objectID];
+				else
+					oid = [NSNull null];
+				[itemsByPath setObject:oid forKey:path];
+			}
+			if (oid == [NSNull null])
+				continue;
+			
+			NSMutableSet *names = [res objectForKey:oid];
+			if (!names)
+			{
+				names = [NSMutableSet set];
+				[res setObject:names forKey:oid];
+			}
+			[names addObject:name];
+		}
+	}
+	
+	NSMutableDictionary *byItem = [NSMutableDictionary dictionaryWithCapacity:[res count]];
+	for (NSManagedObjectID *oid in res)
+		[byItem setObject:[[res objectForKey:oid] allObjects] forKey:oid];
+	return byItem;
+}
+
+- (NSDictionary*)conflictsForContents:(NSSet*)contents
+{
+	return [self itemsForConflicts:[contentTable conflictsForContents:contents excludingPaths:nil]];
+}
+
+- (NSDictionary*)conflictsForItem:(Item*)item
+{
+	if ([item managedObjectContext] != [self managedObjectContext] || ![item.Enabled boolValue])
+		return [NSDictionary dictionary];
+	
+	NSMutableArray *paths = [NSMutableArray arrayWithArray:[[item.modazipin.paths valueForKey:@"path"] allObjects]];
+	NSString *contentPath = [self contentPathForItem:item];
+	
+	if (contentPath)
+		[paths addObject:contentPath];
+	
+	NSMutableDictionary *res = [NSMutableDictionary dictionaryWithDictionary:[self itemsForConflicts:[contentTable conflictsForPaths:paths]]];
+	
+	[res removeObjectForKey:[item objectID]];
+	return res;
+}
+
+- (NSString*)describeConflicts:(NSDictionary*)conflicts
+{
+	NSMutableArray *lines = [NSMutableArray array];
+	
+	for (NSManagedObjectID *oid in conflicts)
+	{
+		Item *other = (Item*)[[self managedObjectContext] objectWithID:oid];
+		NSUInteger n = [[conflicts objectForKey:oid] count];
+		
+		[lines addObject:[NSString stringWithFormat:@"%@ (%lu %@)", other.Title.localizedValue, (unsigned long)n, n == 1 ? @"file" : @"files"]];
+	}
+	[lines sortUsingSelector:@selector(caseInsensitiveCompare:)];
+	return [lines componentsJoinedByString:@", "];
+}
+
+@end
+
@@ -56,6 +56,57 @@
 	return NO;
 }
 
+/*
+ * Several dazips or daoverrides at once, such as when dropped on the icon,
+ * are installed as one batch rather than opened one window each, the same
+ * as when chosen in the install panel.
+ */
+- (void)application:(NSApplication *)sender openFiles:(NSArray *)filenames
+{
+	NSArray *batchTypes = [NSArray arrayWithObjects:@"dazip", @"daoverride", nil];
+	NSMutableArray *dazips = [NSMutableArray array];
+	NSMutableArray *others = [NSMutableArray array];
+	
+	for (NSString *filename in filenames)
+	{
+		NSURL *url = [NSURL fileURLWithPath:filename];
+		NSString *ext = [[url pathExtension] lowercaseString];
+		
+		if ([batchTypes containsObject:ext])
+			[dazips addObject:url];
+		else
+			[others addObject:url];
+	}
+	if ([dazips count] < 2)
+	{
+		[others addObjectsFromArray:dazips];
+		[dazips removeAllObjects];
+	}
+	
+	for (NSURL *url in others)
+	{
+		[[NSDocumentController sharedDocumentController] openDocumentWithContentsOfURL:url display:YES completionHandler:^(NSDocument *doc, BOOL wasOpen, NSError *err) {
+			if (!doc && err)
+				[NSApp presentError:err];
+		}];
+	}
+	
+	if ([dazips count])
+	{
+		AddInsList *list = [AddInsList sharedAddInsList];
+		
+		if (!list)
+		{
+			[self openAddInsList:self];
+			list = [AddInsList sharedAddInsList];
+		}
+		[list showWindows];
+		[list installDazipsAtURLs:dazips];
+	}
+	
+	[sender replyToOpenOrPrint:NSApplicationDelegateReplySuccess];
+}
+
 - (IBAction)chooseDragonAgeFolder:(id)sender
 {
 	static BOOL running = NO;
@@ -0,0 +1,62 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+@class DAArchiveMember;
+
+/*
+ * Keeps the members of an archive as they are decompressed while it's being
+ * opened, so that installing it doesn't have to decompress it all again.
+ * Members are kept in memory up to a fixed total, the rest is written to a
+ * temporary folder.
+ */
+@interface ArchiveSpool : NSObject
+{
+	NSURL *archiveURL;
+	NSDictionary *archiveAttributes;
+	NSURL *spoolURL;
+	
+	NSMutableArray *entries; /* Install path, type and data or URL, in archive order. */
+	uint64_t memoryUsed;
+}
+
+- (id)initWithArchiveURL:(NSURL*)url error:(NSError**)error;
+
+/*
+ * Decompress and keep the member. Returns its data, which might be mapped
+ * from the spooled file, or nil on error.
+ */
+- (NSData*)spoolMember:(DAArchiveMember*)member error:(NSError**)error;
+
+/* Still matches the archive on disk. */
+- (BOOL)isCurrent;
+
+/*
+ * Calls block for each member in archive order, with data if it's kept in
+ * memory and otherwise the URL of the spooled file. The file should be
+ * left in place, in case the install is tried again.
+ */
+- (BOOL)enumerateMembersUsingBlock:(BOOL (^)(NSString *installPath, NSData *data, NSURL *url, NSError **error))block error:(NSError**)error;
+
+@property(readonly) uint64_t size;
+
+@end
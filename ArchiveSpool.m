@@ -0,0 +1,140 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import "ArchiveSpool.h"
+#import "DAArchive.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Members are kept in memory until they add up to this, then written to disk. */
+#define SPOOL_MEMORY_CAP (256 * 1024 * 1024)
+
+@implementation ArchiveSpool
+
+- (id)initWithArchiveURL:(NSURL*)url error:(NSError**)error
+{
+	self = [super init];
+	if (self)
+	{
+		NSString *template = [NSTemporaryDirectory() stringByAppendingPathComponent:@"modazipin-spool.XXXXXX"];
+		char *tmpl = strdup([template fileSystemRepresentation]);
+		
+		if (!tmpl || !mkdtemp(tmpl))
+		{
+			if (error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+			free(tmpl);
+			return nil;
+		}
+		spoolURL = [NSURL fileURLWithPath:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:tmpl length:strlen(tmpl)] isDirectory:YES];
+		free(tmpl);
+		
+		archiveURL = url;
+		archiveAttributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[url path] error:nil];
+		entries = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (spoolURL)
+		[[NSFileManager defaultManager] removeItemAtURL:spoolURL error:nil];
+}
+
+- (NSData*)spoolMember:(DAArchiveMember*)member error:(NSError**)error
+{
+	NSString *path = member.installPath;
+	
+	if (!path)
+	{
+		if (error)
+			*error = nil;
+		return nil;
+	}
+	
+	if (member.sizeAvailable && memoryUsed + (uint64_t)member.size <= SPOOL_MEMORY_CAP)
+	{
+		NSData *data = member.data;
+		
+		if (!data)
+		{
+			if (error)
+				*error = nil;
+			return nil;
+		}
+		
+		memoryUsed += [data length];
+		[entries addObject:[NSArray arrayWithObjects:path, data, nil]];
+		return data;
+	}
+	
+	NSURL *url = [spoolURL URLByAppendingPathComponent:[NSString stringWithFormat:@"%lu", (unsigned long)[entries count]]];
+	
+	if (![member extractToURL:url createDirectories:NO error:error])
+		return nil;
+	
+	[entries addObject:[NSArray arrayWithObjects:path, url, nil]];
+	return [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:error];
+}
+
+- (BOOL)isCurrent
+{
+	NSDictionary *attrs = [[NSFileManager defaultManager] attributesOfItemAtPath:[archiveURL path] error:nil];
+	
+	return attrs && archiveAttributes
+		&& [[attrs fileModificationDate] isEqualToDate:[archiveAttributes fileModificationDate]]
+		&& [attrs fileSize] == [archiveAttributes fileSize]
+		&& [attrs fileSystemFileNumber] == [archiveAttributes fileSystemFileNumber];
+}
+
+- (BOOL)enumerateMembersUsingBlock:(BOOL (^)(NSString *installPath, NSData *data, NSURL *url, NSError **error))block error:(NSError**)error
+{
+	for (NSArray *entry in entries)
+	{
+		id obj = [entry objectAtIndex:1];
+		BOOL isData = [obj isKindOfClass:[NSData class]];
+		
+		if (!block([entry objectAtIndex:0], isData ? obj : nil, isData ? nil : obj, error))
+			return NO;
+	}
+	return YES;
+}
+
+- (uint64_t)size
+{
+	uint64_t sz = 0;
+	
+	for (NSArray *entry in entries)
+	{
+		id obj = [entry objectAtIndex:1];
+		
+		if ([obj isKindOfClass:[NSData class]])
+			sz += [obj length];
+		else
+			sz += [[[NSFileManager defaultManager] attributesOfItemAtPath:[obj path] error:nil] fileSize];
+	}
+	return sz;
+}
+
+@end
@@ -21,7 +21,8 @@
 
 /*
  * libarchive wrapper. Like the library, it only supports simple enumeration.
- * That way it can skip reading the data if not needed.
+ * That way it can skip reading the data if not needed. Zip files can also
+ * be read in any order, see the Seeking category.
  *
  * Requires garbage collection and probably OS X 10.6.
  */
@@ -30,9 +31,13 @@
 
 struct archive;
 struct archive_entry;
+struct zipdir;
 
 @class ArchiveWrapper;
 
+/* Archive bytes read and member bytes handed out since the last call. */
+typedef void (^archiveProgressBlock)(int64_t bytesIn, int64_t bytesOut);
+
 /**********************************************************************
  * Exceptions
  **********************************************************************/
@@ -69,6 +74,9 @@ extern NSString * const ArchiveErrorDomain;
 	
 	BOOL dataAvailable;
 	NSData *data;
+	
+	/* For members from the zip directory, which have no archive. */
+	NSUInteger directoryIndex;
 }
 
 @property(readonly) struct archive_entry *entry;
@@ -92,6 +100,13 @@ extern NSString * const ArchiveErrorDomain;
 - (BOOL)fetchDataWithError:(NSError**)error;
 - (BOOL)skipDataWithError:(NSError**)error;
 
+/*
+ * Hand the data to block as it's decompressed, without keeping it. Reading
+ * stops early if block returns NO, the rest can then be skipped with
+ * skipDataWithError:. The data can't be fetched after this.
+ */
+- (BOOL)readDataUsingBlock:(BOOL (^)(const void *bytes, size_t length))block error:(NSError**)error;
+
 /* -data will do fetchData if needed. It returns nil if there was an error loading the data */
 @property(readonly) BOOL dataAvailable;
 @property(readonly) NSData *data;
@@ -105,11 +120,16 @@ extern NSString * const ArchiveErrorDomain;
 
 @interface ArchiveWrapper : NSObject <NSFastEnumeration>
 {
+	NSURL *URL;
 	struct archive *archive;
 	NSStringEncoding encoding;
 	
 	ArchiveMember *lastMember;
 	int64_t uncompressedOffset;
+	archiveProgressBlock progressBlock;
+	
+	struct zipdir *directory;
+	BOOL directoryOpened;
 }
 
 /* Only file URLs are supported for now. */
@@ -121,6 +141,39 @@ extern NSString * const ArchiveErrorDomain;
 
 - (ArchiveMember *)nextMemberWithError:(NSError**)error;
 
+@property(readonly) NSURL *URL;
+@property(readonly) NSStringEncoding encoding;
 @property int64_t uncompressedOffset;
 
+/*
+ * Called as member data is read, on whatever thread reads it. Data that's
+ * been fetched already isn't counted again.
+ */
+@property(copy) archiveProgressBlock progressBlock;
+
+/* For the members, and subclasses reading some other way than libarchive. */
+- (void)addProgressIn:(int64_t)inBytes out:(int64_t)outBytes;
+
+@end
+
+/*
+ * Random access, through the central directory of a zip file with the file
+ * mapped. Members can be looked up and read in any order without touching
+ * the rest, independently of the enumeration above, which is still what
+ * other formats have. isSeekable opens the directory the first time it's
+ * asked and is NO for anything but a zip file.
+ */
+@interface ArchiveWrapper (Seeking)
+
+@property(readonly) BOOL isSeekable;
+@property(readonly) NSUInteger memberCount;
+
+/* Of all the members, without decompressing anything. */
+@property(readonly) int64_t uncompressedSize;
+
+- (ArchiveMember *)memberAtIndex:(NSUInteger)idx error:(NSError**)error;
+
+/* Case is ignored. Returns nil without setting error if there's no such member. */
+- (ArchiveMember *)memberNamed:(NSString *)name error:(NSError**)error;
+
 @end
@@ -23,6 +23,11 @@
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "zipdir.h"
 
 NSString * const ArchiveMemberInfoNotAvailableException = @"ArchiveMemberInfoNotAvailableException";
 NSString * const ArchiveMemberDataNotAvailableException = @"ArchiveMemberDataNotAvailableException";
@@ -36,6 +41,16 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 
 @end
 
+/* Used by the members from the zip directory. */
+@interface ArchiveWrapper (Directory)
+
+- (const struct zip_member *)directoryMember:(NSUInteger)idx;
+- (NSData*)dataForDirectoryIndex:(NSUInteger)idx error:(NSError**)error;
+- (BOOL)readDirectoryIndex:(NSUInteger)idx usingBlock:(BOOL (^)(const void *bytes, size_t length))block error:(NSError**)error;
+- (BOOL)extractDirectoryIndex:(NSUInteger)idx toURL:(NSURL*)dst error:(NSError**)error;
+
+@end
+
 @implementation ArchiveWrapper (Errors)
 
 + (NSError*)archiveError:(struct archive *)archive code:(NSInteger)code
@@ -106,6 +121,39 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 	return self;
 }
 
+- (id)initWithWrapper:(ArchiveWrapper *)w directoryIndex:(NSUInteger)idx encoding:(NSStringEncoding)enc error:(NSError**)error
+{
+	self = [super init];
+	
+	if (self)
+	{
+		const struct zip_member *m = [w directoryMember:idx];
+		
+		wrapper = w;
+		archive = NULL;
+		directoryIndex = idx;
+		encoding = m->flags & ZIP_FLAG_UTF8 ? NSUTF8StringEncoding : enc;
+		entry = archive_entry_new();
+		if (!entry)
+		{
+			if (error)
+				*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+			return nil;
+		}
+		archive_entry_copy_pathname(entry, m->name);
+		if (m->name_len && m->name[m->name_len - 1] == '/')
+			archive_entry_set_filetype(entry, AE_IFDIR);
+		else
+		{
+			archive_entry_set_filetype(entry, AE_IFREG);
+			archive_entry_set_size(entry, (int64_t)m->usize);
+		}
+		dataAvailable = YES;
+		data = nil;
+	}
+	return self;
+}
+
 - (void)dealloc
 {
 	if (entry)
@@ -176,17 +224,39 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 		return NO;
 	}
 	
+	if (!archive)
+	{
+		NSData *d = [wrapper dataForDirectoryIndex:directoryIndex error:error];
+		
+		[self willChangeValueForKey:@"dataAvailable"];
+		dataAvailable = NO;
+		[self didChangeValueForKey:@"dataAvailable"];
+		
+		if (!d)
+			return NO;
+		
+		[self willChangeValueForKey:@"data"];
+		data = d;
+		[self didChangeValueForKey:@"data"];
+		return YES;
+	}
+	
 	if (self.sizeAvailable)
 	{
 		mutableData = [NSMutableData dataWithLength:(NSUInteger)self.size];
 		
 		int idx = 0;
+		int64_t at = archive_filter_bytes(archive, 0);
 		while ((r = archive_read_data_block (archive, &buf, &len, &offset)) == ARCHIVE_OK)
 		{
+			int64_t now = archive_filter_bytes(archive, 0);
+			
 			[mutableData replaceBytesInRange:(NSRange){(NSUInteger)offset, (NSUInteger)len} withBytes:buf];
+			[wrapper addProgressIn:now - at out:(int64_t)len];
+			at = now;
 		
 			if (++idx % 300 == 0 && wrapper)
-				wrapper.uncompressedOffset = archive_filter_bytes(archive, 0);
+				wrapper.uncompressedOffset = now;
 		}
 	}
 	else
@@ -194,14 +264,19 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 		mutableData = [NSMutableData data];
 		
 		int idx = 0;
+		int64_t at = archive_filter_bytes(archive, 0);
 		while ((r = archive_read_data_block (archive, &buf, &len, &offset)) == ARCHIVE_OK)
 		{
+			int64_t now = archive_filter_bytes(archive, 0);
+			
 			if (offset > (off_t)[data length])
 				[mutableData increaseLengthBy:(NSUInteger)offset - [data length]];
 			[mutableData appendBytes:buf length:len];
+			[wrapper addProgressIn:now - at out:(int64_t)len];
+			at = now;
 			
 			if (++idx % 300 == 0 && wrapper)
-				wrapper.uncompressedOffset = archive_filter_bytes(archive, 0);
+				wrapper.uncompressedOffset = now;
 		}
 	}
 	
@@ -227,6 +302,77 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 	return YES;
 }
 
+- (BOOL)readDataUsingBlock:(BOOL (^)(const void *bytes, size_t length))block error:(NSError**)error
+{
+	const void *buf;
+	size_t len;
+	off_t offset, pos = 0;
+	int64_t at;
+	int r, idx = 0;
+	
+	if (data)
+	{
+		if (error)
+			*error = nil;
+		block([data bytes], [data length]);
+		return YES;
+	}
+	
+	if (!dataAvailable)
+	{
+		if (error)
+			*error = nil;
+		return NO;
+	}
+	
+	[self willChangeValueForKey:@"dataAvailable"];
+	dataAvailable = NO;
+	[self didChangeValueForKey:@"dataAvailable"];
+	
+	if (!archive)
+		return [wrapper readDirectoryIndex:directoryIndex usingBlock:block error:error];
+	
+	at = archive_filter_bytes(archive, 0);
+	while ((r = archive_read_data_block (archive, &buf, &len, &offset)) == ARCHIVE_OK)
+	{
+		int64_t now = archive_filter_bytes(archive, 0);
+		
+		[wrapper addProgressIn:now - at out:(int64_t)(offset > pos ? offset - pos : 0) + (int64_t)len];
+		at = now;
+		
+		/* Holes in sparse entries are zeros. */
+		while (pos < offset)
+		{
+			static const char zeros[4096];
+			size_t l = offset - pos > (off_t)sizeof(zeros) ? sizeof(zeros) : (size_t)(offset - pos);
+			
+			if (!block(zeros, l))
+				return YES;
+			pos += l;
+		}
+		if (!block(buf, len))
+			return YES;
+		pos += len;
+		
+		if (++idx % 300 == 0 && wrapper)
+			wrapper.uncompressedOffset = now;
+	}
+	
+	if (wrapper)
+		wrapper.uncompressedOffset = archive_filter_bytes(archive, 0);
+	
+	if (r != ARCHIVE_EOF && r != ARCHIVE_WARN)
+	{
+		if (error)
+			*error = [ArchiveWrapper archiveError:archive code:r];
+		return NO;
+	}
+	
+	if (error)
+		*error = r == ARCHIVE_WARN ? [ArchiveWrapper archiveError:archive code:r] : nil;
+	return YES;
+}
+
 - (BOOL)skipDataWithError:(NSError **)error
 {
 	int r;
@@ -238,6 +384,18 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 		return NO;
 	}
 	
+	if (!archive)
+	{
+		/* Nothing to skip past. */
+		[self willChangeValueForKey:@"dataAvailable"];
+		dataAvailable = NO;
+		[self didChangeValueForKey:@"dataAvailable"];
+		
+		if (error)
+			*error = nil;
+		return YES;
+	}
+	
 	r = archive_read_data_skip (archive);
 	
 	[self willChangeValueForKey:@"dataAvailable"];
@@ -308,6 +466,15 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 	if (data)
 		return [data writeToURL:dst options:NSDataWritingAtomic error:error];
 	
+	if (!archive)
+	{
+		[self willChangeValueForKey:@"dataAvailable"];
+		dataAvailable = NO;
+		[self didChangeValueForKey:@"dataAvailable"];
+		
+		return [wrapper extractDirectoryIndex:directoryIndex toURL:dst error:error];
+	}
+	
 	[[NSFileManager defaultManager] createFileAtPath:[dst path] contents:nil attributes:nil];
 	NSFileHandle *fh = [NSFileHandle fileHandleForWritingToURL:dst error:error];
 	int r;
@@ -323,13 +490,18 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 	[self didChangeValueForKey:@"dataAvailable"];
 	
 	int idx = 0;
+	int64_t at = archive_filter_bytes(archive, 0);
 	while ((r = archive_read_data_block (archive, &buf, &len, &offset)) == ARCHIVE_OK)
 	{
+		int64_t now = archive_filter_bytes(archive, 0);
+		
 		if (offset > (off_t)[fh offsetInFile])
 			[fh truncateFileAtOffset:offset];
 		[fh writeData:[NSData dataWithBytesNoCopy:(void*)buf length:len freeWhenDone:NO]];
+		[wrapper addProgressIn:now - at out:(int64_t)len];
+		at = now;
 		if (++idx % 300 == 0 && wrapper)
-			wrapper.uncompressedOffset = archive_filter_bytes(archive, 0);
+			wrapper.uncompressedOffset = now;
 	}
 	[fh closeFile];
 	
@@ -389,6 +561,7 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 				return nil;
 		}
 		
+		URL = url;
 		encoding = enc;
 		
 		lastMember = nil;
@@ -401,6 +574,11 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 {
 	if (archive)
 		archive_read_free (archive);
+	if (directory)
+	{
+		close(directory->fd);
+		zipdir_free(directory);
+	}
 }
 
 - (Class)memberClass
@@ -441,6 +619,201 @@ NSString * const ArchiveErrorDomain = @"ArchiveErrorDomain";
 	return 1;
 }
 
+@synthesize URL;
+@synthesize encoding;
 @synthesize uncompressedOffset;
+@synthesize progressBlock;
+
+- (void)addProgressIn:(int64_t)inBytes out:(int64_t)outBytes
+{
+	archiveProgressBlock block = self.progressBlock;
+	
+	if (block)
+		block(inBytes, outBytes);
+}
+
+@end
+
+
+@implementation ArchiveWrapper (Seeking)
+
+- (BOOL)isSeekable
+{
+	if (!directoryOpened)
+	{
+		int fd = URL ? open([[URL path] fileSystemRepresentation], O_RDONLY) : -1;
+		
+		directoryOpened = YES;
+		if (fd >= 0)
+		{
+			directory = zipdir_open(fd);
+			/* Not being able to map it only means it's read with pread. */
+			if (directory)
+				zipdir_map(directory);
+			else
+				close(fd);
+		}
+	}
+	return directory != NULL;
+}
+
+- (NSUInteger)memberCount
+{
+	if (!self.isSeekable)
+		return 0;
+	
+	return directory->nmembers;
+}
+
+- (int64_t)uncompressedSize
+{
+	int64_t sz = 0;
+	
+	if (!self.isSeekable)
+		return 0;
+	
+	for (size_t i = 0 ; i < directory->nmembers ; i++)
+		sz += (int64_t)directory->members[i].usize;
+	return sz;
+}
+
+- (ArchiveMember *)memberAtIndex:(NSUInteger)idx error:(NSError**)error
+{
+	if (!self.isSeekable || idx >= directory->nmembers)
+	{
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EINVAL userInfo:nil];
+		return nil;
+	}
+	
+	return [[[self memberClass] alloc] initWithWrapper:self directoryIndex:idx encoding:encoding error:error];
+}
+
+- (ArchiveMember *)memberNamed:(NSString *)name error:(NSError**)error
+{
+	const char *cname = [name cStringUsingEncoding:encoding];
+	ssize_t idx = -1;
+	
+	if (error)
+		*error = nil;
+	
+	if (!self.isSeekable)
+		return nil;
+	
+	if (cname)
+		idx = zipdir_find(directory, cname, strlen(cname));
+	
+	/* Names flagged as UTF-8 are stored that way whatever the encoding. */
+	if (idx < 0 && (cname = [name UTF8String]))
+		idx = zipdir_find(directory, cname, strlen(cname));
+	
+	if (idx < 0)
+		return nil;
+	
+	return [self memberAtIndex:(NSUInteger)idx error:error];
+}
+
+@end
+
+
+static int
+block_sink(void *ctx, const void *bytes, size_t length)
+{
+	BOOL (^block)(const void *, size_t) = (__bridge BOOL (^)(const void *, size_t))ctx;
+	
+	return block(bytes, length) ? 0 : 1;
+}
+
+static void
+progress_sink(void *ctx, uint64_t in, uint64_t out)
+{
+	ArchiveWrapper *wrapper = (__bridge ArchiveWrapper*)ctx;
+	
+	[wrapper addProgressIn:(int64_t)in out:(int64_t)out];
+}
+
+@implementation ArchiveWrapper (Directory)
+
+- (const struct zip_member *)directoryMember:(NSUInteger)idx
+{
+	return &directory->members[idx];
+}
+
+- (NSData*)dataForDirectoryIndex:(NSUInteger)idx error:(NSError**)error
+{
+	const struct zip_member *m = &directory->members[idx];
+	NSMutableData *d;
+	
+	if (m->usize > NSUIntegerMax || !(d = [NSMutableData dataWithLength:(NSUInteger)m->usize]))
+	{
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:nil];
+		return nil;
+	}
+	
+	if (zipdir_extract_progress(directory, idx, -1, [d mutableBytes], progress_sink, (__bridge void*)self))
+	{
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+		return nil;
+	}
+	
+	self.uncompressedOffset += (int64_t)m->usize;
+	if (error)
+		*error = nil;
+	return d;
+}
+
+- (BOOL)readDirectoryIndex:(NSUInteger)idx usingBlock:(BOOL (^)(const void *bytes, size_t length))block error:(NSError**)error
+{
+	const struct zip_member *m = &directory->members[idx];
+	__block uint64_t out = 0, in = 0;
+	BOOL (^counting)(const void *, size_t) = ^BOOL(const void *bytes, size_t length) {
+		/* In proportion, as zipdir_extract_progress does it. */
+		uint64_t nin;
+		
+		out += length;
+		nin = out >= m->usize ? m->csize : (uint64_t)((double)out * m->csize / m->usize);
+		[self addProgressIn:(int64_t)(nin - in) out:(int64_t)length];
+		in = nin;
+		return block(bytes, length);
+	};
+	
+	if (zipdir_read(directory, idx, block_sink, (__bridge void*)counting) < 0)
+	{
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+		return NO;
+	}
+	
+	if (error)
+		*error = nil;
+	return YES;
+}
+
+- (BOOL)extractDirectoryIndex:(NSUInteger)idx toURL:(NSURL*)dst error:(NSError**)error
+{
+	int fd = open([[dst path] fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	
+	if (fd < 0 || zipdir_extract_progress(directory, idx, fd, NULL, progress_sink, (__bridge void*)self))
+	{
+		int e = errno;
+		
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink([[dst path] fileSystemRepresentation]);
+		}
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:e userInfo:nil];
+		return NO;
+	}
+	close(fd);
+	
+	self.uncompressedOffset += (int64_t)directory->members[idx].usize;
+	if (error)
+		*error = nil;
+	return YES;
+}
 
 @end
@@ -0,0 +1,80 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+@class ArchiveMember;
+
+/*
+ * Remembers the SHA-256 digest of every installed file, so that a file
+ * identical to one already installed can be hardlinked instead of written
+ * again. Records are checked against the file (inode, size and mtime) before
+ * being trusted, stale ones are simply dropped.
+ * Kept in Settings/modazipin-hashes.plist below the base folder.
+ */
+@interface ContentHashStore : NSObject
+{
+	NSURL *baseURL;
+	NSURL *storeURL;
+	
+	NSMutableDictionary *files; /* Relative path -> record dictionary. */
+	NSMutableDictionary *digests; /* Digest -> NSMutableSet of relative paths. */
+	BOOL dirty;
+}
+
+- (id)initWithBaseURL:(NSURL*)base;
+
++ (NSString*)digestForData:(NSData*)data;
++ (NSString*)digestForURL:(NSURL*)url error:(NSError**)error;
+/* Also gives the CRC-32 of the file, read in the same pass. */
++ (NSString*)digestForURL:(NSURL*)url crc:(uint32_t*)crc error:(NSError**)error;
+
+/* An installed file with this digest, or nil if there is none. */
+- (NSURL*)URLForDigest:(NSString*)digest;
+
+- (void)recordURL:(NSURL*)url digest:(NSString*)digest;
+
+/*
+ * Like -[ArchiveMember extractToURL:createDirectories:error:], but links to
+ * an identical installed file when there is one. Members too large to keep
+ * in memory are extracted as usual and only recorded.
+ */
+- (BOOL)extractMember:(ArchiveMember*)member toURL:(NSURL*)dst error:(NSError**)error;
+
+/*
+ * As above, but only returns the digest instead of recording it, for when
+ * dst is not where the file will stay.
+ */
+- (BOOL)extractMember:(ArchiveMember*)member toURL:(NSURL*)dst digest:(NSString**)digest error:(NSError**)error;
+
+/* Hardlink dst to an installed file with the digest. NO if there's none or it's on another volume. */
+- (BOOL)linkURL:(NSURL*)dst toDigest:(NSString*)digest;
+
+/*
+ * Replace identical files below dirs with hardlinks to one copy.
+ * Returns the number of bytes freed, or -1 on error.
+ */
+- (int64_t)dedupeDirectories:(NSArray*)dirs error:(NSError**)error;
+
+- (BOOL)save:(NSError**)error;
+
+@end
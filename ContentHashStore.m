@@ -0,0 +1,381 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import "ContentHashStore.h"
+#import "ArchiveWrapper.h"
+
+#include <CommonCrypto/CommonDigest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Members larger than this are not read into memory to be hashed first. */
+#define MAX_MEMORY_MEMBER (64 * 1024 * 1024)
+
+/* Feed CC_SHA256_Update in pieces this size, since it takes a CC_LONG. */
+#define DIGEST_CHUNK (16 * 1024 * 1024)
+
+/* If crc isn't NULL the CRC-32 of the bytes is computed in the same pass. */
+static NSString *
+digestBytes(const void *bytes, NSUInteger length, uint32_t *crc)
+{
+	uLong c = crc32(0, Z_NULL, 0);
+	CC_SHA256_CTX ctx;
+	unsigned char md[CC_SHA256_DIGEST_LENGTH];
+	NSMutableString *res = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+	
+	CC_SHA256_Init(&ctx);
+	while (length)
+	{
+		CC_LONG l = length > DIGEST_CHUNK ? DIGEST_CHUNK : (CC_LONG)length;
+		
+		CC_SHA256_Update(&ctx, bytes, l);
+		if (crc)
+			c = crc32(c, bytes, (uInt)l);
+		bytes = (const char*)bytes + l;
+		length -= l;
+	}
+	CC_SHA256_Final(md, &ctx);
+	if (crc)
+		*crc = (uint32_t)c;
+	
+	for (int i = 0 ; i < CC_SHA256_DIGEST_LENGTH ; i++)
+		[res appendFormat:@"%02x", md[i]];
+	return res;
+}
+
+@implementation ContentHashStore
+
+- (id)initWithBaseURL:(NSURL*)base
+{
+	self = [super init];
+	if (self)
+	{
+		baseURL = base;
+		storeURL = [[base URLByAppendingPathComponent:@"Settings"] URLByAppendingPathComponent:@"modazipin-hashes.plist"];
+		files = [NSMutableDictionary dictionary];
+		digests = [NSMutableDictionary dictionary];
+		
+		NSData *data = [NSData dataWithContentsOfURL:storeURL];
+		NSDictionary *plist = data ? [NSPropertyListSerialization propertyListWithData:data options:0 format:NULL error:nil] : nil;
+		
+		if ([plist isKindOfClass:[NSDictionary class]])
+		{
+			for (NSString *path in plist)
+			{
+				NSDictionary *rec = [plist objectForKey:path];
+				NSString *digest = [rec objectForKey:@"digest"];
+				
+				if (!digest)
+					continue;
+				
+				[files setObject:rec forKey:path];
+				
+				NSMutableSet *set = [digests objectForKey:digest];
+				if (!set)
+					[digests setObject:(set = [NSMutableSet set]) forKey:digest];
+				[set addObject:path];
+			}
+		}
+	}
+	return self;
+}
+
++ (NSString*)digestForData:(NSData*)data
+{
+	return digestBytes([data bytes], [data length], NULL);
+}
+
++ (NSString*)digestForURL:(NSURL*)url error:(NSError**)error
+{
+	return [self digestForURL:url crc:NULL error:error];
+}
+
++ (NSString*)digestForURL:(NSURL*)url crc:(uint32_t*)crc error:(NSError**)error
+{
+	NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:error];
+	
+	if (!data)
+		return nil;
+	
+	return digestBytes([data bytes], [data length], crc);
+}
+
+- (NSString*)relativePathForURL:(NSURL*)url
+{
+	NSString *base = [[baseURL path] stringByStandardizingPath];
+	NSString *path = [[url path] stringByStandardizingPath];
+	
+	if (![path hasPrefix:base] || [path length] <= [base length] + 1)
+		return nil;
+	
+	return [path substringFromIndex:[base length] + 1];
+}
+
+- (NSDictionary*)recordForStat:(const struct stat*)st digest:(NSString*)digest
+{
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			digest, @"digest",
+			[NSNumber numberWithLongLong:st->st_size], @"size",
+			[NSNumber numberWithLongLong:st->st_mtime], @"mtime",
+			[NSNumber numberWithUnsignedLongLong:st->st_ino], @"inode",
+			nil];
+}
+
+- (BOOL)record:(NSDictionary*)rec matchesStat:(const struct stat*)st
+{
+	return [[rec objectForKey:@"size"] longLongValue] == st->st_size
+		&& [[rec objectForKey:@"mtime"] longLongValue] == st->st_mtime
+		&& [[rec objectForKey:@"inode"] unsignedLongLongValue] == st->st_ino;
+}
+
+- (void)forgetPath:(NSString*)path
+{
+	NSDictionary *rec = [files objectForKey:path];
+	
+	if (!rec)
+		return;
+	
+	[[digests objectForKey:[rec objectForKey:@"digest"]] removeObject:path];
+	[files removeObjectForKey:path];
+	dirty = YES;
+}
+
+/*
+ * The cached digest of url, if the record is still valid.
+ */
+- (NSString*)cachedDigestForURL:(NSURL*)url stat:(const struct stat*)st
+{
+	NSString *path = [self relativePathForURL:url];
+	
+	@synchronized(self)
+	{
+		NSDictionary *rec = path ? [files objectForKey:path] : nil;
+		
+		if (rec && [self record:rec matchesStat:st])
+			return [rec objectForKey:@"digest"];
+	}
+	return nil;
+}
+
+- (NSURL*)URLForDigest:(NSString*)digest
+{
+	@synchronized(self)
+	{
+		for (NSString *path in [[digests objectForKey:digest] allObjects])
+		{
+			NSURL *url = [baseURL URLByAppendingPathComponent:path];
+			struct stat st;
+			
+			if (!lstat([[url path] fileSystemRepresentation], &st) && S_ISREG(st.st_mode)
+				&& [self record:[files objectForKey:path] matchesStat:&st])
+				return url;
+			
+			/* Moved, changed or removed since. */
+			[self forgetPath:path];
+		}
+	}
+	return nil;
+}
+
+- (void)recordURL:(NSURL*)url digest:(NSString*)digest
+{
+	NSString *path = [self relativePathForURL:url];
+	struct stat st;
+	
+	if (!path || lstat([[url path] fileSystemRepresentation], &st))
+		return;
+	
+	@synchronized(self)
+	{
+		[self forgetPath:path];
+		[files setObject:[self recordForStat:&st digest:digest] forKey:path];
+		
+		NSMutableSet *set = [digests objectForKey:digest];
+		if (!set)
+			[digests setObject:(set = [NSMutableSet set]) forKey:digest];
+		[set addObject:path];
+		dirty = YES;
+	}
+}
+
+- (BOOL)linkURL:(NSURL*)dst toDigest:(NSString*)digest
+{
+	NSURL *existing = [self URLForDigest:digest];
+	
+	if (!existing || [[existing path] isEqualToString:[dst path]])
+		return NO;
+	
+	NSURL *dir = [dst URLByDeletingLastPathComponent];
+	
+	if (![dir checkResourceIsReachableAndReturnError:nil]
+		&& ![[NSFileManager defaultManager] createDirectoryAtPath:[dir path] withIntermediateDirectories:YES attributes:nil error:nil])
+		return NO;
+	
+	[[NSFileManager defaultManager] removeItemAtURL:dst error:nil];
+	/* Fails if on another volume, just write it then. */
+	return [[NSFileManager defaultManager] linkItemAtURL:existing toURL:dst error:nil];
+}
+
+- (BOOL)extractMember:(ArchiveMember*)member toURL:(NSURL*)dst digest:(NSString**)digest error:(NSError**)error
+{
+	if (!member.sizeAvailable || member.size > MAX_MEMORY_MEMBER)
+	{
+		if (![member extractToURL:dst createDirectories:YES error:error])
+			return NO;
+		
+		*digest = [ContentHashStore digestForURL:dst error:nil];
+		return YES;
+	}
+	
+	if (![member fetchDataWithError:error])
+		return NO;
+	
+	*digest = [ContentHashStore digestForData:member.data];
+	if ([self linkURL:dst toDigest:*digest])
+		return YES;
+	
+	return [member extractToURL:dst createDirectories:YES error:error];
+}
+
+- (BOOL)extractMember:(ArchiveMember*)member toURL:(NSURL*)dst error:(NSError**)error
+{
+	NSString *digest = nil;
+	
+	if (![self extractMember:member toURL:dst digest:&digest error:error])
+		return NO;
+	
+	if (digest)
+		[self recordURL:dst digest:digest];
+	return YES;
+}
+
+- (int64_t)dedupeDirectories:(NSArray*)dirs error:(NSError**)error
+{
+	NSArray *keys = [NSArray arrayWithObjects:NSURLIsRegularFileKey, nil];
+	NSMutableDictionary *bySize = [NSMutableDictionary dictionary];
+	int64_t freed = 0;
+	
+	/* Only files sharing their size with another file need hashing. */
+	for (NSURL *dir in dirs)
+	{
+		NSDirectoryEnumerator *enumer = [[NSFileManager defaultManager] enumeratorAtURL:dir includingPropertiesForKeys:keys options:0 errorHandler:nil];
+		NSURL *url;
+		
+		while ((url = [enumer nextObject]))
+		{
+			NSNumber *isFile = nil;
+			struct stat st;
+			
+			[url getResourceValue:&isFile forKey:NSURLIsRegularFileKey error:nil];
+			if (![isFile boolValue] || lstat([[url path] fileSystemRepresentation], &st) || !st.st_size)
+				continue;
+			
+			NSNumber *size = [NSNumber numberWithLongLong:st.st_size];
+			NSMutableArray *same = [bySize objectForKey:size];
+			
+			if (!same)
+				[bySize setObject:(same = [NSMutableArray array]) forKey:size];
+			[same addObject:url];
+		}
+	}
+	
+	for (NSArray *same in [bySize objectEnumerator])
+	{
+		NSMutableDictionary *kept = [NSMutableDictionary dictionary];
+		
+		if ([same count] < 2)
+			continue;
+		
+		for (NSURL *url in same)
+		{
+			const char *fsPath = [[url path] fileSystemRepresentation];
+			struct stat st, kst;
+			NSString *digest;
+			
+			if (lstat(fsPath, &st))
+				continue;
+			
+			digest = [self cachedDigestForURL:url stat:&st];
+			if (!digest)
+			{
+				digest = [ContentHashStore digestForURL:url error:nil];
+				if (!digest)
+					continue;
+				[self recordURL:url digest:digest];
+			}
+			
+			NSURL *keep = [kept objectForKey:digest];
+			
+			if (!keep)
+			{
+				[kept setObject:url forKey:digest];
+				continue;
+			}
+			
+			if (lstat([[keep path] fileSystemRepresentation], &kst))
+				continue;
+			if (kst.st_dev != st.st_dev || kst.st_ino == st.st_ino)
+				continue;
+			
+			/* Link next to it and rename over, so that the file never goes missing. */
+			NSString *tmp = [[url path] stringByAppendingString:@".modazipin-link"];
+			
+			if (link([[keep path] fileSystemRepresentation], [tmp fileSystemRepresentation]))
+				continue;
+			if (rename([tmp fileSystemRepresentation], fsPath))
+			{
+				unlink([tmp fileSystemRepresentation]);
+				continue;
+			}
+			
+			/* The space is only freed once the last link is gone. */
+			if (st.st_nlink == 1)
+				freed += st.st_size;
+			[self recordURL:url digest:digest];
+		}
+	}
+	
+	if (![self save:error])
+		return -1;
+	return freed;
+}
+
+- (BOOL)save:(NSError**)error
+{
+	NSData *data;
+	
+	@synchronized(self)
+	{
+		if (!dirty)
+			return YES;
+		
+		data = [NSPropertyListSerialization dataWithPropertyList:files format:NSPropertyListBinaryFormat_v1_0 options:0 error:error];
+		if (!data)
+			return NO;
+		dirty = NO;
+	}
+	
+	return [data writeToURL:storeURL options:NSDataWritingAtomic error:error];
+}
+
+@end
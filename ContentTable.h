@@ -0,0 +1,73 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+/*
+ * The contents found by scanning, that is the names of the files and ERF
+ * entries and where they are, per content path. Names and paths are
+ * interned and matched case insensitively. Entries are kept in plain arrays
+ * with a hash index on (path, name), a chain per path and a chain per name.
+ *
+ * Thread safe, scans add to it on a background queue.
+ */
+@interface ContentTable : NSObject
+{
+	NSMutableDictionary *nameIds;
+	NSMutableArray *names;
+	NSMutableDictionary *pathIds;
+	NSMutableArray *paths;
+	uint32_t *pathHead;
+	uint32_t pathCapacity;
+	uint32_t *nameHead;
+	uint32_t nameCapacity;
+	
+	/* Per entry. Free entries have name UINT32_MAX and are chained on next. */
+	uint32_t *entPath, *entName, *entExt, *entNext, *entNameNext;
+	NSMutableArray *entURL;
+	uint32_t nent, entCapacity, freeHead;
+	
+	/* Open addressing, values are entry index + 1, 0 empty and UINT32_MAX removed. */
+	uint32_t *hash;
+	uint32_t hashSize, hashUsed;
+}
+
+- (void)addContent:(NSString*)name URL:(NSURL*)url forPath:(NSString*)path;
+- (void)removeContentsForPath:(NSString*)path;
+/* For path and all paths below it. */
+- (void)removeContentsBelowPath:(NSString*)path;
+
+- (NSURL*)URLForContent:(NSString*)name inPath:(NSString*)path;
+/* The ones of paths that have the content. */
+- (NSArray*)pathsWithContent:(NSString*)name inPaths:(NSArray*)paths;
+/* Content names by path, for the contents with the extension in any of paths. */
+- (NSDictionary*)contentsWithExtension:(NSString*)ext inPaths:(NSArray*)paths;
+- (NSUInteger)countForPath:(NSString*)path;
+
+/* All paths that have the content. */
+- (NSArray*)pathsWithContent:(NSString*)name;
+/* Lower case content name to the paths having it, for the names also found outside paths. */
+- (NSDictionary*)conflictsForContents:(id<NSFastEnumeration>)contentNames excludingPaths:(NSArray*)paths;
+/* The same, for all of the contents in paths. */
+- (NSDictionary*)conflictsForPaths:(NSArray*)paths;
+
+@end
@@ -0,0 +1,439 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import "ContentTable.h"
+
+#define NONE UINT32_MAX
+
+static inline uint32_t
+hashKey(uint32_t path, uint32_t name)
+{
+	uint32_t h = path * 0x9E3779B1 ^ name * 0x85EBCA77;
+	
+	return h ^ h >> 15;
+}
+
+@implementation ContentTable
+
+- (id)init
+{
+	self = [super init];
+	if (self)
+	{
+		nameIds = [NSMutableDictionary dictionary];
+		names = [NSMutableArray array];
+		pathIds = [NSMutableDictionary dictionary];
+		paths = [NSMutableArray array];
+		entURL = [NSMutableArray array];
+		freeHead = NONE;
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(pathHead);
+	free(nameHead);
+	free(entPath);
+	free(entName);
+	free(entExt);
+	free(entNext);
+	free(entNameNext);
+	free(hash);
+}
+
+/* Returns NONE if not found and not create. */
+static uint32_t
+intern(NSMutableDictionary *ids, NSMutableArray *strs, NSString *str, BOOL create)
+{
+	NSString *key = [str lowercaseString];
+	NSNumber *n = [ids objectForKey:key];
+	
+	if (n)
+		return [n unsignedIntValue];
+	if (!create)
+		return NONE;
+	
+	[ids setObject:[NSNumber numberWithUnsignedInt:(uint32_t)[strs count]] forKey:key];
+	[strs addObject:str];
+	return (uint32_t)[strs count] - 1;
+}
+
+- (uint32_t)pathId:(NSString*)path create:(BOOL)create
+{
+	uint32_t p = intern(pathIds, paths, path, create);
+	
+	if (p != NONE && p >= pathCapacity)
+	{
+		uint32_t n = pathCapacity ? pathCapacity * 2 : 256;
+		
+		while (n <= p)
+			n *= 2;
+		pathHead = realloc(pathHead, n * sizeof (*pathHead));
+		memset(pathHead + pathCapacity, 0xFF, (n - pathCapacity) * sizeof (*pathHead));
+		pathCapacity = n;
+	}
+	return p;
+}
+
+- (uint32_t)nameId:(NSString*)name create:(BOOL)create
+{
+	uint32_t n = intern(nameIds, names, name, create);
+	
+	if (n != NONE && n >= nameCapacity)
+	{
+		uint32_t c = nameCapacity ? nameCapacity * 2 : 1024;
+		
+		while (c <= n)
+			c *= 2;
+		nameHead = realloc(nameHead, c * sizeof (*nameHead));
+		memset(nameHead + nameCapacity, 0xFF, (c - nameCapacity) * sizeof (*nameHead));
+		nameCapacity = c;
+	}
+	return n;
+}
+
+/* The slot for the key, either holding it or the empty one it should go into. */
+- (uint32_t *)slotForPath:(uint32_t)p name:(uint32_t)n
+{
+	uint32_t mask = hashSize - 1;
+	uint32_t i = hashKey(p, n) & mask;
+	uint32_t *removed = NULL;
+	
+	while (hash[i])
+	{
+		if (hash[i] == NONE)
+		{
+			if (!removed)
+				removed = &hash[i];
+		}
+		else if (entPath[hash[i] - 1] == p && entName[hash[i] - 1] == n)
+			return &hash[i];
+		i = (i + 1) & mask;
+	}
+	return removed ? removed : &hash[i];
+}
+
+- (void)rehash:(uint32_t)size
+{
+	uint32_t *old = hash;
+	uint32_t oldSize = hashSize, i;
+	
+	hash = calloc(size, sizeof (*hash));
+	hashSize = size;
+	hashUsed = 0;
+	
+	for (i = 0 ; i < oldSize ; i++)
+	{
+		if (old[i] && old[i] != NONE)
+		{
+			*[self slotForPath:entPath[old[i] - 1] name:entName[old[i] - 1]] = old[i];
+			hashUsed++;
+		}
+	}
+	free(old);
+}
+
+- (uint32_t)newEntry
+{
+	uint32_t e;
+	
+	if (freeHead != NONE)
+	{
+		e = freeHead;
+		freeHead = entNext[e];
+		return e;
+	}
+	
+	if (nent == entCapacity)
+	{
+		entCapacity = entCapacity ? entCapacity * 2 : 1024;
+		entPath = realloc(entPath, entCapacity * sizeof (*entPath));
+		entName = realloc(entName, entCapacity * sizeof (*entName));
+		entExt = realloc(entExt, entCapacity * sizeof (*entExt));
+		entNext = realloc(entNext, entCapacity * sizeof (*entNext));
+		entNameNext = realloc(entNameNext, entCapacity * sizeof (*entNameNext));
+	}
+	[entURL addObject:[NSNull null]];
+	return nent++;
+}
+
+- (void)addContent:(NSString*)name URL:(NSURL*)url forPath:(NSString*)path
+{
+	if (![name isKindOfClass:[NSString class]] || !path)
+		return;
+	
+	@synchronized(self)
+	{
+		uint32_t p = [self pathId:path create:YES];
+		uint32_t n = [self nameId:name create:YES];
+		uint32_t *slot, e;
+		
+		/* Counting removed slots as used, so that probing always ends. */
+		if (hashUsed + 1 > hashSize / 4 * 3)
+			[self rehash:hashSize ? hashSize * 2 : 4096];
+		
+		slot = [self slotForPath:p name:n];
+		if (*slot && *slot != NONE)
+		{
+			[entURL replaceObjectAtIndex:*slot - 1 withObject:url ? (id)url : [NSNull null]];
+			return;
+		}
+		
+		e = [self newEntry];
+		entPath[e] = p;
+		entName[e] = n;
+		entExt[e] = [self nameId:[@"." stringByAppendingString:[name pathExtension]] create:YES];
+		entNext[e] = pathHead[p];
+		pathHead[p] = e;
+		entNameNext[e] = nameHead[n];
+		nameHead[n] = e;
+		[entURL replaceObjectAtIndex:e withObject:url ? (id)url : [NSNull null]];
+		
+		if (!*slot)
+			hashUsed++;
+		*slot = e + 1;
+	}
+}
+
+- (void)removeContentsForPath:(NSString*)path
+{
+	@synchronized(self)
+	{
+		uint32_t p = [self pathId:path create:NO];
+		uint32_t e, next;
+		
+		if (p == NONE)
+			return;
+		
+		for (e = pathHead[p] ; e != NONE ; e = next)
+		{
+			next = entNext[e];
+			*[self slotForPath:p name:entName[e]] = NONE;
+			
+			uint32_t *link = &nameHead[entName[e]];
+			while (*link != e)
+				link = &entNameNext[*link];
+			*link = entNameNext[e];
+			
+			entName[e] = NONE;
+			entNext[e] = freeHead;
+			freeHead = e;
+			[entURL replaceObjectAtIndex:e withObject:[NSNull null]];
+		}
+		pathHead[p] = NONE;
+	}
+}
+
+- (void)removeContentsBelowPath:(NSString*)path
+{
+	NSString *key = [path lowercaseString];
+	NSString *prefix = [key stringByAppendingString:@"/"];
+	
+	@synchronized(self)
+	{
+		for (NSString *k in [pathIds allKeys])
+		{
+			if ([k isEqualToString:key] || [k hasPrefix:prefix])
+				[self removeContentsForPath:[paths objectAtIndex:[[pathIds objectForKey:k] unsignedIntValue]]];
+		}
+	}
+}
+
+- (uint32_t)entryForContent:(NSString*)name inPath:(NSString*)path
+{
+	uint32_t p = [self pathId:path create:NO];
+	uint32_t n = [self nameId:name create:NO];
+	uint32_t slot;
+	
+	if (p == NONE || n == NONE || !hashSize)
+		return NONE;
+	
+	slot = *[self slotForPath:p name:n];
+	return slot && slot != NONE ? slot - 1 : NONE;
+}
+
+- (NSURL*)URLForContent:(NSString*)name inPath:(NSString*)path
+{
+	@synchronized(self)
+	{
+		uint32_t e = [self entryForContent:name inPath:path];
+		id url = e != NONE ? [entURL objectAtIndex:e] : nil;
+		
+		return url == [NSNull null] ? nil : url;
+	}
+}
+
+- (NSArray*)pathsWithContent:(NSString*)name inPaths:(NSArray*)inPaths
+{
+	NSMutableArray *res = [NSMutableArray array];
+	
+	@synchronized(self)
+	{
+		for (NSString *path in inPaths)
+		{
+			if ([self entryForContent:name inPath:path] != NONE)
+				[res addObject:path];
+		}
+	}
+	return res;
+}
+
+- (NSDictionary*)contentsWithExtension:(NSString*)ext inPaths:(NSArray*)inPaths
+{
+	NSMutableDictionary *res = [NSMutableDictionary dictionary];
+	
+	@synchronized(self)
+	{
+		uint32_t x = [self nameId:ext create:NO];
+		
+		if (x == NONE)
+			return res;
+		
+		for (NSString *path in inPaths)
+		{
+			uint32_t p = [self pathId:path create:NO];
+			NSMutableArray *found = nil;
+			uint32_t e;
+			
+			if (p == NONE)
+				continue;
+			
+			for (e = pathHead[p] ; e != NONE ; e = entNext[e])
+			{
+				if (entExt[e] != x)
+					continue;
+				if (!found)
+					found = [NSMutableArray array];
+				[found addObject:[names objectAtIndex:entName[e]]];
+			}
+			if (found)
+				[res setObject:found forKey:path];
+		}
+	}
+	return res;
+}
+
+- (NSUInteger)countForPath:(NSString*)path
+{
+	NSUInteger count = 0;
+	
+	@synchronized(self)
+	{
+		uint32_t p = [self pathId:path create:NO];
+		uint32_t e;
+		
+		if (p == NONE)
+			return 0;
+		for (e = pathHead[p] ; e != NONE ; e = entNext[e])
+			count++;
+	}
+	return count;
+}
+
+- (NSArray*)pathsWithContent:(NSString*)name
+{
+	NSMutableArray *res = [NSMutableArray array];
+	
+	@synchronized(self)
+	{
+		uint32_t n = [self nameId:name create:NO];
+		uint32_t e;
+		
+		if (n == NONE)
+			return res;
+		for (e = nameHead[n] ; e != NONE ; e = entNameNext[e])
+			[res addObject:[paths objectAtIndex:entPath[e]]];
+	}
+	return res;
+}
+
+/* Must be called synchronized. */
+- (void)addConflictsForName:(uint32_t)n excluding:(NSIndexSet*)excluded to:(NSMutableDictionary*)res
+{
+	NSMutableArray *found = nil;
+	uint32_t e;
+	
+	for (e = nameHead[n] ; e != NONE ; e = entNameNext[e])
+	{
+		if ([excluded containsIndex:entPath[e]])
+			continue;
+		if (!found)
+			found = [NSMutableArray array];
+		[found addObject:[paths objectAtIndex:entPath[e]]];
+	}
+	if (found)
+		[res setObject:found forKey:[[names objectAtIndex:n] lowercaseString]];
+}
+
+- (NSIndexSet*)pathIdsForPaths:(NSArray*)inPaths
+{
+	NSMutableIndexSet *res = [NSMutableIndexSet indexSet];
+	
+	for (NSString *path in inPaths)
+	{
+		uint32_t p = [self pathId:path create:NO];
+		
+		if (p != NONE)
+			[res addIndex:p];
+	}
+	return res;
+}
+
+- (NSDictionary*)conflictsForContents:(id<NSFastEnumeration>)contentNames excludingPaths:(NSArray*)inPaths
+{
+	NSMutableDictionary *res = [NSMutableDictionary dictionary];
+	
+	@synchronized(self)
+	{
+		NSIndexSet *excluded = [self pathIdsForPaths:inPaths];
+		
+		for (NSString *name in contentNames)
+		{
+			uint32_t n = [self nameId:name create:NO];
+			
+			if (n != NONE)
+				[self addConflictsForName:n excluding:excluded to:res];
+		}
+	}
+	return res;
+}
+
+- (NSDictionary*)conflictsForPaths:(NSArray*)inPaths
+{
+	NSMutableDictionary *res = [NSMutableDictionary dictionary];
+	
+	@synchronized(self)
+	{
+		NSIndexSet *excluded = [self pathIdsForPaths:inPaths];
+		
+		[excluded enumerateIndexesUsingBlock:^(NSUInteger p, BOOL *stop) {
+			uint32_t e;
+			
+			for (e = pathHead[p] ; e != NONE ; e = entNext[e])
+				[self addConflictsForName:entName[e] excluding:excluded to:res];
+		}];
+	}
+	return res;
+}
+
+@end
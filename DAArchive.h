@@ -27,6 +27,8 @@
 #import <Cocoa/Cocoa.h>
 #import "FolderArchive.h"
 
+#include "pathclass.h"
+
 enum DAMemberType
 {
 	dmtManifest,
@@ -58,11 +60,25 @@ enum DAMemberContentType
 
 @end
 
+typedef enum path_kind (*path_classifier)(const char*, size_t, struct path_member*);
+
 @interface DAArchive : FolderArchive
 {
 }
 
 - (Class)memberClass;
+- (BOOL)classifyMember:(DAArchiveMember*)member usingFunction:(path_classifier)classify;
+- (BOOL)classifyMember:(DAArchiveMember*)member path:(const char*)path usingFunction:(path_classifier)classify;
+
+/* The function members are classified with. */
+- (path_classifier)classifier;
+
+/*
+ * The classified members of a seekable archive, in directory order except
+ * the manifest comes first. Nothing is decompressed. nil if the archive
+ * isn't seekable.
+ */
+- (NSArray*)seekableMembersWithError:(NSError**)error;
 
 @end
 
@@ -70,6 +86,7 @@ enum DAMemberContentType
 {
 }
 
+- (path_classifier)classifier;
 - (DAArchiveMember *)nextMemberWithError:(NSError**)error;
 
 @end
@@ -78,6 +95,7 @@ enum DAMemberContentType
 {
 }
 
+- (path_classifier)classifier;
 - (DAArchiveMember *)nextMemberWithError:(NSError**)error;
 
 @end
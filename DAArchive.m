@@ -21,11 +21,17 @@
 
 #import "DAArchive.h"
 
-static NSPredicate *isDirectory;
-static NSPredicate *startsWithDot;
-static NSPredicate *isBlacklisted;
-static NSPredicate *isDisabled;
-static NSPredicate *isERF;
+#include "pathclass.h"
+
+static NSString *
+spanString(const char *path, const char *prefix, struct path_span span)
+{
+	NSString *str = [[NSString alloc] initWithBytes:path + span.offset length:span.length encoding:NSUTF8StringEncoding];
+	
+	if (*prefix)
+		str = [[NSString stringWithUTF8String:prefix] stringByAppendingString:str];
+	return str;
+}
 
 @implementation DAArchiveMember
 
@@ -39,29 +45,81 @@ static NSPredicate *isERF;
 
 @implementation DAArchive
 
-- (id)init
+- (Class)memberClass
 {
-	self = [super init];
+	return [DAArchiveMember class];
+}
+
+- (BOOL)classifyMember:(DAArchiveMember*)next usingFunction:(path_classifier)classify
+{
+	return [self classifyMember:next path:[[next pathname] UTF8String] usingFunction:classify];
+}
+
+/* Fill in the member from the classification, returning NO if it should be skipped. */
+- (BOOL)classifyMember:(DAArchiveMember*)next path:(const char*)path usingFunction:(path_classifier)classify
+{
+	struct path_member pm;
+	
+	if (!path)
+		return NO;
 	
-	if (self)
+	switch (classify(path, strlen(path), &pm))
 	{
-		if (!isDirectory)
-			isDirectory = [NSPredicate predicateWithFormat:@"SELF ENDSWITH '/'"];
-		if (!startsWithDot)
-			startsWithDot = [NSPredicate predicateWithFormat:@"SELF BEGINSWITH '.'"];
-		if (!isBlacklisted)
-			isBlacklisted = [NSPredicate predicateWithFormat:@"SELF MATCHES '(?i)^Contents/(Characters|Logs|Screenshots|Settings)/.*'"];
-		if (!isDisabled)
-			isDisabled = [NSPredicate predicateWithFormat:@"SELF MATCHES '(?i).* (disabled)/.*'"];
-		if (!isERF)
-			isERF = [NSPredicate predicateWithFormat:@"SELF MATCHES[c] '\\.[ce]rf'"];
+		case PATH_SKIP:
+			return NO;
+		case PATH_MANIFEST:
+			next.type = dmtManifest;
+			return YES;
+		case PATH_ERF:
+			next.type = dmtERF;
+			break;
+		case PATH_FILE:
+			next.type = dmtFile;
+			break;
 	}
-	return self;
+	
+	next.contentPath = spanString(path, pm.prefix, pm.content);
+	next.installPath = spanString(path, pm.prefix, pm.install);
+	next.contentType = pm.in_directory ? dmctDirectory : dmctFile;
+	next.contentName = spanString(path, "", pm.name);
+	return YES;
 }
 
-- (Class)memberClass
+- (path_classifier)classifier
 {
-	return [DAArchiveMember class];
+	return NULL;
+}
+
+- (NSArray*)seekableMembersWithError:(NSError**)error
+{
+	path_classifier classify = [self classifier];
+	NSMutableArray *members;
+	NSUInteger n;
+	
+	if (error)
+		*error = nil;
+	
+	if (!classify || !self.isSeekable)
+		return nil;
+	
+	n = self.memberCount;
+	members = [NSMutableArray arrayWithCapacity:n];
+	for (NSUInteger i = 0 ; i < n ; i++)
+	{
+		DAArchiveMember *next = (DAArchiveMember*)[self memberAtIndex:i error:error];
+		
+		if (!next)
+			return nil;
+		
+		if (![self classifyMember:next usingFunction:classify])
+			continue;
+		
+		if (next.type == dmtManifest)
+			[members insertObject:next atIndex:0];
+		else
+			[members addObject:next];
+	}
+	return members;
 }
 
 @end
@@ -69,76 +127,19 @@ static NSPredicate *isERF;
 
 @implementation DazipArchive
 
+- (path_classifier)classifier
+{
+	return pathclass_dazip;
+}
+
 - (DAArchiveMember *)nextMemberWithError:(NSError**)error
 {
 	DAArchiveMember *next;
 	
 	while ((next = (DAArchiveMember*)[super nextMemberWithError:error]))
 	{
-		NSString *path = [next pathname];
-		NSArray *comps = [path pathComponents];
-		NSRange cr;
-		
-		/* Whitelist Manifest. */
-		if ([path caseInsensitiveCompare:@"Manifest.xml"] == NSOrderedSame)
-		{
-			next.type = dmtManifest;
+		if ([self classifyMember:next usingFunction:[self classifier]])
 			return next;
-		}
-		
-		/* We only care about files currently. */
-		if ([isDirectory evaluateWithObject:path])
-			continue;
-		
-		/* Disallow full paths and anything starting with . */
-		if ([path characterAtIndex:0] == '/')
-			continue;
-		if ([[comps filteredArrayUsingPredicate:startsWithDot] count])
-			continue;
-		
-		/* Disallow everything not in Contents/ and at least two levels below */
-		if ([[comps objectAtIndex:0] caseInsensitiveCompare:@"Contents"] != NSOrderedSame)
-			continue;
-		if ([comps count] < 3)
-			continue;
-		
-		/* Blacklist some of the user data dirs. */
-		if ([isBlacklisted evaluateWithObject:path])
-			continue;
-		
-		/* Disallow stuff containing (disabled) */
-		if ([isDisabled evaluateWithObject:path])
-			continue;
-		
-		/* Determine contents path. */
-		if ([[comps objectAtIndex:1] caseInsensitiveCompare:@"packages"] == NSOrderedSame)
-			cr = NSMakeRange(1, 4);
-		else
-			cr = NSMakeRange(1, 2);
-		if ([comps count] < cr.location + cr.length)
-			continue;
-		next.contentPath = [NSString pathWithComponents:[comps subarrayWithRange:cr]];
-		
-		cr.location = 1;
-		cr.length = [comps count] - 1;
-		next.installPath = [NSString pathWithComponents:[comps subarrayWithRange:cr]];
-					 
-		/* Determine contentType */
-		if ([comps count] > cr.location + cr.length)
-			next.contentType = dmctDirectory;
-		else
-			next.contentType = dmctFile;
-		
-		/* Determine type. */
-		if ([isERF evaluateWithObject:path])
-			next.type = dmtERF;
-		else
-			next.type = dmtFile;
-		
-		/* Determine name. */
-		next.contentName = [comps objectAtIndex:[comps count] - 1];
-		
-		return next;
 	}
 	return nil;
 }
@@ -148,67 +149,19 @@ static NSPredicate *isERF;
 
 @implementation OverrideArchive
 
+- (path_classifier)classifier
+{
+	return pathclass_override;
+}
+
 - (DAArchiveMember *)nextMemberWithError:(NSError**)error
 {
 	DAArchiveMember *next;
 	
 	while ((next = (DAArchiveMember*)[super nextMemberWithError:error]))
 	{
-		NSString *path = [next pathname];
-		NSArray *comps = [path pathComponents];
-		NSRange cr;
-		
-		/* Whitelist Manifest. */
-		if ([path caseInsensitiveCompare:@"Manifest.xml"] == NSOrderedSame)
-		{
-			next.type = dmtManifest;
+		if ([self classifyMember:next usingFunction:[self classifier]])
 			return next;
-		}
-		
-		/* We only care about files currently. */
-		if ([isDirectory evaluateWithObject:path])
-			continue;
-		
-		/* Disallow full paths and anything starting with . */
-		if ([path characterAtIndex:0] == '/')
-			continue;
-		if ([[comps filteredArrayUsingPredicate:startsWithDot] count])
-			continue;
-		
-		/* Find the override folder. */
-		NSUInteger overrideIdx = 0;
-		for (NSString *part in comps)
-		{
-			if ([part caseInsensitiveCompare:@"override"] == NSOrderedSame)
-				break;
-			overrideIdx++;
-		}
-		if (overrideIdx >= [comps count] - 1)
-			continue;
-		
-		/* Determine contents path. */
-		next.contentPath = [NSString stringWithFormat:@"packages/core/override/%@", [comps objectAtIndex:overrideIdx + 1]];
-		
-		cr.location = overrideIdx;
-		cr.length = [comps count] - overrideIdx;
-		next.installPath = [NSString stringWithFormat:@"packages/core/%@", [NSString pathWithComponents:[comps subarrayWithRange:cr]]];
-		
-		/* Determine contentType */
-		if ([comps count] > overrideIdx + 1)
-			next.contentType = dmctDirectory;
-		else
-			next.contentType = dmctFile;
-		
-		/* Determine type. */
-		if ([isERF evaluateWithObject:path])
-			next.type = dmtERF;
-		else
-			next.type = dmtFile;
-		
-		/* Determine name. */
-		next.contentName = [comps objectAtIndex:[comps count] - 1];
-		
-		return next;
 	}
 	return nil;
 }
@@ -28,10 +28,14 @@
 	NSData *data;
 	NSRange range;
 	BOOL hasRange;
+	int compression;
+	NSUInteger unpackedLength;
 }
 
 + (id)dataProxyForURL:(NSURL*)url;
 + (id)dataProxyForURL:(NSURL*)url range:(NSRange)r;
+/* A compressed ERF entry, compression being an enum erf_compression. */
++ (id)dataProxyForURL:(NSURL*)url range:(NSRange)r compression:(int)comp unpackedLength:(NSUInteger)len;
 
 - (id)initWithURL:(NSURL*)url;
 - (id)initWithURL:(NSURL*)url range:(NSRange)r;
@@ -21,6 +21,12 @@
 
 #import "DataProxy.h"
 
+#include "erf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 
 @implementation DataProxy
 
@@ -34,6 +40,18 @@
 	return [[self alloc] initWithURL:url range:r];
 }
 
++ (id)dataProxyForURL:(NSURL*)url range:(NSRange)r compression:(int)comp unpackedLength:(NSUInteger)len
+{
+	DataProxy *res = [[self alloc] initWithURL:url range:r];
+	
+	if (res)
+	{
+		res->compression = comp;
+		res->unpackedLength = len;
+	}
+	return res;
+}
+
 - (id)initWithURL:(NSURL*)url
 {
 	self = [super init];
@@ -55,13 +73,59 @@
 	return self;
 }
 
+/* Only the range is read, not the whole file. */
+- (NSData*)readRange
+{
+	int fd = open([[dataUrl path] fileSystemRepresentation], O_RDONLY);
+	NSMutableData *buf;
+	NSUInteger done = 0;
+	
+	if (fd < 0)
+		return nil;
+	
+	buf = [NSMutableData dataWithLength:range.length];
+	while (done < range.length)
+	{
+		ssize_t r = pread(fd, (char*)[buf mutableBytes] + done, range.length - done, range.location + done);
+		
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		done += r;
+	}
+	close(fd);
+	
+	[buf setLength:done];
+	return buf;
+}
+
 - (id)forwardingTargetForSelector:(SEL)aSelector
 {
 	if (!data)
 	{
-		data = [NSData dataWithContentsOfURL:dataUrl];
 		if (hasRange)
-			data = [data subdataWithRange:range];
+			data = [self readRange];
+		else
+			data = [NSData dataWithContentsOfURL:dataUrl];
+		if (compression != ERF_COMP_NONE && data)
+		{
+			struct erf_file file = {NULL};
+			NSMutableData *buf = [NSMutableData dataWithLength:unpackedLength];
+			const void *out;
+			size_t outlen;
+			
+			file.data = [data bytes];
+			file.length = (uint32_t)[data length];
+			file.unpacked_length = (uint32_t)unpackedLength;
+			file.compression = compression;
+			
+			if (erf_file_read(&file, [buf mutableBytes], [buf length], &out, &outlen) == 0)
+				[buf setLength:outlen];
+			else
+				[buf setLength:0];
+			data = buf;
+		}
 	}
 	return data;
 }
@@ -23,6 +23,9 @@
 #import "DataStoreObject.h"
 #import "GenericStore.h"
 
+@class ArchiveSpool;
+@class XMLSource;
+
 typedef id (^createObjBlock)(NSXMLNode *elem, NSString *entityName);
 typedef id (^setDataBlock)(id obj, NSMutableDictionary *data);
 
@@ -30,6 +33,41 @@ typedef id (^setDataBlock)(id obj, NSMutableDictionary *data);
 {
 	NSString *identifier;
 	NSXMLDocument *xmldoc;
+	/* A list file that's streamed when loading, rather than parsed up front. */
+	NSData *xmlData;
+	/* Set when xmldoc changes, cleared once it's written. */
+	BOOL dirty;
+	/*
+	 * The bytes xmldoc was streamed from or last written as, written back as
+	 * they were except for the item elements in changedItems. A streamed
+	 * xmldoc only has the item elements built from it so far, the rest are
+	 * built as they're needed. Nil if it was parsed instead and hasn't been
+	 * saved since.
+	 */
+	XMLSource *xmlSource;
+	NSHashTable *changedItems;
+	
+	/*
+	 * When loaded from a snapshot, xmldoc and its source are made in the
+	 * background in xmlGroup and handed over by waitForXML.
+	 */
+	dispatch_group_t xmlGroup;
+	NSXMLDocument *pendingDoc;
+	XMLSource *pendingSource;
+	NSDictionary *pendingNodes;
+	NSError *xmlError;
+	/* Loads the whole list, for writing snapshots, and its items and root element type. */
+	SEL snapshotSelector;
+	SEL itemSelector;
+	NSString *listType;
+	/*
+	 * The list as last loaded or saved, to write a snapshot of once it's
+	 * been left alone for a while. Written on snapshotQueue, only by the
+	 * last scheduling, which has snapshotGeneration.
+	 */
+	NSData *snapshotData;
+	NSUInteger snapshotGeneration;
+	dispatch_queue_t snapshotQueue;
 	
 	NSError *loadError;
 }
@@ -38,6 +76,25 @@ typedef id (^setDataBlock)(id obj, NSMutableDictionary *data);
 
 - (id)makeCacheNode:(NSXMLNode*)elem forEntityName:(NSString*)name;
 
+/*
+ * The XML node of a cache node, waiting for the document if it's still
+ * being built, and building its item from the source if it isn't yet.
+ */
+- (NSXMLNode*)nodeForObjectID:(NSManagedObjectID*)objectID;
+
+/* Marks the item element node is in as changed, so that it's written out anew. */
+- (void)nodeChanged:(NSXMLNode*)node;
+
+/*
+ * Writes xmldoc to a temporary file next to the store URL as it's
+ * serialized, syncs it and renames it into place, then syncs the folder.
+ * Does nothing if the document hasn't changed.
+ */
+- (BOOL)saveXML:(NSError **)error;
+
+/* Writes the snapshot if one is waiting to be, and waits for it to be done. */
+- (void)flushSnapshot;
+
 @end
 
 
@@ -65,9 +122,14 @@ typedef id (^setDataBlock)(id obj, NSMutableDictionary *data);
 
 @end
 
+/* Set to keep the decompressed members when opening, for installing. */
+extern NSString * const ArchiveStoreSpoolOption;
+
 @interface ArchiveStore : DataStore
 {
 	int64_t uncompressedSize;
+	NSSet *contents;
+	ArchiveSpool *spool;
 }
 
 - (NSDictionary*)loadArchive:(NSURL *)url error:(NSError**)error;
@@ -75,6 +137,10 @@ typedef id (^setDataBlock)(id obj, NSMutableDictionary *data);
 - (Class)archiveClass;
 
 @property(readonly) int64_t uncompressedSize;
+/* Names of the files and ERF entries in the archive. */
+@property(readonly) NSSet *contents;
+/* The decompressed members, if ArchiveStoreSpoolOption was given and it worked out. */
+@property(readonly) ArchiveSpool *spool;
 
 @end
 
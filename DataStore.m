@@ -22,8 +22,19 @@
 #import "DataStore.h"
 #import "DataStoreObject.h"
 #import "DAArchive.h"
+#import "ArchiveSpool.h"
 
 #include "erf.h"
+#include "snapshot.h"
+#include "xmlname.h"
+#include "xmlpull.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 @interface DataStore (Errors)
 
@@ -31,6 +42,111 @@
 
 @end
 
+@interface DataStore (Snapshots)
+
+- (NSURL*)snapshotURL;
+- (BOOL)loadSnapshotForData:(NSData*)data;
+- (void)scheduleSnapshotForData:(NSData*)data;
+- (void)writeSnapshotForData:(NSData*)data;
+- (void)streamInBackground:(NSData*)data ofType:(NSString*)rootType listSelector:(SEL)listSel;
+- (void)waitForXML;
+
+@end
+
+/*
+ * Where the item elements of a streamed list are in its bytes. A span starts
+ * with whatever came between the previous element and this one, so comments
+ * and whitespace go with the element after them.
+ */
+struct source_span
+{
+	NSUInteger gap;
+	NSUInteger start;
+	NSUInteger end;
+};
+
+/*
+ * An item element of a streamed list. Until the element is needed it's
+ * only known by its span, and by key, which is what uniqueForNode: gives
+ * for it.
+ */
+@interface SourceItem : NSObject
+{
+@public
+	struct source_span span;
+	NSString *key;
+	NSXMLElement *elem;
+}
+
+@end
+
+@implementation SourceItem
+
+@end
+
+@interface XMLSource : NSObject
+{
+@public
+	NSData *data;
+	/*
+	 * Set if data is the list file as it was when it had st. A mapping is
+	 * only valid as long as nobody has written to that file in place.
+	 */
+	BOOL mapped;
+	struct stat st;
+	/* The SourceItems in order, by key, and the ones built by element identity. */
+	NSMutableArray *items;
+	NSMutableDictionary *keys;
+	NSMapTable *built;
+	/* End of the root start tag, and the start of what follows the last item. */
+	NSUInteger head;
+	NSUInteger tail;
+}
+
+- (void)addItem:(SourceItem*)item;
+- (BOOL)isStaleForPath:(NSString*)path;
+
+@end
+
+@implementation XMLSource
+
+- (id)init
+{
+	self = [super init];
+	if (self)
+	{
+		items = [NSMutableArray array];
+		keys = [NSMutableDictionary dictionary];
+		built = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsStrongMemory];
+	}
+	return self;
+}
+
+- (void)addItem:(SourceItem*)item
+{
+	[items addObject:item];
+	if (item->key)
+		[keys setObject:item forKey:item->key];
+	if (item->elem)
+		[built setObject:item forKey:item->elem];
+}
+
+/* A file replaced by rename leaves the old one mapped, only the same one changing matters. */
+- (BOOL)isStaleForPath:(NSString*)path
+{
+	struct stat now;
+	
+	if (!mapped || stat([path fileSystemRepresentation], &now) || now.st_dev != st.st_dev || now.st_ino != st.st_ino)
+		return NO;
+	return now.st_size != st.st_size
+		|| now.st_mtimespec.tv_sec != st.st_mtimespec.tv_sec
+		|| now.st_mtimespec.tv_nsec != st.st_mtimespec.tv_nsec;
+}
+
+@end
+
+typedef void (^xmlOutBlock)(const void *bytes, NSUInteger len);
+
 @implementation DataStore (Errors)
 
 - (NSError*)dataStoreError:(NSInteger)code msg:(NSString*)fmt, ...
@@ -50,10 +166,60 @@
 @end
 
 
+/*
+ * Known names are looked up without allocating, anything else gives
+ * XMLNAME_UNKNOWN, as does a node without a name.
+ */
+static enum xmlname
+nameOf(NSXMLNode *node)
+{
+	CFStringRef name = (__bridge CFStringRef)[node name];
+	const char *s;
+	char buf[32];
+	
+	if (!name)
+		return XMLNAME_UNKNOWN;
+	
+	s = CFStringGetCStringPtr(name, kCFStringEncodingASCII);
+	if (!s)
+	{
+		if (!CFStringGetCString(name, buf, sizeof (buf), kCFStringEncodingUTF8))
+			return XMLNAME_UNKNOWN;
+		s = buf;
+	}
+	return xmlname_lookup(s, strlen(s));
+}
+
+/* The known names are shared rather than making a string per element and attribute. */
+static NSString *
+nameString(const char *name, size_t len)
+{
+	static NSString *known[XMLNAME_COUNT];
+	static dispatch_once_t once;
+	enum xmlname xn = xmlname_lookup(name, len);
+	
+	dispatch_once(&once, ^{
+		int i;
+		
+		for (i = 0 ; i < XMLNAME_COUNT ; i++)
+			known[i] = [[NSString alloc] initWithUTF8String:xmlname_string(i)];
+	});
+	
+	if (xn != XMLNAME_UNKNOWN)
+		return known[xn];
+	return [[NSString alloc] initWithBytes:name length:len encoding:NSUTF8StringEncoding];
+}
+
 @implementation DataStore
 
 @synthesize identifier;
 
+- (void)dealloc
+{
+	if (snapshotQueue)
+		dispatch_release(snapshotQueue);
+}
+
 - (NSDictionary*)metadata {
 	return [NSDictionary dictionaryWithObjectsAndKeys:
 			[self type],
@@ -103,11 +269,8 @@
 	
 	for (NSXMLNode *attr in [(NSXMLElement*)node attributes])
 	{
-		if ([[attr name] isEqualToString:@"DefaultText"])
-		{
+		if (nameOf(attr) == XMLNAME_DefaultText)
 			[data setObject:[attr stringValue] forKey:[attr name]];
-			continue;
-		}
 	}
 	
 	NSMutableSet *langset = [NSMutableSet set];
@@ -150,10 +313,17 @@
 	
 	for (NSXMLElement *elem in [node children])
 	{
-		if ([[elem name] isEqualToString:@"paths"])
-			pathsNode = elem;
-		else if ([[elem name] isEqualToString:@"contents"])
-			[elem detach];
+		switch (nameOf(elem))
+		{
+			case XMLNAME_paths:
+				pathsNode = elem;
+				break;
+			case XMLNAME_contents:
+				[elem detach];
+				break;
+			default:
+				break;
+		}
 	}
 	
 	if (pathsNode)
@@ -183,11 +353,8 @@
 	
 	for (NSXMLNode *attr in [node attributes])
 	{
-		if ([[attr name] isEqualToString:@"origGameVersion"])
-		{
+		if (nameOf(attr) == XMLNAME_origGameVersion)
 			[data setObject:[attr stringValue] forKey:[attr name]];
-			continue;
-		}
 	}
 	
 	return setBlock(res, data);
@@ -206,73 +373,64 @@
 	
 	for (NSXMLNode *attr in [node attributes])
 	{
-		if ([[attr name] isEqualToString:@"UID"]
-			|| [[attr name] isEqualToString:@"Name"]
-			|| [[attr name] isEqualToString:@"ExtendedModuleUID"])
-		{
-			[data setObject:[attr stringValue] forKey:[attr name]];
-			continue;
-		}
-		
-		if ([[attr name] isEqualToString:@"Priority"]
-			|| [[attr name] isEqualToString:@"Format"]
-			|| [[attr name] isEqualToString:@"BioWare"])
+		switch (nameOf(attr))
 		{
-			[data setObject:[NSDecimalNumber decimalNumberWithString:[attr stringValue]] forKey:[attr name]];
-			continue;
+			case XMLNAME_UID:
+			case XMLNAME_Name:
+			case XMLNAME_ExtendedModuleUID:
+				[data setObject:[attr stringValue] forKey:[attr name]];
+				break;
+			case XMLNAME_Priority:
+			case XMLNAME_Format:
+			case XMLNAME_BioWare:
+				[data setObject:[NSDecimalNumber decimalNumberWithString:[attr stringValue]] forKey:[attr name]];
+				break;
+			default:
+				break;
 		}
 	}
 	
 	for (NSXMLElement *subnode in [node children])
 	{
-		if ([[subnode name] isEqualToString:@"Title"]
-			|| [[subnode name] isEqualToString:@"Description"]
-			|| [[subnode name] isEqualToString:@"Rating"]
-			|| [[subnode name] isEqualToString:@"RatingDescription"]
-			|| [[subnode name] isEqualToString:@"URL"]
-			|| [[subnode name] isEqualToString:@"Publisher"])
-		{
-			id tnode = [self loadText:subnode forItem:item error:error usingCreateBlock:createBlock usingSetBlock:setBlock];
-			
-			if (!tnode)
-				return nil;
-			
-			[data setObject:tnode forKey:[subnode name]];
-			continue;
-		}
-		
-		if ([[subnode name] isEqualToString:@"Image"]
-			|| [[subnode name] isEqualToString:@"ReleaseDate"]
-			|| [[subnode name] isEqualToString:@"Version"]
-			|| [[subnode name] isEqualToString:@"GameVersion"])
-		{
-			[data setObject:[subnode stringValue] forKey:[subnode name]];
-			continue;
-		}
-		
-		if ([[subnode name] isEqualToString:@"Type"]
-			|| [[subnode name] isEqualToString:@"Price"]
-			|| [[subnode name] isEqualToString:@"Size"])
-		{
-			[data setObject:[NSDecimalNumber decimalNumberWithString:[subnode stringValue]] forKey:[subnode name]];
-			continue;
-		}
-		
-		if ([[subnode name] isEqualToString:@"PrereqList"])
-		{
-			/* Noop, don't know format. */
-			continue;
-		}
+		id tnode, mnode;
 		
-		if ([[subnode name] isEqualToString:@"modazipin"])
+		switch (nameOf(subnode))
 		{
-			id mnode = [self loadModazipin:subnode forItem:item error:error usingCreateBlock:createBlock usingSetBlock:setBlock];
-			
-			if (!mnode)
-				return nil;
-			
-			[data setObject:mnode forKey:[subnode name]];
-			continue;
+			case XMLNAME_Title:
+			case XMLNAME_Description:
+			case XMLNAME_Rating:
+			case XMLNAME_RatingDescription:
+			case XMLNAME_URL:
+			case XMLNAME_Publisher:
+				tnode = [self loadText:subnode forItem:item error:error usingCreateBlock:createBlock usingSetBlock:setBlock];
+				if (!tnode)
+					return nil;
+				
+				[data setObject:tnode forKey:[subnode name]];
+				break;
+			case XMLNAME_Image:
+			case XMLNAME_ReleaseDate:
+			case XMLNAME_Version:
+			case XMLNAME_GameVersion:
+				[data setObject:[subnode stringValue] forKey:[subnode name]];
+				break;
+			case XMLNAME_Type:
+			case XMLNAME_Price:
+			case XMLNAME_Size:
+				[data setObject:[NSDecimalNumber decimalNumberWithString:[subnode stringValue]] forKey:[subnode name]];
+				break;
+			case XMLNAME_PrereqList:
+				/* Noop, don't know format. */
+				break;
+			case XMLNAME_modazipin:
+				mnode = [self loadModazipin:subnode forItem:item error:error usingCreateBlock:createBlock usingSetBlock:setBlock];
+				if (!mnode)
+					return nil;
+				
+				[data setObject:mnode forKey:[subnode name]];
+				break;
+			default:
+				break;
 		}
 	}
 	
@@ -287,7 +445,7 @@
 	NSMutableDictionary *data;
 	id res;
 	
-	if (![[node name] isEqualToString:@"AddInItem"])
+	if (nameOf(node) != XMLNAME_AddInItem)
 	{
 		if (error)
 			*error = [self dataStoreError:5 msg:@"Node is not an AddInItem"];
@@ -306,12 +464,15 @@
 	
 	for (NSXMLNode *attr in [node attributes])
 	{
-		if ([[attr name] isEqualToString:@"Enabled"]
-			|| [[attr name] isEqualToString:@"State"]
-			|| [[attr name] isEqualToString:@"RequiresAuthorization"])
+		switch (nameOf(attr))
 		{
-			[data setObject:[NSDecimalNumber decimalNumberWithString:[attr stringValue]] forKey:[attr name]];
-			continue;
+			case XMLNAME_Enabled:
+			case XMLNAME_State:
+			case XMLNAME_RequiresAuthorization:
+				[data setObject:[NSDecimalNumber decimalNumberWithString:[attr stringValue]] forKey:[attr name]];
+				break;
+			default:
+				break;
 		}
 	}
 	
@@ -323,7 +484,7 @@
  */
 - (BOOL)loadAddInsList:(NSXMLElement *)node error:(NSError **)error usingCreateBlock:(createObjBlock)createBlock usingSetBlock:(setDataBlock)setBlock
 {
-	if (![[node name] isEqualToString:@"AddInsList"])
+	if (nameOf(node) != XMLNAME_AddInsList)
 	{
 		if (error)
 			*error = [self dataStoreError:5 msg:@"Node is not an AddInsList"];
@@ -368,18 +529,21 @@
 		
 		for (NSXMLNode *attr in [subnode attributes])
 		{
-			if ([[attr name] isEqualToString:@"ProductID"]
-				|| [[attr name] isEqualToString:@"microContentID"]
-				|| [[attr name] isEqualToString:@"Version"])
+			switch (nameOf(attr))
 			{
-				[data setObject:[attr stringValue] forKey:[attr name]];
-				continue;
+				case XMLNAME_ProductID:
+				case XMLNAME_microContentID:
+				case XMLNAME_Version:
+					[data setObject:[attr stringValue] forKey:[attr name]];
+					break;
+				default:
+					break;
 			}
 		}
 		
 		for (NSXMLElement *subsubnode in [subnode children])
 		{
-			if ([[subsubnode name] isEqualToString:@"Title"])
+			if (nameOf(subsubnode) == XMLNAME_Title)
 			{
 				id tnode = [self loadText:subsubnode forItem:pnode error:error usingCreateBlock:createBlock usingSetBlock:setBlock];
 				
@@ -408,7 +572,9 @@
 	NSMutableDictionary *data;
 	id res;
 	
-	if (![[node name] isEqualToString:@"OfferItem"] && ![[node name] isEqualToString:@"DisabledOfferItem"])
+	enum xmlname kind = nameOf(node);
+	
+	if (kind != XMLNAME_OfferItem && kind != XMLNAME_DisabledOfferItem)
 	{
 		if (error)
 			*error = [self dataStoreError:5 msg:@"Node is not an OfferItem"];
@@ -424,21 +590,18 @@
 		return nil;
 	
 	[data setObject:[NSNumber numberWithBool:NO] forKey:@"displayed"];
-	[data setObject:[[node name] isEqualToString:@"OfferItem"] ? [NSDecimalNumber one] : [NSDecimalNumber zero]
+	[data setObject:kind == XMLNAME_OfferItem ? [NSDecimalNumber one] : [NSDecimalNumber zero]
 			 forKey:@"Enabled"];
 	
 	for (NSXMLNode *attr in [node attributes])
 	{
-		if ([[attr name] isEqualToString:@"Presentation"])
-		{
+		if (nameOf(attr) == XMLNAME_Presentation)
 			[data setObject:[NSDecimalNumber decimalNumberWithString:[attr stringValue]] forKey:[attr name]];
-			continue;
-		}
 	}
 	
 	for (NSXMLElement *subnode in [node children])
 	{
-		if ([[subnode name] isEqualToString:@"PRCList"])
+		if (nameOf(subnode) == XMLNAME_PRCList)
 		{
 			NSMutableSet *pset = [self loadPRCList:subnode forOfferItem:res error:error usingCreateBlock:createBlock usingSetBlock:setBlock];
 			
@@ -458,7 +621,7 @@
  */
 - (BOOL)loadOfferList:(NSXMLElement *)node error:(NSError **)error usingCreateBlock:(createObjBlock)createBlock usingSetBlock:(setDataBlock)setBlock
 {
-	if (![[node name] isEqualToString:@"OfferList"])
+	if (nameOf(node) != XMLNAME_OfferList)
 	{
 		if (error)
 			*error = [self dataStoreError:5 msg:@"Node is not an OfferList"];
@@ -491,7 +654,7 @@
 	NSMutableDictionary *data;
 	id res;
 	
-	if (![[node name] isEqualToString:@"OverrideItem"])
+	if (nameOf(node) != XMLNAME_OverrideItem)
 	{
 		if (error)
 			*error = [self dataStoreError:5 msg:@"Node is not an OverrideItem"];
@@ -511,16 +674,16 @@
 	
 	for (NSXMLNode *attr in [node attributes])
 	{
-		if ([[attr name] isEqualToString:@"Name"])
-		{
-			[data setObject:[attr stringValue] forKey:@"UID"];
-			continue;
-		}
-		
-		if ([[attr name] isEqualToString:@"Enabled"])
+		switch (nameOf(attr))
 		{
-			[data setObject:[NSDecimalNumber decimalNumberWithString:[attr stringValue]] forKey:[attr name]];
-			continue;
+			case XMLNAME_Name:
+				[data setObject:[attr stringValue] forKey:@"UID"];
+				break;
+			case XMLNAME_Enabled:
+				[data setObject:[NSDecimalNumber decimalNumberWithString:[attr stringValue]] forKey:[attr name]];
+				break;
+			default:
+				break;
 		}
 	}
 	
@@ -532,7 +695,7 @@
  */
 - (BOOL)loadOverrideList:(NSXMLElement *)node error:(NSError **)error usingCreateBlock:(createObjBlock)createBlock usingSetBlock:(setDataBlock)setBlock
 {
-	if (![[node name] isEqualToString:@"OverrideList"])
+	if (nameOf(node) != XMLNAME_OverrideList)
 	{
 		if (error)
 			*error = [self dataStoreError:5 msg:@"Node is not an OverrideList"];
@@ -554,15 +717,24 @@
 	NSXMLNode *parent = [node parent];
 	NSString *me = [node name];
 	
-	if ([me isEqualToString:@"AddInItem"] || [me isEqualToString:@"OfferItem"] || [me isEqualToString:@"DisabledOfferItem"])
-		return [[(NSXMLElement *)node attributeForName:@"UID"] stringValue];
-	if ([me isEqualToString:@"OverrideItem"])
-		return [[(NSXMLElement *)node attributeForName:@"Name"] stringValue];
-	
-	if ([me isEqualToString:@"file"] || [me isEqualToString:@"dir"])
-		me = [NSString stringWithFormat:@"%@:%@", me, [[(NSXMLElement*)node attributeForName:@"path"] stringValue]];
-	else if ([me isEqualToString:@"content"])
-		me = [NSString stringWithFormat:@"content:%@", [[(NSXMLElement*)node attributeForName:@"name"] stringValue]];
+	switch (nameOf(node))
+	{
+		case XMLNAME_AddInItem:
+		case XMLNAME_OfferItem:
+		case XMLNAME_DisabledOfferItem:
+			return [[(NSXMLElement *)node attributeForName:@"UID"] stringValue];
+		case XMLNAME_OverrideItem:
+			return [[(NSXMLElement *)node attributeForName:@"Name"] stringValue];
+		case XMLNAME_file:
+		case XMLNAME_dir:
+			me = [NSString stringWithFormat:@"%@:%@", me, [[(NSXMLElement*)node attributeForName:@"path"] stringValue]];
+			break;
+		case XMLNAME_content:
+			me = [NSString stringWithFormat:@"content:%@", [[(NSXMLElement*)node attributeForName:@"name"] stringValue]];
+			break;
+		default:
+			break;
+	}
 	
 	if ([node level] == 1 || !parent)
 		return me;
@@ -570,6 +742,26 @@
 	return [[self uniqueForNode:(NSXMLElement*)parent] stringByAppendingFormat:@"/%@", me];
 }
 
+- (NSXMLNode*)nodeForObjectID:(NSManagedObjectID*)objectID
+{
+	[self waitForXML];
+	
+	@synchronized(self)
+	{
+		NSAtomicStoreCacheNode *cnode = [self cacheNodeForObjectID:objectID];
+		NSXMLNode *node = [[cnode propertyCache] objectForKey:@"node"];
+		
+		if (!node && cnode && xmlSource)
+		{
+			SourceItem *item = [self sourceItemForReference:[self referenceObjectForObjectID:objectID]];
+			
+			if (item && !item->elem && [self buildSourceItem:item])
+				node = [[cnode propertyCache] objectForKey:@"node"];
+		}
+		return node;
+	}
+}
+
 - (id)makeCacheNode:(NSXMLElement*)elem forEntityName:(NSString*)name
 {
 	NSEntityDescription *entity = [[[[self persistentStoreCoordinator] managedObjectModel] entitiesByName] objectForKey:name];
@@ -602,150 +794,1294 @@
 		[paths addChild:dirNode];
 	}
 	
-	[res addChild:paths];
+	[res addChild:paths];
+	
+	return res;
+}
+
+- (NSArray *)verifyManifestOfType:(NSString*)manifestType listNodeType:(NSString*)listNodeType error:(NSError**)error
+{
+	NSXMLElement *root = [xmldoc rootElement];
+	
+	if (![[[root attributeForName:@"Type"] stringValue] isEqualToString:manifestType])
+	{
+		if (error)
+			*error = [self dataStoreError:6 msg:@"Manifest type is not %@", manifestType];
+		return nil;
+	}
+	
+	if ([root childCount] < 1)
+	{
+		if (error)
+			*error = [self dataStoreError:7 msg:@"No contents in manifest"];
+		return nil;
+	}
+	
+	if ([root childCount] > 1)
+	{
+		if (error)
+			*error = [self dataStoreError:8 msg:@"Unexpected contents in manifest"];
+		return nil;
+	}
+	
+	NSXMLElement *listNode = (NSXMLElement*)[root childAtIndex:0];
+	
+	if (![[listNode name] isEqualToString:listNodeType])
+	{
+		if (error)
+			*error = [self dataStoreError:9 msg:@"Manifest contents is not %@", listNodeType];
+		return nil;
+	}
+	
+	if ([listNode childCount] < 1)
+	{
+		if (error)
+			*error = [self dataStoreError:10 msg:@"No contents in list"];
+		return nil;
+	}
+	
+	NSArray *itemNodes = [listNode children];
+	
+	for (NSXMLElement *itemNode in itemNodes)
+	{
+		if (![[itemNode name] isEqualToString:[NSString stringWithFormat:@"%@Item", manifestType]])
+		{
+			if (error)
+				*error = [self dataStoreError:12 msg:@"Unexpected item kind"];
+			return nil;
+		}
+		
+		if (![[[itemNode attributeForName:@"UID"] stringValue] length])
+		{
+			if (error)
+				*error = [self dataStoreError:13 msg:@"No UID for item"];
+			return nil;
+		}
+	}
+	
+	return itemNodes;
+}
+
+- (Item*)insertItemNode:(NSXMLElement*)node usingSelector:(SEL)sel error:(NSError **)error intoContext:(NSManagedObjectContext*)context
+{
+	node = [node copy];
+	
+	IMP imp = [self methodForSelector:sel];
+	if (!imp)
+		[NSException raise:NSInvalidArgumentException format:@"%s is not a method of this object.", sel_getName(sel)];
+	
+	id res = (*imp)(self, sel, node, nil, error, ^(NSXMLElement *elem, NSString *entityName)
+			  {
+				  return [NSEntityDescription insertNewObjectForEntityForName:entityName inManagedObjectContext:context];
+			  }, ^(id obj, NSMutableDictionary *data)
+			  {
+				  for (NSString *key in data) {
+					  [obj setValue:[data objectForKey:key] forKey:key];
+				  }
+				  [context assignObject:obj toPersistentStore:self];
+				  if ([obj isKindOfClass:[Path self]])
+					  [obj setValue:[NSNumber numberWithBool:YES] forKey:@"verified"];
+				  return obj;
+			  });
+	
+	if (!res)
+		return nil;
+	
+	[self waitForXML];
+	[[xmldoc rootElement] addChild:node];
+	dirty = YES;
+	return res;
+}
+
+- (BOOL)loadUsingSelector:(SEL)sel error:(NSError **)error
+{
+	if (loadError)
+	{
+		if (error)
+			*error = loadError;
+		loadError = nil;
+		return NO;
+	}
+	
+	if (!xmldoc)
+		return YES;
+	
+	NSMutableSet *set = [NSMutableSet set];
+	
+	createObjBlock createBlock = ^(NSXMLNode *elem, NSString *entityName)
+	{
+		id cnode = [self makeCacheNode:elem forEntityName:entityName];
+		
+		[set addObject:cnode];
+		return cnode;
+	};
+	
+	setDataBlock setBlock = ^(id obj, NSMutableDictionary *data)
+	{
+		[obj setPropertyCache:data];
+		
+		return obj;
+	};	
+	
+	BOOL (*imp)(id, SEL, NSXMLElement*, NSError**, createObjBlock, setDataBlock) = (void*)[self methodForSelector:sel];
+	if (!imp)
+		[NSException raise:NSInvalidArgumentException format:@"%s is not a method of this object.", sel_getName(sel)];
+	
+	BOOL res = (*imp)(self, sel, [xmldoc rootElement], error, createBlock, setBlock);
+	
+	if (!res)
+		return NO;
+	
+	[self addCacheNodes:set];
+	return YES;
+}
+
+/*
+ * Start a new element with the attributes of the current event, in the
+ * order given.
+ */
+static NSXMLElement *
+elementFromEvent(const struct xmlpull *xp)
+{
+	NSXMLElement *elem = [[NSXMLElement alloc] initWithName:nameString(xp->name, xp->name_len)];
+	NSMutableArray *attrs;
+	size_t i;
+	
+	if (!xp->nattrs)
+		return elem;
+	
+	attrs = [NSMutableArray arrayWithCapacity:xp->nattrs];
+	for (i = 0 ; i < xp->nattrs ; i++)
+	{
+		NSString *value = [[NSString alloc] initWithBytes:xp->attrs[i].value length:xp->attrs[i].value_len encoding:NSUTF8StringEncoding];
+		
+		[attrs addObject:[NSXMLNode attributeWithName:nameString(xp->attrs[i].name, xp->attrs[i].name_len) stringValue:value ? value : @""]];
+	}
+	[elem setAttributes:attrs];
+	return elem;
+}
+
+/*
+ * Builds the element whose start element event was just returned, with
+ * everything in it, leaving xp right after its end. Whitespace is only kept
+ * if it's all an element has, and the content lists loadModazipin: would
+ * drop anyway are left out. Returns nil with errno set if it's malformed.
+ */
+static NSXMLElement *
+readElement(struct xmlpull *xp)
+{
+	NSXMLElement *top = elementFromEvent(xp);
+	NSMutableArray *open = [NSMutableArray arrayWithObject:top];
+	size_t depth = xp->depth;
+	NSString *space = nil;
+	int ev;
+	
+	while ((ev = xmlpull_next(xp)) > 0)
+	{
+		NSXMLElement *elem;
+		NSString *text;
+		
+		switch (ev)
+		{
+			case XMLPULL_START_ELEMENT:
+				elem = elementFromEvent(xp);
+				space = nil;
+				
+				if (nameOf(elem) == XMLNAME_contents && nameOf([open lastObject]) == XMLNAME_modazipin)
+				{
+					if (xmlpull_skip(xp))
+						return nil;
+					break;
+				}
+				
+				[[open lastObject] addChild:elem];
+				[open addObject:elem];
+				break;
+			case XMLPULL_TEXT:
+				text = [[NSString alloc] initWithBytes:xp->text length:xp->text_len encoding:NSUTF8StringEncoding];
+				if (!text)
+				{
+					errno = EINVAL;
+					return nil;
+				}
+				if (xp->text_ws)
+					space = text;
+				else
+					[[open lastObject] addChild:[NSXMLNode textWithStringValue:text]];
+				break;
+			case XMLPULL_END_ELEMENT:
+				elem = [open lastObject];
+				[open removeLastObject];
+				
+				if (space && ![elem childCount])
+					[elem addChild:[NSXMLNode textWithStringValue:space]];
+				space = nil;
+				
+				if (xp->depth == depth)
+					return top;
+				break;
+		}
+	}
+	
+	/* The document ended first. */
+	if (!ev)
+		errno = EINVAL;
+	return nil;
+}
+
+/*
+ * Build the document of one of the list files straight from its bytes,
+ * instead of parsing it whole first. Each item element is built as it's read
+ * and loaded with sel and the blocks, then let go of, leaving only the
+ * values they were loaded with. The document only gets the root element,
+ * what's in data is known by source, with where each item is, for saveXML:
+ * to copy back unchanged and nodeForObjectID: to build an item from once
+ * it's needed. If sel is NULL the items are only found, not loaded.
+ * Files in some other encoding than UTF-8 are parsed as a document and
+ * loaded using listSel, and get no source.
+ * sel and, for the fallback, listSel are sent to the store from whatever
+ * thread this runs on. They change nothing of it, only reading its URL for
+ * errors, and everything they load goes through the blocks, which is what
+ * lets this run off the main thread.
+ */
+- (NSXMLDocument*)streamDocument:(NSData*)data ofType:(NSString*)rootType selector:(SEL)sel listSelector:(SEL)listSel usingCreateBlock:(createObjBlock)createBlock usingSetBlock:(setDataBlock)setBlock source:(XMLSource**)source error:(NSError **)error
+{
+	struct xmlpull xp;
+	
+	*source = nil;
+	if (xmlpull_init(&xp, [data bytes], [data length]))
+	{
+		xmlpull_free(&xp);
+		if (errno == ENOTSUP)
+		{
+			NSInteger xmlopt = NSXMLNodePreserveCharacterReferences | NSXMLNodePreserveWhitespace;
+			NSXMLDocument *doc = [[NSXMLDocument alloc] initWithData:data options:xmlopt error:error];
+			
+			if (!doc)
+				return nil;
+			if (![[[doc rootElement] name] isEqualToString:rootType])
+			{
+				if (error)
+					*error = [self dataStoreError:4 msg:@"XML is not of type '%@'", rootType];
+				return nil;
+			}
+			
+			BOOL (*listImp)(id, SEL, NSXMLElement*, NSError**, createObjBlock, setDataBlock) = (void*)[self methodForSelector:listSel];
+			if (!listImp)
+				[NSException raise:NSInvalidArgumentException format:@"%s is not a method of this object.", sel_getName(listSel)];
+			
+			if (!(*listImp)(self, listSel, [doc rootElement], error, createBlock, setBlock))
+				return nil;
+			return doc;
+		}
+		if (error)
+			*error = [self dataStoreError:14 msg:@"Malformed XML declaration"];
+		return nil;
+	}
+	
+	id (*imp)(id, SEL, NSXMLElement*, id, NSError**, createObjBlock, setDataBlock) = sel ? (void*)[self methodForSelector:sel] : NULL;
+	if (sel && !imp)
+		[NSException raise:NSInvalidArgumentException format:@"%s is not a method of this object.", sel_getName(sel)];
+	
+	/* The elements are let go of once loaded, the source has what they were. */
+	setDataBlock itemSetBlock = ^(id obj, NSMutableDictionary *values)
+	{
+		[values removeObjectForKey:@"node"];
+		return setBlock(obj, values);
+	};
+	
+	NSXMLDocument *doc = nil;
+	NSXMLElement *root = nil;
+	XMLSource *src = [[XMLSource alloc] init];
+	NSUInteger gap = 0;
+	NSError *err = nil;
+	BOOL res = YES;
+	int ev = XMLPULL_END_DOCUMENT;
+	int eno = 0;
+	
+	while (res && (ev = xmlpull_next(&xp)) > 0)
+	{
+		@autoreleasepool
+		{
+			NSXMLElement *elem;
+			SourceItem *item;
+			NSError *e = nil;
+			
+			/* Items are read whole, so only the root and what's directly in it shows up here. */
+			if (ev != XMLPULL_START_ELEMENT)
+				continue;
+			
+			if (xp.depth == 1)
+			{
+				root = elementFromEvent(&xp);
+				if (![[root name] isEqualToString:rootType])
+				{
+					err = [self dataStoreError:4 msg:@"XML is not of type '%@'", rootType];
+					res = NO;
+				}
+				else
+				{
+					/* An empty root tag has nowhere to put items, it's written anew instead. */
+					if (xp.pending_end)
+						src = nil;
+					else
+						src->head = gap = xp.cur - xp.start;
+					doc = [[NSXMLDocument alloc] initWithRootElement:root];
+					[doc setVersion:@"1.0"];
+					[doc setCharacterEncoding:@"UTF-8"];
+					if (xp.standalone >= 0)
+						[doc setStandalone:xp.standalone];
+				}
+			}
+			else
+			{
+				item = [[SourceItem alloc] init];
+				item->span.gap = gap;
+				item->span.start = xp.markup - xp.start;
+				
+				if (!sel)
+				{
+					/* The key only needs the attributes. */
+					item->key = [self uniqueForNode:elementFromEvent(&xp)];
+					if (xmlpull_skip(&xp))
+					{
+						eno = errno;
+						ev = -1;
+						res = NO;
+					}
+				}
+				else if ((elem = readElement(&xp)))
+				{
+					item->key = [self uniqueForNode:elem];
+					if (!(*imp)(self, sel, elem, nil, &e, createBlock, itemSetBlock))
+					{
+						err = e;
+						res = NO;
+					}
+				}
+				else
+				{
+					eno = errno;
+					ev = -1;
+					res = NO;
+				}
+				
+				if (res)
+				{
+					item->span.end = gap = xp.cur - xp.start;
+					[src addItem:item];
+				}
+			}
+		}
+	}
+	
+	if (ev < 0)
+	{
+		if (!eno)
+			eno = errno;
+		if (eno == EINVAL)
+			err = [self dataStoreError:14 msg:@"Malformed XML on line %lu", (unsigned long)xmlpull_line(&xp)];
+		else
+			err = [NSError errorWithDomain:NSPOSIXErrorDomain code:eno userInfo:nil];
+		res = NO;
+	}
+	else if (res && !root)
+	{
+		err = [self dataStoreError:4 msg:@"XML is not of type '%@'", rootType];
+		res = NO;
+	}
+	xmlpull_free(&xp);
+	
+	if (!res)
+	{
+		if (error)
+			*error = err;
+		return nil;
+	}
+	
+	/*
+	 * Not copied, data maps the list file. Someone writing to it in place
+	 * is checked for before the source is used.
+	 */
+	if (src)
+	{
+		src->data = data;
+		src->mapped = !stat([[[self URL] path] fileSystemRepresentation], &src->st);
+		src->tail = gap;
+		*source = src;
+	}
+	return doc;
+}
+
+/*
+ * The source item with the object that has ref in it. What's in an item
+ * has a reference starting with the item's, see uniqueForNode:.
+ */
+- (SourceItem*)sourceItemForReference:(NSString*)ref
+{
+	for (;;)
+	{
+		SourceItem *item = [xmlSource->keys objectForKey:ref];
+		NSRange r;
+		
+		if (item)
+			return item;
+		
+		r = [ref rangeOfString:@"/" options:NSBackwardsSearch];
+		if (r.location == NSNotFound)
+			return nil;
+		ref = [ref substringToIndex:r.location];
+	}
+}
+
+/*
+ * Builds the element of an item that's only known by its span and adds it
+ * to the document. Loading it again gives the XML nodes in it to their
+ * cache nodes, what else they have is left as it is.
+ */
+- (BOOL)buildSourceItem:(SourceItem*)item
+{
+	const char *bytes = [xmlSource->data bytes];
+	NSXMLElement *elem = nil;
+	struct xmlpull xp;
+	
+	/* Written to by someone else, the span could be anything now. */
+	if ([xmlSource isStaleForPath:[[self URL] path]])
+		return NO;
+	
+	if (!xmlpull_init(&xp, bytes + item->span.start, item->span.end - item->span.start) && xmlpull_next(&xp) == XMLPULL_START_ELEMENT)
+		elem = readElement(&xp);
+	xmlpull_free(&xp);
+	if (!elem)
+		return NO;
+	
+	NSDictionary *entities = [[[self persistentStoreCoordinator] managedObjectModel] entitiesByName];
+	
+	createObjBlock createBlock = ^(NSXMLNode *node, NSString *entityName)
+	{
+		return (id)[self objectIDForEntity:[entities objectForKey:entityName] referenceObject:[self uniqueForNode:(NSXMLElement*)node]];
+	};
+	
+	setDataBlock setBlock = ^(id obj, NSMutableDictionary *values)
+	{
+		[[self cacheNodeForObjectID:obj] setValue:[values objectForKey:@"node"] forKey:@"node"];
+		return obj;
+	};
+	
+	id (*imp)(id, SEL, NSXMLElement*, id, NSError**, createObjBlock, setDataBlock) = (void*)[self methodForSelector:itemSelector];
+	
+	if (!(*imp)(self, itemSelector, elem, nil, NULL, createBlock, setBlock))
+		return NO;
+	
+	item->elem = elem;
+	[xmlSource->built setObject:item forKey:elem];
+	[[xmldoc rootElement] addChild:elem];
+	return YES;
+}
+
+/*
+ * Load one of the list files, from its snapshot if there's a valid one.
+ * Its items are then found in the background, and only waited for once
+ * they're needed. Otherwise it's streamed, and a snapshot written for the
+ * next time once the list has been left alone for a while.
+ */
+- (BOOL)streamUsingSelector:(SEL)sel listSelector:(SEL)listSel ofType:(NSString*)rootType error:(NSError **)error
+{
+	NSData *data = xmlData;
+	
+	snapshotSelector = listSel;
+	itemSelector = sel;
+	listType = rootType;
+	
+	if (loadError || !data)
+		return [self loadUsingSelector:listSel error:error];
+	
+	xmlData = nil;
+	
+	if ([self loadSnapshotForData:data])
+	{
+		[self streamInBackground:data ofType:rootType listSelector:listSel];
+		return YES;
+	}
+	
+	NSMutableSet *set = [NSMutableSet set];
+	
+	createObjBlock createBlock = ^(NSXMLNode *elem, NSString *entityName)
+	{
+		id cnode = [self makeCacheNode:elem forEntityName:entityName];
+		
+		[set addObject:cnode];
+		return cnode;
+	};
+	
+	setDataBlock setBlock = ^(id obj, NSMutableDictionary *data)
+	{
+		[obj setPropertyCache:data];
+		
+		return obj;
+	};
+	
+	XMLSource *src = nil;
+	
+	xmldoc = [self streamDocument:data ofType:rootType selector:sel listSelector:listSel usingCreateBlock:createBlock usingSetBlock:setBlock source:&src error:error];
+	if (!xmldoc)
+		return NO;
+	xmlSource = src;
+	
+	[self addCacheNodes:set];
+	[self scheduleSnapshotForData:data];
+	return YES;
+}
+
+- (void)nodeChanged:(NSXMLNode*)node
+{
+	NSXMLElement *root = [xmldoc rootElement];
+	
+	dirty = YES;
+	while (node && [node parent] != root)
+		node = [node parent];
+	if (!node)
+		return;
+	
+	if (!changedItems)
+		changedItems = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality | NSPointerFunctionsStrongMemory];
+	[changedItems addObject:node];
+}
+
+static BOOL
+isSpace(const char *p, NSUInteger len)
+{
+	while (len--)
+	{
+		if (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+			return NO;
+		p++;
+	}
+	return YES;
+}
+
+/*
+ * Hands xmldoc to out in order. With a source, everything but the changed
+ * and new item elements is copied from it as it was, character references,
+ * comments and whitespace included. The rest is serialized, pretty printed.
+ * Returns where the item elements are in what was handed out, to be the
+ * source once that's written.
+ */
+- (XMLSource*)serializeXMLTo:(xmlOutBlock)out
+{
+	NSXMLElement *root = [xmldoc rootElement];
+	const char *src = xmlSource ? [xmlSource->data bytes] : NULL;
+	const char *sep = "\n    ";
+	NSUInteger seplen = strlen(sep);
+	XMLSource *next = [[XMLSource alloc] init];
+	struct source_span nspan = {0};
+	__block NSUInteger off = 0;
+	xmlOutBlock put = ^(const void *bytes, NSUInteger len) {
+		out(bytes, len);
+		off += len;
+	};
+	void (^outString)(NSString*) = ^(NSString *str) {
+		const char *utf8 = [str UTF8String];
+		
+		put(utf8, strlen(utf8));
+	};
+	
+	if (xmlSource)
+		put(src, xmlSource->head);
+	else
+	{
+		NSMutableString *head = [NSMutableString stringWithFormat:@"<?xml version=\"%@\" encoding=\"UTF-8\"%@?>\n",
+								 [xmldoc version] ? [xmldoc version] : @"1.0", [xmldoc isStandalone] ? @" standalone=\"yes\"" : @""];
+		
+		for (NSXMLNode *node in [xmldoc children])
+		{
+			if (node == root)
+				break;
+			[head appendFormat:@"%@\n", [node XMLStringWithOptions:NSXMLNodePrettyPrint]];
+		}
+		[head appendFormat:@"<%@", [root name]];
+		for (NSXMLNode *ns in [root namespaces])
+			[head appendFormat:@" %@", [ns XMLString]];
+		for (NSXMLNode *attr in [root attributes])
+			[head appendFormat:@" %@", [attr XMLString]];
+		[head appendString:@">"];
+		outString(head);
+	}
+	next->head = nspan.gap = off;
+	
+	NSXMLNode *prev = nil;
+	
+	/* Items of the source, unless they were removed from the document. */
+	for (SourceItem *item in xmlSource->items)
+	{
+		struct source_span span = item->span;
+		SourceItem *moved;
+		
+		if (item->elem && [item->elem parent] != root)
+			continue;
+		
+		put(src + span.gap, span.start - span.gap);
+		
+		/* New items are indented like the one before them. */
+		if (span.start > span.gap && isSpace(src + span.gap, span.start - span.gap))
+		{
+			sep = src + span.gap;
+			seplen = span.start - span.gap;
+		}
+		
+		nspan.start = off;
+		if (!item->elem || ![changedItems containsObject:item->elem])
+			put(src + span.start, span.end - span.start);
+		else
+			outString([item->elem XMLStringWithOptions:NSXMLNodePrettyPrint]);
+		nspan.end = off;
+		
+		moved = [[SourceItem alloc] init];
+		moved->span = nspan;
+		moved->key = item->key;
+		moved->elem = item->elem;
+		[next addItem:moved];
+		nspan.gap = nspan.end;
+		prev = item->elem;
+	}
+	
+	/* New items, or everything if there's no source. */
+	for (NSXMLNode *child in [root children])
+	{
+		if ([xmlSource->built objectForKey:child])
+			continue;
+		
+		if ([child kind] != NSXMLTextKind && [prev kind] != NSXMLTextKind)
+			put(sep, seplen);
+		
+		nspan.start = off;
+		outString([child XMLStringWithOptions:NSXMLNodePrettyPrint]);
+		prev = child;
+		
+		/* Anything else in the root goes with the gap before the next element. */
+		if ([child kind] == NSXMLElementKind)
+		{
+			SourceItem *item = [[SourceItem alloc] init];
+			
+			nspan.end = off;
+			item->span = nspan;
+			item->key = [self uniqueForNode:(NSXMLElement*)child];
+			item->elem = (NSXMLElement*)child;
+			[next addItem:item];
+			nspan.gap = nspan.end;
+		}
+	}
+	next->tail = nspan.gap;
+	
+	if (xmlSource)
+	{
+		put(src + xmlSource->tail, [xmlSource->data length] - xmlSource->tail);
+		return next;
+	}
+	
+	NSMutableString *tail = [NSMutableString stringWithFormat:@"%@</%@>\n", prev && [prev kind] != NSXMLTextKind ? @"\n" : @"", [root name]];
+	BOOL after = NO;
+	
+	for (NSXMLNode *node in [xmldoc children])
+	{
+		if (after)
+			[tail appendFormat:@"%@\n", [node XMLStringWithOptions:NSXMLNodePrettyPrint]];
+		after |= node == root;
+	}
+	outString(tail);
+	return next;
+}
+
+/*
+ * Makes next, from serializeXMLTo:, the source now that it's written to
+ * the list file, which had written. Nothing is changed since, and whatever
+ * was in the root between the item elements is in the source now. If the
+ * file can't be mapped the current source is kept, it's still valid for
+ * what's in memory, only more gets written the next time.
+ */
+- (void)rebaseSource:(XMLSource*)next written:(const struct stat*)written
+{
+	NSString *path = [[self URL] path];
+	NSData *data = [NSData dataWithContentsOfURL:[self URL] options:NSDataReadingMapped error:nil];
+	
+	if (!data || stat([path fileSystemRepresentation], &next->st)
+		|| next->st.st_dev != written->st_dev || next->st.st_ino != written->st_ino
+		|| (uint64_t)next->st.st_size != [data length])
+		return;
+	
+	next->data = data;
+	next->mapped = YES;
+	xmlSource = next;
+	[changedItems removeAllObjects];
+	
+	NSXMLElement *root = [xmldoc rootElement];
+	NSUInteger i = [root childCount];
+	
+	while (i--)
+	{
+		if ([[root childAtIndex:i] kind] != NSXMLElementKind)
+			[root removeChildAtIndex:i];
+	}
+}
+
+static int
+writeAll(int fd, const char *p, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = write(fd, p, len);
+		
+		if (n < 0)
+		{
+			if (errno != EINTR)
+				return -1;
+			continue;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Written in chunks of this, so the file is never in memory as a whole. */
+#define SAVE_CHUNK 65536
+
+- (BOOL)saveXML:(NSError **)error
+{
+	if (!dirty)
+		return YES;
+	
+	[self waitForXML];
+	if (!xmldoc)
+	{
+		if (error)
+			*error = xmlError ? xmlError : [self dataStoreError:17 msg:@"The list could not be read for saving"];
+		return NO;
+	}
+	
+	NSString *path = [[self URL] path];
+	
+	/* Written to by someone else, what's left of the source can't be trusted. */
+	if ([xmlSource isStaleForPath:path])
+	{
+		if (error)
+			*error = [self dataStoreError:18 msg:@"The list was changed by another program"];
+		return NO;
+	}
+	
+	NSString *tmpPath = [path stringByAppendingString:@".XXXXXX"];
+	char *tmpl = strdup([tmpPath fileSystemRepresentation]);
+	int fd = tmpl ? mkstemp(tmpl) : -1;
+	char *buf = malloc(SAVE_CHUNK);
+	struct stat st, written;
+	XMLSource *next;
+	__block int res = fd >= 0 && buf ? 0 : -1;
+	__block size_t used = 0;
+	int eno = errno;
+	BOOL renamed = NO;
+	
+	/* mkstemp gives 0600, keep whatever the list had. */
+	if (!res && fchmod(fd, stat([path fileSystemRepresentation], &st) ? 0644 : st.st_mode & 07777))
+		res = -1;
+	
+	next = [self serializeXMLTo:^(const void *bytes, NSUInteger len) {
+		if (res)
+			return;
+		
+		if (used + len > SAVE_CHUNK)
+		{
+			res = writeAll(fd, buf, used);
+			used = 0;
+		}
+		if (!res && len >= SAVE_CHUNK)
+			res = writeAll(fd, bytes, len);
+		else if (!res)
+		{
+			memcpy(buf + used, bytes, len);
+			used += len;
+		}
+	}];
+	if (!res && used)
+		res = writeAll(fd, buf, used);
+	if (!res && (fsync(fd) || fstat(fd, &written)))
+		res = -1;
+	free(buf);
+	
+	if (res)
+		eno = errno;
+	if (fd >= 0 && close(fd) && !res)
+	{
+		eno = errno;
+		res = -1;
+	}
+	if (!res && rename(tmpl, [path fileSystemRepresentation]))
+	{
+		eno = errno;
+		res = -1;
+	}
+	else if (!res)
+		renamed = YES;
+	if (!renamed && fd >= 0)
+		unlink(tmpl);
+	free(tmpl);
+	
+	/*
+	 * Until the directory is synced as well, a crash can leave the old file
+	 * in place. The new one is there by now though, so it's not a failed save.
+	 */
+	if (renamed)
+	{
+		int dfd = open([[path stringByDeletingLastPathComponent] fileSystemRepresentation], O_RDONLY);
+		
+		if (dfd < 0 || fsync(dfd))
+			NSLog(@"Failed to sync the folder of %@: %s", path, strerror(errno));
+		if (dfd >= 0)
+			close(dfd);
+	}
+	
+	if (res)
+	{
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:eno userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+																				  [self URL], NSURLErrorKey,
+																				  nil]];
+		return NO;
+	}
+	dirty = NO;
+	[self rebaseSource:next written:&written];
+	/* Otherwise it's not known what the file has. */
+	if (xmlSource == next)
+		[self scheduleSnapshotForData:xmlSource->data];
+	return YES;
+}
+
+@end
+
+
+/*
+ * Stands in for a cache node while a snapshot is written.
+ */
+@interface SnapshotRef : NSObject
+{
+@public
+	uint32_t nodeIndex;
+}
+
+@end
+
+@implementation SnapshotRef
+
+@end
+
+
+static uint32_t
+addString(struct snapshot_writer *sw, NSString *str)
+{
+	const char *s = [str UTF8String];
+	
+	if (!s)
+	{
+		errno = EINVAL;
+		return SNAPSHOT_NONE;
+	}
+	return snapshot_add_string(sw, s, strlen(s));
+}
+
+static NSString *
+stringAt(const struct snapshot *snap, uint32_t idx)
+{
+	size_t len;
+	const char *s = snapshot_string(snap, idx, &len);
+	
+	return [[NSString alloc] initWithBytes:s length:len encoding:NSUTF8StringEncoding];
+}
+
+/*
+ * Size and mtime of the list file, with the hash of data which should be
+ * what it contains.
+ */
+static BOOL
+sourceForHash(NSURL *url, uint64_t length, uint64_t hash, struct snapshot_source *src)
+{
+	struct stat st;
 	
-	return res;
+	if (stat([[url path] fileSystemRepresentation], &st) || (uint64_t)st.st_size != length)
+		return NO;
+	
+	src->size = st.st_size;
+	src->mtime_sec = st.st_mtimespec.tv_sec;
+	src->mtime_nsec = st.st_mtimespec.tv_nsec;
+	src->hash = hash;
+	return YES;
 }
 
-- (NSArray *)verifyManifestOfType:(NSString*)manifestType listNodeType:(NSString*)listNodeType error:(NSError**)error
+@implementation DataStore (Snapshots)
+
+/* Settings/AddIns.xml has Settings/modazipin-AddIns.snapshot, and so on. */
+- (NSURL*)snapshotURL
 {
-	NSXMLElement *root = [xmldoc rootElement];
+	NSURL *url = [self URL];
+	NSString *name = [NSString stringWithFormat:@"modazipin-%@.snapshot", [[url lastPathComponent] stringByDeletingPathExtension]];
 	
-	if (![[[root attributeForName:@"Type"] stringValue] isEqualToString:manifestType])
-	{
-		if (error)
-			*error = [self dataStoreError:6 msg:@"Manifest type is not %@", manifestType];
-		return nil;
-	}
+	return [[url URLByDeletingLastPathComponent] URLByAppendingPathComponent:name];
+}
+
+/*
+ * Adds the cache nodes from the snapshot, if it was made from data. They have
+ * everything but the XML nodes, which are filled in by waitForXML.
+ */
+- (BOOL)loadSnapshotForData:(NSData*)data
+{
+	NSData *snapData = [NSData dataWithContentsOfURL:[self snapshotURL] options:NSDataReadingMapped error:nil];
+	struct snapshot snap;
+	struct stat st;
+	uint32_t i, j;
 	
-	if ([root childCount] < 1)
-	{
-		if (error)
-			*error = [self dataStoreError:7 msg:@"No contents in manifest"];
-		return nil;
-	}
+	if (!snapData || snapshot_open(&snap, [snapData bytes], [snapData length]))
+		return NO;
 	
-	if ([root childCount] > 1)
-	{
-		if (error)
-			*error = [self dataStoreError:8 msg:@"Unexpected contents in manifest"];
-		return nil;
-	}
+	/* Size and mtime first, the hash only if they match. */
+	if (stat([[[self URL] path] fileSystemRepresentation], &st)
+		|| snap.source.size != (uint64_t)st.st_size
+		|| snap.source.size != [data length]
+		|| snap.source.mtime_sec != st.st_mtimespec.tv_sec
+		|| snap.source.mtime_nsec != st.st_mtimespec.tv_nsec
+		|| snap.source.hash != snapshot_hash([data bytes], [data length]))
+		return NO;
 	
-	NSXMLElement *listNode = (NSXMLElement*)[root childAtIndex:0];
+	NSDictionary *entities = [[[self persistentStoreCoordinator] managedObjectModel] entitiesByName];
+	NSMutableArray *strings = [NSMutableArray arrayWithCapacity:snap.nstrings];
+	NSMutableArray *cnodes = [NSMutableArray arrayWithCapacity:snap.nnodes];
 	
-	if (![[listNode name] isEqualToString:listNodeType])
+	for (i = 0 ; i < snap.nstrings ; i++)
 	{
-		if (error)
-			*error = [self dataStoreError:9 msg:@"Manifest contents is not %@", listNodeType];
-		return nil;
+		NSString *str = stringAt(&snap, i);
+		
+		if (!str)
+			return NO;
+		[strings addObject:str];
 	}
 	
-	if ([listNode childCount] < 1)
+	for (i = 0 ; i < snap.nnodes ; i++)
 	{
-		if (error)
-			*error = [self dataStoreError:10 msg:@"No contents in list"];
-		return nil;
+		NSEntityDescription *entity = [entities objectForKey:[strings objectAtIndex:snap.nodes[i].entity]];
+		
+		/* The model changed since. */
+		if (!entity)
+			return NO;
+		
+		NSManagedObjectID *objid = [self objectIDForEntity:entity referenceObject:[strings objectAtIndex:snap.nodes[i].ref]];
+		
+		[cnodes addObject:[[NSAtomicStoreCacheNode alloc] initWithObjectID:objid]];
 	}
 	
-	NSArray *itemNodes = [listNode children];
-	
-	for (NSXMLElement *itemNode in itemNodes)
+	for (i = 0 ; i < snap.nnodes ; i++)
 	{
-		if (![[itemNode name] isEqualToString:[NSString stringWithFormat:@"%@Item", manifestType]])
-		{
-			if (error)
-				*error = [self dataStoreError:12 msg:@"Unexpected item kind"];
-			return nil;
-		}
+		const struct snapshot_node *node = &snap.nodes[i];
+		NSMutableDictionary *values = [NSMutableDictionary dictionaryWithCapacity:node->nvalues];
 		
-		if (![[[itemNode attributeForName:@"UID"] stringValue] length])
+		for (j = node->first ; j < node->first + node->nvalues ; j++)
 		{
-			if (error)
-				*error = [self dataStoreError:13 msg:@"No UID for item"];
-			return nil;
+			const struct snapshot_value *v = &snap.values[j];
+			id value = nil;
+			uint32_t k;
+			
+			switch (v->type)
+			{
+				case SNAPSHOT_STRING:
+					value = [strings objectAtIndex:v->a];
+					break;
+				case SNAPSHOT_DECIMAL:
+					value = [NSDecimalNumber decimalNumberWithString:[strings objectAtIndex:v->a]];
+					break;
+				case SNAPSHOT_BOOL:
+					value = [NSNumber numberWithBool:v->a];
+					break;
+				case SNAPSHOT_NODE:
+					value = [cnodes objectAtIndex:v->a];
+					break;
+				case SNAPSHOT_NODES:
+					value = [NSMutableSet setWithCapacity:v->b];
+					for (k = v->a ; k < v->a + v->b ; k++)
+						[value addObject:[cnodes objectAtIndex:snap.refs[k]]];
+					break;
+			}
+			[values setObject:value forKey:[strings objectAtIndex:v->key]];
 		}
+		[[cnodes objectAtIndex:i] setPropertyCache:values];
 	}
 	
-	return itemNodes;
+	[self addCacheNodes:[NSSet setWithArray:cnodes]];
+	return YES;
 }
 
-- (Item*)insertItemNode:(NSXMLElement*)node usingSelector:(SEL)sel error:(NSError **)error intoContext:(NSManagedObjectContext*)context
+/* How long the list has to be left alone before its snapshot is written. */
+#define SNAPSHOT_DELAY 5.0
+
+/*
+ * Has a snapshot of data, which is what the list file has now, written
+ * once the list hasn't been saved for SNAPSHOT_DELAY, or when flushed.
+ */
+- (void)scheduleSnapshotForData:(NSData*)data
 {
-	node = [node copy];
-	
-	IMP imp = [self methodForSelector:sel];
-	if (!imp)
-		[NSException raise:NSInvalidArgumentException format:@"%s is not a method of this object.", sel_getName(sel)];
-	
-	id res = (*imp)(self, sel, node, nil, error, ^(NSXMLElement *elem, NSString *entityName)
-			  {
-				  return [NSEntityDescription insertNewObjectForEntityForName:entityName inManagedObjectContext:context];
-			  }, ^(id obj, NSMutableDictionary *data)
-			  {
-				  for (NSString *key in data) {
-					  [obj setValue:[data objectForKey:key] forKey:key];
-				  }
-				  [context assignObject:obj toPersistentStore:self];
-				  if ([obj isKindOfClass:[Path self]])
-					  [obj setValue:[NSNumber numberWithBool:YES] forKey:@"verified"];
-				  return obj;
-			  });
+	NSUInteger gen;
 	
-	if (!res)
-		return nil;
+	if (!snapshotSelector)
+		return;
 	
-	[[xmldoc rootElement] addChild:node];
-	return res;
+	@synchronized(self)
+	{
+		if (!snapshotQueue)
+			snapshotQueue = dispatch_queue_create("org.morth.per.modazipin.snapshot", NULL);
+		snapshotData = data;
+		gen = ++snapshotGeneration;
+	}
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(SNAPSHOT_DELAY * NSEC_PER_SEC)), snapshotQueue, ^{
+		NSData *pending = nil;
+		
+		@synchronized(self)
+		{
+			if (gen == snapshotGeneration)
+			{
+				pending = snapshotData;
+				snapshotData = nil;
+			}
+		}
+		if (pending)
+			[self writeSnapshotForData:pending];
+	});
 }
 
-- (BOOL)loadUsingSelector:(SEL)sel error:(NSError **)error
+/* The snapshot is written while the store still has its URL. */
+- (void)willRemoveFromPersistentStoreCoordinator:(NSPersistentStoreCoordinator *)coordinator
 {
-	if (loadError)
+	[self flushSnapshot];
+	[super willRemoveFromPersistentStoreCoordinator:coordinator];
+}
+
+- (void)flushSnapshot
+{
+	NSData *pending;
+	dispatch_queue_t queue;
+	
+	@synchronized(self)
 	{
-		if (error)
-			*error = loadError;
-		loadError = nil;
-		return NO;
+		pending = snapshotData;
+		snapshotData = nil;
+		queue = snapshotQueue;
 	}
+	if (!queue)
+		return;
 	
-	if (!xmldoc)
-		return YES;
+	dispatch_sync(queue, ^{
+		if (pending)
+			[self writeSnapshotForData:pending];
+	});
+}
+
+/*
+ * Writes what loading data gives, except the XML nodes themselves, as its
+ * snapshot. It's streamed again rather than taken from the cache nodes,
+ * which also hold what's only set while running. This is run on
+ * snapshotQueue, and errors are ignored, the snapshot is only a cache.
+ */
+- (void)writeSnapshotForData:(NSData*)data
+{
+	struct snapshot_source src;
 	
-	NSMutableSet *set = [NSMutableSet set];
+	if (!sourceForHash([self URL], [data length], snapshot_hash([data bytes], [data length]), &src))
+		return;
+	
+	struct snapshot_writer *sw = snapshot_writer_new();
+	
+	if (!sw)
+		return;
 	
 	createObjBlock createBlock = ^(NSXMLNode *elem, NSString *entityName)
 	{
-		id cnode = [self makeCacheNode:elem forEntityName:entityName];
+		uint32_t entity = addString(sw, entityName);
+		uint32_t ref = entity == SNAPSHOT_NONE ? SNAPSHOT_NONE : addString(sw, [self uniqueForNode:(NSXMLElement*)elem]);
+		SnapshotRef *res;
 		
-		[set addObject:cnode];
-		return cnode;
+		if (ref == SNAPSHOT_NONE)
+			return (id)nil;
+		
+		res = [[SnapshotRef alloc] init];
+		res->nodeIndex = snapshot_add_node(sw, entity, ref);
+		if (res->nodeIndex == SNAPSHOT_NONE)
+			return (id)nil;
+		return (id)res;
 	};
 	
-	setDataBlock setBlock = ^(id obj, NSMutableDictionary *data)
+	setDataBlock setBlock = ^(id obj, NSMutableDictionary *values)
 	{
-		[obj setPropertyCache:data];
+		NSMutableData *vdata = [NSMutableData dataWithCapacity:[values count] * sizeof (struct snapshot_value)];
+		
+		if (!obj)
+			return (id)nil;
+		
+		for (NSString *key in values)
+		{
+			id value = [values objectForKey:key];
+			struct snapshot_value v = {0};
+			
+			/* Put back by waitForXML. */
+			if ([key isEqualToString:@"node"])
+				continue;
+			
+			v.key = addString(sw, key);
+			if ([value isKindOfClass:[NSString class]])
+			{
+				v.type = SNAPSHOT_STRING;
+				v.a = addString(sw, value);
+			}
+			else if ([value isKindOfClass:[NSDecimalNumber class]])
+			{
+				v.type = SNAPSHOT_DECIMAL;
+				v.a = addString(sw, [value stringValue]);
+			}
+			else if (CFGetTypeID((__bridge CFTypeRef)value) == CFBooleanGetTypeID())
+			{
+				v.type = SNAPSHOT_BOOL;
+				v.a = [value boolValue];
+			}
+			else if ([value isKindOfClass:[SnapshotRef class]])
+			{
+				v.type = SNAPSHOT_NODE;
+				v.a = ((SnapshotRef*)value)->nodeIndex;
+			}
+			else if ([value isKindOfClass:[NSSet class]])
+			{
+				NSMutableData *refs = [NSMutableData dataWithLength:[value count] * sizeof (uint32_t)];
+				uint32_t *r = [refs mutableBytes];
+				
+				for (SnapshotRef *ref in value)
+					*r++ = ref->nodeIndex;
+				v.type = SNAPSHOT_NODES;
+				v.a = snapshot_add_refs(sw, [refs bytes], (uint32_t)[value count]);
+				v.b = (uint32_t)[value count];
+			}
+			else
+				return (id)nil;
+			
+			if (v.key == SNAPSHOT_NONE || v.a == SNAPSHOT_NONE)
+				return (id)nil;
+			[vdata appendBytes:&v length:sizeof (v)];
+		}
 		
+		if (snapshot_set_values(sw, ((SnapshotRef*)obj)->nodeIndex, [vdata bytes], (uint32_t)([vdata length] / sizeof (struct snapshot_value))))
+			return (id)nil;
 		return obj;
-	};	
-	
-	BOOL (*imp)(id, SEL, NSXMLElement*, NSError**, createObjBlock, setDataBlock) = (void*)[self methodForSelector:sel];
-	if (!imp)
-		[NSException raise:NSInvalidArgumentException format:@"%s is not a method of this object.", sel_getName(sel)];
+	};
 	
-	BOOL res = (*imp)(self, sel, [xmldoc rootElement], error, createBlock, setBlock);
+	XMLSource *xs = nil;
+	NSError *err = nil;
+	BOOL res = [self streamDocument:data ofType:listType selector:itemSelector listSelector:snapshotSelector usingCreateBlock:createBlock usingSetBlock:setBlock source:&xs error:&err] != nil;
 	
-	if (!res)
-		return NO;
+	if (res)
+	{
+		NSString *path = [[self snapshotURL] path];
+		NSString *tmpPath = [path stringByAppendingString:@".XXXXXX"];
+		char *tmpl = strdup([tmpPath fileSystemRepresentation]);
+		int fd = tmpl ? mkstemp(tmpl) : -1;
+		
+		res = fd >= 0 && !snapshot_write(sw, fd, &src);
+		if (fd >= 0 && close(fd))
+			res = NO;
+		if (res && rename(tmpl, [path fileSystemRepresentation]))
+			res = NO;
+		if (!res && fd >= 0)
+			unlink(tmpl);
+		free(tmpl);
+	}
+	snapshot_writer_free(sw);
+}
+
+/*
+ * Finds the items in data on a background queue, for the source. Only a
+ * list that isn't UTF-8 is parsed whole, keeping the XML node of every cache
+ * node it finds. All of it is handed over on the main queue when done, or
+ * as soon as anything waits for it.
+ */
+- (void)streamInBackground:(NSData*)data ofType:(NSString*)rootType listSelector:(SEL)listSel
+{
+	xmlGroup = dispatch_group_create();
 	
-	[self addCacheNodes:set];
-	return YES;
+	dispatch_group_async(xmlGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		NSMutableDictionary *nodes = [NSMutableDictionary dictionary];
+		NSError *err = nil;
+		
+		createObjBlock createBlock = ^(NSXMLNode *elem, NSString *entityName)
+		{
+			return (id)[NSArray arrayWithObjects:entityName, [self uniqueForNode:(NSXMLElement*)elem], nil];
+		};
+		
+		setDataBlock setBlock = ^(id obj, NSMutableDictionary *values)
+		{
+			id node = [values objectForKey:@"node"];
+			
+			if (node)
+				[nodes setObject:node forKey:obj];
+			return obj;
+		};
+		
+		XMLSource *src = nil;
+		
+		pendingDoc = [self streamDocument:data ofType:rootType selector:NULL listSelector:listSel usingCreateBlock:createBlock usingSetBlock:setBlock source:&src error:&err];
+		pendingSource = src;
+		pendingNodes = nodes;
+		xmlError = err;
+	});
+	dispatch_group_notify(xmlGroup, dispatch_get_main_queue(), ^{
+		[self waitForXML];
+	});
 }
 
+- (void)waitForXML
+{
+	@synchronized(self)
+	{
+		if (!xmlGroup)
+			return;
+		
+		dispatch_group_wait(xmlGroup, DISPATCH_TIME_FOREVER);
+		dispatch_release(xmlGroup);
+		xmlGroup = NULL;
+		
+		NSDictionary *entities = [[[self persistentStoreCoordinator] managedObjectModel] entitiesByName];
+		
+		xmldoc = pendingDoc;
+		xmlSource = pendingSource;
+		for (NSArray *key in pendingNodes)
+		{
+			NSEntityDescription *entity = [entities objectForKey:[key objectAtIndex:0]];
+			NSManagedObjectID *objid = [self objectIDForEntity:entity referenceObject:[key objectAtIndex:1]];
+			
+			[[self cacheNodeForObjectID:objid] setValue:[pendingNodes objectForKey:key] forKey:@"node"];
+		}
+		pendingDoc = nil;
+		pendingSource = nil;
+		pendingNodes = nil;
+	}
+}
 
 @end
 
 
+/*
+ * Sets the value only if it differs, returning YES if it did.
+ */
+static BOOL
+setIfChanged(NSXMLNode *node, NSString *value)
+{
+	NSString *old = [node stringValue];
+	
+	if (old == value || [old isEqualToString:value])
+		return NO;
+	[node setStringValue:value];
+	return YES;
+}
+
 @implementation DataStore (AtomicStoreCallbacks)
 
 - (void)updateCacheNode:(NSAtomicStoreCacheNode *)node fromManagedObject:(NSManagedObject *)managedObject
@@ -756,6 +2092,10 @@
 	NSXMLElement *elem = (NSXMLElement*)[managedObject valueForKey:@"node"];
 	NSXMLNode *attr;
 	
+	/* Edited outside the model, such as the consolidated attribute. */
+	if ([[managedObject changedValues] objectForKey:@"node"])
+		[self nodeChanged:elem];
+	
 	if ([managedObject isKindOfClass:[Item self]])
 	{
 		Item *item = (Item*)managedObject;
@@ -764,23 +2104,24 @@
 			|| [[[managedObject entity] name] isEqualToString:@"OverrideItem"])
 		{
 			attr = [elem attributeForName:@"Enabled"];
-			if ([item.Enabled intValue])
-				[attr setStringValue:@"1"];
-			else
-				[attr setStringValue:@"0"];
+			if (setIfChanged(attr, [item.Enabled intValue] ? @"1" : @"0"))
+				[self nodeChanged:elem];
 		}
 		else if ([[[managedObject entity] name] isEqualToString:@"OfferItem"])
 		{
-			if ([item.Enabled intValue])
-				[elem setName:@"OfferItem"];
-			else
-				[elem setName:@"DisabledOfferItem"];
+			NSString *name = [item.Enabled intValue] ? @"OfferItem" : @"DisabledOfferItem";
+			
+			if (![[elem name] isEqualToString:name])
+			{
+				[elem setName:name];
+				[self nodeChanged:elem];
+			}
 		}
 		
 		for (NSXMLNode *child in [elem children])
 		{
-			if ([[child name] isEqualToString:@"GameVersion"])
-				[child setStringValue:item.GameVersion];
+			if (nameOf(child) == XMLNAME_GameVersion && setIfChanged(child, item.GameVersion))
+				[self nodeChanged:elem];
 		}
 		
 		[node setValue:item.Enabled forKey:@"Enabled"];
@@ -796,11 +2137,15 @@
 			attr = [elem attributeForName:@"origGameVersion"];
 			
 			if (attr)
-				[attr setStringValue:modazipin.origGameVersion];
+			{
+				if (setIfChanged(attr, modazipin.origGameVersion))
+					[self nodeChanged:elem];
+			}
 			else
 			{
 				attr = [NSXMLNode attributeWithName:@"origGameVersion" stringValue:modazipin.origGameVersion];
 				[elem addAttribute:attr];
+				[self nodeChanged:elem];
 			}
 		}
 	}
@@ -808,7 +2153,8 @@
 	{
 		attr = [elem attributeForName:@"DefaultValue"];
 		
-		[attr setStringValue:[managedObject valueForKey:@"DefaultValue"]];
+		if (setIfChanged(attr, [managedObject valueForKey:@"DefaultValue"]))
+			[self nodeChanged:elem];
 		[node setValue:[managedObject valueForKey:@"DefaultValue"] forKey:@"DefaultValue"];
 	}
 }
@@ -834,20 +2180,34 @@
 				NSXMLElement *elem = [NSXMLElement elementWithName:@"modazipin"];
 				[(NSXMLElement*)modazipin.item.node addChild:elem];
 				modazipin.node = elem;
+				[self nodeChanged:elem];
 			}
 		}
 	}
+	else if ([managedObject isKindOfClass:[DataStoreObject self]])
+	{
+		/* Path nodes are added to the document before the objects are saved. */
+		[self nodeChanged:[managedObject valueForKey:@"node"]];
+	}
 	
 	return [super newCacheNodeForManagedObject:managedObject];
 }
 
 - (void)willRemoveCacheNodes:(NSSet *)cacheNodes
 {
+	[self waitForXML];
+	
 	for (NSAtomicStoreCacheNode *cnode in cacheNodes)
 	{
-		NSXMLNode *node = [[cnode propertyCache] objectForKey:@"node"];
+		NSXMLNode *node = [self nodeForObjectID:[cnode objectID]];
+		
+		NSXMLNode *parent = [node parent];
 		
-		[node detach];
+		if (parent)
+		{
+			[node detach];
+			[self nodeChanged:parent];
+		}
 	}
 }
 
@@ -860,10 +2220,9 @@
 	if (self && url)
 	{
 		NSError *err = nil;
-		NSData *xmldata = [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:&err];
-
-		if (xmldata)
-			[self loadXML:xmldata ofType:@"AddInsList" error:&err];
+		
+		/* Parsed as it's loaded. */
+		xmlData = [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:&err];
 
 		loadError = err;
 		self.identifier = @"AddInsList";
@@ -873,7 +2232,10 @@
 
 - (BOOL)load:(NSError **)error
 {
-	return [self loadUsingSelector:@selector(loadAddInsList:error:usingCreateBlock:usingSetBlock:) error:error];
+	return [self streamUsingSelector:@selector(loadAddInItem:forManifest:error:usingCreateBlock:usingSetBlock:)
+						listSelector:@selector(loadAddInsList:error:usingCreateBlock:usingSetBlock:)
+							  ofType:@"AddInsList"
+							   error:error];
 }
 
 - (NSString *)type {
@@ -882,9 +2244,7 @@
 
 - (BOOL)save:(NSError **)error
 {
-	BOOL res = [[xmldoc XMLDataWithOptions:NSXMLNodePrettyPrint] writeToURL:[self URL] options:0 error:error];
-	
-	return res;
+	return [self saveXML:error];
 }
 
 - (AddInItem*)insertAddInNode:(NSXMLElement*)node error:(NSError **)error intoContext:(NSManagedObjectContext*)context
@@ -917,8 +2277,7 @@
 			}
 		}
 		
-		if (xmldata)
-			[self loadXML:xmldata ofType:@"OfferList" error:&err];
+		xmlData = xmldata;
 
 		loadError = err;
 		self.identifier = @"OfferList";
@@ -928,7 +2287,10 @@
 
 - (BOOL)load:(NSError **)error
 {
-	return [self loadUsingSelector:@selector(loadOfferList:error:usingCreateBlock:usingSetBlock:) error:error];
+	return [self streamUsingSelector:@selector(loadOfferItem:forManifest:error:usingCreateBlock:usingSetBlock:)
+						listSelector:@selector(loadOfferList:error:usingCreateBlock:usingSetBlock:)
+							  ofType:@"OfferList"
+							   error:error];
 }
 
 - (NSString *)type {
@@ -937,9 +2299,7 @@
 
 - (BOOL)save:(NSError **)error
 {
-	BOOL res = [[xmldoc XMLDataWithOptions:NSXMLNodePrettyPrint] writeToURL:[self URL] options:0 error:error];
-	
-	return res;
+	return [self saveXML:error];
 }
 
 - (OfferItem*)insertOfferNode:(NSXMLElement*)node error:(NSError **)error intoContext:(NSManagedObjectContext*)context
@@ -960,7 +2320,7 @@
 		NSData *xmldata = [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:&err];
 		
 		if (xmldata)
-			[self loadXML:xmldata ofType:@"OverrideList" error:&err];
+			xmlData = xmldata;
 		else if ([err domain] == NSCocoaErrorDomain && [err code] == NSFileReadNoSuchFileError)
 		{
 			err = nil;
@@ -968,6 +2328,7 @@
 			[xmldoc setVersion:@"1.0"];
 			[xmldoc setCharacterEncoding:@"UTF-8"];
 			[xmldoc setStandalone:YES];
+			dirty = YES;
 			[self save:&err];
 		}
 
@@ -979,7 +2340,10 @@
 
 - (BOOL)load:(NSError**)error
 {
-	return [self loadUsingSelector:@selector(loadOverrideList:error:usingCreateBlock:usingSetBlock:) error:error];
+	return [self streamUsingSelector:@selector(loadOverrideItem:forManifest:error:usingCreateBlock:usingSetBlock:)
+						listSelector:@selector(loadOverrideList:error:usingCreateBlock:usingSetBlock:)
+							  ofType:@"OverrideList"
+							   error:error];
 }
 
 - (NSString *)type {
@@ -988,9 +2352,7 @@
 
 - (BOOL)save:(NSError **)error
 {
-	BOOL res = [[xmldoc XMLDataWithOptions:NSXMLNodePrettyPrint] writeToURL:[self URL] options:0 error:error];
-	
-	return res;
+	return [self saveXML:error];
 }
 
 - (Item*)insertOverrideNode:(NSXMLElement*)node error:(NSError **)error intoContext:(NSManagedObjectContext*)context
@@ -1001,6 +2363,8 @@
 @end
 
 
+NSString * const ArchiveStoreSpoolOption = @"ArchiveStoreSpoolOption";
+
 @implementation ArchiveStore
 
 - (NSDictionary*)loadArchive:(NSURL *)url error:(NSError**)error
@@ -1014,10 +2378,25 @@
 	
 	NSMutableSet *files = [NSMutableSet set];
 	NSMutableSet *dirs = [NSMutableSet set];
-	NSMutableSet *contents = [NSMutableSet set];
+	NSMutableSet *names = [NSMutableSet set];
+	ArchiveSpool *sp = nil;
+	
+	/* Zip files are read through the central directory, nothing needs decompressing but the manifest and ERF headers. */
+	NSArray *seekable = [archive seekableMembersWithError:nil];
+	id <NSFastEnumeration> members = seekable ? (id <NSFastEnumeration>)seekable : archive;
 	
-	for (DAArchiveMember *entry in archive)
+	/* A seekable archive can be read again directly, no point in spooling it. */
+	if (!seekable && [[[self options] objectForKey:ArchiveStoreSpoolOption] boolValue])
+		sp = [[ArchiveSpool alloc] initWithArchiveURL:url error:nil];
+	
+	for (DAArchiveMember *entry in members)
 	{
+		NSData *spooled = nil;
+		
+		/* Not worth failing the open over, install will just decompress again. */
+		if (sp && entry.type != dmtManifest && !(spooled = [sp spoolMember:entry error:nil]))
+			sp = nil;
+		
 		switch (entry.type)
 		{
 			case dmtManifest:
@@ -1025,20 +2404,49 @@
 				break;
 			case dmtERF:
 			{
-				NSData *erfdata = entry.data;
+				struct erf_cursor cursor;
+				struct erf_toc *toc = erf_toc_new(1024);
+				struct erf_stream *stream = NULL;
+				int ok;
+				
+				if (spooled)
+					ok = erf_cursor_init(&cursor, [spooled bytes], [spooled length]) == 0;
+				else
+				{
+					/* Only the table of contents is kept, the file data is skipped. */
+					__block int fed = 0;
+					
+					stream = erf_stream_new(entry.sizeAvailable ? (uint64_t)entry.size : 0);
+					if (stream)
+					{
+						[entry readDataUsingBlock:^BOOL(const void *bytes, size_t length) {
+							fed = erf_stream_feed(stream, bytes, length);
+							return fed == 0;
+						} error:nil];
+						[entry skipDataWithError:nil];
+					}
+					ok = fed > 0 && erf_stream_cursor(stream, &cursor) == 0;
+				}
 				
-				parse_erf_data([erfdata bytes], [erfdata length],
-							   ^(struct erf_header *header, struct erf_file *file)
-							   {
-								   if (file->name)
-									   [contents addObject:[NSString stringWithCString:file->name encoding:NSASCIIStringEncoding]];
-							   });
+				if (toc && ok)
+				{
+					while (erf_cursor_read(&cursor, toc) > 0)
+					{
+						for (uint32_t i = 0 ; i < toc->count ; i++)
+						{
+							if (toc->name[i] != ERF_TOC_NONAME)
+								[names addObject:[NSString stringWithCString:toc->names + toc->name[i] encoding:NSASCIIStringEncoding]];
+						}
+					}
+				}
+				erf_toc_free(toc);
+				erf_stream_free(stream);
 			}
 				/* Fall through */
 				if (0)
 				{
 				case dmtFile:
-					[contents addObject:entry.contentName];
+					[names addObject:entry.contentName];
 				}
 				switch (entry.contentType)
 			{
@@ -1053,8 +2461,11 @@
 		}
 	}
 	
+	contents = names;
+	spool = sp;
+	
 	[self willChangeValueForKey:@"uncompressedSize"];
-	uncompressedSize = archive.uncompressedOffset;
+	uncompressedSize = seekable ? archive.uncompressedSize : archive.uncompressedOffset;
 	[self didChangeValueForKey:@"uncompressedSize"];
 	
 	if (!xmldata)
@@ -1068,7 +2479,7 @@
 			xmldata, @"manifest",
 			files, @"files",
 			dirs, @"directories",
-			contents, @"contents",
+			names, @"contents",
 			nil];
 }
 
@@ -1078,6 +2489,8 @@
 }
 
 @synthesize uncompressedSize;
+@synthesize contents;
+@synthesize spool;
 
 @end
 
@@ -1517,9 +2930,7 @@
 
 - (BOOL)save:(NSError **)error
 {
-	BOOL res = [[xmldoc XMLDataWithOptions:NSXMLNodePrettyPrint] writeToURL:[self URL] options:0 error:error];
-	
-	return res;
+	return [self saveXML:error];
 }
 
 @end
@@ -42,6 +42,9 @@
 @property (nonatomic, retain) NSString * type;
 @property (nonatomic, retain) NSNumber * verified;
 
+/* Name of the ERF the files of this path are packed into, kept in the path node. */
+@property (nonatomic, copy) NSString * consolidated;
+
 @end
 
 // coalesce these into one @interface Path (CoreDataGeneratedAccessors) section
@@ -147,6 +150,12 @@
 - (NSView*)configView;
 - (BOOL)hasConfigSections;
 
+- (BOOL)isConsolidated;
+- (BOOL)canConsolidate;
+
+/* Installed addins and offers can be written back out as a dazip. */
+- (BOOL)canExport;
+
 @end
 
 
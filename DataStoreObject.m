@@ -26,6 +26,7 @@
 
 /* XXX layering violation */
 #import "AddInsList.h"
+#import "ContentTable.h"
 
 @implementation DataStoreObject
 
@@ -36,8 +37,33 @@
 	[super awakeFromFetch];
 	
 	DataStore *store = (DataStore*)[[self objectID] persistentStore];
+	NSXMLNode *node = [[[store cacheNodeForObjectID:[self objectID]] propertyCache] objectForKey:@"node"];
 	
-	self.node = [[[store cacheNodeForObjectID:[self objectID]] propertyCache] objectForKey:@"node"];
+	/* Not there for a streamed list until its item is built, see -node. */
+	if (node)
+		self.node = node;
+}
+
+- (NSXMLNode*)node
+{
+	NSXMLNode *node;
+	
+	[self willAccessValueForKey:@"node"];
+	node = [self primitiveValueForKey:@"node"];
+	[self didAccessValueForKey:@"node"];
+	
+	if (!node)
+	{
+		DataStore *store = (DataStore*)[[self objectID] persistentStore];
+		
+		if ([store isKindOfClass:[DataStore class]] && ![[self objectID] isTemporaryID])
+		{
+			node = [store nodeForObjectID:[self objectID]];
+			if (node)
+				[self setPrimitiveValue:node forKey:@"node"];
+		}
+	}
+	return node;
 }
 
 @end
@@ -79,21 +105,79 @@ static NSPredicate *isERF;
 		else if ([isERF evaluateWithObject:name])
 		{
 			NSData *erfdata = [NSData dataWithContentsOfURL:item options:NSDataReadingMapped error:nil];
+			struct erf_index *index = erfdata ? erf_index_new([erfdata bytes], [erfdata length]) : NULL;
 			
-			parse_erf_data([erfdata bytes], [erfdata length], ^(struct erf_header *header, struct erf_file *file)
-						   {
-							   if (!file->name)
-								   return;
-							   NSString *n = [NSString stringWithCString:file->name encoding:NSASCIIStringEncoding];
-							   
-							   if ([n caseInsensitiveCompare:name] == NSOrderedSame)
-								   [res setObject:[NSData dataWithBytes:(void*)file->data length:file->length] forKey:name];
-						   });
+			if (!index)
+				continue;
+			
+			NSMutableArray *found = [NSMutableArray arrayWithCapacity:[contents count]];
+			NSMutableArray *bufs = [NSMutableArray arrayWithCapacity:[contents count]];
+			NSMutableData *reqdata = [NSMutableData dataWithLength:[contents count] * sizeof (struct erf_read_request)];
+			struct erf_read_request *reqs = [reqdata mutableBytes];
+			size_t nreqs = 0;
+			
+			for (NSString *c in contents)
+			{
+				const char *cname = [c cStringUsingEncoding:NSASCIIStringEncoding];
+				struct erf_read_request *req = &reqs[nreqs];
+				
+				if (!cname || [res objectForKey:c] || [found containsObject:c])
+					continue;
+				if (erf_find(index, cname, &req->file))
+					continue;
+				
+				NSMutableData *buf = [NSMutableData dataWithLength:req->file.compression == ERF_COMP_NONE ? 0 : req->file.unpacked_length];
+				
+				req->buf = [buf mutableBytes];
+				req->buflen = [buf length];
+				[bufs addObject:buf];
+				[found addObject:c];
+				nreqs++;
+			}
+			
+			/* Compressed entries are inflated in parallel. */
+			erf_file_read_batch(reqs, nreqs);
+			
+			for (size_t i = 0 ; i < nreqs ; i++)
+			{
+				if (reqs[i].error)
+					continue;
+				if (reqs[i].out == reqs[i].file.data)
+					[res setObject:[NSData dataWithBytes:reqs[i].out length:reqs[i].outlen] forKey:[found objectAtIndex:i]];
+				else
+				{
+					NSMutableData *buf = [bufs objectAtIndex:i];
+					
+					[buf setLength:reqs[i].outlen];
+					[res setObject:buf forKey:[found objectAtIndex:i]];
+				}
+			}
+			erf_index_free(index);
 		}
 	}
 	return res;
 }
 
+- (NSString*)consolidated
+{
+	return [[(NSXMLElement*)self.node attributeForName:@"consolidated"] stringValue];
+}
+
+- (void)setConsolidated:(NSString *)value
+{
+	NSXMLElement *elem = (NSXMLElement*)self.node;
+	
+	if (!elem)
+		return;
+	
+	[elem removeAttributeForName:@"consolidated"];
+	if (value)
+		[elem addAttribute:[NSXMLNode attributeWithName:@"consolidated" stringValue:value]];
+	
+	/* Not part of the model, so touch the node to get the store saved. */
+	self.node = elem;
+}
+
 @end
 
 
@@ -297,16 +381,41 @@ static NSPredicate *isERF;
 	return res;
 }
 
+- (void)replaceProperty:(NSString*)name with:(NSString*)repTo inString:(NSMutableString*)str
+{
+	NSString *repFrom = [NSString stringWithFormat:@"%%%@%%", name];
+	NSString *secStart = [NSString stringWithFormat:@"%%?%@%%", name];
+	NSString *secEnd = [NSString stringWithFormat:@"%%!%@%%", name];
+	
+	[str replaceOccurrencesOfString:repFrom withString:repTo options:0 range:NSMakeRange(0, [str length])];
+	if ([repTo length])
+	{
+		[str replaceOccurrencesOfString:secStart withString:@"" options:0 range:NSMakeRange(0, [str length])];
+		[str replaceOccurrencesOfString:secEnd withString:@"" options:0 range:NSMakeRange(0, [str length])];
+	}
+	else
+	{
+		while (1)
+		{
+			NSRange rs = [str rangeOfString:secStart];
+			NSRange re = [str rangeOfString:secEnd];
+			
+			if (rs.location == NSNotFound || re.location == NSNotFound || re.location < rs.location)
+				break;
+			
+			rs.length = re.location + re.length - rs.location;
+			[str deleteCharactersInRange:rs];
+		}
+	}
+}
+
 - (NSMutableString*)replaceProperties:(NSMutableString*)str
 {
 	NSEntityDescription *textEntity = [NSEntityDescription entityForName:@"Text" inManagedObjectContext:[self managedObjectContext]];
 	
 	for (NSPropertyDescription *prop in [self entity])
 	{
-		NSString *repFrom = [NSString stringWithFormat:@"%%%@%%", [prop name]];
 		NSString *repTo = nil;
-		NSString *secStart = [NSString stringWithFormat:@"%%?%@%%", [prop name]];
-		NSString *secEnd = [NSString stringWithFormat:@"%%!%@%%", [prop name]];
 
 		if ([[prop class] isSubclassOfClass:[NSRelationshipDescription class]])
 		{
@@ -387,30 +496,14 @@ static NSPredicate *isERF;
 		}
 		
 		if (repTo)
-		{
-			[str replaceOccurrencesOfString:repFrom withString:repTo options:0 range:NSMakeRange(0, [str length])];
-			if ([repTo length])
-			{
-				[str replaceOccurrencesOfString:secStart withString:@"" options:0 range:NSMakeRange(0, [str length])];
-				[str replaceOccurrencesOfString:secEnd withString:@"" options:0 range:NSMakeRange(0, [str length])];
-			}
-			else
-			{
-				while (1)
-				{
-					NSRange rs = [str rangeOfString:secStart];
-					NSRange re = [str rangeOfString:secEnd];
-					
-					if (rs.location == NSNotFound || re.location == NSNotFound || re.location < rs.location)
-						break;
-					
-					rs.length = re.location + re.length - rs.location;
-					[str deleteCharactersInRange:rs];
-				}
-			}
-		}
+			[self replaceProperty:[prop name] with:repTo inString:str];
 	}
 	
+	/* Not in the model, but useful for the details page. */
+	[self replaceProperty:@"consolidated" with:[self isConsolidated] ? @"1" : @"" inString:str];
+	[self replaceProperty:@"canConsolidate" with:[self canConsolidate] ? @"1" : @"" inString:str];
+	[self replaceProperty:@"canExport" with:[self canExport] ? @"1" : @"" inString:str];
+	
 	NSString *secStart = [NSString stringWithFormat:@"%%?%@%%", [[self entity] name]];
 	NSString *secEnd = [NSString stringWithFormat:@"%%!%@%%", [[self entity] name]];
 
@@ -473,28 +566,32 @@ static NSPredicate *isERF;
 	if (!cachedDetails)
 		return nil;
 	
+	AddInsList *list = [AddInsList sharedAddInsList];
+	NSString *conflicts = [list describeConflicts:[list conflictsForItem:self]];
+	[self replaceProperty:@"conflicts" with:conflicts ? conflicts : @"" inString:cachedDetails];
+	
 	return [self replaceProperties:cachedDetails];
 }
 
 - (NSMutableString*)galleryHTMLWithContents:(NSDictionary**)outContents
 {
-	NSError *err = nil;
-	NSFetchRequest *req = [[[self entity] managedObjectModel] fetchRequestFromTemplateWithName:@"contentsOfTypeForItem" substitutionVariables:[NSDictionary dictionaryWithObjectsAndKeys:@".dds", @"type", self, @"item", nil]];
-	NSArray *images = [[self managedObjectContext] executeFetchRequest:req error:&err];
+	NSSet *paths = self.modazipin.paths;
+	NSDictionary *images = [[[AddInsList sharedAddInsList] contentTable] contentsWithExtension:@".dds" inPaths:[[paths valueForKey:@"path"] allObjects]];
 	
 	NSMutableString *res = [NSMutableString stringWithString:@"<html><body style='color: #b7a266;'>"];
 	/*XXX NSMapTable*/NSMutableDictionary *pcmap = [NSMutableDictionary dictionary];
 	
-	for (NSManagedObject *image in images)
+	for (Path *p in paths)
 	{
-		Path *p = [image valueForKey:@"path"];
-		NSString *name = [image valueForKey:@"name"];
-		NSMutableArray *a = [pcmap objectForKey:p.path];
+		NSArray *names = [images objectForKey:p.path];
 		
-		if (a)
-			[a addObject:name];
-		else
-			[pcmap setObject:[NSMutableArray arrayWithObjects:p, name, nil] forKey:p.path];
+		if (names)
+		{
+			NSMutableArray *a = [NSMutableArray arrayWithObject:p];
+			
+			[a addObjectsFromArray:names];
+			[pcmap setObject:a forKey:p.path];
+		}
 	}
 	
 	for (NSString *path in [pcmap allKeys])
@@ -584,6 +681,41 @@ static NSPredicate *isERF;
 	return [[self valueForKey:@"configSections"] count] > 0;
 }
 
+- (BOOL)isConsolidated
+{
+	for (Path *p in self.modazipin.paths)
+	{
+		if (p.consolidated)
+			return YES;
+	}
+	return NO;
+}
+
+- (BOOL)canConsolidate
+{
+	/* Only loose override folders. Config options are applied by linking files, which needs them loose. */
+	if (![[[self entity] name] isEqualToString:@"OverrideItem"] || [self hasConfigSections])
+		return NO;
+	
+	for (Path *p in self.modazipin.paths)
+	{
+		if ([p.type isEqualToString:@"dir"] && !p.consolidated)
+			return YES;
+	}
+	return NO;
+}
+
+- (BOOL)canExport
+{
+	NSString *entity = [[self entity] name];
+	
+	if (![entity isEqualToString:@"AddInItem"] && ![entity isEqualToString:@"OfferItem"])
+		return NO;
+	
+	return [[[self objectID] persistentStore] isKindOfClass:[AddInsListStore class]]
+		|| [[[self objectID] persistentStore] isKindOfClass:[OfferListStore class]];
+}
+
 - (NSView*)configView
 {
 	if (!configView)
@@ -766,7 +898,7 @@ static NSPredicate *isERF;
 - (IBAction)valueChanged:(id)sender
 {
 	/* XXX layering violation */
-	[[AddInsList sharedAddInsList] saveDocument:self];
+	[[AddInsList sharedAddInsList] scheduleSave];
 }
 
 @end
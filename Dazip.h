@@ -24,6 +24,8 @@
 
 #import "DetailsDelegate.h"
 
+@class AddInsList;
+
 @interface Dazip : NSPersistentDocument {
 	IBOutlet WebView *detailsView;
 	IBOutlet DetailsDelegate *detailsDelegate;
@@ -34,5 +36,7 @@
 - (void)detailsCommand:(NSString*)command;
 
 - (IBAction)install:(id)sender;
+- (void)answerContentsConflict:(NSWindow *)sheet returnCode:(NSInteger)returnCode contextInfo:(void *)contextInfo;
+- (void)installIntoList:(AddInsList*)list;
 
 @end
@@ -43,6 +43,15 @@
 }
 #endif
 
+/* Installing is what dazips are opened for, so keep what's decompressed for that. */
+- (BOOL)configurePersistentStoreCoordinatorForURL:(NSURL *)url ofType:(NSString *)fileType modelConfiguration:(NSString *)configuration storeOptions:(NSDictionary *)storeOptions error:(NSError **)error
+{
+	NSMutableDictionary *options = [NSMutableDictionary dictionaryWithDictionary:storeOptions];
+	
+	[options setObject:[NSNumber numberWithBool:YES] forKey:ArchiveStoreSpoolOption];
+	return [super configurePersistentStoreCoordinatorForURL:url ofType:fileType modelConfiguration:configuration storeOptions:options error:error];
+}
+
 - (NSString *)persistentStoreTypeForFileType:(NSString *)fileType
 {
 	/*
@@ -171,6 +180,42 @@
 		return;
 	}
 	
+	ArchiveStore *store = (ArchiveStore*)[[[arr objectAtIndex:0] objectID] persistentStore];
+	NSDictionary *conflicts = [list conflictsForContents:store.contents];
+	
+	if ([conflicts count])
+	{
+		NSBeginAlertSheet(@"Conflicting contents",
+						  @"Install",
+						  @"Cancel",
+						  nil,
+						  [self windowForSheet],
+						  self,
+						  @selector(answerContentsConflict:returnCode:contextInfo:),
+						  NULL,
+						  NULL,
+						  @"Some files in this addin are also provided by other enabled addins: %@. Only one of them will be used by the game. Install anyway?",
+						  [list describeConflicts:conflicts]);
+		return;
+	}
+	
+	[self installIntoList:list];
+}
+
+- (void)answerContentsConflict:(NSWindow *)sheet returnCode:(NSInteger)returnCode contextInfo:(void *)contextInfo
+{
+	if (returnCode != NSAlertDefaultReturn)
+		return;
+	
+	/* Let the sheet go away before the install progress window comes up. */
+	[sheet orderOut:self];
+	[self installIntoList:[AddInsList sharedAddInsList]];
+}
+
+- (void)installIntoList:(AddInsList*)list
+{
+	NSError *err;
+	NSArray *arr = [[self managedObjectContext] executeFetchRequest:[[self managedObjectModel] fetchRequestTemplateForName:@"allItems"] error:&err];
 	ArchiveStore *store = (ArchiveStore*)[[[arr objectAtIndex:0] objectID] persistentStore];
 	DAArchive *archive = [[store archiveClass] archiveForReadingFromURL:[self fileURL] encoding:NSWindowsCP1252StringEncoding error:&err];
 	
@@ -180,7 +225,7 @@
 		return;
 	}
 	
-	if (![list installItems:[arr valueForKey:@"node"] withArchive:archive name:[[self fileURL] lastPathComponent] uncompressedSize:store.uncompressedSize error:&err])
+	if (![list installItems:[arr valueForKey:@"node"] withArchive:archive spool:store.spool name:[[self fileURL] lastPathComponent] uncompressedSize:store.uncompressedSize error:&err])
 	{
 		[self presentError:err];
 		return;
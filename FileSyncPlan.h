@@ -0,0 +1,48 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+/*
+ * A batch of file moves and hard link swaps, planned on the main thread and
+ * performed in one go somewhere else. The file system is only looked at when
+ * performing, so planning is cheap. Each operation gets its completion block
+ * called on the main thread afterwards, with the error if it failed.
+ */
+@interface FileSyncPlan : NSObject
+{
+	NSMutableArray *operations;
+}
+
+/* Moves from to to unless to already exists. Nothing is done if from is missing as well. */
+- (void)moveFromURL:(NSURL*)from toURL:(NSURL*)to completion:(void (^)(BOOL done, NSError *error))completion;
+/* Replaces link with a hard link to target, unless it already is one. */
+- (void)linkURL:(NSURL*)link toURL:(NSURL*)target completion:(void (^)(BOOL done, NSError *error))completion;
+
+@property(readonly) NSUInteger count;
+
+/*
+ * Performs the operations in order, then calls the completions on the main
+ * thread. Returns the errors of the ones that failed, empty if none did.
+ */
+- (NSArray*)perform;
+
+@end
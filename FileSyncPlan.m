@@ -0,0 +1,191 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import "FileSyncPlan.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum
+{
+	SYNC_MOVE,
+	SYNC_LINK
+};
+
+@interface FileSyncOperation : NSObject
+{
+@public
+	int kind;
+	NSURL *from, *to;
+	void (^completion)(BOOL done, NSError *error);
+	BOOL done;
+	NSError *error;
+}
+@end
+
+@implementation FileSyncOperation
+@end
+
+static NSError *
+syncError(int eno, NSString *fmt, NSURL *url)
+{
+	NSString *msg = [NSString stringWithFormat:fmt, [url path]];
+	
+	return [NSError errorWithDomain:NSPOSIXErrorDomain code:eno userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+																		  msg, NSLocalizedDescriptionKey,
+																		  [NSString stringWithUTF8String:strerror(eno)], NSLocalizedFailureReasonErrorKey,
+																		  url, NSURLErrorKey,
+																		  nil]];
+}
+
+@implementation FileSyncPlan
+
+- (id)init
+{
+	self = [super init];
+	if (self)
+		operations = [NSMutableArray array];
+	return self;
+}
+
+- (void)add:(int)kind from:(NSURL*)from to:(NSURL*)to completion:(void (^)(BOOL done, NSError *error))completion
+{
+	FileSyncOperation *op = [[FileSyncOperation alloc] init];
+	
+	op->kind = kind;
+	op->from = from;
+	op->to = to;
+	op->completion = [completion copy];
+	[operations addObject:op];
+}
+
+- (void)moveFromURL:(NSURL*)from toURL:(NSURL*)to completion:(void (^)(BOOL done, NSError *error))completion
+{
+	[self add:SYNC_MOVE from:from to:to completion:completion];
+}
+
+- (void)linkURL:(NSURL*)link toURL:(NSURL*)target completion:(void (^)(BOOL done, NSError *error))completion
+{
+	[self add:SYNC_LINK from:target to:link completion:completion];
+}
+
+- (NSUInteger)count
+{
+	return [operations count];
+}
+
+- (void)performMove:(FileSyncOperation*)op
+{
+	struct stat st;
+	NSError *err = nil;
+	
+	if (!lstat([[op->to path] fileSystemRepresentation], &st))
+		return;
+	
+	if (lstat([[op->from path] fileSystemRepresentation], &st))
+	{
+		/* Missing from both places, which will show up as missing files. */
+		if (errno != ENOENT)
+			op->error = syncError(errno, @"Could not look at \"%@\".", op->from);
+		return;
+	}
+	
+	[[NSFileManager defaultManager] createDirectoryAtURL:[op->to URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+	if (![[NSFileManager defaultManager] moveItemAtURL:op->from toURL:op->to error:&err])
+	{
+		op->error = err;
+		return;
+	}
+	op->done = YES;
+}
+
+- (void)performLink:(FileSyncOperation*)op
+{
+	const char *targetPath = [[op->from path] fileSystemRepresentation];
+	const char *linkPath = [[op->to path] fileSystemRepresentation];
+	struct stat tst, lst;
+	
+	if (stat(targetPath, &tst))
+	{
+		op->error = syncError(errno, @"Could not find \"%@\".", op->from);
+		return;
+	}
+	if (!stat(linkPath, &lst) && lst.st_dev == tst.st_dev && lst.st_ino == tst.st_ino)
+		return;
+	
+	/* Link next to it and rename over, so that there's always a file there. */
+	char *tmp;
+	if (asprintf(&tmp, "%s.modazipin-link", linkPath) < 0)
+	{
+		op->error = syncError(ENOMEM, @"Could not link \"%@\".", op->to);
+		return;
+	}
+	
+	unlink(tmp);
+	if (link(targetPath, tmp) || rename(tmp, linkPath))
+	{
+		op->error = syncError(errno, @"Could not link \"%@\".", op->to);
+		unlink(tmp);
+	}
+	else
+		op->done = YES;
+	free(tmp);
+}
+
+- (NSArray*)perform
+{
+	NSMutableArray *failed = [NSMutableArray array];
+	
+	for (FileSyncOperation *op in operations)
+	{
+		@autoreleasepool
+		{
+			switch (op->kind)
+			{
+				case SYNC_MOVE:
+					[self performMove:op];
+					break;
+				case SYNC_LINK:
+					[self performLink:op];
+					break;
+			}
+			if (op->error)
+				[failed addObject:op->error];
+		}
+	}
+	
+	NSArray *ops = operations;
+	operations = [NSMutableArray array];
+	dispatch_async(dispatch_get_main_queue(), ^{
+		for (FileSyncOperation *op in ops)
+		{
+			if (op->completion)
+				op->completion(op->done, op->error);
+		}
+	});
+	return failed;
+}
+
+@end
@@ -21,8 +21,21 @@
 
 #import "FolderArchive.h"
 
+#include <errno.h>
+#include <unistd.h>
+
+#include "filecopy.h"
+
 static NSArray *resourceKeys;
 
+static void
+copy_progress(void *ctx, uint64_t bytes)
+{
+	ArchiveWrapper *wrapper = (__bridge ArchiveWrapper*)ctx;
+	
+	[wrapper addProgressIn:(int64_t)bytes out:(int64_t)bytes];
+}
+
 @implementation FolderArchiveMember
 
 - (id)initWithWrapper:(FolderArchive*)w URL:(NSURL*)u level:(NSUInteger)l encoding:(NSStringEncoding)enc error:(NSError**)error
@@ -116,9 +129,27 @@ static NSArray *resourceKeys;
 	
 	if (wrapper)
 		wrapper.uncompressedOffset += [data length];
+	[wrapper addProgressIn:(int64_t)[data length] out:(int64_t)[data length]];
 	return data != nil;
 }
 
+- (BOOL)readDataUsingBlock:(BOOL (^)(const void *bytes, size_t length))block error:(NSError**)error
+{
+	if (!url)
+		return [super readDataUsingBlock:block error:error];
+	
+	/* Mapped, so only what the block looks at is read. */
+	NSData *mapped = data ? data : [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:error];
+	
+	if (!mapped)
+		return NO;
+	
+	block([mapped bytes], [mapped length]);
+	if (error)
+		*error = nil;
+	return YES;
+}
+
 - (BOOL)skipDataWithError:(NSError **)error
 {
 	if (!url)
@@ -141,14 +172,52 @@ static NSArray *resourceKeys;
 	return YES;
 }
 
+/*
+ * Regular files are cloned or linked when possible, otherwise copied by the
+ * kernel. Any fetched data is only used for hashing then.
+ */
 - (BOOL)extractToURL:(NSURL *)dst createDirectories:(BOOL)create error:(NSError **)error
 {
-	if (url && !data && dataAvailable)
+	if (!url)
+		return [super extractToURL:dst createDirectories:create error:error];
+	
+	if (!dataAvailable)
 	{
-		if (![self fetchDataWithError:error])
+		if (error)
+			*error = nil;
+		return NO;
+	}
+	
+	if (![[resources objectForKey:NSURLIsRegularFileKey] boolValue])
+	{
+		if (!data && ![self fetchDataWithError:error])
 			return NO;
+		return [super extractToURL:dst createDirectories:create error:error];
 	}
-	return [super extractToURL:dst createDirectories:create error:error];
+	
+	if (create)
+	{
+		NSURL *dir = [dst URLByDeletingLastPathComponent];
+		
+		if (![dir checkResourceIsReachableAndReturnError:nil]
+			&& ![[NSFileManager defaultManager] createDirectoryAtPath:[dir path] withIntermediateDirectories:YES attributes:nil error:error])
+			return NO;
+	}
+	
+	unlink([[dst path] fileSystemRepresentation]);
+	if (filecopy_file([[url path] fileSystemRepresentation], [[dst path] fileSystemRepresentation], FILECOPY_ALLOW_LINK,
+					  data ? NULL : copy_progress, (__bridge void*)wrapper) < 0)
+	{
+		if (error)
+			*error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:[NSDictionary dictionaryWithObject:dst forKey:NSURLErrorKey]];
+		return NO;
+	}
+	
+	if (!data && wrapper)
+		wrapper.uncompressedOffset += [[resources objectForKey:NSURLFileSizeKey] longLongValue];
+	if (error)
+		*error = nil;
+	return YES;
 }
 
 @end
@@ -180,6 +249,7 @@ static NSArray *resourceKeys;
 											  includingPropertiesForKeys:resourceKeys
 																 options:NSDirectoryEnumerationSkipsHiddenFiles
 															errorHandler:^(NSURL *u, NSError *err) { if (errPtr) *errPtr = err; return NO; }];
+			URL = url;
 			encoding = enc;
 		}
 	}
@@ -0,0 +1,51 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+struct fswatch;
+
+/*
+ * Watches a folder and calls the handler on the main thread with the paths
+ * changed. Events are collected until there's been none for delay seconds,
+ * but no longer than a few times that.
+ */
+@interface FolderWatcher : NSObject
+{
+	NSURL *URL;
+	NSTimeInterval delay;
+	void (^handler)(NSSet *paths);
+	
+	struct fswatch *watch;
+	NSMutableSet *changed;
+	CFAbsoluteTime firstChange, lastChange;
+	BOOL scheduled;
+}
+
+- (id)initWithURL:(NSURL*)url delay:(NSTimeInterval)delay handler:(void (^)(NSSet *paths))handler;
+
+- (BOOL)start;
+- (void)stop;
+
+- (void)noteChange:(NSString*)path;
+
+@end
@@ -0,0 +1,126 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import "FolderWatcher.h"
+
+#include "fswatch.h"
+
+/* Don't hold events longer than this many times the delay. */
+#define MAX_DELAY_FACTOR 5
+
+static void
+watchCallback(void *ctx, const char *path)
+{
+	@autoreleasepool
+	{
+		NSString *p = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:path length:strlen(path)];
+		
+		if (p)
+			[(__bridge FolderWatcher*)ctx noteChange:p];
+	}
+}
+
+@implementation FolderWatcher
+
+- (id)initWithURL:(NSURL*)url delay:(NSTimeInterval)d handler:(void (^)(NSSet *paths))h
+{
+	self = [super init];
+	if (self)
+	{
+		URL = url;
+		delay = d;
+		handler = [h copy];
+		changed = [NSMutableSet set];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	fswatch_stop(watch);
+}
+
+- (BOOL)start
+{
+	if (!watch)
+		watch = fswatch_start([[URL path] fileSystemRepresentation], delay / 2, watchCallback, (__bridge void*)self);
+	return watch != NULL;
+}
+
+- (void)stop
+{
+	fswatch_stop(watch);
+	watch = NULL;
+	
+	@synchronized(changed)
+	{
+		[changed removeAllObjects];
+	}
+}
+
+- (void)noteChange:(NSString*)path
+{
+	@synchronized(changed)
+	{
+		[changed addObject:path];
+		lastChange = CFAbsoluteTimeGetCurrent();
+		if (scheduled)
+			return;
+		scheduled = YES;
+		firstChange = lastChange;
+	}
+	
+	[self scheduleFire:delay];
+}
+
+- (void)scheduleFire:(NSTimeInterval)after
+{
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(after * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+		[self fire];
+	});
+}
+
+- (void)fire
+{
+	NSSet *paths;
+	
+	@synchronized(changed)
+	{
+		CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+		
+		/* Still changing, wait some more. */
+		if (now - lastChange < delay && now - firstChange < delay * MAX_DELAY_FACTOR)
+		{
+			[self scheduleFire:delay - (now - lastChange)];
+			return;
+		}
+		
+		paths = [changed copy];
+		[changed removeAllObjects];
+		scheduled = NO;
+	}
+	
+	if ([paths count])
+		handler(paths);
+}
+
+@end
@@ -20,6 +20,7 @@
  */
 
 #import "Game.h"
+#import "AddInsList.h"
 
 
 @implementation Game
@@ -157,6 +158,13 @@ static Game *sharedGame = nil;
 		NSError *err;
 		NSRunningApplication *running;
 		
+		/* The game should see the latest enabled state, on disk. */
+		if (![[AddInsList sharedAddInsList] waitForFileSync:&err])
+		{
+			[NSApp presentError:err];
+			return;
+		}
+		
 		url = [url URLByAppendingPathComponent:@"Contents/MacOS/cider"];
 		running = [[NSWorkspace sharedWorkspace] launchApplicationAtURL:url options:NSWorkspaceLaunchDefault configuration:nil error:&err];
 		
@@ -0,0 +1,92 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+@class AddInsList;
+
+/*
+ * One dazip of a batch. Only plain values are kept from the manifest, so
+ * the archive's store can be closed as soon as it's been read.
+ */
+@interface InstallBatchEntry : NSObject
+{
+	NSURL *URL;
+	NSString *storeType;
+	Class archiveClass;
+	
+	NSString *title;
+	NSString *UID;
+	NSArray *nodes;
+	NSArray *UIDs;
+	NSArray *paths;
+	NSSet *contents;
+	int64_t uncompressedSize;
+	
+	NSString *problem;
+	NSString *warning;
+}
+
+- (id)initWithURL:(NSURL*)url;
+
+- (BOOL)readWithModel:(NSManagedObjectModel*)model error:(NSError**)error;
+
+@property(readonly) NSURL *URL;
+@property(readonly) Class archiveClass;
+@property(readonly) NSString *title;
+@property(readonly) NSString *UID;
+@property(readonly) NSArray *nodes;
+@property(readonly) int64_t uncompressedSize;
+
+/* Why it won't be installed, nil if it will. */
+@property(copy) NSString *problem;
+/* Content conflicts that don't stop it from being installed. */
+@property(copy) NSString *warning;
+
+@end
+
+
+/*
+ * Dazips to install together. All the manifests are read first and checked
+ * against the installed items and against each other, earlier dazips
+ * winning, so that nothing is extracted for a dazip that would be refused.
+ */
+@interface InstallBatch : NSObject
+{
+	NSArray *entries;
+}
+
+- (id)initWithURLs:(NSArray*)urls;
+
+/* Reads several manifests at a time, can be called from any thread. */
+- (void)readManifestsWithModel:(NSManagedObjectModel*)model;
+
+/* Looks at the list's context, so only from the main thread. */
+- (void)checkAgainstList:(AddInsList*)list;
+
+@property(readonly) NSArray *entries;
+/* The entries without problems, in the order given. */
+@property(readonly) NSArray *accepted;
+@property(readonly) int64_t uncompressedSize;
+
+- (NSString*)describe;
+
+@end
@@ -0,0 +1,301 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import "InstallBatch.h"
+#import "AddInsList.h"
+#import "DataStore.h"
+#import "DataStoreObject.h"
+
+@interface InstallBatchEntry (Checking)
+
+- (NSArray*)conflictsInList:(AddInsList*)list template:(NSString*)name values:(NSArray*)values key:(NSString*)key;
+
+@property(readonly) NSArray *UIDs;
+@property(readonly) NSArray *paths;
+@property(readonly) NSSet *contents;
+
+@end
+
+@implementation InstallBatchEntry
+
+@synthesize URL, archiveClass, title, UID, nodes, uncompressedSize, problem, warning;
+
+- (id)initWithURL:(NSURL*)url
+{
+	self = [super init];
+	if (self)
+	{
+		URL = url;
+		if ([[url pathExtension] caseInsensitiveCompare:@"daoverride"] == NSOrderedSame)
+			storeType = @"OverrideStore";
+		else
+			storeType = @"DazipStore";
+		title = [url lastPathComponent];
+	}
+	return self;
+}
+
+- (BOOL)readWithModel:(NSManagedObjectModel*)model error:(NSError**)error
+{
+	NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+	NSDictionary *options = [NSDictionary dictionaryWithObject:[NSNumber numberWithBool:YES] forKey:NSReadOnlyPersistentStoreOption];
+	ArchiveStore *store = (ArchiveStore*)[psc addPersistentStoreWithType:storeType configuration:nil URL:URL options:options error:error];
+	
+	if (!store)
+		return NO;
+	
+	NSManagedObjectContext *moc = [[NSManagedObjectContext alloc] init];
+	[moc setPersistentStoreCoordinator:psc];
+	
+	NSArray *items = [moc executeFetchRequest:[model fetchRequestTemplateForName:@"allItems"] error:error];
+	NSArray *allPaths = nil;
+	
+	if (items)
+		allPaths = [moc executeFetchRequest:[model fetchRequestTemplateForName:@"allPaths"] error:error];
+	
+	if ([items count] && allPaths)
+	{
+		Item *first = [items objectAtIndex:0];
+		NSMutableArray *copies = [NSMutableArray arrayWithCapacity:[items count]];
+		
+		/* Detached from the store's document, which goes away with it. */
+		for (Item *item in items)
+			[copies addObject:[item.node copy]];
+		nodes = copies;
+		
+		if ([first.Title.localizedValue length])
+			title = first.Title.localizedValue;
+		UID = first.UID;
+		UIDs = [items valueForKey:@"UID"];
+		paths = [allPaths valueForKey:@"path"];
+		contents = store.contents;
+		uncompressedSize = store.uncompressedSize;
+		archiveClass = [store archiveClass];
+	}
+	else if (items && allPaths)
+		self.problem = @"there are no items in the manifest";
+	
+	[moc reset];
+	[psc removePersistentStore:store error:nil];
+	return items && allPaths;
+}
+
+@end
+
+
+@implementation InstallBatchEntry (Checking)
+
+/* Installed items matching any of the UIDs, or paths, of this entry. */
+- (NSArray*)conflictsInList:(AddInsList*)list template:(NSString*)name values:(NSArray*)values key:(NSString*)key
+{
+	NSFetchRequest *fetch = [[list managedObjectModel] fetchRequestFromTemplateWithName:name substitutionVariables:[NSDictionary dictionaryWithObject:values forKey:key]];
+	
+	return [[list managedObjectContext] executeFetchRequest:fetch error:nil];
+}
+
+- (NSArray*)UIDs
+{
+	return UIDs;
+}
+
+- (NSArray*)paths
+{
+	return paths;
+}
+
+- (NSSet*)contents
+{
+	return contents;
+}
+
+@end
+
+
+@implementation InstallBatch
+
+@synthesize entries;
+
+- (id)initWithURLs:(NSArray*)urls
+{
+	self = [super init];
+	if (self)
+	{
+		NSMutableArray *arr = [NSMutableArray arrayWithCapacity:[urls count]];
+		
+		for (NSURL *url in urls)
+			[arr addObject:[[InstallBatchEntry alloc] initWithURL:url]];
+		entries = arr;
+	}
+	return self;
+}
+
+- (void)readManifestsWithModel:(NSManagedObjectModel*)model
+{
+	NSArray *arr = entries;
+	
+	/* Each entry gets a coordinator of its own, so they don't block each other. */
+	dispatch_apply([arr count], dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+		@autoreleasepool
+		{
+			InstallBatchEntry *entry = [arr objectAtIndex:i];
+			NSError *err = nil;
+			
+			if (![entry readWithModel:model error:&err])
+				entry.problem = err ? [err localizedDescription] : @"it could not be read";
+		}
+	});
+}
+
+/*
+ * Same checks as when installing a single dazip, except that instead of
+ * asking about content conflicts they're collected for the summary. Every
+ * entry is also checked against the ones before it that were accepted.
+ */
+- (void)checkAgainstList:(AddInsList*)list
+{
+	NSMutableDictionary *claimedUIDs = [NSMutableDictionary dictionary];
+	NSMutableDictionary *claimedPaths = [NSMutableDictionary dictionary];
+	NSMutableDictionary *claimedContents = [NSMutableDictionary dictionary];
+	
+	for (InstallBatchEntry *entry in entries)
+	{
+		if (entry.problem)
+			continue;
+		
+		NSArray *conflict = [entry conflictsInList:list template:@"itemsWithUIDs" values:entry.UIDs key:@"UIDs"];
+		if ([conflict count])
+		{
+			Item *other = [conflict objectAtIndex:0];
+			
+			entry.problem = [NSString stringWithFormat:@"it conflicts with \"%@\"", other.Title.localizedValue];
+			continue;
+		}
+		
+		conflict = [entry conflictsInList:list template:@"itemsWithPaths" values:entry.paths key:@"paths"];
+		if ([conflict count])
+		{
+			Item *other = [conflict objectAtIndex:0];
+			
+			entry.problem = [NSString stringWithFormat:@"it contains items also contained by \"%@\"", other.Title.localizedValue];
+			continue;
+		}
+		
+		for (NSString *uid in entry.UIDs)
+		{
+			InstallBatchEntry *other = [claimedUIDs objectForKey:[uid lowercaseString]];
+			
+			if (other)
+			{
+				entry.problem = [NSString stringWithFormat:@"it conflicts with \"%@\"", other.title];
+				break;
+			}
+		}
+		for (NSString *path in entry.paths)
+		{
+			InstallBatchEntry *other = entry.problem ? nil : [claimedPaths objectForKey:[path lowercaseString]];
+			
+			if (other)
+			{
+				entry.problem = [NSString stringWithFormat:@"it contains items also contained by \"%@\"", other.title];
+				break;
+			}
+		}
+		if (entry.problem)
+			continue;
+		
+		NSMutableArray *warnings = [NSMutableArray array];
+		NSDictionary *conflicts = [list conflictsForContents:entry.contents];
+		NSMutableSet *others = [NSMutableSet set];
+		
+		if ([conflicts count])
+			[warnings addObject:[list describeConflicts:conflicts]];
+		
+		for (NSString *content in entry.contents)
+		{
+			NSString *key = [content lowercaseString];
+			InstallBatchEntry *other = [claimedContents objectForKey:key];
+			
+			if (other)
+				[others addObject:other.title];
+			else
+				[claimedContents setObject:entry forKey:key];
+		}
+		for (NSString *other in [[others allObjects] sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)])
+			[warnings addObject:[NSString stringWithFormat:@"%@ (also in this batch)", other]];
+		if ([warnings count])
+			entry.warning = [warnings componentsJoinedByString:@", "];
+		
+		for (NSString *uid in entry.UIDs)
+			[claimedUIDs setObject:entry forKey:[uid lowercaseString]];
+		for (NSString *path in entry.paths)
+			[claimedPaths setObject:entry forKey:[path lowercaseString]];
+	}
+}
+
+- (NSArray*)accepted
+{
+	NSMutableArray *arr = [NSMutableArray arrayWithCapacity:[entries count]];
+	
+	for (InstallBatchEntry *entry in entries)
+	{
+		if (!entry.problem)
+			[arr addObject:entry];
+	}
+	return arr;
+}
+
+- (int64_t)uncompressedSize
+{
+	int64_t sz = 0;
+	
+	for (InstallBatchEntry *entry in self.accepted)
+		sz += entry.uncompressedSize;
+	return sz;
+}
+
+- (NSString*)describe
+{
+	NSMutableArray *skipped = [NSMutableArray array];
+	NSMutableArray *warned = [NSMutableArray array];
+	NSUInteger n = 0;
+	
+	for (InstallBatchEntry *entry in entries)
+	{
+		if (entry.problem)
+			[skipped addObject:[NSString stringWithFormat:@"%@: %@", entry.title, entry.problem]];
+		else
+		{
+			n++;
+			if (entry.warning)
+				[warned addObject:[NSString stringWithFormat:@"%@: %@", entry.title, entry.warning]];
+		}
+	}
+	
+	NSMutableString *str = [NSMutableString stringWithFormat:@"%lu of %lu %@ can be installed.", (unsigned long)n, (unsigned long)[entries count], [entries count] == 1 ? @"addin" : @"addins"];
+	
+	if ([skipped count])
+		[str appendFormat:@"\n\nThese will be skipped:\n%@", [skipped componentsJoinedByString:@"\n"]];
+	if ([warned count])
+		[str appendFormat:@"\n\nThese have files also provided by other addins, only one of which will be used by the game:\n%@", [warned componentsJoinedByString:@"\n"]];
+	return str;
+}
+
+@end
@@ -0,0 +1,71 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import <Cocoa/Cocoa.h>
+
+/*
+ * Counters for an install running in the background. The extracting threads
+ * only do atomic adds, the UI samples the counters on a timer, so nothing
+ * waits on the other. Cancelling is checked between members.
+ */
+@interface InstallProgress : NSObject
+{
+	volatile int64_t bytesIn;
+	volatile int64_t bytesOut;
+	volatile int32_t membersDone;
+	volatile int32_t cancelled;
+	
+	CFAbsoluteTime started;
+	
+	/* Only used from sample. */
+	CFAbsoluteTime sampledAt;
+	int64_t sampledBytes;
+	double bytesPerSecond;
+	
+	NSMutableArray *timings;
+}
+
+/* Archive bytes read and bytes written. Can be read from any thread. */
+@property(readonly) int64_t bytesIn;
+@property(readonly) int64_t bytesOut;
+@property(readonly) int32_t membersDone;
+
+/* Output rate between the last two samples. */
+@property(readonly) double bytesPerSecond;
+
+@property(readonly) BOOL isCancelled;
+
+- (void)cancel;
+
+/* From the extracting threads, as each piece is read and written. */
+- (void)addBytesIn:(int64_t)inBytes bytesOut:(int64_t)outBytes;
+
+/* From the extracting threads, when a member is done. Only counts it and keeps its timing for the summary. */
+- (void)finishMember:(NSString*)path bytes:(int64_t)bytes started:(CFAbsoluteTime)start;
+
+/* From the timer. */
+- (void)sample;
+
+/* Log the totals and the slowest members. */
+- (void)logSummaryForName:(NSString*)name;
+
+@end
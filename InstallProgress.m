@@ -0,0 +1,133 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#import "InstallProgress.h"
+
+#include <libkern/OSAtomic.h>
+
+/* How many of the slowest members are logged. */
+#define SUMMARY_MEMBERS 10
+
+@implementation InstallProgress
+
+- (id)init
+{
+	self = [super init];
+	if (self)
+	{
+		started = sampledAt = CFAbsoluteTimeGetCurrent();
+		timings = [NSMutableArray array];
+	}
+	return self;
+}
+
+- (int64_t)bytesIn
+{
+	return OSAtomicAdd64Barrier(0, &bytesIn);
+}
+
+- (int64_t)bytesOut
+{
+	return OSAtomicAdd64Barrier(0, &bytesOut);
+}
+
+- (int32_t)membersDone
+{
+	return OSAtomicAdd32Barrier(0, &membersDone);
+}
+
+@synthesize bytesPerSecond;
+
+- (BOOL)isCancelled
+{
+	return OSAtomicAdd32Barrier(0, &cancelled) != 0;
+}
+
+- (void)cancel
+{
+	OSAtomicCompareAndSwap32Barrier(0, 1, &cancelled);
+}
+
+- (void)addBytesIn:(int64_t)inBytes bytesOut:(int64_t)outBytes
+{
+	if (inBytes)
+		OSAtomicAdd64Barrier(inBytes, &bytesIn);
+	if (outBytes)
+		OSAtomicAdd64Barrier(outBytes, &bytesOut);
+}
+
+- (void)finishMember:(NSString*)path bytes:(int64_t)bytes started:(CFAbsoluteTime)start
+{
+	NSArray *timing = [NSArray arrayWithObjects:path, [NSNumber numberWithDouble:CFAbsoluteTimeGetCurrent() - start], [NSNumber numberWithLongLong:bytes], nil];
+	
+	OSAtomicIncrement32Barrier(&membersDone);
+	
+	/* Once per member, not worth avoiding the lock. */
+	@synchronized(timings)
+	{
+		[timings addObject:timing];
+	}
+}
+
+- (void)sample
+{
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+	int64_t bytes = self.bytesOut;
+	
+	/* Too short an interval just gives noise. */
+	if (now - sampledAt < 0.25)
+		return;
+	
+	[self willChangeValueForKey:@"bytesPerSecond"];
+	bytesPerSecond = (bytes - sampledBytes) / (now - sampledAt);
+	[self didChangeValueForKey:@"bytesPerSecond"];
+	
+	sampledAt = now;
+	sampledBytes = bytes;
+}
+
+- (void)logSummaryForName:(NSString*)name
+{
+	CFAbsoluteTime total = CFAbsoluteTimeGetCurrent() - started;
+	NSArray *slowest;
+	
+	@synchronized(timings)
+	{
+		slowest = [timings sortedArrayUsingComparator:^NSComparisonResult(NSArray *a, NSArray *b) {
+			return [[b objectAtIndex:1] compare:[a objectAtIndex:1]];
+		}];
+	}
+	
+	NSLog(@"Installed %@%@: %d members, %.1f MB read, %.1f MB written in %.2f s (%.1f MB/s)",
+		  name, self.isCancelled ? @" (cancelled)" : @"", self.membersDone,
+		  self.bytesIn / (1024.0 * 1024.0), self.bytesOut / (1024.0 * 1024.0), total,
+		  total > 0 ? self.bytesOut / (1024.0 * 1024.0) / total : 0.0);
+	
+	for (NSUInteger i = 0 ; i < [slowest count] && i < SUMMARY_MEMBERS ; i++)
+	{
+		NSArray *timing = [slowest objectAtIndex:i];
+		
+		NSLog(@"  %8.3f s %10lld bytes %@", [[timing objectAtIndex:1] doubleValue], [[timing objectAtIndex:2] longLongValue], [timing objectAtIndex:0]);
+	}
+}
+
+@end
@@ -0,0 +1,78 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import <Cocoa/Cocoa.h>
+#import "DAArchive.h"
+
+@class ContentHashStore;
+@class ArchiveSpool;
+@class InstallProgress;
+
+/*
+ * Installs files by first extracting them into a staging folder next to
+ * the game folders, then renaming them into place once everything is there.
+ * A failed extraction never touches the game folders, and a failed commit
+ * renames back what was already moved.
+ */
+@interface InstallStage : NSObject
+{
+	NSURL *baseURL;
+	NSURL *stagingURL;
+	ContentHashStore *hashStore;
+	
+	NSMutableArray *paths; /* Staged files, relative to both base and staging. */
+	NSMutableDictionary *digests; /* Lower case relative path -> digest, recorded on commit. */
+	InstallProgress *progress;
+}
+
+/* Left behind by a crash, nothing in them was installed. */
++ (void)removeStaleStagingBelowURL:(NSURL*)base;
+
+/* If the archive is a zip file, so that stageZipArchive: can be used. */
++ (BOOL)isZipArchive:(ArchiveWrapper*)archive;
+
+- (id)initWithBaseURL:(NSURL*)base hashStore:(ContentHashStore*)store error:(NSError**)error;
+
+/* Extract a member to be installed at path. Members must come in archive order. */
+- (BOOL)stageMember:(ArchiveMember*)member path:(NSString*)path error:(NSError**)error;
+
+/* Extract all members by enumerating the archive, for when nothing faster can be used. */
+- (BOOL)stageArchive:(DAArchive*)archive pathMap:(NSString *(^)(NSString *installPath))pathMap error:(NSError**)error;
+
+/*
+ * Extract all members of a zip archive, several at a time, using the central
+ * directory. pathMap gives the path to install each at.
+ */
+- (BOOL)stageZipArchive:(DAArchive*)archive pathMap:(NSString *(^)(NSString *installPath))pathMap error:(NSError**)error;
+
+/* Install what was kept when the archive was opened. */
+- (BOOL)stageSpool:(ArchiveSpool*)spool pathMap:(NSString *(^)(NSString *installPath))pathMap error:(NSError**)error;
+
+/*
+ * Where the stage methods count what they've done, and check if they should
+ * stop. Cancelling makes them fail with NSUserCancelledError.
+ */
+@property(readonly) InstallProgress *progress;
+
+- (BOOL)commit:(NSError**)error;
+- (void)rollback;
+
+@end
@@ -0,0 +1,534 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import "InstallStage.h"
+#import "ContentHashStore.h"
+#import "ArchiveSpool.h"
+#import "InstallProgress.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filecopy.h"
+#include "zipdir.h"
+
+/* Zip members larger than this are written straight to the file, and hashed afterwards. */
+#define MAX_MEMORY_MEMBER (64 * 1024 * 1024)
+
+#define STAGING_PREFIX @".modazipin-staging."
+
+static NSError *
+stageError(int eno, NSURL *url, NSString *msg)
+{
+	return [NSError errorWithDomain:NSPOSIXErrorDomain code:eno userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+																		  msg, NSLocalizedDescriptionKey,
+																		  [NSString stringWithUTF8String:strerror(eno)], NSLocalizedFailureReasonErrorKey,
+																		  url, NSURLErrorKey,
+																		  nil]];
+}
+
+static NSError *
+cancelledError(void)
+{
+	return [NSError errorWithDomain:NSCocoaErrorDomain code:NSUserCancelledError userInfo:nil];
+}
+
+static void
+copyProgress(void *ctx, uint64_t bytes)
+{
+	InstallProgress *progress = (__bridge InstallProgress*)ctx;
+	
+	[progress addBytesIn:(int64_t)bytes bytesOut:(int64_t)bytes];
+}
+
+static void
+zipProgress(void *ctx, uint64_t in, uint64_t out)
+{
+	InstallProgress *progress = (__bridge InstallProgress*)ctx;
+	
+	[progress addBytesIn:(int64_t)in bytesOut:(int64_t)out];
+}
+
+@implementation InstallStage
+
++ (void)removeStaleStagingBelowURL:(NSURL*)base
+{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	
+	for (NSString *name in [fm contentsOfDirectoryAtPath:[base path] error:nil])
+	{
+		if ([name hasPrefix:STAGING_PREFIX])
+			[fm removeItemAtURL:[base URLByAppendingPathComponent:name] error:nil];
+	}
+}
+
++ (BOOL)isZipArchive:(ArchiveWrapper*)archive
+{
+	int fd = open([[archive.URL path] fileSystemRepresentation], O_RDONLY);
+	struct zipdir *zd;
+	
+	if (fd < 0)
+		return NO;
+	
+	zd = zipdir_open(fd);
+	zipdir_free(zd);
+	close(fd);
+	return zd != NULL;
+}
+
+- (id)initWithBaseURL:(NSURL*)base hashStore:(ContentHashStore*)store error:(NSError**)error
+{
+	self = [super init];
+	if (self)
+	{
+		NSString *template = [[base path] stringByAppendingPathComponent:[STAGING_PREFIX stringByAppendingString:@"XXXXXX"]];
+		char *tmpl = strdup([template fileSystemRepresentation]);
+		
+		if (!tmpl || !mkdtemp(tmpl))
+		{
+			if (error)
+				*error = stageError(errno, base, @"Could not create a folder to install into.");
+			free(tmpl);
+			return nil;
+		}
+		
+		baseURL = base;
+		stagingURL = [NSURL fileURLWithPath:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:tmpl length:strlen(tmpl)] isDirectory:YES];
+		hashStore = store;
+		paths = [NSMutableArray array];
+		digests = [NSMutableDictionary dictionary];
+		progress = [[InstallProgress alloc] init];
+		free(tmpl);
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[self rollback];
+}
+
+@synthesize progress;
+
+/* A path differing only in case is the same file on the usual file system, so it's only committed once. */
+- (void)addPath:(NSString*)path digest:(NSString*)digest
+{
+	NSString *key = [path lowercaseString];
+	
+	@synchronized(self)
+	{
+		if (![digests objectForKey:key])
+			[paths addObject:path];
+		[digests setObject:digest ? digest : (id)[NSNull null] forKey:key];
+	}
+}
+
+- (BOOL)stageMember:(ArchiveMember*)member path:(NSString*)path error:(NSError**)error
+{
+	NSString *digest = nil;
+	
+	if (![hashStore extractMember:member toURL:[stagingURL URLByAppendingPathComponent:path] digest:&digest error:error])
+		return NO;
+	
+	[self addPath:path digest:digest];
+	return YES;
+}
+
+- (BOOL)stageArchive:(DAArchive*)archive pathMap:(NSString *(^)(NSString *installPath))pathMap error:(NSError**)error
+{
+	InstallProgress *p = progress;
+	BOOL ok = YES;
+	
+	/* The bytes are counted as the archive hands them out. */
+	archive.progressBlock = ^(int64_t bytesIn, int64_t bytesOut) {
+		[p addBytesIn:bytesIn bytesOut:bytesOut];
+	};
+	
+	for (DAArchiveMember *entry in archive)
+	{
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		
+		if (entry.type == dmtManifest)
+			continue;
+		
+		if (progress.isCancelled)
+		{
+			if (error)
+				*error = cancelledError();
+			ok = NO;
+			break;
+		}
+		
+		NSString *path = pathMap(entry.installPath);
+		if (![self stageMember:entry path:path error:error])
+		{
+			ok = NO;
+			break;
+		}
+		
+		[progress finishMember:path bytes:entry.sizeAvailable ? entry.size : 0 started:start];
+	}
+	
+	archive.progressBlock = nil;
+	return ok;
+}
+
+- (BOOL)stageZip:(struct zipdir*)zd index:(size_t)idx path:(NSString*)path error:(NSError**)error
+{
+	const struct zip_member *m = &zd->members[idx];
+	NSURL *dst = [stagingURL URLByAppendingPathComponent:path];
+	NSString *digest;
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	
+	if (![[[NSFileManager alloc] init] createDirectoryAtURL:[dst URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:error])
+		return NO;
+	
+	if (m->method == ZIP_METHOD_STORED && !(m->flags & ZIP_FLAG_ENCRYPTED) && m->csize == m->usize)
+	{
+		/* Let the kernel copy it. The CRC is checked when the copy is read to be hashed. */
+		uint32_t crc = 0;
+		int fd = open([[dst path] fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		off_t offset;
+		
+		if (fd < 0 || zipdir_data_offset(zd, idx, &offset)
+			|| filecopy_range(zd->fd, offset, m->usize, fd, copyProgress, (__bridge void*)progress) < 0)
+		{
+			if (error)
+				*error = stageError(errno, dst, [NSString stringWithFormat:@"Could not extract %@.", path]);
+			if (fd >= 0)
+				close(fd);
+			return NO;
+		}
+		if (close(fd))
+		{
+			if (error)
+				*error = stageError(errno, dst, [NSString stringWithFormat:@"Could not extract %@.", path]);
+			return NO;
+		}
+		
+		digest = [ContentHashStore digestForURL:dst crc:&crc error:error];
+		if (!digest)
+			return NO;
+		if (crc != m->crc)
+		{
+			if (error)
+				*error = stageError(EINVAL, dst, [NSString stringWithFormat:@"Could not extract %@.", path]);
+			return NO;
+		}
+		
+		/* Replaced by a link if it's already installed. */
+		[hashStore linkURL:dst toDigest:digest];
+	}
+	else if (m->usize <= MAX_MEMORY_MEMBER)
+	{
+		NSMutableData *data = [NSMutableData dataWithLength:(NSUInteger)m->usize];
+		
+		if (zipdir_extract_progress(zd, idx, -1, [data mutableBytes], zipProgress, (__bridge void*)progress))
+		{
+			if (error)
+				*error = stageError(errno, dst, [NSString stringWithFormat:@"Could not extract %@.", path]);
+			return NO;
+		}
+		
+		digest = [ContentHashStore digestForData:data];
+		if (![hashStore linkURL:dst toDigest:digest] && ![data writeToURL:dst options:0 error:error])
+			return NO;
+	}
+	else
+	{
+		int fd = open([[dst path] fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		
+		if (fd < 0 || zipdir_extract_progress(zd, idx, fd, NULL, zipProgress, (__bridge void*)progress))
+		{
+			if (error)
+				*error = stageError(errno, dst, [NSString stringWithFormat:@"Could not extract %@.", path]);
+			if (fd >= 0)
+				close(fd);
+			return NO;
+		}
+		if (close(fd))
+		{
+			if (error)
+				*error = stageError(errno, dst, [NSString stringWithFormat:@"Could not extract %@.", path]);
+			return NO;
+		}
+		
+		digest = [ContentHashStore digestForURL:dst error:nil];
+	}
+	
+	[self addPath:path digest:digest];
+	[progress finishMember:path bytes:(int64_t)m->usize started:start];
+	return YES;
+}
+
+- (BOOL)stageZipArchive:(DAArchive*)archive pathMap:(NSString *(^)(NSString *installPath))pathMap error:(NSError**)error
+{
+	int fd = open([[archive.URL path] fileSystemRepresentation], O_RDONLY);
+	struct zipdir *zd = fd >= 0 ? zipdir_open(fd) : NULL;
+	
+	if (!zd)
+	{
+		if (error)
+			*error = stageError(errno, archive.URL, @"Could not read the archive.");
+		if (fd >= 0)
+			close(fd);
+		return NO;
+	}
+	
+	/* The last member wins if several install to the same path, as when extracting in order. */
+	NSMutableDictionary *byPath = [NSMutableDictionary dictionary];
+	for (size_t i = 0 ; i < zd->nmembers ; i++)
+	{
+		const struct zip_member *m = &zd->members[i];
+		
+		if (!m->name_len || m->name[m->name_len - 1] == '/')
+			continue;
+		
+		NSString *name = [[NSString alloc] initWithBytes:m->name length:m->name_len encoding:m->flags & ZIP_FLAG_UTF8 ? NSUTF8StringEncoding : archive.encoding];
+		DAArchiveMember *member = [[DAArchiveMember alloc] init];
+		
+		if (![archive classifyMember:member path:[name UTF8String] usingFunction:[archive classifier]] || member.type == dmtManifest)
+			continue;
+		
+		NSString *path = pathMap(member.installPath);
+		[byPath setObject:[NSArray arrayWithObjects:path, [NSNumber numberWithUnsignedLong:i], nil] forKey:[path lowercaseString]];
+	}
+	
+	NSArray *members = [byPath allValues];
+	__block volatile BOOL failed = NO;
+	__block NSError *firstError = nil;
+	
+	/* Biggest first, so that they don't end up last on a single core. */
+	members = [members sortedArrayUsingComparator:^NSComparisonResult(NSArray *a, NSArray *b) {
+		uint64_t sa = zd->members[[[a objectAtIndex:1] unsignedLongValue]].usize;
+		uint64_t sb = zd->members[[[b objectAtIndex:1] unsignedLongValue]].usize;
+		
+		return sa > sb ? NSOrderedAscending : sa < sb ? NSOrderedDescending : NSOrderedSame;
+	}];
+	
+	dispatch_apply([members count], dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t n) {
+		if (failed)
+			return;
+		
+		if (progress.isCancelled)
+		{
+			@synchronized(self)
+			{
+				if (!failed)
+					firstError = cancelledError();
+				failed = YES;
+			}
+			return;
+		}
+		
+		@autoreleasepool
+		{
+			NSArray *entry = [members objectAtIndex:n];
+			NSError *err = nil;
+			
+			if (![self stageZip:zd index:[[entry objectAtIndex:1] unsignedLongValue] path:[entry objectAtIndex:0] error:&err])
+			{
+				@synchronized(self)
+				{
+					if (!failed)
+						firstError = err;
+					failed = YES;
+				}
+			}
+		}
+	});
+	
+	zipdir_free(zd);
+	close(fd);
+	
+	if (failed && error)
+		*error = firstError;
+	return !failed;
+}
+
+- (BOOL)stageSpool:(ArchiveSpool*)spool pathMap:(NSString *(^)(NSString *installPath))pathMap error:(NSError**)error
+{
+	return [spool enumerateMembersUsingBlock:^BOOL(NSString *installPath, NSData *data, NSURL *url, NSError **err) {
+		NSString *path = pathMap(installPath);
+		NSURL *dst = [stagingURL URLByAppendingPathComponent:path];
+		NSString *digest;
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		int64_t written = 0;
+		
+		if (progress.isCancelled)
+		{
+			if (err)
+				*err = cancelledError();
+			return NO;
+		}
+		
+		if (![[NSFileManager defaultManager] createDirectoryAtURL:[dst URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:err])
+			return NO;
+		
+		if (data)
+		{
+			digest = [ContentHashStore digestForData:data];
+			if (![hashStore linkURL:dst toDigest:digest] && ![data writeToURL:dst options:0 error:err])
+				return NO;
+			written = (int64_t)[data length];
+			/* Spooled data has been decompressed already. */
+			[progress addBytesIn:written bytesOut:written];
+		}
+		else
+		{
+			struct stat st;
+			
+			/* The spool is usually on the same volume, so this is mostly a link. */
+			unlink([[dst path] fileSystemRepresentation]);
+			if (filecopy_file([[url path] fileSystemRepresentation], [[dst path] fileSystemRepresentation], FILECOPY_ALLOW_LINK,
+							  copyProgress, (__bridge void*)progress) < 0)
+			{
+				if (err)
+					*err = stageError(errno, dst, [NSString stringWithFormat:@"Could not extract %@.", path]);
+				return NO;
+			}
+			
+			digest = [ContentHashStore digestForURL:dst error:nil];
+			if (digest)
+				[hashStore linkURL:dst toDigest:digest];
+			if (!stat([[dst path] fileSystemRepresentation], &st))
+				written = st.st_size;
+		}
+		
+		[self addPath:path digest:digest];
+		[progress finishMember:path bytes:written started:start];
+		return YES;
+	} error:error];
+}
+
+/* Like mkdir -p, but remembers what it created. */
+- (BOOL)createDirectoryAtURL:(NSURL*)url created:(NSMutableArray*)created error:(NSError**)error
+{
+	NSMutableArray *missing = [NSMutableArray array];
+	struct stat st;
+	
+	while (lstat([[url path] fileSystemRepresentation], &st))
+	{
+		[missing insertObject:url atIndex:0];
+		url = [url URLByDeletingLastPathComponent];
+	}
+	
+	for (NSURL *dir in missing)
+	{
+		if (mkdir([[dir path] fileSystemRepresentation], 0755))
+		{
+			if (error)
+				*error = stageError(errno, dir, @"Could not create a folder.");
+			return NO;
+		}
+		[created addObject:dir];
+	}
+	return YES;
+}
+
+- (void)undoMoved:(NSArray*)moved replaced:(NSArray*)replaced created:(NSArray*)created
+{
+	NSURL *replacedURL = [stagingURL URLByAppendingPathComponent:@".replaced"];
+	
+	for (NSString *path in [moved reverseObjectEnumerator])
+		rename([[[baseURL URLByAppendingPathComponent:path] path] fileSystemRepresentation], [[[stagingURL URLByAppendingPathComponent:path] path] fileSystemRepresentation]);
+	for (NSString *path in [replaced reverseObjectEnumerator])
+		rename([[[replacedURL URLByAppendingPathComponent:path] path] fileSystemRepresentation], [[[baseURL URLByAppendingPathComponent:path] path] fileSystemRepresentation]);
+	for (NSURL *dir in [created reverseObjectEnumerator])
+		rmdir([[dir path] fileSystemRepresentation]);
+}
+
+/*
+ * Files already in the way are moved aside into the staging folder, so that
+ * they can be put back if a later rename fails.
+ */
+- (BOOL)commit:(NSError**)error
+{
+	NSURL *replacedURL = [stagingURL URLByAppendingPathComponent:@".replaced"];
+	NSMutableArray *moved = [NSMutableArray arrayWithCapacity:[paths count]];
+	NSMutableArray *replaced = [NSMutableArray array];
+	NSMutableArray *created = [NSMutableArray array];
+	
+	for (NSString *path in paths)
+	{
+		NSURL *src = [stagingURL URLByAppendingPathComponent:path];
+		NSURL *dst = [baseURL URLByAppendingPathComponent:path];
+		struct stat st;
+		
+		if (![self createDirectoryAtURL:[dst URLByDeletingLastPathComponent] created:created error:error])
+		{
+			[self undoMoved:moved replaced:replaced created:created];
+			return NO;
+		}
+		
+		if (!lstat([[dst path] fileSystemRepresentation], &st))
+		{
+			NSURL *bak = [replacedURL URLByAppendingPathComponent:path];
+			
+			[[NSFileManager defaultManager] createDirectoryAtURL:[bak URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+			if (rename([[dst path] fileSystemRepresentation], [[bak path] fileSystemRepresentation]))
+			{
+				if (error)
+					*error = stageError(errno, dst, [NSString stringWithFormat:@"Could not replace %@.", path]);
+				[self undoMoved:moved replaced:replaced created:created];
+				return NO;
+			}
+			[replaced addObject:path];
+		}
+		
+		if (rename([[src path] fileSystemRepresentation], [[dst path] fileSystemRepresentation]))
+		{
+			if (error)
+				*error = stageError(errno, dst, [NSString stringWithFormat:@"Could not install %@.", path]);
+			[self undoMoved:moved replaced:replaced created:created];
+			return NO;
+		}
+		[moved addObject:path];
+	}
+	
+	for (NSString *path in paths)
+	{
+		NSString *digest = [digests objectForKey:[path lowercaseString]];
+		
+		if (digest != (id)[NSNull null])
+			[hashStore recordURL:[baseURL URLByAppendingPathComponent:path] digest:digest];
+	}
+	
+	[self rollback];
+	return YES;
+}
+
+- (void)rollback
+{
+	if (!stagingURL)
+		return;
+	
+	[[NSFileManager defaultManager] removeItemAtURL:stagingURL error:nil];
+	stagingURL = nil;
+	[paths removeAllObjects];
+	[digests removeAllObjects];
+}
+
+@end
@@ -0,0 +1,57 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+#include <sys/stat.h>
+
+/*
+ * What the Scanner found out about each file, kept between launches so that
+ * only files that changed have to be classified and parsed again. A record
+ * is valid as long as the (dev, inode, size, mtime) of the file is the same.
+ * Kept in Settings/modazipin-scancache.plist below the base folder.
+ *
+ * Records are dictionaries with the keys
+ *   path, type - the basepath and path type of the file.
+ *   names - for ERFs, entry names with "" for nameless entries.
+ *   toc - for ERFs, offset, length, unpacked length and compression of
+ *         each entry as uint32_t.
+ */
+@interface ScanCache : NSObject
+{
+	NSURL *baseURL;
+	NSURL *cacheURL;
+	
+	NSMutableDictionary *records;
+	NSMutableSet *touched;
+	BOOL dirty;
+}
+
+- (id)initWithBaseURL:(NSURL*)base;
+
+/* The record for url, or nil if there is none or the file changed. */
+- (NSDictionary*)recordForURL:(NSURL*)url stat:(const struct stat*)st;
+- (void)setRecord:(NSDictionary*)record forURL:(NSURL*)url stat:(const struct stat*)st;
+
+/* Drops records of files that are gone, then writes the cache if changed. */
+- (BOOL)save:(NSError**)error;
+
+@end
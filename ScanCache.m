@@ -0,0 +1,145 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#import "ScanCache.h"
+
+/* Bump when the format of the records change. */
+#define SCAN_CACHE_VERSION 1
+
+@implementation ScanCache
+
+- (id)initWithBaseURL:(NSURL*)base
+{
+	self = [super init];
+	if (self)
+	{
+		baseURL = base;
+		cacheURL = [[base URLByAppendingPathComponent:@"Settings"] URLByAppendingPathComponent:@"modazipin-scancache.plist"];
+		touched = [NSMutableSet set];
+		
+		NSData *data = [NSData dataWithContentsOfURL:cacheURL options:NSDataReadingMapped error:nil];
+		NSDictionary *plist = data ? [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListMutableContainers format:NULL error:nil] : nil;
+		
+		if ([plist isKindOfClass:[NSDictionary class]] && [[plist objectForKey:@"version"] intValue] == SCAN_CACHE_VERSION)
+			records = [plist objectForKey:@"files"];
+		if (![records isKindOfClass:[NSMutableDictionary class]])
+			records = [NSMutableDictionary dictionary];
+	}
+	return self;
+}
+
+- (NSString*)keyForURL:(NSURL*)url
+{
+	NSString *base = [baseURL path];
+	NSString *path = [url path];
+	
+	if (![path hasPrefix:base] || [path length] <= [base length] + 1)
+		return nil;
+	
+	return [path substringFromIndex:[base length] + 1];
+}
+
+- (NSDictionary*)recordForURL:(NSURL*)url stat:(const struct stat*)st
+{
+	NSString *key = [self keyForURL:url];
+	
+	if (!key)
+		return nil;
+	
+	@synchronized(self)
+	{
+		NSDictionary *rec = [records objectForKey:key];
+		
+		[touched addObject:key];
+		
+		if (!rec
+			|| [[rec objectForKey:@"dev"] longLongValue] != (long long)st->st_dev
+			|| [[rec objectForKey:@"inode"] unsignedLongLongValue] != (unsigned long long)st->st_ino
+			|| [[rec objectForKey:@"size"] longLongValue] != (long long)st->st_size
+			|| [[rec objectForKey:@"mtime"] longLongValue] != (long long)st->st_mtime)
+			return nil;
+		
+		return rec;
+	}
+}
+
+- (void)setRecord:(NSDictionary*)record forURL:(NSURL*)url stat:(const struct stat*)st
+{
+	NSString *key = [self keyForURL:url];
+	NSMutableDictionary *rec = [NSMutableDictionary dictionaryWithDictionary:record];
+	
+	if (!key)
+		return;
+	
+	[rec setObject:[NSNumber numberWithLongLong:st->st_dev] forKey:@"dev"];
+	[rec setObject:[NSNumber numberWithUnsignedLongLong:st->st_ino] forKey:@"inode"];
+	[rec setObject:[NSNumber numberWithLongLong:st->st_size] forKey:@"size"];
+	[rec setObject:[NSNumber numberWithLongLong:st->st_mtime] forKey:@"mtime"];
+	
+	@synchronized(self)
+	{
+		[records setObject:rec forKey:key];
+		[touched addObject:key];
+		dirty = YES;
+	}
+}
+
+- (BOOL)save:(NSError**)error
+{
+	NSData *data;
+	
+	@synchronized(self)
+	{
+		/* Only stat what wasn't seen by a scan, the rest is known to exist. */
+		for (NSString *key in [records allKeys])
+		{
+			struct stat st;
+			
+			if ([touched containsObject:key])
+				continue;
+			if (lstat([[[baseURL URLByAppendingPathComponent:key] path] fileSystemRepresentation], &st))
+			{
+				[records removeObjectForKey:key];
+				dirty = YES;
+			}
+			else
+				[touched addObject:key];
+		}
+		
+		if (!dirty)
+			return YES;
+		
+		data = [NSPropertyListSerialization dataWithPropertyList:[NSDictionary dictionaryWithObjectsAndKeys:
+																  [NSNumber numberWithInt:SCAN_CACHE_VERSION], @"version",
+																  records, @"files",
+																  nil]
+														  format:NSPropertyListBinaryFormat_v1_0
+														 options:0
+														   error:error];
+		if (!data)
+			return NO;
+		dirty = NO;
+	}
+	
+	return [data writeToURL:cacheURL options:NSDataWritingAtomic error:error];
+}
+
+@end
@@ -22,23 +22,29 @@
 #import <Cocoa/Cocoa.h>
 
 @class AddInsList;
+@class ScanCache;
 
 @interface Scanner : NSOperation
 {
 	AddInsList *document;
-	NSURL *startURL;
+	NSArray *startURLs;
 	NSString *message;
 	BOOL disabled;
-	NSArray *mparts;
+	NSString *basePath;
+	ScanCache *cache;
 	
-	NSString *currPath;
-	NSString *currPathType;
-	NSMutableArray *currCont;
-	NSMutableArray *currData;
-	NSMutableArray *currOrigURLs;
+	/* Not retained, only valid while main is running. */
+	dispatch_group_t group;
+	dispatch_queue_t workQueue;
+	
+	/* Results not yet sent, and the number of unfinished tasks, per content path. */
+	NSMutableDictionary *results;
+	NSCountedSet *pending;
 }
 
 - (id)initWithDocument:(AddInsList*)doc URL:(NSURL*)url message:(NSString*)msg disabled:(BOOL)disabled;
+/* Walk several folders or files as one scan, results are sent per content path as usual. */
+- (id)initWithDocument:(AddInsList*)doc URLs:(NSArray*)urls message:(NSString*)msg disabled:(BOOL)disabled;
 
 @property(copy) NSString *message;
 
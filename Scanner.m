@@ -22,28 +22,35 @@
 #import "Scanner.h"
 #import "AddInsList.h"
 #import "DataProxy.h"
+#import "ScanCache.h"
 
 #include "erf.h"
+#include "pathclass.h"
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <sqlite3.h>
-
-static NSPredicate *isERF;
+#include <sys/stat.h>
 
 @implementation Scanner
 
 @synthesize message;
 
 - (id)initWithDocument:(AddInsList*)doc URL:(NSURL*)url message:(NSString*)msg disabled:(BOOL)dis
+{
+	return [self initWithDocument:doc URLs:[NSArray arrayWithObject:url] message:msg disabled:dis];
+}
+
+- (id)initWithDocument:(AddInsList*)doc URLs:(NSArray*)urls message:(NSString*)msg disabled:(BOOL)dis
 {
 	self = [super init];
 	if (self)
 	{
 		document = doc;
-		startURL = url;
+		startURLs = [urls copy];
 		message = msg;
-		if (!isERF)
-			isERF = [NSPredicate predicateWithFormat:@"SELF MATCHES[c] '\\.[ce]rf'"];
-		mparts = [[document fileURL] pathComponents];
+		basePath = [[document fileURL] path];
+		cache = [document scanCache];
 		disabled = dis;
 	}
 	return self;
@@ -51,133 +58,330 @@ static NSPredicate *isERF;
 
 - (NSString*)basepathForURL:(NSURL*)url type:(NSString**)outType
 {
-	NSMutableArray *cparts = [NSMutableArray arrayWithArray:[url pathComponents]];
-	NSString *pathType;
-	NSString *path;
-		
-	for (NSString *p in mparts) {
-		if (![[cparts objectAtIndex:0] isEqualToString:p])
+	const char *fspath = [[url path] fileSystemRepresentation];
+	const char *base = [basePath fileSystemRepresentation];
+	size_t blen = strlen(base);
+	struct path_scan ps;
+	
+	if (strncmp(fspath, base, blen) != 0 || fspath[blen] != '/')
+		return nil;
+	fspath += blen + 1;
+	
+	switch (pathclass_scan(fspath, strlen(fspath), disabled, &ps))
+	{
+		case PATH_SCAN_NONE:
 			return nil;
-		
-		[cparts removeObjectAtIndex:0];
+		case PATH_SCAN_ADDIN:
+			if (outType)
+				*outType = @"addin";
+			break;
+		case PATH_SCAN_DIR:
+			if (outType)
+				*outType = @"dir";
+			break;
+		case PATH_SCAN_FILE:
+			if (outType)
+				*outType = @"file";
+			break;
 	}
 	
-	if ([[cparts objectAtIndex:0] caseInsensitiveCompare:@"Addins"] == NSOrderedSame
-		|| [[cparts objectAtIndex:0] caseInsensitiveCompare:@"Offers"] == NSOrderedSame)
+	NSMutableData *buf = [NSMutableData dataWithBytes:fspath + ps.head.offset length:ps.head.length];
+	[buf appendBytes:fspath + ps.tail.offset length:ps.tail.length];
+	return [[NSFileManager defaultManager] stringWithFileSystemRepresentation:[buf bytes] length:[buf length]];
+}
+
+/*
+ * Work for a content path is counted, so that its results can be sent as soon
+ * as the last task adding to it is done. Results will then be grouped per path
+ * just as if the tree was walked in order.
+ */
+- (void)retainPath:(NSString*)path
+{
+	if (!path)
+		return;
+	
+	@synchronized(results)
 	{
-		path = [NSString pathWithComponents:[cparts subarrayWithRange:NSMakeRange(0, 2)]];
-		pathType = @"addin";
+		[pending addObject:path];
 	}
-	else
+}
+
+- (void)releasePath:(NSString*)path
+{
+	NSMutableDictionary *res = nil;
+	
+	if (!path)
+		return;
+	
+	@synchronized(results)
 	{
-		if (disabled)
+		[pending removeObject:path];
+		if (![pending countForObject:path])
 		{
-			NSString *s = [cparts objectAtIndex:0];
-			
-			[cparts replaceObjectAtIndex:0 withObject:[s substringToIndex:[s length] - sizeof (" (disabled)") + 1]];
+			res = [results objectForKey:path];
+			[results removeObjectForKey:path];
 		}
+	}
+	
+	/* Doesn't wait for the results to be applied. */
+	if (res && ![self isCancelled])
+		[document addContentsForPath:res];
+}
+
+- (void)addContents:(NSArray*)cont data:(NSArray*)data origURLs:(NSArray*)origURLs forPath:(NSString*)path type:(NSString*)pathType
+{
+	if (!path)
+		return;
+	
+	@synchronized(results)
+	{
+		NSMutableDictionary *res = [results objectForKey:path];
 		
-		if ([cparts count] > 4)
+		if (!res)
 		{
-			[cparts removeObjectsInRange:NSMakeRange(4, [cparts count] - 4)];
-			pathType = @"dir";
+			res = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+				   [NSMutableArray array], @"contents",
+				   [NSMutableArray array], @"data",
+				   [NSMutableArray array], @"origurls",
+				   path, @"path",
+				   pathType, @"pathtype",
+				   [NSNumber numberWithBool:disabled], @"disabled",
+				   nil];
+			[results setObject:res forKey:path];
 		}
-		else
-			pathType = @"file";
-		
-		path = [NSString pathWithComponents:cparts];
+		[[res objectForKey:@"contents"] addObjectsFromArray:cont];
+		[[res objectForKey:@"data"] addObjectsFromArray:data];
+		[[res objectForKey:@"origurls"] addObjectsFromArray:origURLs];
 	}
-	
-	if (outType)
-		*outType = pathType;
-	return path;
 }
 
-- (void)sendResults
+/*
+ * Only the table of contents is read. The entries are added as proxies that
+ * read and inflate the data if it's used, so the ERF isn't kept mapped.
+ */
+- (void)parseERF:(NSURL*)url path:(NSString*)path type:(NSString*)pathType record:(NSMutableDictionary*)record stat:(const struct stat*)st
 {
-	if (currPath)
+	NSMutableArray *names = [NSMutableArray array];
+	NSMutableData *tocData = [NSMutableData data];
+	
+	@autoreleasepool
 	{
-		[document performSelectorOnMainThread:@selector(addContentsForPath:)
-								   withObject:[NSDictionary dictionaryWithObjectsAndKeys:
-											   currCont, @"contents",
-											   currData, @"data",
-											   currOrigURLs, @"origurls",
-											   currPath, @"path",
-											   currPathType, @"pathtype",
-											   [NSNumber numberWithBool:disabled], @"disabled",
-											   nil]
-								waitUntilDone:YES];
+		NSData *erfdata = [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:nil];
+		struct erf_cursor cursor;
+		struct erf_toc *toc = erf_toc_new(1024);
+		
+		if (erfdata && toc && erf_cursor_init(&cursor, [erfdata bytes], [erfdata length]) == 0)
+		{
+			while (erf_cursor_read(&cursor, toc) > 0)
+			{
+				uint32_t i;
+				
+				for (i = 0 ; i < toc->count ; i++)
+				{
+					uint32_t ent[4] = { toc->offset[i], toc->length[i], toc->unpacked_length[i], toc->compression[i] };
+					
+					if (toc->name[i] != ERF_TOC_NONAME)
+						[names addObject:[NSString stringWithCString:toc->names + toc->name[i] encoding:NSASCIIStringEncoding]];
+					else
+						[names addObject:@""];
+					[tocData appendBytes:ent length:sizeof (ent)];
+				}
+			}
+		}
+		erf_toc_free(toc);
+	}
+	
+	[self addERF:url names:names toc:tocData path:path type:pathType];
+	
+	if (record)
+	{
+		[record setObject:names forKey:@"names"];
+		[record setObject:tocData forKey:@"toc"];
+		[cache setRecord:record forURL:url stat:st];
 	}
 }
 
-- (void)handle:(NSURL*)url
+/*
+ * Add the entries of an ERF, given the names and the offset, length,
+ * unpacked length and compression of each, as in the scan cache.
+ */
+- (void)addERF:(NSURL*)url names:(NSArray*)names toc:(NSData*)tocData path:(NSString*)path type:(NSString*)pathType
 {
-	NSArray *keys = [NSArray arrayWithObjects:NSURLNameKey, NSURLIsRegularFileKey, nil];
-	NSDictionary *props = [url resourceValuesForKeys:keys error:nil];
+	const uint32_t *ent = [tocData bytes];
+	NSUInteger i, n = [tocData length] / (4 * sizeof (uint32_t));
+	NSMutableArray *cont = [NSMutableArray arrayWithCapacity:n];
+	NSMutableArray *data = [NSMutableArray arrayWithCapacity:n];
+	NSMutableArray *origURLs = [NSMutableArray arrayWithCapacity:n];
 	
-	if (!props)
-		return;
+	if ([names count] < n)
+		n = [names count];
 	
-	if (![[props objectForKey:NSURLIsRegularFileKey] boolValue])
-		return;
+	for (i = 0 ; i < n ; i++, ent += 4)
+	{
+		NSString *cname = [names objectAtIndex:i];
+		
+		[cont addObject:[cname length] ? cname : (id)[NSNull null]];
+		if (ent[3] == ERF_COMP_NONE)
+			[data addObject:[DataProxy dataProxyForURL:url range:NSMakeRange(ent[0], ent[1])]];
+		else
+			[data addObject:[DataProxy dataProxyForURL:url range:NSMakeRange(ent[0], ent[1]) compression:ent[3] unpackedLength:ent[2]]];
+		[origURLs addObject:url];
+	}
 	
-	NSString *name = [props objectForKey:NSURLNameKey];
+	[self addContents:cont data:data origURLs:origURLs forPath:path type:pathType];
+}
+
+/*
+ * Handle a regular file. ERFs that aren't in the cache are parsed in a task of
+ * their own.
+ */
+- (void)handle:(NSURL*)url name:(NSString*)name
+{
 	if (!name || [name isEqualToString:@".DS_Store"])
 		return;
-
+	
 	NSString *path;
 	NSString *pathType;
+	struct stat st;
+	BOOL haveStat = lstat([[url path] fileSystemRepresentation], &st) == 0;
+	NSDictionary *cached = haveStat ? [cache recordForURL:url stat:&st] : nil;
+	NSMutableDictionary *record = nil;
 	
-	path = [self basepathForURL:url type:&pathType];
-	if (![currPath isEqualToString:path])
+	if (cached)
+	{
+		path = [cached objectForKey:@"path"];
+		pathType = [cached objectForKey:@"type"];
+	}
+	else
 	{
-		[self sendResults];
+		path = [self basepathForURL:url type:&pathType];
+		if (haveStat && path)
+			record = [NSMutableDictionary dictionaryWithObjectsAndKeys:path, @"path", pathType, @"type", nil];
+	}
+	
+	if (!path)
+		return;
+	
+	[self retainPath:path];
+	
+	const char *cname = [name UTF8String];
+	BOOL erf = pathclass_is_erf(cname, strlen(cname));
+	
+	if (erf && [cached objectForKey:@"toc"])
+		[self addERF:url names:[cached objectForKey:@"names"] toc:[cached objectForKey:@"toc"] path:path type:pathType];
+	else if (erf)
+	{
+		[self retainPath:path];
+		dispatch_group_async(group, workQueue, ^{
+			if (![self isCancelled])
+				[self parseERF:url path:path type:pathType record:record stat:&st];
+			[self releasePath:path];
+		});
+	}
+	else
+	{
+		[self addContents:[NSArray arrayWithObject:name]
+					 data:[NSArray arrayWithObject:[DataProxy dataProxyForURL:url]]
+				 origURLs:[NSArray arrayWithObject:url]
+				  forPath:path
+					 type:pathType];
 		
-		currPath = path;
-		currPathType = pathType;
-		currCont = [NSMutableArray array];
-		currData = [NSMutableArray array];
-		currOrigURLs = [NSMutableArray array];
+		if (record)
+			[cache setRecord:record forURL:url stat:&st];
 	}
 	
-	if ([isERF evaluateWithObject:name])
+	[self releasePath:path];
+}
+
+/*
+ * Read a directory, taking the file types from the entries themselves rather
+ * than a stat per file. Subdirectories get a task each, which the queue will
+ * spread over the available cores.
+ */
+- (void)scanDirectory:(NSURL*)dirURL
+{
+	NSFileManager *fm = [[NSFileManager alloc] init];
+	DIR *dir = opendir([[dirURL path] fileSystemRepresentation]);
+	struct dirent *de;
+	
+	if (!dir)
+		return;
+	
+	while ((de = readdir(dir)) && ![self isCancelled])
 	{
-		NSData *erfdata = [NSData dataWithContentsOfURL:url options:NSDataReadingMapped error:nil];
+		int type = de->d_type;
+		
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
 		
-		if (erfdata)
+		if (type == DT_UNKNOWN)
 		{
-			parse_erf_data([erfdata bytes], [erfdata length], ^(struct erf_header *header, struct erf_file *file)
-						   {
-							   if (file->name)
-								   [currCont addObject:[NSString stringWithCString:file->name encoding:NSASCIIStringEncoding]];
-							   else
-								   [currCont addObject:[NSNull null]]; 
-							   [currData addObject:[erfdata subdataWithRange:NSMakeRange(file->data - [erfdata bytes], file->length)]];
-							   [currOrigURLs addObject:url];
-						   });
+			struct stat st;
+			
+			if (fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW))
+				continue;
+			if (S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if (S_ISREG(st.st_mode))
+				type = DT_REG;
 		}
+		
+		NSString *name = [fm stringWithFileSystemRepresentation:de->d_name length:strlen(de->d_name)];
+		if (!name)
+			continue;
+		
+		if (type == DT_REG)
+		{
+			@autoreleasepool
+			{
+				[self handle:[dirURL URLByAppendingPathComponent:name isDirectory:NO] name:name];
+			}
+		}
+		else if (type == DT_DIR)
+			[self scanDirectoryAsync:[dirURL URLByAppendingPathComponent:name isDirectory:YES]];
 	}
-	else
-	{
-		[currCont addObject:name];
-		[currData addObject:[DataProxy dataProxyForURL:url]];
-		[currOrigURLs addObject:url];
-	}
+	closedir(dir);
 }
 
-- (void)main
+- (void)scanDirectoryAsync:(NSURL*)dirURL
 {
-	NSDirectoryEnumerator *enumer = [[NSFileManager defaultManager] enumeratorAtURL:startURL includingPropertiesForKeys:nil options:0 errorHandler:^(NSURL *url, NSError *error) { return YES; }];
-	NSURL *item;
+	NSString *path = [self basepathForURL:dirURL type:NULL];
 	
-	[self handle:startURL];
+	/* Below the content path level, this is the path all the files in it will have. */
+	[self retainPath:path];
+	dispatch_group_async(group, workQueue, ^{
+		@autoreleasepool
+		{
+			[self scanDirectory:dirURL];
+		}
+		[self releasePath:path];
+	});
+}
+
+- (void)main
+{
+	results = [NSMutableDictionary dictionary];
+	pending = [NSCountedSet set];
+	group = dispatch_group_create();
+	workQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
 	
-	while ((item = [enumer nextObject]) && ![self isCancelled])
+	for (NSURL *startURL in startURLs)
 	{
-		[self handle:item];
+		NSNumber *isDir = nil;
+		
+		if ([self isCancelled])
+			break;
+		
+		[startURL getResourceValue:&isDir forKey:NSURLIsDirectoryKey error:nil];
+		if ([isDir boolValue])
+			[self scanDirectoryAsync:startURL];
+		else
+			[self handle:startURL name:[startURL lastPathComponent]];
 	}
 	
-	[self sendResults];
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+	dispatch_release(group);
+	group = NULL;
 }
 
 @end
@@ -21,9 +21,18 @@
 
 #include "erf.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 /* ptr < data is paranoia */
 #define CHECKLEN(x) if (ptr < (const char*)data || ptr - (const char *)data + sizeof (x) > length) return -1
@@ -32,97 +41,788 @@ const char erf_v2_0[16] = { 'E', 0, 'R', 0, 'F', 0, ' ', 0, 'V', 0, '2', 0, '.',
 const char erf_v2_2[16] = { 'E', 0, 'R', 0, 'F', 0, ' ', 0, 'V', 0, '2', 0, '.', 0, '2', 0 };
 const char erf_v3_0[16] = { 'E', 0, 'R', 0, 'F', 0, ' ', 0, 'V', 0, '3', 0, '.', 0, '0', 0 };
 
-int
-parse_erf_data(const void *data, size_t length, erf_entry_block block)
+/*
+ * Parse the header and leave ptr at the first file entry.
+ * For V3 the name table is located and checked here as well.
+ */
+static int
+parse_erf_header(const void *data, size_t length, struct erf_header *header, const char **outptr, uint32_t *outn)
 {
 	const char *ptr = (const char*)data;
-	struct erf_header header = {NULL};
-	struct erf_file file = {NULL};
-	int i, n;
-	int perrno = errno;
-	char name[ERF_FILENAME_MAXLEN + 1];
-	int len;
-	
-	errno = EINVAL;
+	uint32_t n;
 	
 	if (length < 16)
 		return -1;
 	
 	if (memcmp(data, erf_v2_0, 16) == 0)
 	{
-		CHECKLEN (*header.entry_2);
+		CHECKLEN (*header->entry_2);
 		
-		header.entry_2 = (const struct erf_header_entry_2 *)ptr;
-		ptr += sizeof (*header.entry_2);
+		header->entry_2 = (const struct erf_header_entry_2 *)ptr;
+		ptr += sizeof (*header->entry_2);
 		
-		n = le32toh (header.entry_2->num_entries);
+		n = le32toh (header->entry_2->num_entries);
 	}
 	else if (memcmp(data, erf_v2_2, 16) == 0)
 	{
-		CHECKLEN (*header.entry_2);
+		CHECKLEN (*header->entry_2);
 		
-		header.entry_2 = (const struct erf_header_entry_2 *)ptr;
-		ptr += sizeof (*header.entry_2);
+		header->entry_2 = (const struct erf_header_entry_2 *)ptr;
+		ptr += sizeof (*header->entry_2);
 		
-		n = le32toh (header.entry_2->num_entries);
+		n = le32toh (header->entry_2->num_entries);
 		
-		CHECKLEN (*header.ext_2_2);
-		header.ext_2_2 = (const struct erf_header_ext_2_2*)ptr;
-		ptr += sizeof (*header.ext_2_2);
+		CHECKLEN (*header->ext_2_2);
+		header->ext_2_2 = (const struct erf_header_ext_2_2*)ptr;
+		ptr += sizeof (*header->ext_2_2);
 	}
 	else if (memcmp(data, erf_v3_0, 16) == 0)
 	{
-		CHECKLEN (*header.entry_3);
+		uint32_t nsz;
 		
-		header.entry_3 = (const struct erf_header_entry_3 *)ptr;
-		ptr += sizeof (*header.entry_3);
+		CHECKLEN (*header->entry_3);
 		
-		n = le32toh (header.entry_3->num_entries);
+		header->entry_3 = (const struct erf_header_entry_3 *)ptr;
+		ptr += sizeof (*header->entry_3);
+		
+		n = le32toh (header->entry_3->num_entries);
+		
+		/* The name table sits between the header and the file entries. */
+		nsz = le32toh (header->entry_3->num_names);
+		if (nsz > length - (size_t)(ptr - (const char*)data))
+			return -1;
+		header->names = nsz ? ptr : NULL;
+		ptr += nsz;
 	}
 	else
 		return -1;
+	
+	*outptr = ptr;
+	*outn = n;
+	return 0;
+}
 
-	for (i = 0 ; i < n ; i++)
+/*
+ * Parse the file entry at *outptr and advance it.
+ * name is used as buffer for V2 names and must be ERF_FILENAME_MAXLEN + 1 long.
+ */
+static int
+parse_erf_file(const void *data, size_t length, const struct erf_header *header, const char **outptr, struct erf_file *file, char *name)
+{
+	const char *ptr = *outptr;
+	
+	if (header->entry_3)
 	{
-		if (header.entry_3)
+		int32_t noff;
+		
+		CHECKLEN (*file->entry_3);
+		file->entry_3 = (const struct erf_file_entry_3*)ptr;
+		ptr += sizeof (*file->entry_3);
+		
+		file->data = (const char*)data + le32toh (file->entry_3->offset);
+		file->length = le32toh(file->entry_3->length);
+		file->unpacked_length = le32toh(file->entry_3->unpacked_length);
+		file->compression = ERF_FLAGS_COMPRESSION(le32toh(header->entry_3->flags));
+		
+		noff = (int32_t)le32toh ((uint32_t)file->entry_3->name_offset);
+		if (noff == -1)
+			file->name = NULL;
+		else
 		{
-			CHECKLEN (*file.entry_3);
-			file.entry_3 = (const struct erf_file_entry_3*)ptr;
-			ptr += sizeof (*file.entry_3);
+			size_t nsz = le32toh (header->entry_3->num_names);
 			
-			file.data = (const char*)data + le32toh (file.entry_3->offset);
-			file.length = le32toh(file.entry_3->length);
-			file.name = file.entry_3->name_offset != -1 ? header.names + le32toh(file.entry_3->name_offset) : NULL;
+			/* Must be inside the table and terminated within it. */
+			if (!header->names || noff < 0 || (size_t)noff >= nsz
+				|| !memchr(header->names + noff, '\0', nsz - (size_t)noff))
+				return -1;
+			file->name = header->names + noff;
+		}
+	}
+	else
+	{
+		CHECKLEN (*file->entry_2);
+		file->entry_2 = (const struct erf_file_entry_2*)ptr;
+		ptr += sizeof (*file->entry_2);
+		
+		if (header->ext_2_2)
+		{
+			CHECKLEN (*file->ext_2_2);
+			file->ext_2_2 = (const struct erf_file_ext_2_2*)ptr;
+			ptr += sizeof (*file->ext_2_2);
+		}
+		file->data = (const char*)data + le32toh (file->entry_2->offset);
+		file->length = le32toh(file->entry_2->length);
+		file->name = name;
+		
+		if (header->ext_2_2)
+		{
+			file->unpacked_length = le32toh(file->ext_2_2->unpacked_length);
+			file->compression = ERF_FLAGS_COMPRESSION(le32toh(header->ext_2_2->flags));
 		}
 		else
 		{
-			CHECKLEN (*file.entry_2);
-			file.entry_2 = (const struct erf_file_entry_2*)ptr;
-			ptr += sizeof (*file.entry_2);
+			file->unpacked_length = file->length;
+			file->compression = ERF_COMP_NONE;
+		}
+		
+		erf_narrow_name(file->entry_2->name, name);
+	}
+	if (file->compression == ERF_COMP_NONE)
+		file->unpacked_length = file->length;
+	if (file->data < data || (size_t)((const char*)file->data - (const char*)data) > length
+		|| file->length > length - (size_t)((const char*)file->data - (const char*)data))
+		return -1;
+	
+	*outptr = ptr;
+	return 0;
+}
+
+int
+parse_erf_data_f(const void *data, size_t length, void *ctx, erf_entry_func func)
+{
+	const char *ptr;
+	struct erf_header header = {NULL};
+	struct erf_file file = {NULL};
+	uint32_t i, n;
+	int perrno = errno;
+	char name[ERF_FILENAME_MAXLEN + 1];
+	
+	errno = EINVAL;
+	
+	if (parse_erf_header(data, length, &header, &ptr, &n))
+		return -1;
+	
+	for (i = 0 ; i < n ; i++)
+	{
+		if (parse_erf_file(data, length, &header, &ptr, &file, name))
+			return -1;
 		
-			if (header.ext_2_2)
+		func(ctx, &header, &file);
+	}
+	
+	errno = perrno;
+	return 0;
+}
+
+#ifdef __BLOCKS__
+static void
+call_entry_block(void *ctx, struct erf_header *header, struct erf_file *file)
+{
+	erf_entry_block block = (erf_entry_block)ctx;
+	
+	block(header, file);
+}
+
+int
+parse_erf_data(const void *data, size_t length, erf_entry_block block)
+{
+	return parse_erf_data_f(data, length, (void*)block, call_entry_block);
+}
+#endif
+
+/*
+ * Names
+ */
+
+size_t
+erf_narrow_name(const void *name, char *out)
+{
+	const unsigned char *in = name;
+	size_t len;
+	
+	/* Assumes ascii/latin1, but that's probably safe. */
+#if defined(__SSE2__) && BYTE_ORDER == LITTLE_ENDIAN
+	const __m128i lowbyte = _mm_set1_epi16(0xFF);
+	const __m128i zero = _mm_setzero_si128();
+	
+	for (len = 0 ; len < ERF_FILENAME_MAXLEN ; len += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(in + 2 * len));
+		__m128i b = _mm_loadu_si128((const __m128i*)(in + 2 * len + 16));
+		int zmask = _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero)));
+		
+		_mm_storeu_si128((__m128i*)(out + len), _mm_packus_epi16(_mm_and_si128(a, lowbyte), _mm_and_si128(b, lowbyte)));
+		if (zmask)
+		{
+			len += (size_t)__builtin_ctz((unsigned)zmask);
+			break;
+		}
+	}
+#elif defined(__ARM_NEON) && BYTE_ORDER == LITTLE_ENDIAN
+	for (len = 0 ; len < ERF_FILENAME_MAXLEN ; len += 8)
+	{
+		uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(in + 2 * len));
+		uint64_t zmask = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(vceqq_u16(v, vdupq_n_u16(0)))), 0);
+		
+		vst1_u8((uint8_t*)out + len, vmovn_u16(v));
+		if (zmask)
+		{
+			len += (size_t)__builtin_ctzll(zmask) / 8;
+			break;
+		}
+	}
+#else
+	for (len = 0 ; len < ERF_FILENAME_MAXLEN && (in[2 * len] || in[2 * len + 1]) ; len++)
+		out[len] = (char)in[2 * len];
+#endif
+	out[len] = '\0';
+	return len;
+}
+
+/*
+ * Cursor
+ */
+
+int
+erf_cursor_init(struct erf_cursor *cursor, const void *data, size_t length)
+{
+	int perrno = errno;
+	
+	memset(cursor, 0, sizeof (*cursor));
+	cursor->data = data;
+	cursor->length = length;
+	
+	errno = EINVAL;
+	if (parse_erf_header(data, length, &cursor->header, &cursor->ptr, &cursor->count))
+		return -1;
+	
+	errno = perrno;
+	return 0;
+}
+
+struct erf_toc *
+erf_toc_new(uint32_t capacity)
+{
+	struct erf_toc *toc;
+	
+	if (!capacity)
+		capacity = 1;
+	
+	/* One allocation for the arrays. Names are kept apart since V3 names can grow the table. */
+	toc = calloc(1, sizeof (*toc) + (size_t)capacity * (4 * sizeof (uint32_t) + sizeof (uint8_t)));
+	if (!toc)
+		return NULL;
+	
+	toc->capacity = capacity;
+	toc->offset = (uint32_t*)(toc + 1);
+	toc->length = toc->offset + capacity;
+	toc->unpacked_length = toc->length + capacity;
+	toc->name = toc->unpacked_length + capacity;
+	toc->compression = (uint8_t*)(toc->name + capacity);
+	
+	toc->names_capacity = (size_t)capacity * (ERF_FILENAME_MAXLEN + 1);
+	toc->names = malloc(toc->names_capacity);
+	if (!toc->names)
+	{
+		free(toc);
+		return NULL;
+	}
+	return toc;
+}
+
+void
+erf_toc_free(struct erf_toc *toc)
+{
+	if (!toc)
+		return;
+	
+	free(toc->names);
+	free(toc);
+}
+
+static int
+erf_toc_reserve(struct erf_toc *toc, size_t len)
+{
+	size_t ncap = toc->names_capacity;
+	char *n;
+	
+	if (ncap - toc->names_size >= len)
+		return 0;
+	
+	while (ncap - toc->names_size < len)
+		ncap *= 2;
+	n = realloc(toc->names, ncap);
+	if (!n)
+		return -1;
+	toc->names = n;
+	toc->names_capacity = ncap;
+	return 0;
+}
+
+int
+erf_cursor_read(struct erf_cursor *cursor, struct erf_toc *toc)
+{
+	const char *data = cursor->data;
+	const char *ptr = cursor->ptr;
+	size_t length = cursor->length, avail, esz;
+	const struct erf_header *header = &cursor->header;
+	enum erf_compression comp = ERF_COMP_NONE;
+	uint32_t i, n;
+	
+	toc->count = 0;
+	toc->names_size = 0;
+	
+	if (cursor->error)
+	{
+		errno = cursor->error;
+		return -1;
+	}
+	
+	if (header->entry_3)
+	{
+		esz = sizeof (struct erf_file_entry_3);
+		comp = ERF_FLAGS_COMPRESSION(le32toh(header->entry_3->flags));
+	}
+	else
+	{
+		esz = sizeof (struct erf_file_entry_2);
+		if (header->ext_2_2)
+		{
+			esz += sizeof (struct erf_file_ext_2_2);
+			comp = ERF_FLAGS_COMPRESSION(le32toh(header->ext_2_2->flags));
+		}
+	}
+	
+	n = cursor->count - cursor->index;
+	if (n > toc->capacity)
+		n = toc->capacity;
+	
+	/* Bounds check the whole batch of entries up front, the loop only has to check the data ranges. */
+	avail = (size_t)(ptr - data) > length ? 0 : (length - (size_t)(ptr - data)) / esz;
+	if (avail < n)
+	{
+		n = (uint32_t)avail;
+		cursor->error = EINVAL;
+	}
+	
+	for (i = 0 ; i < n ; i++, ptr += esz)
+	{
+		uint32_t off, len, ulen;
+		
+		if (header->entry_3)
+		{
+			const struct erf_file_entry_3 *e = (const struct erf_file_entry_3*)ptr;
+			int32_t noff = (int32_t)le32toh((uint32_t)e->name_offset);
+			
+			off = le32toh(e->offset);
+			len = le32toh(e->length);
+			ulen = le32toh(e->unpacked_length);
+			
+			if (noff == -1)
+				toc->name[i] = ERF_TOC_NONAME;
+			else
 			{
-				CHECKLEN (*file.ext_2_2);
-				file.ext_2_2 = (const struct erf_file_ext_2_2*)ptr;
-				ptr += sizeof (*file.ext_2_2);
+				size_t nsz = le32toh(header->entry_3->num_names);
+				const char *nend;
+				size_t nlen;
+				
+				/* Must be inside the table and terminated within it. */
+				if (!header->names || noff < 0 || (size_t)noff >= nsz
+					|| !(nend = memchr(header->names + noff, '\0', nsz - (size_t)noff)))
+					break;
+				
+				nlen = (size_t)(nend - (header->names + noff)) + 1;
+				if (erf_toc_reserve(toc, nlen))
+				{
+					cursor->error = ENOMEM;
+					break;
+				}
+				toc->name[i] = (uint32_t)toc->names_size;
+				memcpy(toc->names + toc->names_size, header->names + noff, nlen);
+				toc->names_size += nlen;
 			}
-			file.data = (const char*)data + le32toh (file.entry_2->offset);
-			file.length = le32toh(file.entry_2->length);
-			file.name = name;
+		}
+		else
+		{
+			const struct erf_file_entry_2 *e = (const struct erf_file_entry_2*)ptr;
 			
-			for (len = 0 ; len < ERF_FILENAME_MAXLEN && file.entry_2->name[len] != 0 ; len++)
+			off = le32toh(e->offset);
+			len = le32toh(e->length);
+			if (header->ext_2_2)
+				ulen = le32toh(((const struct erf_file_ext_2_2*)(e + 1))->unpacked_length);
+			else
+				ulen = len;
+			
+			/* Narrowing might write a full name worth of bytes. */
+			if (erf_toc_reserve(toc, ERF_FILENAME_MAXLEN + 1))
 			{
-				/* Assumes ascii/latin1, but that's probably safe. */
-				name[len] = le16toh(file.entry_2->name[len]);
+				cursor->error = ENOMEM;
+				break;
 			}
-			name[len] = '\0';
+			toc->name[i] = (uint32_t)toc->names_size;
+			toc->names_size += erf_narrow_name(e->name, toc->names + toc->names_size) + 1;
 		}
-		if (file.data < data || (const char*)file.data + file.length > (const char *)data + length)
+		
+		if (off > length || len > length - off)
+			break;
+		
+		toc->offset[i] = off;
+		toc->length[i] = len;
+		toc->unpacked_length[i] = comp == ERF_COMP_NONE ? len : ulen;
+		toc->compression[i] = (uint8_t)comp;
+	}
+	
+	/* Return what was good so far, the error is reported on the next call. */
+	if (i < n && !cursor->error)
+		cursor->error = EINVAL;
+	
+	toc->count = i;
+	cursor->index += i;
+	cursor->ptr = ptr;
+	
+	if (!i && cursor->error)
+	{
+		errno = cursor->error;
+		return -1;
+	}
+	return (int)i;
+}
+
+
+/*
+ * Stream
+ */
+
+/* Tables of contents larger than this are not believed. */
+#define ERF_STREAM_MAX (64 * 1024 * 1024)
+
+struct erf_stream *
+erf_stream_new(uint64_t total)
+{
+	struct erf_stream *stream = calloc(1, sizeof (*stream));
+	
+	if (!stream)
+		return NULL;
+	
+	stream->total = total;
+	stream->need = 16;
+	return stream;
+}
+
+void
+erf_stream_free(struct erf_stream *stream)
+{
+	if (!stream)
+		return;
+	
+	free(stream->buf);
+	free(stream);
+}
+
+/*
+ * How much has to be buffered, as far as can be told from what's there.
+ * Sets complete when that's the final answer.
+ */
+static int
+erf_stream_need(struct erf_stream *stream)
+{
+	const char *data = stream->buf;
+	size_t hsz, esz;
+	uint64_t need;
+	uint32_t n;
+	
+	if (stream->size < 16)
+		return 0;
+	
+	if (memcmp(data, erf_v2_0, 16) == 0)
+	{
+		hsz = sizeof (struct erf_header_entry_2);
+		esz = sizeof (struct erf_file_entry_2);
+	}
+	else if (memcmp(data, erf_v2_2, 16) == 0)
+	{
+		hsz = sizeof (struct erf_header_entry_2) + sizeof (struct erf_header_ext_2_2);
+		esz = sizeof (struct erf_file_entry_2) + sizeof (struct erf_file_ext_2_2);
+	}
+	else if (memcmp(data, erf_v3_0, 16) == 0)
+	{
+		hsz = sizeof (struct erf_header_entry_3);
+		esz = sizeof (struct erf_file_entry_3);
+	}
+	else
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	
+	if (stream->size < hsz)
+	{
+		stream->need = hsz;
+		return 0;
+	}
+	
+	if (esz == sizeof (struct erf_file_entry_3))
+	{
+		const struct erf_header_entry_3 *h = (const struct erf_header_entry_3*)data;
+		
+		n = le32toh(h->num_entries);
+		need = (uint64_t)hsz + le32toh(h->num_names) + (uint64_t)n * esz;
+	}
+	else
+	{
+		const struct erf_header_entry_2 *h = (const struct erf_header_entry_2*)data;
+		
+		n = le32toh(h->num_entries);
+		need = (uint64_t)hsz + (uint64_t)n * esz;
+	}
+	
+	if (need > ERF_STREAM_MAX || (stream->total && need > stream->total))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	stream->need = (size_t)need;
+	stream->complete = 1;
+	return 0;
+}
+
+int
+erf_stream_feed(struct erf_stream *stream, const void *data, size_t length)
+{
+	const char *in = data;
+	
+	while (1)
+	{
+		if (!stream->complete && erf_stream_need(stream))
 			return -1;
+		if (stream->size >= stream->need)
+		{
+			if (stream->complete)
+				return 1;
+			continue;
+		}
+		if (!length)
+			return 0;
+		
+		size_t l = stream->need - stream->size;
 		
-		block (&header, &file);
+		if (l > length)
+			l = length;
+		if (stream->size + l > stream->capacity)
+		{
+			size_t ncap = stream->capacity ? stream->capacity : 4096;
+			char *nbuf;
+			
+			while (ncap < stream->need)
+				ncap *= 2;
+			if (!(nbuf = realloc(stream->buf, ncap)))
+				return -1;
+			stream->buf = nbuf;
+			stream->capacity = ncap;
+		}
+		memcpy(stream->buf + stream->size, in, l);
+		stream->size += l;
+		in += l;
+		length -= l;
+	}
+}
+
+int
+erf_stream_cursor(struct erf_stream *stream, struct erf_cursor *cursor)
+{
+	size_t length = stream->size;
+	
+	if (!stream->complete || stream->size < stream->need)
+	{
+		errno = EAGAIN;
+		return -1;
 	}
 	
+	/*
+	 * Offsets are checked against the whole ERF, the entries themselves are all buffered.
+	 * If its length isn't known they can't be checked at all.
+	 */
+	if (!stream->total || stream->total > SIZE_MAX)
+		length = SIZE_MAX;
+	else if (stream->total > length)
+		length = (size_t)stream->total;
+	return erf_cursor_init(cursor, stream->buf, length);
+}
+
+/*
+ * Index
+ */
+
+#define FNV64_BASIS 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+#define FNV32_BASIS 0x811c9dc5U
+#define FNV32_PRIME 0x01000193U
+
+uint64_t
+erf_name_hash(const char *name)
+{
+	uint64_t h = FNV64_BASIS;
+	
+	for ( ; *name ; name++)
+	{
+		h *= FNV64_PRIME;
+		h ^= (unsigned char)tolower((unsigned char)*name);
+	}
+	return h;
+}
+
+uint32_t
+erf_type_hash(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	uint32_t h = FNV32_BASIS;
+	
+	if (!ext)
+		return h;
+	
+	for (ext++ ; *ext ; ext++)
+	{
+		h *= FNV32_PRIME;
+		h ^= (unsigned char)tolower((unsigned char)*ext);
+	}
+	return h;
+}
+
+struct erf_index_slot
+{
+	uint64_t name_hash;
+	uint32_t type_hash;
+	uint32_t file; /* Index into files + 1, 0 is an empty slot. */
+};
+
+struct erf_index
+{
+	struct erf_header header;
+	uint32_t num_files;
+	uint32_t mask;
+	struct erf_file *files;
+	struct erf_index_slot *slots;
+	char *names; /* V2 names, ERF_FILENAME_MAXLEN + 1 per entry. */
+};
+
+static void
+erf_index_insert(struct erf_index *index, uint64_t name_hash, uint32_t type_hash, uint32_t file)
+{
+	uint32_t i = (uint32_t)(name_hash ^ name_hash >> 32) & index->mask;
+	
+	/* Linear probing, the table is never more than half full. */
+	while (index->slots[i].file)
+	{
+		/* Keep the first of any duplicates, like a linear scan would. */
+		if (index->slots[i].name_hash == name_hash && index->slots[i].type_hash == type_hash)
+			return;
+		i = (i + 1) & index->mask;
+	}
+	index->slots[i].name_hash = name_hash;
+	index->slots[i].type_hash = type_hash;
+	index->slots[i].file = file + 1;
+}
+
+struct erf_index *
+erf_index_new(const void *data, size_t length)
+{
+	struct erf_index *index;
+	const char *ptr;
+	uint32_t i, n, sz;
+	int perrno = errno;
+	
+	index = calloc(1, sizeof (*index));
+	if (!index)
+		return NULL;
+	
+	errno = EINVAL;
+	
+	if (parse_erf_header(data, length, &index->header, &ptr, &n))
+		goto fail;
+	
+	/* Each entry is at least 28 bytes, so this catches bogus counts before allocating. */
+	if (n > length / sizeof (struct erf_file_entry_3))
+		goto fail;
+	
+	for (sz = 16 ; sz < n * 2 ; sz <<= 1)
+		;
+	index->mask = sz - 1;
+	index->num_files = n;
+	index->files = calloc(n ? n : 1, sizeof (*index->files));
+	index->slots = calloc(sz, sizeof (*index->slots));
+	if (!index->header.entry_3)
+		index->names = malloc((size_t)(n ? n : 1) * (ERF_FILENAME_MAXLEN + 1));
+	if (!index->files || !index->slots || (!index->header.entry_3 && !index->names))
+		goto fail;
+	
+	for (i = 0 ; i < n ; i++)
+	{
+		struct erf_file *file = &index->files[i];
+		char *name = index->names ? index->names + (size_t)i * (ERF_FILENAME_MAXLEN + 1) : NULL;
+		
+		if (parse_erf_file(data, length, &index->header, &ptr, file, name))
+			goto fail;
+		
+		if (file->name)
+			erf_index_insert(index, erf_name_hash(file->name), file->entry_3 ? erf_type_hash(file->name) : 0, i);
+		else
+			erf_index_insert(index, le64toh(file->entry_3->name_hash), le32toh(file->entry_3->type_hash), i);
+	}
+	
+	errno = perrno;
+	return index;
+
+fail:
+	perrno = errno;
+	erf_index_free(index);
 	errno = perrno;
+	return NULL;
+}
+
+void
+erf_index_free(struct erf_index *index)
+{
+	if (!index)
+		return;
+	
+	free(index->files);
+	free(index->slots);
+	free(index->names);
+	free(index);
+}
+
+size_t
+erf_index_count(const struct erf_index *index)
+{
+	return index->num_files;
+}
+
+const struct erf_header *
+erf_index_header(const struct erf_index *index)
+{
+	return &index->header;
+}
+
+int
+erf_find_hash(const struct erf_index *index, uint64_t name_hash, uint32_t type_hash, struct erf_file *file)
+{
+	uint32_t i = (uint32_t)(name_hash ^ name_hash >> 32) & index->mask;
+	
+	for ( ; index->slots[i].file ; i = (i + 1) & index->mask)
+	{
+		if (index->slots[i].name_hash == name_hash && index->slots[i].type_hash == type_hash)
+		{
+			*file = index->files[index->slots[i].file - 1];
+			return 0;
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+int
+erf_find(const struct erf_index *index, const char *name, struct erf_file *file)
+{
+	uint32_t type_hash = index->header.entry_3 ? erf_type_hash(name) : 0;
+	
+	if (erf_find_hash(index, erf_name_hash(name), type_hash, file))
+		return -1;
+	
+	/* Guard against hash collisions for entries we have the name of. */
+	if (file->name && strcasecmp(file->name, name) != 0)
+	{
+		errno = ENOENT;
+		return -1;
+	}
 	return 0;
 }
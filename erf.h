@@ -23,21 +23,41 @@
 #define ERF_H
 
 #include <stdint.h>
+#ifdef __APPLE__
 #include <machine/endian.h>
+#else
+#include <endian.h>
+#endif
 #include <sys/types.h>
 
+/* glibc already has these. */
+#ifndef le16toh
 #if BYTE_ORDER == LITTLE_ENDIAN
 #define le16toh(x) (x)
 #define le32toh(x) (x)
+#define le64toh(x) (x)
 #else
 #define le16toh(x) (((x) >> 8 & 0xFF) | ((x) << 8 & 0xFF00))
 #define le32toh(x) (((x) >> 24 & 0xFF) | ((x) >> 8 & 0xFF00) | ((x) << 8 & 0xFF0000) | ((x) << 24 & 0xFF000000))
+#define le64toh(x) ((uint64_t)le32toh((uint32_t)(x)) << 32 | le32toh((uint32_t)((x) >> 32)))
+#endif
+#endif
+#ifndef htole16
+/* Swapping is symmetric. */
+#define htole16(x) le16toh(x)
+#define htole32(x) le32toh(x)
+#define htole64(x) le64toh(x)
 #endif
 
 /* All data in the packed structs are in little endian, use above macros to access. */
 
 #define ERF_FILENAME_MAXLEN 32
 
+/* The version signatures, UTF-16LE. */
+extern const char erf_v2_0[16];
+extern const char erf_v2_2[16];
+extern const char erf_v3_0[16];
+
 enum erf_encryption
 {
 	ERF_ENC_NONE, ERF_ENC_XOR, ERF_ENC_BLOWFISH, ERF_ENC_BLOWFISH_V3
@@ -69,7 +89,7 @@ struct erf_header_ext_2_2
 struct erf_header_entry_3
 {
 	uint16_t version[8];
-	uint32_t num_names;
+	uint32_t num_names; /* Actually the size of the name table in bytes. */
 	uint32_t num_entries;
 	uint32_t flags;
 	uint32_t module_id;
@@ -104,7 +124,7 @@ struct erf_file_entry_3
 	uint32_t offset;
 	uint32_t length;
 	uint32_t unpacked_length;
-};
+} __attribute__((packed));
 
 struct erf_file
 {
@@ -114,10 +134,182 @@ struct erf_file
 	const void *data;
 	const char *name;
 	uint32_t length;
+	uint32_t unpacked_length; /* Same as length unless compressed. */
+	enum erf_compression compression;
 };
 
+/*
+ * Calls func for each entry, one at a time. Returns -1 with errno EINVAL
+ * on bad data, possibly after some entries were handed out.
+ */
+typedef void (*erf_entry_func)(void *ctx, struct erf_header *header, struct erf_file *file);
+
+int parse_erf_data_f(const void *data, size_t length, void *ctx, erf_entry_func func);
+
+#ifdef __BLOCKS__
 typedef void (^erf_entry_block)(struct erf_header *header, struct erf_file *file);
 
 int parse_erf_data(const void *data, size_t length, erf_entry_block block);
+#endif
+
+/*
+ * Batch parsing of the table of contents. Each call to erf_cursor_read
+ * decodes up to capacity entries into the arrays of an erf_toc, with the
+ * names packed after each other in one buffer.
+ * Plain C, so that it can be used outside of the app as well.
+ */
+#define ERF_TOC_NONAME UINT32_MAX
+
+struct erf_toc
+{
+	uint32_t count;
+	uint32_t capacity;
+	
+	uint32_t *offset;
+	uint32_t *length;
+	uint32_t *unpacked_length;
+	uint8_t *compression;
+	uint32_t *name; /* Offset into names or ERF_TOC_NONAME */
+	
+	char *names;
+	size_t names_size;
+	size_t names_capacity;
+};
+
+struct erf_cursor
+{
+	const void *data;
+	size_t length;
+	struct erf_header header;
+	const char *ptr;
+	uint32_t index;
+	uint32_t count;
+	int error;
+};
+
+int erf_cursor_init(struct erf_cursor *cursor, const void *data, size_t length);
+
+/*
+ * Fill toc with the next batch of entries. Returns the number of entries
+ * read, 0 when done or -1 with errno set on bad data. Entries before a
+ * bad one are still returned, the error is reported on the next call.
+ */
+int erf_cursor_read(struct erf_cursor *cursor, struct erf_toc *toc);
+
+struct erf_toc *erf_toc_new(uint32_t capacity);
+void erf_toc_free(struct erf_toc *toc);
+
+/*
+ * Incremental parsing, for ERFs coming out of an archive. Only the header
+ * and table of contents are buffered. Once erf_stream_feed says they're all
+ * there, a cursor can be had over them and the rest of the data skipped.
+ * total is the length of the whole ERF, used to check the data ranges of
+ * the entries. If it's 0 the length isn't known and any data range is taken.
+ */
+struct erf_stream
+{
+	char *buf;
+	size_t size;
+	size_t capacity;
+	size_t need;
+	uint64_t total;
+	int complete;
+};
+
+struct erf_stream *erf_stream_new(uint64_t total);
+void erf_stream_free(struct erf_stream *stream);
+
+/* Returns 1 when the table of contents is complete, 0 if more is needed or -1 with errno set on bad data. */
+int erf_stream_feed(struct erf_stream *stream, const void *data, size_t length);
+
+/* Only once erf_stream_feed has returned 1. */
+int erf_stream_cursor(struct erf_stream *stream, struct erf_cursor *cursor);
+
+/* Decode a V2 name of ERF_FILENAME_MAXLEN UTF-16LE chars. out needs ERF_FILENAME_MAXLEN + 1 bytes. Returns the length. */
+size_t erf_narrow_name(const void *name, char *out);
+
+/*
+ * Random access to the entries of an ERF, through a hash table built once.
+ * The data must stay mapped for as long as the index is used.
+ * Names are compared case insensitively. V3 entries without a name can
+ * still be found by name through their name and type hashes.
+ */
+struct erf_index;
+
+struct erf_index *erf_index_new(const void *data, size_t length);
+void erf_index_free(struct erf_index *index);
+
+size_t erf_index_count(const struct erf_index *index);
+const struct erf_header *erf_index_header(const struct erf_index *index);
+
+/* Returns 0 and fills in file if found, otherwise -1 with errno set to ENOENT. */
+int erf_find(const struct erf_index *index, const char *name, struct erf_file *file);
+int erf_find_hash(const struct erf_index *index, uint64_t name_hash, uint32_t type_hash, struct erf_file *file);
+
+/* The hashes used by V3, FNV-1 of the lowercase name and the lowercase extension. */
+uint64_t erf_name_hash(const char *name);
+uint32_t erf_type_hash(const char *name);
+
+/*
+ * Decompression, see erf_inflate.c
+ */
+
+/*
+ * Get the real contents of a file. Uncompressed files are passed through,
+ * *out pointing at file->data and buf left untouched. Compressed files are
+ * inflated into buf, which has to be at least file->unpacked_length bytes.
+ * Returns 0 on success or -1 with errno set.
+ */
+int erf_file_read(const struct erf_file *file, void *buf, size_t buflen, const void **out, size_t *outlen);
+
+struct erf_read_request
+{
+	struct erf_file file;
+	void *buf;
+	size_t buflen;
+	
+	/* Results */
+	const void *out;
+	size_t outlen;
+	int error; /* errno value, 0 if successful. */
+};
+
+/*
+ * Read several files, spread out over the available cores where possible.
+ * Returns the number of failed requests.
+ */
+size_t erf_file_read_batch(struct erf_read_request *reqs, size_t n);
+
+/*
+ * Writing, see erf_write.c
+ */
+
+enum erf_version
+{
+	ERF_VERSION_2_0, ERF_VERSION_2_2, ERF_VERSION_3_0
+};
+
+struct erf_write_entry
+{
+	const char *name;
+	const void *data;
+	uint32_t length;
+};
+
+/*
+ * Size of the resulting file, or 0 with errno set if the entries can't be
+ * written in that version. V2 names are limited to ERF_FILENAME_MAXLEN
+ * ascii characters. Entries are stored uncompressed.
+ */
+size_t erf_write_size(enum erf_version version, const struct erf_write_entry *entries, uint32_t n);
+
+/* Write the file into out, which has to be erf_write_size bytes. */
+int erf_write(void *out, size_t outlen, enum erf_version version, const struct erf_write_entry *entries, uint32_t n);
+
+/*
+ * Write the file to fd, which is resized, preallocated and mapped so that
+ * the data is copied straight into place. Returns 0 or -1 with errno set.
+ */
+int erf_write_fd(int fd, enum erf_version version, const struct erf_write_entry *entries, uint32_t n);
 
 #endif /*ERF_H*/
@@ -0,0 +1,152 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "erf.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <zlib.h>
+
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#endif
+
+/* Feed zlib in pieces this size, since avail_in is only an uInt. */
+#define INFLATE_CHUNK (1024 * 1024)
+
+/*
+ * Inflate in into out. windowBits as for inflateInit2, negative for raw deflate.
+ */
+static int
+inflate_into(const unsigned char *in, size_t inlen, unsigned char *out, size_t outlen, int windowBits, size_t *produced)
+{
+	z_stream strm = {0};
+	int r;
+	
+	if (inflateInit2(&strm, windowBits) != Z_OK)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	
+	strm.next_out = out;
+	strm.avail_out = outlen > UINT_MAX ? UINT_MAX : (uInt)outlen;
+	
+	do
+	{
+		if (!strm.avail_in)
+		{
+			size_t l = inlen > INFLATE_CHUNK ? INFLATE_CHUNK : inlen;
+			
+			strm.next_in = (unsigned char*)in;
+			strm.avail_in = (uInt)l;
+			in += l;
+			inlen -= l;
+		}
+		r = inflate(&strm, inlen ? Z_NO_FLUSH : Z_FINISH);
+	} while (r == Z_OK || (r == Z_BUF_ERROR && !strm.avail_in && inlen));
+	
+	*produced = strm.total_out;
+	inflateEnd(&strm);
+	
+	if (r != Z_STREAM_END)
+	{
+		/* Out of space means unpacked_length lied. */
+		errno = r == Z_BUF_ERROR && !strm.avail_out ? EOVERFLOW : EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int
+erf_file_read(const struct erf_file *file, void *buf, size_t buflen, const void **out, size_t *outlen)
+{
+	const unsigned char *in = file->data;
+	size_t produced;
+	
+	switch (file->compression)
+	{
+		case ERF_COMP_NONE:
+			*out = file->data;
+			*outlen = file->length;
+			return 0;
+		case ERF_COMP_BWZLIB:
+			/* One byte header in front of a raw deflate stream. */
+			if (file->length < 1)
+			{
+				errno = EINVAL;
+				return -1;
+			}
+			if (inflate_into(in + 1, file->length - 1, buf, buflen, -MAX_WBITS, &produced))
+				return -1;
+			break;
+		case ERF_COMP_HLZLIB:
+			/* Plain zlib stream. Some writers seem to leave out the zlib header as well. */
+			if (inflate_into(in, file->length, buf, buflen, MAX_WBITS, &produced)
+				&& (errno != EINVAL || inflate_into(in, file->length, buf, buflen, -MAX_WBITS, &produced)))
+				return -1;
+			break;
+		default:
+			errno = ENOTSUP;
+			return -1;
+	}
+	
+	*out = buf;
+	*outlen = produced;
+	return 0;
+}
+
+static void
+read_request(void *ctx, size_t i)
+{
+	struct erf_read_request *req = (struct erf_read_request*)ctx + i;
+	int perrno = errno;
+	
+	if (erf_file_read(&req->file, req->buf, req->buflen, &req->out, &req->outlen))
+	{
+		req->error = errno;
+		req->out = NULL;
+		req->outlen = 0;
+	}
+	else
+		req->error = 0;
+	errno = perrno;
+}
+
+size_t
+erf_file_read_batch(struct erf_read_request *reqs, size_t n)
+{
+	size_t i, failed = 0;
+
+#ifdef __APPLE__
+	dispatch_apply_f(n, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), reqs, read_request);
+#else
+	for (i = 0 ; i < n ; i++)
+		read_request(reqs, i);
+#endif
+
+	for (i = 0 ; i < n ; i++)
+	{
+		if (reqs[i].error)
+			failed++;
+	}
+	return failed;
+}
@@ -0,0 +1,256 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "erf.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static size_t
+toc_size(enum erf_version version, const struct erf_write_entry *entries, uint32_t n)
+{
+	size_t sz;
+	uint32_t i;
+	
+	switch (version)
+	{
+		case ERF_VERSION_2_0:
+			return sizeof (struct erf_header_entry_2) + (size_t)n * sizeof (struct erf_file_entry_2);
+		case ERF_VERSION_2_2:
+			return sizeof (struct erf_header_entry_2) + sizeof (struct erf_header_ext_2_2)
+				+ (size_t)n * (sizeof (struct erf_file_entry_2) + sizeof (struct erf_file_ext_2_2));
+		case ERF_VERSION_3_0:
+			sz = sizeof (struct erf_header_entry_3) + (size_t)n * sizeof (struct erf_file_entry_3);
+			for (i = 0 ; i < n ; i++)
+				sz += strlen(entries[i].name) + 1;
+			return sz;
+	}
+	return 0;
+}
+
+size_t
+erf_write_size(enum erf_version version, const struct erf_write_entry *entries, uint32_t n)
+{
+	size_t sz;
+	uint32_t i;
+	
+	if (version != ERF_VERSION_2_0 && version != ERF_VERSION_2_2 && version != ERF_VERSION_3_0)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+	
+	sz = toc_size(version, entries, n);
+	for (i = 0 ; i < n ; i++)
+	{
+		if (version != ERF_VERSION_3_0)
+		{
+			const unsigned char *c;
+			
+			if (strlen(entries[i].name) > ERF_FILENAME_MAXLEN)
+			{
+				errno = ENAMETOOLONG;
+				return 0;
+			}
+			for (c = (const unsigned char*)entries[i].name ; *c ; c++)
+			{
+				if (*c >= 0x80)
+				{
+					errno = EINVAL;
+					return 0;
+				}
+			}
+		}
+		sz += entries[i].length;
+	}
+	
+	/* Offsets are 32 bit. */
+	if (sz > UINT32_MAX)
+	{
+		errno = EFBIG;
+		return 0;
+	}
+	return sz;
+}
+
+int
+erf_write(void *out, size_t outlen, enum erf_version version, const struct erf_write_entry *entries, uint32_t n)
+{
+	char *ptr = out;
+	char *names = NULL;
+	uint32_t offset, nameoff = 0;
+	uint32_t i;
+	
+	size_t sz = erf_write_size(version, entries, n);
+	
+	if (!sz)
+		return -1;
+	if (outlen != sz)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	
+	offset = (uint32_t)toc_size(version, entries, n);
+	
+	if (version == ERF_VERSION_3_0)
+	{
+		struct erf_header_entry_3 header;
+		
+		memset(&header, 0, sizeof (header));
+		memcpy(header.version, erf_v3_0, sizeof (header.version));
+		header.num_names = htole32((uint32_t)(offset - sizeof (header) - n * sizeof (struct erf_file_entry_3)));
+		header.num_entries = htole32(n);
+		memcpy(ptr, &header, sizeof (header));
+		ptr += sizeof (header);
+		
+		names = ptr;
+		ptr += le32toh(header.num_names);
+	}
+	else
+	{
+		struct erf_header_entry_2 header;
+		time_t now = time(NULL);
+		struct tm tm;
+		
+		gmtime_r(&now, &tm);
+		memset(&header, 0, sizeof (header));
+		memcpy(header.version, version == ERF_VERSION_2_2 ? erf_v2_2 : erf_v2_0, sizeof (header.version));
+		header.num_entries = htole32(n);
+		header.year = htole32((uint32_t)tm.tm_year);
+		header.day = htole32((uint32_t)tm.tm_yday);
+		header.unk1 = htole32(UINT32_MAX);
+		memcpy(ptr, &header, sizeof (header));
+		ptr += sizeof (header);
+		
+		if (version == ERF_VERSION_2_2)
+		{
+			/* No compression, no encryption. */
+			memset(ptr, 0, sizeof (struct erf_header_ext_2_2));
+			ptr += sizeof (struct erf_header_ext_2_2);
+		}
+	}
+	
+	for (i = 0 ; i < n ; i++)
+	{
+		const struct erf_write_entry *e = &entries[i];
+		
+		if (version == ERF_VERSION_3_0)
+		{
+			struct erf_file_entry_3 entry;
+			size_t nlen = strlen(e->name) + 1;
+			
+			memcpy(names + nameoff, e->name, nlen);
+			entry.name_offset = (int32_t)htole32(nameoff);
+			entry.name_hash = htole64(erf_name_hash(e->name));
+			entry.type_hash = htole32(erf_type_hash(e->name));
+			entry.offset = htole32(offset);
+			entry.length = htole32(e->length);
+			entry.unpacked_length = htole32(e->length);
+			memcpy(ptr, &entry, sizeof (entry));
+			ptr += sizeof (entry);
+			nameoff += (uint32_t)nlen;
+		}
+		else
+		{
+			struct erf_file_entry_2 entry;
+			int j;
+			
+			memset(&entry, 0, sizeof (entry));
+			for (j = 0 ; e->name[j] ; j++)
+				entry.name[j] = htole16((uint16_t)(unsigned char)e->name[j]);
+			entry.offset = htole32(offset);
+			entry.length = htole32(e->length);
+			memcpy(ptr, &entry, sizeof (entry));
+			ptr += sizeof (entry);
+			
+			if (version == ERF_VERSION_2_2)
+			{
+				struct erf_file_ext_2_2 ext;
+				
+				ext.unpacked_length = htole32(e->length);
+				memcpy(ptr, &ext, sizeof (ext));
+				ptr += sizeof (ext);
+			}
+		}
+		offset += e->length;
+	}
+	
+	for (i = 0 ; i < n ; i++)
+	{
+		if (entries[i].length)
+			memcpy(ptr, entries[i].data, entries[i].length);
+		ptr += entries[i].length;
+	}
+	return 0;
+}
+
+int
+erf_write_fd(int fd, enum erf_version version, const struct erf_write_entry *entries, uint32_t n)
+{
+	size_t sz = erf_write_size(version, entries, n);
+	void *out;
+	int perrno;
+	
+	if (!sz)
+		return -1;
+	
+	/* Reserve the space up front, so that the file ends up in one piece. Best effort. */
+#ifdef __APPLE__
+	fstore_t fst = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)sz, 0 };
+	
+	if (fcntl(fd, F_PREALLOCATE, &fst) == -1)
+	{
+		fst.fst_flags = F_ALLOCATEALL;
+		(void)fcntl(fd, F_PREALLOCATE, &fst);
+	}
+#else
+	(void)posix_fallocate(fd, 0, (off_t)sz);
+#endif
+	if (ftruncate(fd, (off_t)sz))
+		return -1;
+	
+	out = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (out == MAP_FAILED)
+		return -1;
+	
+	if (erf_write(out, sz, version, entries, n))
+	{
+		perrno = errno;
+		munmap(out, sz);
+		errno = perrno;
+		return -1;
+	}
+	
+	if (msync(out, sz, MS_SYNC))
+	{
+		perrno = errno;
+		munmap(out, sz);
+		errno = perrno;
+		return -1;
+	}
+	return munmap(out, sz);
+}
@@ -0,0 +1,215 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "filecopy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <dlfcn.h>
+#elif defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#define COPY_CHUNK (1024 * 1024)
+/* Largest piece asked of copy_file_range at once, small enough for the progress to move. */
+#define KERNEL_CHUNK (64 * 1024 * 1024)
+
+static int
+buffered_range(int infd, off_t offset, uint64_t len, int outfd, filecopy_progress progress, void *ctx)
+{
+	char *buf = malloc(len < COPY_CHUNK ? (len ? (size_t)len : 1) : COPY_CHUNK);
+	
+	if (!buf)
+		return -1;
+	
+	while (len)
+	{
+		size_t l = len < COPY_CHUNK ? (size_t)len : COPY_CHUNK;
+		ssize_t r = pread(infd, buf, l, offset);
+		char *p = buf;
+		
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+		{
+			if (r == 0)
+				errno = EIO;
+			free(buf);
+			return -1;
+		}
+		offset += r;
+		len -= (uint64_t)r;
+		if (progress)
+			progress(ctx, (uint64_t)r);
+		
+		while (r > 0)
+		{
+			ssize_t w = write(outfd, p, (size_t)r);
+			
+			if (w < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				free(buf);
+				return -1;
+			}
+			p += w;
+			r -= w;
+		}
+	}
+	free(buf);
+	return FILECOPY_BUFFERED;
+}
+
+int
+filecopy_range(int infd, off_t offset, uint64_t len, int outfd, filecopy_progress progress, void *ctx)
+{
+#ifdef __linux__
+	uint64_t left = len;
+	loff_t off = offset;
+	
+	while (left)
+	{
+		ssize_t r = copy_file_range(infd, &off, outfd, NULL, left > KERNEL_CHUNK ? KERNEL_CHUNK : (size_t)left, 0);
+		
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+		{
+			/* Nothing copied yet, so the whole range can still be done by hand. */
+			if (left == len && (r == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+				break;
+			if (r == 0)
+				errno = EIO;
+			return -1;
+		}
+		left -= (uint64_t)r;
+		if (progress)
+			progress(ctx, (uint64_t)r);
+	}
+	if (!left)
+		return FILECOPY_KERNEL;
+#endif
+	return buffered_range(infd, offset, len, outfd, progress, ctx);
+}
+
+static int
+clone_file(const char *src, const char *dst)
+{
+#ifdef __APPLE__
+	/* Looked up at runtime, it's only in 10.12 and later. */
+	static int (*clonefile_fn)(const char*, const char*, uint32_t);
+	static int looked_up;
+	
+	if (!looked_up)
+	{
+		clonefile_fn = (int (*)(const char*, const char*, uint32_t))dlsym(RTLD_DEFAULT, "clonefile");
+		looked_up = 1;
+	}
+	if (clonefile_fn)
+		return clonefile_fn(src, dst, 0);
+#else
+	(void)src;
+	(void)dst;
+#endif
+	errno = ENOTSUP;
+	return -1;
+}
+
+int
+filecopy_file(const char *src, const char *dst, int flags, filecopy_progress progress, void *ctx)
+{
+	struct stat st;
+	int infd, outfd, res;
+	
+	if (!clone_file(src, dst))
+	{
+		if (progress && !stat(dst, &st))
+			progress(ctx, (uint64_t)st.st_size);
+		return FILECOPY_CLONE;
+	}
+	
+	if ((infd = open(src, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(infd, &st))
+	{
+		close(infd);
+		return -1;
+	}
+	
+	if ((outfd = open(dst, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0777)) < 0)
+	{
+		close(infd);
+		return -1;
+	}
+
+#ifdef FICLONE
+	if (!ioctl(outfd, FICLONE, infd))
+	{
+		close(infd);
+		close(outfd);
+		if (progress)
+			progress(ctx, (uint64_t)st.st_size);
+		return FILECOPY_CLONE;
+	}
+#endif
+
+	if (flags & FILECOPY_ALLOW_LINK)
+	{
+		close(outfd);
+		unlink(dst);
+		if (!link(src, dst))
+		{
+			close(infd);
+			if (progress)
+				progress(ctx, (uint64_t)st.st_size);
+			return FILECOPY_LINK;
+		}
+		if ((outfd = open(dst, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0777)) < 0)
+		{
+			close(infd);
+			return -1;
+		}
+	}
+	
+	res = filecopy_range(infd, 0, (uint64_t)st.st_size, outfd, progress, ctx);
+	close(infd);
+	if (close(outfd) && res >= 0)
+		res = -1;
+	if (res < 0)
+	{
+		int e = errno;
+		
+		unlink(dst);
+		errno = e;
+	}
+	return res;
+}
@@ -0,0 +1,63 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FILECOPY_H
+#define FILECOPY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Copying without moving the bytes through user space where the system
+ * allows it: clonefile on Mac OS X 10.12 and later, FICLONE and
+ * copy_file_range on Linux. Falls back to plain reads and writes.
+ */
+
+enum filecopy_method
+{
+	FILECOPY_CLONE,
+	FILECOPY_LINK,
+	FILECOPY_KERNEL,
+	FILECOPY_BUFFERED
+};
+
+/* Allow dst to be a hardlink to src if it can't be cloned. They will then share any later changes. */
+#define FILECOPY_ALLOW_LINK 0x1
+
+/*
+ * Called as the copy goes on, with the number of bytes copied since the
+ * last call. Clones and links are reported whole once done.
+ */
+typedef void (*filecopy_progress)(void *ctx, uint64_t bytes);
+
+/*
+ * Create dst as a copy of src. dst must not exist. progress may be NULL.
+ * Returns the method used, or -1 with errno set.
+ */
+int filecopy_file(const char *src, const char *dst, int flags, filecopy_progress progress, void *ctx);
+
+/*
+ * Copy len bytes from offset in infd to the current position of outfd.
+ * progress may be NULL. Returns the method used, or -1 with errno set.
+ */
+int filecopy_range(int infd, off_t offset, uint64_t len, int outfd, filecopy_progress progress, void *ctx);
+
+#endif /*FILECOPY_H*/
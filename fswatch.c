@@ -0,0 +1,365 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "fswatch.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+
+#include <CoreServices/CoreServices.h>
+#include <dispatch/dispatch.h>
+
+struct fswatch
+{
+	FSEventStreamRef stream;
+	dispatch_queue_t queue;
+	fswatch_callback cb;
+	void *ctx;
+};
+
+static void
+fsevents_callback(ConstFSEventStreamRef stream, void *info, size_t n, void *paths, const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[])
+{
+	struct fswatch *w = info;
+	char **p = paths;
+	size_t i;
+	
+	for (i = 0 ; i < n ; i++)
+		w->cb(w->ctx, p[i]);
+}
+
+struct fswatch *
+fswatch_start(const char *root, double latency, fswatch_callback cb, void *ctx)
+{
+	struct fswatch *w = calloc(1, sizeof (*w));
+	FSEventStreamContext fsctx = {0};
+	CFStringRef path;
+	CFArrayRef paths;
+	
+	if (!w)
+		return NULL;
+	
+	w->cb = cb;
+	w->ctx = ctx;
+	fsctx.info = w;
+	
+	path = CFStringCreateWithFileSystemRepresentation(NULL, root);
+	paths = CFArrayCreate(NULL, (const void**)&path, 1, &kCFTypeArrayCallBacks);
+	w->stream = FSEventStreamCreate(NULL, fsevents_callback, &fsctx, paths, kFSEventStreamEventIdSinceNow, latency,
+			kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagWatchRoot);
+	CFRelease(paths);
+	CFRelease(path);
+	
+	if (!w->stream)
+	{
+		free(w);
+		errno = EINVAL;
+		return NULL;
+	}
+	
+	w->queue = dispatch_queue_create("org.morth.per.modazipin.fswatch", NULL);
+	FSEventStreamSetDispatchQueue(w->stream, w->queue);
+	if (!FSEventStreamStart(w->stream))
+	{
+		FSEventStreamInvalidate(w->stream);
+		FSEventStreamRelease(w->stream);
+		dispatch_release(w->queue);
+		free(w);
+		errno = EIO;
+		return NULL;
+	}
+	return w;
+}
+
+void
+fswatch_stop(struct fswatch *w)
+{
+	if (!w)
+		return;
+	
+	FSEventStreamStop(w->stream);
+	FSEventStreamInvalidate(w->stream);
+	/* Wait for any callback in progress. */
+	dispatch_sync(w->queue, ^{});
+	FSEventStreamRelease(w->stream);
+	dispatch_release(w->queue);
+	free(w);
+}
+
+#elif defined(__linux__)
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO \
+		| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+struct fswatch
+{
+	int fd;
+	int stopfd[2];
+	pthread_t thread;
+	fswatch_callback cb;
+	void *ctx;
+	
+	char *root;
+	/* Directory paths, indexed by watch descriptor. */
+	char **dirs;
+	int ndirs;
+};
+
+static int
+set_dir(struct fswatch *w, int wd, const char *path)
+{
+	if (wd >= w->ndirs)
+	{
+		int n = w->ndirs ? w->ndirs : 64;
+		char **dirs;
+		
+		while (n <= wd)
+			n *= 2;
+		dirs = realloc(w->dirs, n * sizeof (*dirs));
+		if (!dirs)
+			return -1;
+		memset(dirs + w->ndirs, 0, (n - w->ndirs) * sizeof (*dirs));
+		w->dirs = dirs;
+		w->ndirs = n;
+	}
+	
+	free(w->dirs[wd]);
+	w->dirs[wd] = path ? strdup(path) : NULL;
+	if (path && !w->dirs[wd])
+		return -1;
+	return 0;
+}
+
+/* inotify isn't recursive, so each directory needs a watch of its own. */
+static int
+add_tree(struct fswatch *w, const char *path)
+{
+	int wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+	struct dirent *de;
+	DIR *dir;
+	
+	if (wd < 0)
+		return -1;
+	if (set_dir(w, wd, path))
+		return -1;
+	
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+	
+	while ((de = readdir(dir)))
+	{
+		char sub[PATH_MAX];
+		int isdir = de->d_type == DT_DIR;
+		
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		
+		if (de->d_type == DT_UNKNOWN)
+		{
+			struct stat st;
+			
+			isdir = fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+		}
+		if (!isdir)
+			continue;
+		
+		if (snprintf(sub, sizeof (sub), "%s/%s", path, de->d_name) >= (int)sizeof (sub))
+			continue;
+		/* Might be gone already, that's fine. */
+		add_tree(w, sub);
+	}
+	closedir(dir);
+	return 0;
+}
+
+static void
+handle_event(struct fswatch *w, const struct inotify_event *ev)
+{
+	char path[PATH_MAX];
+	const char *dir;
+	
+	if (ev->mask & IN_Q_OVERFLOW)
+	{
+		w->cb(w->ctx, w->root);
+		return;
+	}
+	
+	if (ev->wd < 0 || ev->wd >= w->ndirs || !(dir = w->dirs[ev->wd]))
+		return;
+	
+	if (ev->mask & IN_IGNORED)
+	{
+		set_dir(w, ev->wd, NULL);
+		return;
+	}
+	
+	if (ev->len && ev->name[0])
+	{
+		if (snprintf(path, sizeof (path), "%s/%s", dir, ev->name) >= (int)sizeof (path))
+			return;
+	}
+	else
+	{
+		strncpy(path, dir, sizeof (path) - 1);
+		path[sizeof (path) - 1] = '\0';
+	}
+	
+	/* Anything created in a new directory before its watch was added is reported through the directory. */
+	if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+		add_tree(w, path);
+	
+	w->cb(w->ctx, path);
+}
+
+static void *
+watch_thread(void *arg)
+{
+	struct fswatch *w = arg;
+	char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	
+	while (1)
+	{
+		struct pollfd fds[2] = {{ w->fd, POLLIN, 0 }, { w->stopfd[0], POLLIN, 0 }};
+		ssize_t len, off;
+		
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents)
+			break;
+		
+		len = read(w->fd, buf, sizeof (buf));
+		if (len < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			break;
+		}
+		
+		for (off = 0 ; off < len ; )
+		{
+			const struct inotify_event *ev = (const struct inotify_event *)(buf + off);
+			
+			handle_event(w, ev);
+			off += sizeof (*ev) + ev->len;
+		}
+	}
+	return NULL;
+}
+
+static void
+free_watch(struct fswatch *w)
+{
+	int i;
+	
+	if (w->fd >= 0)
+		close(w->fd);
+	if (w->stopfd[0] >= 0)
+		close(w->stopfd[0]);
+	if (w->stopfd[1] >= 0)
+		close(w->stopfd[1]);
+	for (i = 0 ; i < w->ndirs ; i++)
+		free(w->dirs[i]);
+	free(w->dirs);
+	free(w->root);
+	free(w);
+}
+
+struct fswatch *
+fswatch_start(const char *root, double latency, fswatch_callback cb, void *ctx)
+{
+	struct fswatch *w = calloc(1, sizeof (*w));
+	int e;
+	
+	(void)latency;
+	
+	if (!w)
+		return NULL;
+	
+	w->cb = cb;
+	w->ctx = ctx;
+	w->stopfd[0] = w->stopfd[1] = -1;
+	w->fd = inotify_init1(IN_CLOEXEC);
+	
+	if (w->fd < 0 || pipe(w->stopfd) || !(w->root = strdup(root)) || add_tree(w, root))
+		goto fail;
+	
+	if ((e = pthread_create(&w->thread, NULL, watch_thread, w)))
+	{
+		errno = e;
+		goto fail;
+	}
+	return w;
+
+fail:
+	e = errno;
+	free_watch(w);
+	errno = e;
+	return NULL;
+}
+
+void
+fswatch_stop(struct fswatch *w)
+{
+	char c = 0;
+	
+	if (!w)
+		return;
+	
+	while (write(w->stopfd[1], &c, 1) < 0 && errno == EINTR)
+		;
+	pthread_join(w->thread, NULL);
+	free_watch(w);
+}
+
+#else
+
+struct fswatch *
+fswatch_start(const char *root, double latency, fswatch_callback cb, void *ctx)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+void
+fswatch_stop(struct fswatch *w)
+{
+}
+
+#endif
@@ -0,0 +1,50 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef FSWATCH_H
+#define FSWATCH_H
+
+/*
+ * Recursive watching of a folder for changes. Uses FSEvents on Mac OS X and
+ * inotify on Linux.
+ */
+
+struct fswatch;
+
+/*
+ * Called on a background thread with the path of each changed file or
+ * directory. If the events for a subtree were lost, the path of the
+ * subtree is given, possibly the root itself.
+ */
+typedef void (*fswatch_callback)(void *ctx, const char *path);
+
+/*
+ * Start watching root. latency is the number of seconds FSEvents may wait to
+ * coalesce events, inotify delivers them as they come.
+ * Returns NULL and sets errno on failure.
+ */
+struct fswatch *fswatch_start(const char *root, double latency, fswatch_callback cb, void *ctx);
+
+/* Stop watching. No callbacks are made once this returns. */
+void fswatch_stop(struct fswatch *w);
+
+#endif /*FSWATCH_H*/
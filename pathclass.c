@@ -0,0 +1,326 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "pathclass.h"
+
+#include <string.h>
+
+/* Components recorded. Content paths are never deeper than this. */
+#define MAX_COMPS 8
+
+enum char_class
+{
+	CC_OTHER,
+	CC_SLASH,
+	CC_DOT
+};
+
+static const unsigned char char_class[256] = {
+	['/'] = CC_SLASH,
+	['.'] = CC_DOT,
+};
+
+/* ASCII lower case, other bytes are kept as is. */
+#define LC(x) ((x) >= 'A' && (x) <= 'Z' ? (x) - 'A' + 'a' : (x))
+#define LC4(x) LC(x), LC(x + 1), LC(x + 2), LC(x + 3)
+#define LC16(x) LC4(x), LC4(x + 4), LC4(x + 8), LC4(x + 12)
+#define LC64(x) LC16(x), LC16(x + 16), LC16(x + 32), LC16(x + 48)
+static const unsigned char lower[256] = {
+	LC64(0), LC64(64), LC64(128), LC64(192)
+};
+#undef LC64
+#undef LC16
+#undef LC4
+#undef LC
+
+static const char disabled_dir[] = " (disabled)/";
+static const char disabled_suffix[] = " (disabled)";
+
+struct path_info
+{
+	size_t ncomps;
+	struct path_span comps[MAX_COMPS];
+	struct path_span last;
+	
+	/* First component named override, or ncomps if none, and the one after it. */
+	size_t override_idx;
+	struct path_span override_comp;
+	struct path_span override_next;
+	
+	int has_dot_comp;
+	int has_empty_comp;
+	int has_disabled_dir;
+	int has_trailing_slash;
+};
+
+static int
+span_is(const char *path, struct path_span s, const char *word)
+{
+	size_t i;
+	
+	for (i = 0 ; i < s.length ; i++)
+	{
+		if (!word[i] || lower[(unsigned char)path[s.offset + i]] != (unsigned char)word[i])
+			return 0;
+	}
+	return !word[i];
+}
+
+static int
+span_ends_with(const char *path, struct path_span s, const char *word, size_t wlen)
+{
+	if (s.length < wlen)
+		return 0;
+	return span_is(path, (struct path_span){ s.offset + s.length - wlen, wlen }, word);
+}
+
+/*
+ * The single pass. Splits into components and notes everything the
+ * classifiers below need to know.
+ */
+static void
+scan_path(const char *path, size_t len, struct path_info *info)
+{
+	size_t i, start = 0;
+	size_t dmatch = 0;
+	int have_override = 0;
+	
+	memset(info, 0, sizeof (*info));
+	
+	for (i = 0 ; i <= len ; i++)
+	{
+		int cc = i < len ? char_class[(unsigned char)path[i]] : CC_SLASH;
+		
+		if (i < len)
+		{
+			/* Space only occurs first in the pattern, so a mismatch can only restart there. */
+			if (lower[(unsigned char)path[i]] == (unsigned char)disabled_dir[dmatch])
+				dmatch++;
+			else
+				dmatch = path[i] == ' ';
+			if (dmatch == sizeof (disabled_dir) - 1)
+			{
+				info->has_disabled_dir = 1;
+				dmatch = 0;
+			}
+		}
+		
+		if (cc == CC_DOT && i == start)
+			info->has_dot_comp = 1;
+		
+		if (cc != CC_SLASH)
+			continue;
+		
+		if (i == len && start == len && len > 0)
+		{
+			info->has_trailing_slash = 1;
+			break;
+		}
+		
+		info->last.offset = start;
+		info->last.length = i - start;
+		if (i == start)
+			info->has_empty_comp = 1;
+		if (info->ncomps < MAX_COMPS)
+			info->comps[info->ncomps] = info->last;
+		if (!have_override && span_is(path, info->last, "override"))
+		{
+			info->override_idx = info->ncomps;
+			info->override_comp = info->last;
+			have_override = 1;
+		}
+		else if (have_override && info->ncomps == info->override_idx + 1)
+			info->override_next = info->last;
+		info->ncomps++;
+		start = i + 1;
+	}
+	
+	if (!have_override)
+		info->override_idx = info->ncomps;
+}
+
+/* From the start of component from to the end of component to, both included. */
+static struct path_span
+comp_range(const struct path_info *info, size_t from, size_t to)
+{
+	struct path_span s;
+	size_t end;
+	
+	s.offset = info->comps[from].offset;
+	if (to < MAX_COMPS)
+		end = info->comps[to].offset + info->comps[to].length;
+	else
+		end = info->last.offset + info->last.length;
+	s.length = end - s.offset;
+	return s;
+}
+
+int
+pathclass_is_erf(const char *path, size_t len)
+{
+	struct path_span s = { 0, len };
+	
+	return span_ends_with(path, s, ".erf", 4) || span_ends_with(path, s, ".crf", 4);
+}
+
+/*
+ * Things both archive types agree on. Returns PATH_SKIP to skip the member,
+ * PATH_MANIFEST for the manifest and PATH_FILE to continue.
+ */
+static enum path_kind
+common_member(const char *path, size_t len, const struct path_info *info)
+{
+	struct path_span all = { 0, len };
+	
+	/* Whitelist Manifest. */
+	if (span_is(path, all, "manifest.xml"))
+		return PATH_MANIFEST;
+	
+	/* We only care about files currently. */
+	if (len == 0 || info->has_trailing_slash)
+		return PATH_SKIP;
+	
+	/* Disallow full paths and anything starting with . */
+	if (info->has_empty_comp || info->has_dot_comp)
+		return PATH_SKIP;
+	
+	return PATH_FILE;
+}
+
+static enum path_kind
+finish_member(const char *path, const struct path_info *info, struct path_member *out)
+{
+	out->name = info->last;
+	out->kind = pathclass_is_erf(path + info->last.offset, info->last.length) ? PATH_ERF : PATH_FILE;
+	return out->kind;
+}
+
+enum path_kind
+pathclass_dazip(const char *path, size_t len, struct path_member *out)
+{
+	struct path_info info;
+	size_t cend;
+	
+	memset(out, 0, sizeof (*out));
+	out->prefix = "";
+	
+	scan_path(path, len, &info);
+	out->kind = common_member(path, len, &info);
+	if (out->kind != PATH_FILE)
+		return out->kind;
+	out->kind = PATH_SKIP;
+	
+	/* Disallow everything not in Contents/ and at least two levels below */
+	if (info.ncomps < 3 || !span_is(path, info.comps[0], "contents"))
+		return PATH_SKIP;
+	
+	/* Blacklist some of the user data dirs. */
+	if (span_is(path, info.comps[1], "characters") || span_is(path, info.comps[1], "logs")
+		|| span_is(path, info.comps[1], "screenshots") || span_is(path, info.comps[1], "settings"))
+		return PATH_SKIP;
+	
+	/* Disallow stuff containing (disabled) */
+	if (info.has_disabled_dir)
+		return PATH_SKIP;
+	
+	/* Determine contents path. */
+	cend = span_is(path, info.comps[1], "packages") ? 4 : 2;
+	if (info.ncomps < cend + 1)
+		return PATH_SKIP;
+	
+	out->content = comp_range(&info, 1, cend);
+	out->install = comp_range(&info, 1, info.ncomps - 1);
+	out->in_directory = info.ncomps > cend + 1;
+	
+	return finish_member(path, &info, out);
+}
+
+enum path_kind
+pathclass_override(const char *path, size_t len, struct path_member *out)
+{
+	struct path_info info;
+	
+	memset(out, 0, sizeof (*out));
+	out->prefix = "packages/core/";
+	
+	scan_path(path, len, &info);
+	out->kind = common_member(path, len, &info);
+	if (out->kind != PATH_FILE)
+		return out->kind;
+	out->kind = PATH_SKIP;
+	
+	/* Find the override folder, which can be deeper than the components kept. */
+	if (info.override_idx + 1 >= info.ncomps)
+		return PATH_SKIP;
+	
+	out->content.offset = info.override_comp.offset;
+	out->content.length = info.override_next.offset + info.override_next.length - out->content.offset;
+	out->install.offset = info.override_comp.offset;
+	out->install.length = info.last.offset + info.last.length - out->install.offset;
+	out->in_directory = info.ncomps > info.override_idx + 2;
+	
+	return finish_member(path, &info, out);
+}
+
+enum path_scan_type
+pathclass_scan(const char *path, size_t len, int disabled, struct path_scan *out)
+{
+	struct path_info info;
+	size_t cend;
+	
+	memset(out, 0, sizeof (*out));
+	
+	scan_path(path, len, &info);
+	if (len == 0 || info.has_empty_comp)
+		return PATH_SCAN_NONE;
+	
+	out->head = info.comps[0];
+	
+	if (span_is(path, info.comps[0], "addins") || span_is(path, info.comps[0], "offers"))
+	{
+		/* Directories above the content path level. */
+		if (info.ncomps < 2)
+			return PATH_SCAN_NONE;
+		out->type = PATH_SCAN_ADDIN;
+		cend = 1;
+	}
+	else
+	{
+		if (disabled && span_ends_with(path, out->head, disabled_suffix, sizeof (disabled_suffix) - 1))
+			out->head.length -= sizeof (disabled_suffix) - 1;
+		
+		if (info.ncomps > 4)
+		{
+			out->type = PATH_SCAN_DIR;
+			cend = 3;
+		}
+		else
+		{
+			out->type = PATH_SCAN_FILE;
+			cend = info.ncomps - 1;
+		}
+	}
+	
+	out->tail.offset = info.comps[0].offset + info.comps[0].length;
+	out->tail.length = cend ? comp_range(&info, 0, cend).length - info.comps[0].length : 0;
+	return out->type;
+}
@@ -0,0 +1,93 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef PATHCLASS_H
+#define PATHCLASS_H
+
+#include <stddef.h>
+
+/*
+ * Classification of archive member paths and scanned files in a single pass
+ * over the raw bytes of the path, without allocating. Results are given as
+ * spans into the path.
+ */
+
+struct path_span
+{
+	size_t offset;
+	size_t length;
+};
+
+enum path_kind
+{
+	PATH_SKIP,
+	PATH_MANIFEST,
+	PATH_ERF,
+	PATH_FILE
+};
+
+struct path_member
+{
+	enum path_kind kind;
+	
+	/* Set if the member is below the content path rather than being it. */
+	int in_directory;
+	
+	/* Prepended to both content and install path. */
+	const char *prefix;
+	struct path_span content;
+	struct path_span install;
+	struct path_span name;
+};
+
+/* Members of a dazip, which must be in Contents/. */
+enum path_kind pathclass_dazip(const char *path, size_t len, struct path_member *out);
+
+/* Members of an override archive, which must be in a folder called override. */
+enum path_kind pathclass_override(const char *path, size_t len, struct path_member *out);
+
+enum path_scan_type
+{
+	PATH_SCAN_NONE,
+	PATH_SCAN_ADDIN,
+	PATH_SCAN_DIR,
+	PATH_SCAN_FILE
+};
+
+/*
+ * A scanned file, path relative to the game folder. The content path is head
+ * followed by tail, head being the first component with any " (disabled)"
+ * suffix removed if disabled is set.
+ */
+struct path_scan
+{
+	enum path_scan_type type;
+	struct path_span head;
+	struct path_span tail;
+};
+
+enum path_scan_type pathclass_scan(const char *path, size_t len, int disabled, struct path_scan *out);
+
+/* Check for .erf or .crf at the end. */
+int pathclass_is_erf(const char *path, size_t len);
+
+#endif /*PATHCLASS_H*/
@@ -0,0 +1,427 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef EFTYPE
+#define EFTYPE EINVAL
+#endif
+
+#define SNAPSHOT_MAGIC 0x4d5a534e /* MZSN */
+
+struct snapshot_header
+{
+	uint32_t magic;
+	uint32_t version;
+	struct snapshot_source source;
+	uint32_t nnodes;
+	uint32_t nvalues;
+	uint32_t nrefs;
+	uint32_t nstrings;
+	uint32_t strdata_len;
+	uint32_t pad;
+};
+
+struct snapshot_writer
+{
+	struct snapshot_node *nodes;
+	uint32_t nnodes, nodes_size;
+	struct snapshot_value *values;
+	uint32_t nvalues, values_size;
+	uint32_t *refs;
+	uint32_t nrefs, refs_size;
+	struct snapshot_string *strings;
+	uint32_t nstrings, strings_size;
+	char *strdata;
+	uint32_t strdata_len, strdata_size;
+	
+	/* String lookup, open addressing. Index + 1, 0 is empty. */
+	uint32_t *buckets;
+	uint32_t nbuckets;
+};
+
+uint64_t
+snapshot_hash_update(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	
+	/* FNV-1a */
+	while (len--)
+	{
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+uint64_t
+snapshot_hash(const void *data, size_t len)
+{
+	return snapshot_hash_update(SNAPSHOT_HASH_INIT, data, len);
+}
+
+int
+snapshot_open(struct snapshot *s, const void *data, size_t len)
+{
+	const struct snapshot_header *hdr = data;
+	const unsigned char *p = data;
+	uint64_t need;
+	uint32_t i;
+	
+	if (len < sizeof (*hdr) || hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION)
+	{
+		errno = EFTYPE;
+		return -1;
+	}
+	
+	need = sizeof (*hdr)
+		+ (uint64_t)hdr->nnodes * sizeof (*s->nodes)
+		+ (uint64_t)hdr->nvalues * sizeof (*s->values)
+		+ (uint64_t)hdr->nrefs * sizeof (*s->refs)
+		+ (uint64_t)hdr->nstrings * sizeof (*s->strings)
+		+ hdr->strdata_len;
+	if (need != len)
+	{
+		errno = EFTYPE;
+		return -1;
+	}
+	
+	s->source = hdr->source;
+	p += sizeof (*hdr);
+	s->nodes = (const struct snapshot_node*)p;
+	s->nnodes = hdr->nnodes;
+	p += (size_t)s->nnodes * sizeof (*s->nodes);
+	s->values = (const struct snapshot_value*)p;
+	s->nvalues = hdr->nvalues;
+	p += (size_t)s->nvalues * sizeof (*s->values);
+	s->refs = (const uint32_t*)p;
+	s->nrefs = hdr->nrefs;
+	p += (size_t)s->nrefs * sizeof (*s->refs);
+	s->strings = (const struct snapshot_string*)p;
+	s->nstrings = hdr->nstrings;
+	p += (size_t)s->nstrings * sizeof (*s->strings);
+	s->strdata = (const char*)p;
+	s->strdata_len = hdr->strdata_len;
+	
+	for (i = 0 ; i < s->nstrings ; i++)
+	{
+		if ((uint64_t)s->strings[i].offset + s->strings[i].len > s->strdata_len)
+			goto bad;
+	}
+	for (i = 0 ; i < s->nrefs ; i++)
+	{
+		if (s->refs[i] >= s->nnodes)
+			goto bad;
+	}
+	for (i = 0 ; i < s->nnodes ; i++)
+	{
+		const struct snapshot_node *n = &s->nodes[i];
+		
+		if (n->entity >= s->nstrings || n->ref >= s->nstrings
+			|| (uint64_t)n->first + n->nvalues > s->nvalues)
+			goto bad;
+	}
+	for (i = 0 ; i < s->nvalues ; i++)
+	{
+		const struct snapshot_value *v = &s->values[i];
+		
+		if (v->key >= s->nstrings)
+			goto bad;
+		switch (v->type)
+		{
+			case SNAPSHOT_STRING:
+			case SNAPSHOT_DECIMAL:
+				if (v->a >= s->nstrings)
+					goto bad;
+				break;
+			case SNAPSHOT_BOOL:
+				if (v->a > 1)
+					goto bad;
+				break;
+			case SNAPSHOT_NODE:
+				if (v->a >= s->nnodes)
+					goto bad;
+				break;
+			case SNAPSHOT_NODES:
+				if ((uint64_t)v->a + v->b > s->nrefs)
+					goto bad;
+				break;
+			default:
+				goto bad;
+		}
+	}
+	return 0;
+
+bad:
+	errno = EFTYPE;
+	return -1;
+}
+
+const char *
+snapshot_string(const struct snapshot *s, uint32_t idx, size_t *len)
+{
+	*len = s->strings[idx].len;
+	return s->strdata + s->strings[idx].offset;
+}
+
+/*
+ * Make room for n more elements of elsize in *arr, currently holding *count
+ * out of *size.
+ */
+static int
+grow(void *arr, uint32_t *size, uint32_t count, uint32_t n, size_t elsize)
+{
+	void **parr = arr;
+	uint64_t nsize = *size ? *size : 64;
+	void *narr;
+	
+	if ((uint64_t)count + n <= *size)
+		return 0;
+	
+	while (nsize < (uint64_t)count + n)
+		nsize *= 2;
+	if (nsize >= SNAPSHOT_NONE)
+	{
+		if ((uint64_t)count + n >= SNAPSHOT_NONE)
+		{
+			errno = EOVERFLOW;
+			return -1;
+		}
+		nsize = SNAPSHOT_NONE - 1;
+	}
+	
+	narr = realloc(*parr, nsize * elsize);
+	if (!narr)
+		return -1;
+	*parr = narr;
+	*size = (uint32_t)nsize;
+	return 0;
+}
+
+struct snapshot_writer *
+snapshot_writer_new(void)
+{
+	return calloc(1, sizeof (struct snapshot_writer));
+}
+
+void
+snapshot_writer_free(struct snapshot_writer *sw)
+{
+	if (!sw)
+		return;
+	free(sw->nodes);
+	free(sw->values);
+	free(sw->refs);
+	free(sw->strings);
+	free(sw->strdata);
+	free(sw->buckets);
+	free(sw);
+}
+
+static uint32_t
+bucket_for(const struct snapshot_writer *sw, const char *str, size_t len)
+{
+	uint32_t b = (uint32_t)snapshot_hash(str, len) & (sw->nbuckets - 1);
+	
+	while (sw->buckets[b])
+	{
+		const struct snapshot_string *ss = &sw->strings[sw->buckets[b] - 1];
+		
+		if (ss->len == len && !memcmp(sw->strdata + ss->offset, str, len))
+			break;
+		b = (b + 1) & (sw->nbuckets - 1);
+	}
+	return b;
+}
+
+static int
+rehash(struct snapshot_writer *sw)
+{
+	uint32_t nbuckets = sw->nbuckets ? sw->nbuckets * 2 : 256;
+	uint32_t *old = sw->buckets;
+	uint32_t i;
+	
+	if (!nbuckets)
+	{
+		errno = EOVERFLOW;
+		return -1;
+	}
+	sw->buckets = calloc(nbuckets, sizeof (*sw->buckets));
+	if (!sw->buckets)
+	{
+		sw->buckets = old;
+		return -1;
+	}
+	sw->nbuckets = nbuckets;
+	free(old);
+	
+	for (i = 0 ; i < sw->nstrings ; i++)
+	{
+		const struct snapshot_string *ss = &sw->strings[i];
+		
+		sw->buckets[bucket_for(sw, sw->strdata + ss->offset, ss->len)] = i + 1;
+	}
+	return 0;
+}
+
+uint32_t
+snapshot_add_string(struct snapshot_writer *sw, const char *str, size_t len)
+{
+	uint32_t b;
+	
+	/* Keep the load at most a half. */
+	if (sw->nstrings >= sw->nbuckets / 2 && rehash(sw))
+		return SNAPSHOT_NONE;
+	
+	b = bucket_for(sw, str, len);
+	if (sw->buckets[b])
+		return sw->buckets[b] - 1;
+	
+	if (len >= SNAPSHOT_NONE)
+	{
+		errno = EOVERFLOW;
+		return SNAPSHOT_NONE;
+	}
+	if (grow(&sw->strings, &sw->strings_size, sw->nstrings, 1, sizeof (*sw->strings))
+		|| grow(&sw->strdata, &sw->strdata_size, sw->strdata_len, (uint32_t)len, 1))
+		return SNAPSHOT_NONE;
+	
+	if (len)
+		memcpy(sw->strdata + sw->strdata_len, str, len);
+	sw->strings[sw->nstrings].offset = sw->strdata_len;
+	sw->strings[sw->nstrings].len = (uint32_t)len;
+	sw->strdata_len += (uint32_t)len;
+	sw->buckets[b] = sw->nstrings + 1;
+	return sw->nstrings++;
+}
+
+uint32_t
+snapshot_add_node(struct snapshot_writer *sw, uint32_t entity, uint32_t ref)
+{
+	struct snapshot_node *n;
+	
+	if (entity >= sw->nstrings || ref >= sw->nstrings)
+	{
+		errno = EINVAL;
+		return SNAPSHOT_NONE;
+	}
+	if (grow(&sw->nodes, &sw->nodes_size, sw->nnodes, 1, sizeof (*sw->nodes)))
+		return SNAPSHOT_NONE;
+	
+	n = &sw->nodes[sw->nnodes];
+	n->entity = entity;
+	n->ref = ref;
+	n->first = 0;
+	n->nvalues = 0;
+	return sw->nnodes++;
+}
+
+uint32_t
+snapshot_add_refs(struct snapshot_writer *sw, const uint32_t *nodes, uint32_t n)
+{
+	uint32_t i, first = sw->nrefs;
+	
+	for (i = 0 ; i < n ; i++)
+	{
+		if (nodes[i] >= sw->nnodes)
+		{
+			errno = EINVAL;
+			return SNAPSHOT_NONE;
+		}
+	}
+	if (grow(&sw->refs, &sw->refs_size, sw->nrefs, n, sizeof (*sw->refs)))
+		return SNAPSHOT_NONE;
+	
+	if (n)
+		memcpy(sw->refs + first, nodes, n * sizeof (*nodes));
+	sw->nrefs += n;
+	return first;
+}
+
+int
+snapshot_set_values(struct snapshot_writer *sw, uint32_t node, const struct snapshot_value *values, uint32_t n)
+{
+	if (node >= sw->nnodes)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (grow(&sw->values, &sw->values_size, sw->nvalues, n, sizeof (*sw->values)))
+		return -1;
+	
+	if (n)
+		memcpy(sw->values + sw->nvalues, values, n * sizeof (*values));
+	sw->nodes[node].first = sw->nvalues;
+	sw->nodes[node].nvalues = n;
+	sw->nvalues += n;
+	return 0;
+}
+
+static int
+write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	
+	while (len)
+	{
+		ssize_t n = write(fd, p, len);
+		
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+int
+snapshot_write(struct snapshot_writer *sw, int fd, const struct snapshot_source *source)
+{
+	struct snapshot_header hdr;
+	
+	memset(&hdr, 0, sizeof (hdr));
+	hdr.magic = SNAPSHOT_MAGIC;
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.source = *source;
+	hdr.nnodes = sw->nnodes;
+	hdr.nvalues = sw->nvalues;
+	hdr.nrefs = sw->nrefs;
+	hdr.nstrings = sw->nstrings;
+	hdr.strdata_len = sw->strdata_len;
+	
+	if (write_all(fd, &hdr, sizeof (hdr))
+		|| write_all(fd, sw->nodes, (size_t)sw->nnodes * sizeof (*sw->nodes))
+		|| write_all(fd, sw->values, (size_t)sw->nvalues * sizeof (*sw->values))
+		|| write_all(fd, sw->refs, (size_t)sw->nrefs * sizeof (*sw->refs))
+		|| write_all(fd, sw->strings, (size_t)sw->nstrings * sizeof (*sw->strings))
+		|| write_all(fd, sw->strdata, sw->strdata_len))
+		return -1;
+	return 0;
+}
@@ -0,0 +1,140 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A flat copy of the objects loaded from one of the list files, written
+ * next to it so the list can be shown without parsing the XML. The file is
+ * used straight from a mapping: a header, then arrays of fixed size records
+ * that refer to each other and to a string table by index. Everything is in
+ * host byte order, a file from another byte order fails the magic check.
+ *
+ * Each node is one cache node, with an entity name, a reference object and
+ * a run of values. A value has a key and either a string, a number given
+ * as a string, a boolean, another node or a run of node indices in refs.
+ */
+
+#define SNAPSHOT_VERSION 1
+
+enum snapshot_type
+{
+	SNAPSHOT_STRING,
+	SNAPSHOT_DECIMAL,
+	SNAPSHOT_BOOL,
+	SNAPSHOT_NODE,
+	SNAPSHOT_NODES
+};
+
+/* What the snapshot was made from. It's only valid while the file matches. */
+struct snapshot_source
+{
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t hash;
+};
+
+struct snapshot_string
+{
+	uint32_t offset;
+	uint32_t len;
+};
+
+struct snapshot_node
+{
+	uint32_t entity;
+	uint32_t ref;
+	uint32_t first;
+	uint32_t nvalues;
+};
+
+/*
+ * a is the string index for strings and decimals, 0 or 1 for booleans and
+ * the node index for nodes. For SNAPSHOT_NODES, a is the first index in refs
+ * and b the count.
+ */
+struct snapshot_value
+{
+	uint32_t key;
+	uint32_t type;
+	uint32_t a;
+	uint32_t b;
+};
+
+struct snapshot
+{
+	struct snapshot_source source;
+	
+	const struct snapshot_node *nodes;
+	uint32_t nnodes;
+	const struct snapshot_value *values;
+	uint32_t nvalues;
+	const uint32_t *refs;
+	uint32_t nrefs;
+	const struct snapshot_string *strings;
+	uint32_t nstrings;
+	const char *strdata;
+	uint32_t strdata_len;
+};
+
+/*
+ * Checks the whole snapshot, so that every index in it can be used without
+ * further checks. The data must stay mapped while s is used. Returns -1 with
+ * errno EFTYPE (or EINVAL) if it's not a snapshot of this version.
+ */
+int snapshot_open(struct snapshot *s, const void *data, size_t len);
+
+/* String idx, not NUL terminated. */
+const char *snapshot_string(const struct snapshot *s, uint32_t idx, size_t *len);
+
+/* Cheap hash of the source file, to catch edits that keep size and mtime. */
+uint64_t snapshot_hash(const void *data, size_t len);
+
+/* The same for data in parts, starting from SNAPSHOT_HASH_INIT. */
+#define SNAPSHOT_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t snapshot_hash_update(uint64_t h, const void *data, size_t len);
+
+#define SNAPSHOT_NONE UINT32_MAX
+
+struct snapshot_writer;
+
+struct snapshot_writer *snapshot_writer_new(void);
+void snapshot_writer_free(struct snapshot_writer *sw);
+
+/*
+ * These return SNAPSHOT_NONE and set errno on failure. Strings are stored
+ * once however many times they're added. Node values may be set in any
+ * order after the node is added, but only once.
+ */
+uint32_t snapshot_add_string(struct snapshot_writer *sw, const char *str, size_t len);
+uint32_t snapshot_add_node(struct snapshot_writer *sw, uint32_t entity, uint32_t ref);
+uint32_t snapshot_add_refs(struct snapshot_writer *sw, const uint32_t *nodes, uint32_t n);
+int snapshot_set_values(struct snapshot_writer *sw, uint32_t node, const struct snapshot_value *values, uint32_t n);
+
+/* Returns -1 and sets errno on failure, fd is left open. */
+int snapshot_write(struct snapshot_writer *sw, int fd, const struct snapshot_source *source);
+
+#endif /*SNAPSHOT_H*/
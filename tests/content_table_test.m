@@ -0,0 +1,85 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Checks the conflict lookups of ContentTable, which is what AddInsList
+ * reports conflicts from. Needs Foundation, so only built on Mac OS X.
+ */
+
+#import "ContentTable.h"
+
+static int failed;
+
+static void
+expect(BOOL ok, NSString *what)
+{
+	if (ok)
+		return;
+	fprintf(stderr, "content_table_test: %s\n", [what UTF8String]);
+	failed = 1;
+}
+
+int
+main(void)
+{
+	@autoreleasepool
+	{
+		ContentTable *table = [[ContentTable alloc] init];
+		NSDictionary *res;
+		
+		/* Two addins sharing a file, and a package with another of theirs. */
+		[table addContent:@"shared.gda" URL:nil forPath:@"Addins/first"];
+		[table addContent:@"first.erf" URL:nil forPath:@"Addins/first"];
+		[table addContent:@"Shared.GDA" URL:nil forPath:@"Addins/second"];
+		[table addContent:@"second.erf" URL:nil forPath:@"Addins/second"];
+		[table addContent:@"second.erf" URL:nil forPath:@"packages/core/override/mod"];
+		[table addContent:@"mod.erf" URL:nil forPath:@"packages/core/override/mod"];
+		
+		res = [table conflictsForPaths:[NSArray arrayWithObject:@"Addins/first"]];
+		expect([res isEqualToDictionary:[NSDictionary dictionaryWithObject:[NSArray arrayWithObject:@"Addins/second"] forKey:@"shared.gda"]],
+			   [NSString stringWithFormat:@"addin vs addin: %@", res]);
+		
+		res = [table conflictsForPaths:[NSArray arrayWithObject:@"addins/SECOND"]];
+		expect([[res objectForKey:@"shared.gda"] isEqualToArray:[NSArray arrayWithObject:@"Addins/first"]]
+			   && [[res objectForKey:@"second.erf"] isEqualToArray:[NSArray arrayWithObject:@"packages/core/override/mod"]]
+			   && [res count] == 2,
+			   [NSString stringWithFormat:@"addin vs addin and package: %@", res]);
+		
+		/* As asked when installing a dazip with the contents. */
+		res = [table conflictsForContents:[NSSet setWithObjects:@"SHARED.gda", @"new.erf", nil] excludingPaths:nil];
+		expect([res count] == 1 && [[NSSet setWithArray:[res objectForKey:@"shared.gda"]] isEqualToSet:[NSSet setWithObjects:@"Addins/first", @"Addins/second", nil]],
+			   [NSString stringWithFormat:@"dazip contents: %@", res]);
+		
+		/* Removing an addin folder takes its contents with it. */
+		[table removeContentsBelowPath:@"Addins/second"];
+		res = [table conflictsForPaths:[NSArray arrayWithObject:@"Addins/first"]];
+		expect([res count] == 0, [NSString stringWithFormat:@"after removing the second addin: %@", res]);
+		expect([table countForPath:@"packages/core/override/mod"] == 2, @"package contents were removed with the addin");
+		
+		[table removeContentsBelowPath:@"Addins"];
+		expect([table countForPath:@"Addins/first"] == 0, @"addin contents left after removing all addins");
+	}
+	
+	if (failed)
+		return 1;
+	printf("content_table_test: ok\n");
+	return 0;
+}
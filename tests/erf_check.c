@@ -0,0 +1,156 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "erf_check.h"
+#include "erf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ref_entry
+{
+	uint32_t offset;
+	uint32_t length;
+	uint32_t unpacked_length;
+	int compression;
+	char *name;
+};
+
+struct ref_list
+{
+	const char *data;
+	struct ref_entry *entries;
+	size_t count;
+	size_t size;
+	int failed;
+};
+
+static void
+collect(void *ctx, struct erf_header *header, struct erf_file *file)
+{
+	struct ref_list *list = ctx;
+	struct ref_entry *e;
+	
+	(void)header;
+	
+	if (list->failed)
+		return;
+	if (list->count == list->size)
+	{
+		size_t nsize = list->size ? list->size * 2 : 64;
+		struct ref_entry *n = realloc(list->entries, nsize * sizeof (*n));
+		
+		if (!n)
+		{
+			list->failed = 1;
+			return;
+		}
+		list->entries = n;
+		list->size = nsize;
+	}
+	e = &list->entries[list->count++];
+	e->offset = (uint32_t)((const char*)file->data - list->data);
+	e->length = file->length;
+	e->unpacked_length = file->unpacked_length;
+	e->compression = file->compression;
+	e->name = file->name ? strdup(file->name) : NULL;
+}
+
+static void
+ref_free(struct ref_list *list)
+{
+	size_t i;
+	
+	for (i = 0 ; i < list->count ; i++)
+		free(list->entries[i].name);
+	free(list->entries);
+}
+
+int
+erf_check_equivalent(const void *data, size_t length, uint32_t capacity, char *why, size_t whylen)
+{
+	struct ref_list ref = { data, NULL, 0, 0, 0 };
+	struct erf_cursor cursor;
+	struct erf_toc *toc = erf_toc_new(capacity);
+	int ref_ok, r, res = -1;
+	size_t seen = 0;
+	uint32_t i;
+	
+	if (!toc)
+	{
+		snprintf(why, whylen, "out of memory");
+		return -1;
+	}
+	
+	ref_ok = !parse_erf_data_f(data, length, &ref, collect);
+	if (ref.failed)
+	{
+		snprintf(why, whylen, "out of memory");
+		goto out;
+	}
+	
+	if (erf_cursor_init(&cursor, data, length))
+	{
+		if (ref_ok || ref.count)
+			snprintf(why, whylen, "cursor header rejected, reference gave %zu entries", ref.count);
+		else
+			res = 0;
+		goto out;
+	}
+	
+	while ((r = erf_cursor_read(&cursor, toc)) > 0)
+	{
+		for (i = 0 ; i < toc->count ; i++, seen++)
+		{
+			const struct ref_entry *e;
+			const char *name = toc->name[i] == ERF_TOC_NONAME ? NULL : toc->names + toc->name[i];
+			
+			if (seen >= ref.count)
+			{
+				snprintf(why, whylen, "cursor gave entry %zu, reference only %zu", seen, ref.count);
+				goto out;
+			}
+			e = &ref.entries[seen];
+			if (toc->offset[i] != e->offset || toc->length[i] != e->length
+				|| toc->unpacked_length[i] != e->unpacked_length || toc->compression[i] != e->compression
+				|| (!name != !e->name) || (name && strcmp(name, e->name)))
+			{
+				snprintf(why, whylen, "entry %zu differs: %s %u %u %u %u, reference %s %u %u %u %d", seen,
+						 name ? name : "(none)", toc->offset[i], toc->length[i], toc->unpacked_length[i], toc->compression[i],
+						 e->name ? e->name : "(none)", e->offset, e->length, e->unpacked_length, e->compression);
+				goto out;
+			}
+		}
+	}
+	
+	if (seen != ref.count)
+		snprintf(why, whylen, "cursor gave %zu entries, reference %zu", seen, ref.count);
+	else if ((r < 0) == ref_ok)
+		snprintf(why, whylen, "cursor %s, reference %s", r < 0 ? "failed" : "succeeded", ref_ok ? "succeeded" : "failed");
+	else
+		res = 0;
+	
+out:
+	erf_toc_free(toc);
+	ref_free(&ref);
+	return res;
+}
@@ -0,0 +1,86 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Fuzz target for the ERF table of contents parsing, aborting whenever the
+ * cursor and parse_erf_data_f disagree. Built for libFuzzer by default,
+ * with -DFUZZ_MAIN it reads one input from a file or stdin instead, for AFL
+ * or for replaying a crash.
+ */
+
+#include "erf_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char why[256];
+	uint32_t capacity;
+	
+	/* Let the first byte pick the batch size, so that batch edges get covered. */
+	if (!size)
+		return 0;
+	capacity = 1 + data[0] % 64;
+	
+	if (erf_check_equivalent(data + 1, size - 1, capacity, why, sizeof (why)))
+	{
+		fprintf(stderr, "erf_fuzz: %s\n", why);
+		abort();
+	}
+	return 0;
+}
+
+#ifdef FUZZ_MAIN
+int
+main(int argc, char *argv[])
+{
+	FILE *f = argc > 1 ? fopen(argv[1], "rb") : stdin;
+	uint8_t *buf = NULL;
+	size_t len = 0, size = 0, n;
+	
+	if (!f)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	do
+	{
+		if (len == size)
+		{
+			size = size ? size * 2 : 65536;
+			buf = realloc(buf, size);
+			if (!buf)
+				return 1;
+		}
+		n = fread(buf + len, 1, size - len, f);
+		len += n;
+	} while (n);
+	
+	LLVMFuzzerTestOneInput(buf, len);
+	free(buf);
+	return 0;
+}
+#endif
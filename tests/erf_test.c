@@ -0,0 +1,292 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Checks the ERF table of contents cursor against parse_erf_data_f on
+ * generated ERFs of all versions, intact and damaged, and streamed with
+ * their length known and unknown. With -b it instead times both on one
+ * large ERF.
+ */
+
+#include "erf_check.h"
+#include "erf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t
+rnd(uint32_t n)
+{
+	/* xorshift64 */
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return n ? (uint32_t)(rng % n) : 0;
+}
+
+/* A random ERF of the version, in a malloced buffer. */
+static unsigned char *
+make_erf(enum erf_version version, uint32_t n, size_t *len)
+{
+	struct erf_write_entry *entries = calloc(n ? n : 1, sizeof (*entries));
+	char (*names)[ERF_FILENAME_MAXLEN + 1] = calloc(n ? n : 1, sizeof (*names));
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.";
+	static const char payload[4096];
+	unsigned char *buf = NULL;
+	uint32_t i, j;
+	
+	for (i = 0 ; i < n ; i++)
+	{
+		/* Unique, 1 to 32 characters. */
+		uint32_t nlen = 1 + rnd(ERF_FILENAME_MAXLEN);
+		int l = snprintf(names[i], sizeof (names[i]), "%u.", i);
+		
+		for (j = (uint32_t)l ; j < nlen ; j++)
+			names[i][j] = chars[rnd(sizeof (chars) - 1)];
+		names[i][nlen > (uint32_t)l ? nlen : (uint32_t)l] = '\0';
+		entries[i].name = names[i];
+		entries[i].data = payload;
+		entries[i].length = rnd(64);
+	}
+	
+	*len = erf_write_size(version, entries, n);
+	if (*len)
+	{
+		buf = malloc(*len);
+		if (buf && erf_write(buf, *len, version, entries, n))
+		{
+			free(buf);
+			buf = NULL;
+		}
+	}
+	free(names);
+	free(entries);
+	return buf;
+}
+
+static int
+check(const unsigned char *buf, size_t len, const char *what)
+{
+	char why[256];
+	
+	if (!erf_check_equivalent(buf, len, 1 + rnd(40), why, sizeof (why)))
+		return 0;
+	fprintf(stderr, "%s: %s\n", what, why);
+	return -1;
+}
+
+/*
+ * Feeds the ERF to a stream in random pieces, the way loadArchive does, and
+ * checks its cursor gives the same entries as one over the whole ERF.
+ * total is what the stream is told the length is, 0 if unknown.
+ */
+static int
+check_stream(const unsigned char *buf, size_t len, uint64_t total, const char *what)
+{
+	struct erf_stream *stream = erf_stream_new(total);
+	struct erf_toc *want = erf_toc_new(256), *got = erf_toc_new(256);
+	struct erf_cursor cursor;
+	size_t at = 0;
+	int fed = 0, res = -1, r;
+	uint32_t i;
+	
+	if (!stream || !want || !got)
+	{
+		perror("check_stream");
+		goto out;
+	}
+	
+	while (!fed && at < len)
+	{
+		size_t l = 1 + rnd(1000);
+		
+		if (l > len - at)
+			l = len - at;
+		fed = erf_stream_feed(stream, buf + at, l);
+		at += l;
+	}
+	if (fed != 1 || erf_stream_cursor(stream, &cursor))
+	{
+		fprintf(stderr, "%s: stream never completed\n", what);
+		goto out;
+	}
+	if ((r = erf_cursor_read(&cursor, got)) < 0)
+	{
+		fprintf(stderr, "%s: stream cursor failed\n", what);
+		goto out;
+	}
+	
+	erf_cursor_init(&cursor, buf, len);
+	if (erf_cursor_read(&cursor, want) < 0 || want->count != got->count)
+	{
+		fprintf(stderr, "%s: stream cursor gave %u entries, reference %u\n", what, got->count, want->count);
+		goto out;
+	}
+	for (i = 0 ; i < want->count ; i++)
+	{
+		if (got->offset[i] != want->offset[i] || got->length[i] != want->length[i]
+			|| got->unpacked_length[i] != want->unpacked_length[i] || got->compression[i] != want->compression[i]
+			|| strcmp(got->names + got->name[i], want->names + want->name[i]))
+		{
+			fprintf(stderr, "%s: stream cursor entry %u differs\n", what, i);
+			goto out;
+		}
+	}
+	res = 0;
+	
+out:
+	erf_toc_free(got);
+	erf_toc_free(want);
+	erf_stream_free(stream);
+	return res;
+}
+
+static int
+run_tests(void)
+{
+	static const enum erf_version versions[] = { ERF_VERSION_2_0, ERF_VERSION_2_2, ERF_VERSION_3_0 };
+	int failed = 0, round;
+	size_t v;
+	
+	for (round = 0 ; round < 300 ; round++)
+	{
+		for (v = 0 ; v < sizeof (versions) / sizeof (*versions) ; v++)
+		{
+			size_t len, cut;
+			unsigned char *buf = make_erf(versions[v], rnd(200), &len);
+			unsigned char *bad;
+			int k;
+			
+			if (!buf)
+			{
+				perror("make_erf");
+				return 1;
+			}
+			failed |= check(buf, len, "intact");
+			failed |= check_stream(buf, len, len, "streamed");
+			failed |= check_stream(buf, len, 0, "streamed, length unknown");
+			
+			/* Every truncation point in the header and table, a few in the data. */
+			bad = malloc(len);
+			for (cut = 0 ; cut < len ; cut += cut < 2048 ? 1 : 1 + rnd(512))
+			{
+				memcpy(bad, buf, cut);
+				failed |= check(bad, cut, "truncated");
+			}
+			
+			/* Random damage, in the first 2 kB where the table is. */
+			for (k = 0 ; k < 200 ; k++)
+			{
+				size_t at = rnd(len < 2048 ? (uint32_t)len : 2048);
+				
+				memcpy(bad, buf, len);
+				if (rnd(2))
+					bad[at] ^= (unsigned char)(1 << rnd(8));
+				else
+					bad[at] = rnd(2) ? 0xff : 0;
+				failed |= check(bad, len, "damaged");
+			}
+			
+			free(bad);
+			free(buf);
+		}
+	}
+	
+	if (failed)
+		return 1;
+	printf("erf_test: ok\n");
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+count_entry(void *ctx, struct erf_header *header, struct erf_file *file)
+{
+	size_t *sum = ctx;
+	
+	(void)header;
+	/* What the callers did per entry, at the least. */
+	*sum += strlen(file->name);
+}
+
+static int
+run_bench(void)
+{
+	static const enum erf_version versions[] = { ERF_VERSION_2_0, ERF_VERSION_2_2, ERF_VERSION_3_0 };
+	static const char *vnames[] = { "V2.0", "V2.2", "V3.0" };
+	const int reps = 50;
+	size_t v;
+	
+	for (v = 0 ; v < sizeof (versions) / sizeof (*versions) ; v++)
+	{
+		size_t len, sum = 0;
+		unsigned char *buf = make_erf(versions[v], 50000, &len);
+		struct erf_toc *toc = erf_toc_new(4096);
+		struct erf_cursor cursor;
+		double t0, t1, t2;
+		int i, r;
+		
+		if (!buf || !toc)
+		{
+			perror("bench");
+			return 1;
+		}
+		
+		t0 = now();
+		for (i = 0 ; i < reps ; i++)
+			parse_erf_data_f(buf, len, &sum, count_entry);
+		t1 = now();
+		for (i = 0 ; i < reps ; i++)
+		{
+			erf_cursor_init(&cursor, buf, len);
+			while ((r = erf_cursor_read(&cursor, toc)) > 0)
+				sum += toc->names_size;
+		}
+		t2 = now();
+		
+		printf("%s, 50000 entries: parse_erf_data_f %.1f ns/entry, cursor %.1f ns/entry (%zu)\n", vnames[v],
+			   (t1 - t0) * 1e9 / (reps * 50000.0), (t2 - t1) * 1e9 / (reps * 50000.0), sum);
+		erf_toc_free(toc);
+		free(buf);
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		return run_bench();
+	return run_tests();
+}
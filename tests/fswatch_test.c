@@ -0,0 +1,288 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Checks the inotify watcher of fswatch on a temporary folder: files
+ * created, renamed and deleted are reported, also in folders made after
+ * the watch started, and the root is reported when the events overflow
+ * the queue and are lost. Linux only.
+ */
+
+#include "fswatch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How long to wait for an event before giving up. */
+#define TIMEOUT 5
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/* The paths reported since the last clear_seen. */
+static char **seen;
+static size_t nseen, seencap;
+
+/* Set to make the next callback wait for release, with held set meanwhile. */
+static int hold, held;
+
+static void
+watch_cb(void *ctx, const char *path)
+{
+	(void)ctx;
+	
+	pthread_mutex_lock(&lock);
+	if (hold)
+	{
+		hold = 0;
+		held = 1;
+		pthread_cond_broadcast(&cond);
+		while (held)
+			pthread_cond_wait(&cond, &lock);
+	}
+	if (nseen == seencap)
+	{
+		size_t ncap = seencap ? seencap * 2 : 64;
+		char **n = realloc(seen, ncap * sizeof (*seen));
+		
+		if (!n)
+			abort();
+		seen = n;
+		seencap = ncap;
+	}
+	if (!(seen[nseen] = strdup(path)))
+		abort();
+	nseen++;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static void
+clear_seen(void)
+{
+	size_t i;
+	
+	pthread_mutex_lock(&lock);
+	for (i = 0 ; i < nseen ; i++)
+		free(seen[i]);
+	nseen = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static struct timespec
+deadline(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += TIMEOUT;
+	return ts;
+}
+
+/* Waits for path to be reported. Returns 0 if it was, -1 on timeout. */
+static int
+wait_for(const char *path, const char *what)
+{
+	struct timespec ts = deadline();
+	size_t i = 0;
+	int res = -1;
+	
+	pthread_mutex_lock(&lock);
+	while (1)
+	{
+		for ( ; i < nseen ; i++)
+		{
+			if (strcmp(seen[i], path) == 0)
+				break;
+		}
+		if (i < nseen)
+		{
+			res = 0;
+			break;
+		}
+		if (pthread_cond_timedwait(&cond, &lock, &ts) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&lock);
+	
+	if (res)
+		fprintf(stderr, "%s: %s was not reported\n", what, path);
+	return res;
+}
+
+static int
+make_file(const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	
+	if (fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static long
+max_queued_events(void)
+{
+	FILE *f = fopen("/proc/sys/fs/inotify/max_queued_events", "r");
+	long n = 16384;
+	
+	if (f)
+	{
+		if (fscanf(f, "%ld", &n) != 1)
+			n = 16384;
+		fclose(f);
+	}
+	return n;
+}
+
+/* Stops the watcher from reading, makes more events than the queue holds, then lets it go on. */
+static int
+check_overflow(const char *root)
+{
+	char path[PATH_MAX];
+	long i, n = max_queued_events() + 16;
+	struct timespec ts = deadline();
+	int res = 0;
+	
+	if (n > 1000000)
+	{
+		printf("fswatch_test: max_queued_events too large, not checking overflow\n");
+		return 0;
+	}
+	
+	pthread_mutex_lock(&lock);
+	hold = 1;
+	pthread_mutex_unlock(&lock);
+	
+	snprintf(path, sizeof (path), "%s/gate", root);
+	if (make_file(path))
+		return -1;
+	
+	pthread_mutex_lock(&lock);
+	while (!held && res == 0)
+		res = pthread_cond_timedwait(&cond, &lock, &ts);
+	pthread_mutex_unlock(&lock);
+	if (!held)
+	{
+		fprintf(stderr, "overflow: the watcher never got the first event\n");
+		return -1;
+	}
+	
+	for (i = 0 ; i < n && res == 0 ; i++)
+	{
+		snprintf(path, sizeof (path), "%s/flood.%ld", root, i);
+		res = make_file(path);
+	}
+	
+	clear_seen();
+	pthread_mutex_lock(&lock);
+	held = 0;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	
+	if (res)
+		return -1;
+	res = wait_for(root, "overflow");
+	
+	for (i = 0 ; i < n ; i++)
+	{
+		snprintf(path, sizeof (path), "%s/flood.%ld", root, i);
+		unlink(path);
+	}
+	snprintf(path, sizeof (path), "%s/gate", root);
+	unlink(path);
+	return res;
+}
+
+int
+main(void)
+{
+	char root[] = "/tmp/fswatch_test.XXXXXX";
+	char a[PATH_MAX], b[PATH_MAX], sub[PATH_MAX], c[PATH_MAX];
+	struct fswatch *w;
+	int failed = 0;
+	
+	if (!mkdtemp(root))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(a, sizeof (a), "%s/a", root);
+	snprintf(b, sizeof (b), "%s/b", root);
+	snprintf(sub, sizeof (sub), "%s/sub", root);
+	snprintf(c, sizeof (c), "%s/sub/c", root);
+	
+	w = fswatch_start(root, 0, watch_cb, NULL);
+	if (!w)
+	{
+		perror("fswatch_start");
+		rmdir(root);
+		return 1;
+	}
+	
+	failed |= make_file(a) || wait_for(a, "create");
+	
+	clear_seen();
+	if (rename(a, b))
+		perror("rename"), failed = 1;
+	failed |= wait_for(a, "rename from") | wait_for(b, "rename to");
+	
+	clear_seen();
+	if (unlink(b))
+		perror("unlink"), failed = 1;
+	failed |= wait_for(b, "delete");
+	
+	/* A folder made after the start has to get a watch of its own. */
+	clear_seen();
+	if (mkdir(sub, 0755))
+		perror("mkdir"), failed = 1;
+	failed |= wait_for(sub, "mkdir");
+	clear_seen();
+	failed |= make_file(c) || wait_for(c, "create in new folder");
+	clear_seen();
+	unlink(c);
+	failed |= wait_for(c, "delete in new folder");
+	rmdir(sub);
+	
+	failed |= check_overflow(root);
+	
+	fswatch_stop(w);
+	clear_seen();
+	free(seen);
+	rmdir(root);
+	
+	if (failed)
+		return 1;
+	printf("fswatch_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,455 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Checks pathclass against the rules it replaced, the NSPredicate and path
+ * component checks of DAArchive and Scanner, ported here component by
+ * component. The port includes the fixes pathclass made: ERFs are told by
+ * suffix, the (disabled) check looks for " (disabled)/" and paths with
+ * empty components are skipped. A table of fixed cases pins the rules
+ * themselves, then every path built from a word list up to four components
+ * deep, and some deeper ones, is run through both.
+ */
+
+#include "pathclass.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAXC 32
+#define RESLEN 1024
+
+struct comps
+{
+	size_t n;
+	char *c[MAXC];
+	char buf[RESLEN];
+};
+
+static void
+split(const char *path, struct comps *out)
+{
+	char *p;
+	
+	snprintf(out->buf, sizeof (out->buf), "%s", path);
+	out->n = 0;
+	out->c[out->n++] = out->buf;
+	for (p = out->buf ; *p ; p++)
+	{
+		if (*p == '/' && out->n < MAXC)
+		{
+			*p = '\0';
+			out->c[out->n++] = p + 1;
+		}
+	}
+}
+
+/* Components from to to, both included, joined with / and appended to out. */
+static void
+join(char *out, const struct comps *c, size_t from, size_t to)
+{
+	size_t i;
+	
+	for (i = from ; i <= to ; i++)
+	{
+		if (i > from)
+			strcat(out, "/");
+		strcat(out, c->c[i]);
+	}
+}
+
+static int
+ends_with_ci(const char *s, const char *suffix)
+{
+	size_t l = strlen(s), sl = strlen(suffix);
+	
+	return l >= sl && !strcasecmp(s + l - sl, suffix);
+}
+
+static int
+contains_ci(const char *s, const char *needle)
+{
+	size_t nl = strlen(needle);
+	
+	for ( ; *s ; s++)
+	{
+		if (!strncasecmp(s, needle, nl))
+			return 1;
+	}
+	return 0;
+}
+
+/* Was MATCHES[c] '\\.[ce]rf' on the whole path. */
+static int
+ref_is_erf(const char *name)
+{
+	return ends_with_ci(name, ".erf") || ends_with_ci(name, ".crf");
+}
+
+/* Common to both archive kinds: directories, full paths, empty and dot components. */
+static int
+ref_member_ok(const char *path, const struct comps *c)
+{
+	size_t i;
+	
+	if (!*path || path[strlen(path) - 1] == '/')
+		return 0;
+	if (path[0] == '/' || strstr(path, "//"))
+		return 0;
+	for (i = 0 ; i < c->n ; i++)
+	{
+		if (c->c[i][0] == '.')
+			return 0;
+	}
+	return 1;
+}
+
+static void
+ref_member(char *out, const struct comps *c, const char *prefix, size_t cfrom, size_t cto, size_t ifrom)
+{
+	snprintf(out, RESLEN, "%c|%s", ref_is_erf(c->c[c->n - 1]) ? 'E' : 'F', prefix);
+	join(out, c, cfrom, cto);
+	strcat(out, "|");
+	strcat(out, prefix);
+	join(out, c, ifrom, c->n - 1);
+	sprintf(out + strlen(out), "|%d|%s", c->n > cto + 1, c->c[c->n - 1]);
+}
+
+static void
+ref_dazip(const char *path, char *out)
+{
+	struct comps c;
+	size_t cend;
+	
+	strcpy(out, "-");
+	if (!strcasecmp(path, "Manifest.xml"))
+	{
+		strcpy(out, "M");
+		return;
+	}
+	split(path, &c);
+	if (!ref_member_ok(path, &c))
+		return;
+	
+	if (strcasecmp(c.c[0], "Contents") || c.n < 3)
+		return;
+	
+	/* '(?i)^Contents/(Characters|Logs|Screenshots|Settings)/.*' */
+	if (!strcasecmp(c.c[1], "Characters") || !strcasecmp(c.c[1], "Logs")
+		|| !strcasecmp(c.c[1], "Screenshots") || !strcasecmp(c.c[1], "Settings"))
+		return;
+	if (contains_ci(path, " (disabled)/"))
+		return;
+	
+	cend = strcasecmp(c.c[1], "packages") ? 2 : 4;
+	if (c.n < cend + 1)
+		return;
+	ref_member(out, &c, "", 1, cend, 1);
+}
+
+static void
+ref_override(const char *path, char *out)
+{
+	struct comps c;
+	size_t idx;
+	
+	strcpy(out, "-");
+	if (!strcasecmp(path, "Manifest.xml"))
+	{
+		strcpy(out, "M");
+		return;
+	}
+	split(path, &c);
+	if (!ref_member_ok(path, &c))
+		return;
+	
+	for (idx = 0 ; idx < c.n ; idx++)
+	{
+		if (!strcasecmp(c.c[idx], "override"))
+			break;
+	}
+	if (idx + 1 >= c.n)
+		return;
+	ref_member(out, &c, "packages/core/", idx, idx + 1, idx);
+}
+
+static void
+ref_scan(const char *path, int disabled, char *out)
+{
+	char p[RESLEN];
+	size_t len;
+	struct comps c;
+	
+	strcpy(out, "-");
+	snprintf(p, sizeof (p), "%s", path);
+	len = strlen(p);
+	if (len > 1 && p[len - 1] == '/' && p[len - 2] != '/')
+		p[len - 1] = '\0';
+	if (!*p || p[0] == '/' || strstr(p, "//"))
+		return;
+	split(p, &c);
+	
+	if (!strcasecmp(c.c[0], "Addins") || !strcasecmp(c.c[0], "Offers"))
+	{
+		if (c.n < 2)
+			return;
+		strcpy(out, "A|");
+		join(out, &c, 0, 1);
+		return;
+	}
+	
+	if (disabled && ends_with_ci(c.c[0], " (disabled)"))
+		c.c[0][strlen(c.c[0]) - strlen(" (disabled)")] = '\0';
+	if (c.n > 4)
+	{
+		strcpy(out, "D|");
+		join(out, &c, 0, 3);
+	}
+	else
+	{
+		strcpy(out, "F|");
+		join(out, &c, 0, c.n - 1);
+	}
+}
+
+static void
+span_cat(char *out, const char *path, struct path_span s)
+{
+	strncat(out, path + s.offset, s.length);
+}
+
+typedef enum path_kind (*member_func)(const char *path, size_t len, struct path_member *out);
+
+static void
+run_member(member_func func, const char *path, char *out)
+{
+	struct path_member m;
+	
+	memset(&m, 0xa5, sizeof (m));
+	switch (func(path, strlen(path), &m))
+	{
+	case PATH_SKIP:
+		strcpy(out, "-");
+		return;
+	case PATH_MANIFEST:
+		strcpy(out, "M");
+		return;
+	case PATH_ERF:
+		sprintf(out, "E|%s", m.prefix);
+		break;
+	case PATH_FILE:
+		sprintf(out, "F|%s", m.prefix);
+		break;
+	}
+	span_cat(out, path, m.content);
+	strcat(out, "|");
+	strcat(out, m.prefix);
+	span_cat(out, path, m.install);
+	sprintf(out + strlen(out), "|%d|", m.in_directory);
+	span_cat(out, path, m.name);
+}
+
+static void
+run_scan(const char *path, int disabled, char *out)
+{
+	struct path_scan s;
+	
+	memset(&s, 0xa5, sizeof (s));
+	switch (pathclass_scan(path, strlen(path), disabled, &s))
+	{
+	case PATH_SCAN_NONE:
+		strcpy(out, "-");
+		return;
+	case PATH_SCAN_ADDIN:
+		strcpy(out, "A|");
+		break;
+	case PATH_SCAN_DIR:
+		strcpy(out, "D|");
+		break;
+	case PATH_SCAN_FILE:
+		strcpy(out, "F|");
+		break;
+	}
+	span_cat(out, path, s.head);
+	span_cat(out, path, s.tail);
+}
+
+static unsigned long checked, failed;
+
+static void
+expect(const char *what, const char *path, const char *got, const char *want)
+{
+	checked++;
+	if (!strcmp(got, want))
+		return;
+	if (failed++ < 20)
+		fprintf(stderr, "%s \"%s\": got %s, expected %s\n", what, path, got, want);
+}
+
+static void
+compare(const char *path)
+{
+	char got[RESLEN], want[RESLEN];
+	int d;
+	
+	run_member(pathclass_dazip, path, got);
+	ref_dazip(path, want);
+	expect("dazip", path, got, want);
+	
+	run_member(pathclass_override, path, got);
+	ref_override(path, want);
+	expect("override", path, got, want);
+	
+	for (d = 0 ; d < 2 ; d++)
+	{
+		run_scan(path, d, got);
+		ref_scan(path, d, want);
+		expect(d ? "scan disabled" : "scan", path, got, want);
+	}
+}
+
+/* Fixed cases, "-" for skipped. */
+static const struct
+{
+	const char *path;
+	const char *dazip;
+	const char *override;
+	const char *scan;
+	const char *scan_disabled;
+} table[] = {
+	{ "Manifest.xml", "M", "M", "F|Manifest.xml", "F|Manifest.xml" },
+	{ "MANIFEST.XML", "M", "M", "F|MANIFEST.XML", "F|MANIFEST.XML" },
+	{ "Contents/Addins/foo/core/x.erf", "E|Addins/foo|Addins/foo/core/x.erf|1|x.erf", "-", "D|Contents/Addins/foo/core", "D|Contents/Addins/foo/core" },
+	{ "contents/addins/foo", "F|addins/foo|addins/foo|0|foo", "-", "F|contents/addins/foo", "F|contents/addins/foo" },
+	{ "Contents/packages/core/override/a/b.CRF", "E|packages/core/override/a|packages/core/override/a/b.CRF|1|b.CRF", "E|packages/core/override/a|packages/core/override/a/b.CRF|1|b.CRF", "D|Contents/packages/core/override", "D|Contents/packages/core/override" },
+	{ "Contents/packages/core/override/a.erf", "E|packages/core/override/a.erf|packages/core/override/a.erf|0|a.erf", "E|packages/core/override/a.erf|packages/core/override/a.erf|0|a.erf", "D|Contents/packages/core/override", "D|Contents/packages/core/override" },
+	{ "Contents/packages/core/override", "-", "-", "F|Contents/packages/core/override", "F|Contents/packages/core/override" },
+	{ "Contents/Logs/x.txt", "-", "-", "F|Contents/Logs/x.txt", "F|Contents/Logs/x.txt" },
+	{ "Contents/settings/x.txt", "-", "-", "F|Contents/settings/x.txt", "F|Contents/settings/x.txt" },
+	{ "Contents/Addins/foo (disabled)/x", "-", "-", "F|Contents/Addins/foo (disabled)/x", "F|Contents/Addins/foo (disabled)/x" },
+	{ "Contents/Addins/foo disabled/x", "F|Addins/foo disabled|Addins/foo disabled/x|1|x", "-", "F|Contents/Addins/foo disabled/x", "F|Contents/Addins/foo disabled/x" },
+	{ "Contents/Addins/.DS_Store", "-", "-", "F|Contents/Addins/.DS_Store", "F|Contents/Addins/.DS_Store" },
+	{ "Contents/Addins/foo/", "-", "-", "F|Contents/Addins/foo", "F|Contents/Addins/foo" },
+	{ "/Contents/Addins/foo", "-", "-", "-", "-" },
+	{ "Contents//Addins/foo", "-", "-", "-", "-" },
+	{ "mymod/Override/x.erf", "-", "E|packages/core/Override/x.erf|packages/core/Override/x.erf|0|x.erf", "F|mymod/Override/x.erf", "F|mymod/Override/x.erf" },
+	{ "a/override/b/override/c", "-", "F|packages/core/override/b|packages/core/override/b/override/c|1|c", "D|a/override/b/override", "D|a/override/b/override" },
+	{ "a/b/c/d/e/f/g/h/override/x/y", "-", "F|packages/core/override/x|packages/core/override/x/y|1|y", "D|a/b/c/d", "D|a/b/c/d" },
+	{ "override/x", "-", "F|packages/core/override/x|packages/core/override/x|0|x", "F|override/x", "F|override/x" },
+	{ "override", "-", "-", "F|override", "F|override" },
+	{ "Addins/foo/core/data/x.erf", "-", "-", "A|Addins/foo", "A|Addins/foo" },
+	{ "offers", "-", "-", "-", "-" },
+	{ "packages (disabled)/core/override/a/b", "-", "F|packages/core/override/a|packages/core/override/a/b|1|b", "D|packages (disabled)/core/override/a", "D|packages/core/override/a" },
+	{ "packages (disabled)/core/override/a", "-", "F|packages/core/override/a|packages/core/override/a|0|a", "F|packages (disabled)/core/override/a", "F|packages/core/override/a" },
+	{ "packages/core/override/a/", "-", "-", "F|packages/core/override/a", "F|packages/core/override/a" },
+	{ "", "-", "-", "-", "-" },
+};
+
+static const char *words[] = {
+	"Contents", "contents", "packages", "core", "override", "Override", "Addins", "offers",
+	"Logs", "settings", "x", ".hid", "a.erf", "B.CRF", "f.txt", "Manifest.xml",
+	"foo (disabled)", "foo disabled", "packages (disabled)", "", "erf",
+};
+#define NWORDS (sizeof (words) / sizeof (*words))
+
+static void
+compare_variants(const char *path)
+{
+	char p[RESLEN];
+	
+	compare(path);
+	snprintf(p, sizeof (p), "%s/", path);
+	compare(p);
+	snprintf(p, sizeof (p), "/%s", path);
+	compare(p);
+	snprintf(p, sizeof (p), "/%s/", path);
+	compare(p);
+}
+
+int
+main(void)
+{
+	char got[RESLEN], path[RESLEN];
+	size_t i, depth, idx[12];
+	
+	for (i = 0 ; i < sizeof (table) / sizeof (*table) ; i++)
+	{
+		run_member(pathclass_dazip, table[i].path, got);
+		expect("table dazip", table[i].path, got, table[i].dazip);
+		run_member(pathclass_override, table[i].path, got);
+		expect("table override", table[i].path, got, table[i].override);
+		run_scan(table[i].path, 0, got);
+		expect("table scan", table[i].path, got, table[i].scan);
+		run_scan(table[i].path, 1, got);
+		expect("table scan disabled", table[i].path, got, table[i].scan_disabled);
+		compare(table[i].path);
+	}
+	
+	/* Every combination up to four deep. */
+	for (depth = 1 ; depth <= 4 ; depth++)
+	{
+		memset(idx, 0, sizeof (idx));
+		for (;;)
+		{
+			path[0] = '\0';
+			for (i = 0 ; i < depth ; i++)
+			{
+				if (i)
+					strcat(path, "/");
+				strcat(path, words[idx[i]]);
+			}
+			compare_variants(path);
+			
+			for (i = 0 ; i < depth && ++idx[i] == NWORDS ; i++)
+				idx[i] = 0;
+			if (i == depth)
+				break;
+		}
+	}
+	
+	/* Runs of the word list for the deeper ones. */
+	for (depth = 5 ; depth <= 12 ; depth++)
+	{
+		size_t start;
+		
+		for (start = 0 ; start < 400 ; start++)
+		{
+			path[0] = '\0';
+			for (i = 0 ; i < depth ; i++)
+			{
+				if (i)
+					strcat(path, "/");
+				strcat(path, words[(start + i * (start / NWORDS + 1)) % NWORDS]);
+			}
+			compare_variants(path);
+		}
+	}
+	
+	if (failed)
+	{
+		fprintf(stderr, "pathclass_test: %lu of %lu checks failed\n", failed, checked);
+		return 1;
+	}
+	printf("pathclass_test: ok, %lu checks\n", checked);
+	return 0;
+}
@@ -0,0 +1,151 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Checks the perfect hash of xmlname: every name is found as itself, also
+ * when not NUL terminated, and near misses of them (one character changed,
+ * dropped or added, or of another case) are only found if they are names
+ * themselves. A linear search of the names is the reference. Fails when a
+ * name was added without the slot table being redone.
+ */
+
+#include "xmlname.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXLEN 64
+
+static enum xmlname
+reference(const char *name, size_t len)
+{
+	int xn;
+	
+	for (xn = XMLNAME_UNKNOWN + 1 ; xn < XMLNAME_COUNT ; xn++)
+	{
+		const char *s = xmlname_string((enum xmlname)xn);
+		
+		if (strlen(s) == len && memcmp(s, name, len) == 0)
+			return (enum xmlname)xn;
+	}
+	return XMLNAME_UNKNOWN;
+}
+
+static unsigned long checks;
+
+/* name is copied into a buffer with junk after it, so a missing length check shows. */
+static int
+check(const char *name, size_t len, const char *what)
+{
+	char buf[MAXLEN + 1];
+	enum xmlname want = reference(name, len), got;
+	
+	memcpy(buf, name, len);
+	buf[len] = 'x';
+	got = xmlname_lookup(buf, len);
+	checks++;
+	if (got == want)
+		return 0;
+	fprintf(stderr, "%s: \"%.*s\" gave %d (%s), expected %d (%s)\n", what, (int)len, name,
+			got, xmlname_string(got), want, xmlname_string(want));
+	return -1;
+}
+
+int
+main(void)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-:.";
+	int failed = 0, xn;
+	
+	failed |= check("", 0, "empty");
+	
+	for (xn = XMLNAME_UNKNOWN + 1 ; xn < XMLNAME_COUNT ; xn++)
+	{
+		const char *name = xmlname_string((enum xmlname)xn);
+		size_t len = strlen(name), i, j;
+		char buf[MAXLEN + 1];
+		
+		if (len >= MAXLEN)
+		{
+			fprintf(stderr, "%s: too long for the test\n", name);
+			return 1;
+		}
+		if (xmlname_lookup(name, len) != (enum xmlname)xn)
+		{
+			fprintf(stderr, "round trip: \"%s\" is not found as %d\n", name, xn);
+			failed = 1;
+		}
+		
+		/* Prefixes and suffixes, down to one character. */
+		for (i = 1 ; i < len ; i++)
+		{
+			failed |= check(name, i, "prefix");
+			failed |= check(name + i, len - i, "suffix");
+		}
+		
+		for (i = 0 ; i < len ; i++)
+		{
+			/* Each character changed, to every other and to the other case. */
+			for (j = 0 ; j < sizeof (chars) - 1 ; j++)
+			{
+				memcpy(buf, name, len);
+				buf[i] = chars[j];
+				failed |= check(buf, len, "changed");
+			}
+			
+			/* Each character dropped. */
+			memcpy(buf, name, i);
+			memcpy(buf + i, name + i + 1, len - i - 1);
+			failed |= check(buf, len - 1, "dropped");
+		}
+		
+		/* All in the other case. */
+		for (i = 0 ; i < len ; i++)
+			buf[i] = isupper((unsigned char)name[i]) ? tolower((unsigned char)name[i]) : toupper((unsigned char)name[i]);
+		failed |= check(buf, len, "case");
+		
+		/* A character added anywhere. */
+		for (i = 0 ; i <= len ; i++)
+		{
+			for (j = 0 ; j < sizeof (chars) - 1 ; j++)
+			{
+				memcpy(buf, name, i);
+				buf[i] = chars[j];
+				memcpy(buf + i + 1, name + i, len - i);
+				failed |= check(buf, len + 1, "added");
+			}
+		}
+	}
+	
+	/* Out of range values give the empty name. */
+	if (*xmlname_string(XMLNAME_COUNT) != '\0')
+	{
+		fprintf(stderr, "xmlname_string: XMLNAME_COUNT gave \"%s\"\n", xmlname_string(XMLNAME_COUNT));
+		failed = 1;
+	}
+	
+	if (failed)
+		return 1;
+	printf("xmlname_test: ok, %lu checks\n", checks);
+	return 0;
+}
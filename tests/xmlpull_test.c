@@ -0,0 +1,134 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Checks that the markup positions xmlpull gives for the item elements
+ * (depth 2) split a list file the way DataStore saves it: the head up to
+ * the end of the root start tag, then per item the bytes since the previous
+ * one and the item itself, then the tail. Put back together, those have to
+ * be the file, byte for byte.
+ */
+
+#include "xmlpull.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *docs[] = {
+	"<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\r\n"
+	"<!-- Written by the game -->\r\n"
+	"<AddInsList>\r\n"
+	"\t<AddInItem UID=\"a\" Enabled=\"1\"><Title><DefaultText>Caf&#xE9; &amp; more</DefaultText></Title></AddInItem>\r\n"
+	"\t<!-- between items -->\r\n"
+	"\t<AddInItem UID=\"b\" Enabled=\"0\"/>\r\n"
+	"\t<?pi here?>\r\n"
+	"\t<AddInItem UID=\"c\">\r\n"
+	"\t\t<modazipin><contents><file name=\"x\"/></contents></modazipin>\r\n"
+	"\t\t<![CDATA[<not an element>]]>\r\n"
+	"\t</AddInItem>\r\n"
+	"<!-- after the last one -->\r\n"
+	"</AddInsList>\r\n"
+	"<!-- trailing -->\r\n",
+	
+	"<OfferList></OfferList>",
+	"<OfferList>\n</OfferList>\n",
+	"<OfferList><OfferItem UID='x'/><DisabledOfferItem UID='y'></DisabledOfferItem></OfferList>",
+};
+
+static int
+check(const char *doc)
+{
+	size_t len = strlen(doc), gap = 0, start = 0, head = 0, items = 0;
+	char *out = malloc(len + 1);
+	size_t outlen = 0;
+	struct xmlpull xp;
+	int ev;
+	
+	if (!out || xmlpull_init(&xp, doc, len))
+	{
+		perror("xmlpull_init");
+		free(out);
+		return -1;
+	}
+	
+	while ((ev = xmlpull_next(&xp)) > 0)
+	{
+		if (ev == XMLPULL_START_ELEMENT && xp.depth == 1)
+		{
+			head = gap = xp.cur - xp.start;
+			memcpy(out, doc, head);
+			outlen = head;
+		}
+		else if (ev == XMLPULL_START_ELEMENT && xp.depth == 2)
+			start = xp.markup - xp.start;
+		else if (ev == XMLPULL_END_ELEMENT && xp.depth == 2)
+		{
+			size_t end = xp.cur - xp.start;
+			
+			if (doc[start] != '<' || doc[end - 1] != '>')
+			{
+				fprintf(stderr, "xmlpull_test: item %zu spans \"%.*s\"\n", items, (int)(end - start), doc + start);
+				free(out);
+				xmlpull_free(&xp);
+				return -1;
+			}
+			memcpy(out + outlen, doc + gap, end - gap);
+			outlen += end - gap;
+			gap = end;
+			items++;
+		}
+	}
+	xmlpull_free(&xp);
+	if (ev < 0)
+	{
+		perror("xmlpull_next");
+		free(out);
+		return -1;
+	}
+	
+	memcpy(out + outlen, doc + gap, len - gap);
+	outlen += len - gap;
+	
+	if (outlen != len || memcmp(out, doc, len))
+	{
+		fprintf(stderr, "xmlpull_test: put back as \"%.*s\"\n", (int)outlen, out);
+		free(out);
+		return -1;
+	}
+	free(out);
+	return 0;
+}
+
+int
+main(void)
+{
+	size_t i;
+	int failed = 0;
+	
+	for (i = 0 ; i < sizeof (docs) / sizeof (*docs) ; i++)
+		failed |= check(docs[i]);
+	
+	if (failed)
+		return 1;
+	printf("xmlpull_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "xmlname.h"
+
+#include <string.h>
+
+static const char *const names[XMLNAME_COUNT] =
+{
+	"",
+	"AddInsList",
+	"AddInItem",
+	"OfferList",
+	"OfferItem",
+	"DisabledOfferItem",
+	"OverrideList",
+	"OverrideItem",
+	"Title",
+	"Description",
+	"Rating",
+	"RatingDescription",
+	"URL",
+	"Publisher",
+	"Image",
+	"ReleaseDate",
+	"Version",
+	"GameVersion",
+	"Type",
+	"Price",
+	"Size",
+	"PrereqList",
+	"modazipin",
+	"paths",
+	"contents",
+	"content",
+	"file",
+	"dir",
+	"PRCList",
+	"PRCItem",
+	"UID",
+	"Name",
+	"ExtendedModuleUID",
+	"Priority",
+	"Format",
+	"BioWare",
+	"Enabled",
+	"State",
+	"RequiresAuthorization",
+	"Presentation",
+	"ProductID",
+	"microContentID",
+	"DefaultText",
+	"origGameVersion",
+	"path",
+	"name",
+};
+
+/*
+ * Slot for each hash value, found by trying multipliers until none of the
+ * names above collided. Has to be redone whenever a name is added,
+ * tests/xmlname_test fails until it is.
+ */
+#define SLOTS 128
+
+static const unsigned char slots[SLOTS] =
+{
+	40, 32,  0, 38,  0,  0, 13,  0, 20,  0,  0, 18,  0,  0,  0,  0,
+	 0, 24,  1,  0, 22, 41,  8,  0,  0, 28,  0,  0,  0, 35,  0, 17,
+	 0,  0,  0,  0,  0, 15,  0,  0,  0,  0, 39,  0,  0,  2,  0,  0,
+	36, 34,  0,  0, 23,  0, 10,  0, 25, 42, 31,  0,  0, 29,  0,  0,
+	 3,  0,  0, 43,  0,  0,  0,  6,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0, 21, 16,  0,  0, 19, 44,  0, 45,  0,  0,  0,  0,  0,
+	27, 33,  0,  0,  0,  0, 11,  4,  0,  0,  0, 30, 12,  5,  7,  0,
+	 0, 26,  0,  0, 14,  0, 37,  0,  0,  0,  0,  0,  9,  0,  0,  0,
+};
+
+static inline unsigned
+hash(const unsigned char *name, size_t len)
+{
+	return (unsigned)(len * 7 + name[0] * 13 + name[len - 1] * 31 + name[len / 2]) % SLOTS;
+}
+
+enum xmlname
+xmlname_lookup(const char *name, size_t len)
+{
+	enum xmlname xn;
+	
+	if (len == 0)
+		return XMLNAME_UNKNOWN;
+	
+	xn = slots[hash((const unsigned char*)name, len)];
+	if (xn == XMLNAME_UNKNOWN || strncmp(names[xn], name, len) != 0 || names[xn][len] != '\0')
+		return XMLNAME_UNKNOWN;
+	return xn;
+}
+
+const char *
+xmlname_string(enum xmlname xn)
+{
+	if (xn >= XMLNAME_COUNT)
+		return names[XMLNAME_UNKNOWN];
+	return names[xn];
+}
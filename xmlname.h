@@ -0,0 +1,90 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef XMLNAME_H
+#define XMLNAME_H
+
+#include <stddef.h>
+
+/*
+ * The element and attribute names the list and manifest loaders know about,
+ * looked up with a perfect hash so that dispatching on a name is a single
+ * compare rather than a chain of them. The enum values are named after the
+ * XML names as they are, case included, since Name and name are both used.
+ */
+enum xmlname
+{
+	XMLNAME_UNKNOWN,
+	XMLNAME_AddInsList,
+	XMLNAME_AddInItem,
+	XMLNAME_OfferList,
+	XMLNAME_OfferItem,
+	XMLNAME_DisabledOfferItem,
+	XMLNAME_OverrideList,
+	XMLNAME_OverrideItem,
+	XMLNAME_Title,
+	XMLNAME_Description,
+	XMLNAME_Rating,
+	XMLNAME_RatingDescription,
+	XMLNAME_URL,
+	XMLNAME_Publisher,
+	XMLNAME_Image,
+	XMLNAME_ReleaseDate,
+	XMLNAME_Version,
+	XMLNAME_GameVersion,
+	XMLNAME_Type,
+	XMLNAME_Price,
+	XMLNAME_Size,
+	XMLNAME_PrereqList,
+	XMLNAME_modazipin,
+	XMLNAME_paths,
+	XMLNAME_contents,
+	XMLNAME_content,
+	XMLNAME_file,
+	XMLNAME_dir,
+	XMLNAME_PRCList,
+	XMLNAME_PRCItem,
+	XMLNAME_UID,
+	XMLNAME_Name,
+	XMLNAME_ExtendedModuleUID,
+	XMLNAME_Priority,
+	XMLNAME_Format,
+	XMLNAME_BioWare,
+	XMLNAME_Enabled,
+	XMLNAME_State,
+	XMLNAME_RequiresAuthorization,
+	XMLNAME_Presentation,
+	XMLNAME_ProductID,
+	XMLNAME_microContentID,
+	XMLNAME_DefaultText,
+	XMLNAME_origGameVersion,
+	XMLNAME_path,
+	XMLNAME_name,
+	XMLNAME_COUNT
+};
+
+/* XMLNAME_UNKNOWN for any name not above. name need not be NUL terminated. */
+enum xmlname xmlname_lookup(const char *name, size_t len);
+
+/* The name itself, NUL terminated. */
+const char *xmlname_string(enum xmlname xn);
+
+#endif /*XMLNAME_H*/
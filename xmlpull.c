@@ -0,0 +1,640 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "xmlpull.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static int
+is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int
+is_name_end(char c)
+{
+	return is_space(c) || c == '/' || c == '>' || c == '=' || c == '<';
+}
+
+static int
+starts_with(const struct xmlpull *xp, const char *s)
+{
+	size_t l = strlen(s);
+	
+	return (size_t)(xp->end - xp->cur) >= l && memcmp(xp->cur, s, l) == 0;
+}
+
+static int
+malformed(void)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static int
+buf_reserve(struct xmlpull *xp, size_t n)
+{
+	char *nbuf;
+	size_t nsize;
+	
+	if (xp->buf_len + n <= xp->buf_size)
+		return 0;
+	
+	nsize = xp->buf_size ? xp->buf_size : 256;
+	while (nsize < xp->buf_len + n)
+		nsize *= 2;
+	nbuf = realloc(xp->buf, nsize);
+	if (!nbuf)
+		return -1;
+	xp->buf = nbuf;
+	xp->buf_size = nsize;
+	return 0;
+}
+
+static int
+buf_append(struct xmlpull *xp, const char *s, size_t n)
+{
+	if (!n)
+		return 0;
+	if (buf_reserve(xp, n))
+		return -1;
+	memcpy(xp->buf + xp->buf_len, s, n);
+	xp->buf_len += n;
+	return 0;
+}
+
+static int
+buf_append_utf8(struct xmlpull *xp, unsigned long c)
+{
+	char u[4];
+	size_t n;
+	
+	if (c == 0 || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+		return malformed();
+	
+	if (c < 0x80)
+	{
+		u[0] = (char)c;
+		n = 1;
+	}
+	else if (c < 0x800)
+	{
+		u[0] = (char)(0xC0 | (c >> 6));
+		u[1] = (char)(0x80 | (c & 0x3F));
+		n = 2;
+	}
+	else if (c < 0x10000)
+	{
+		u[0] = (char)(0xE0 | (c >> 12));
+		u[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+		u[2] = (char)(0x80 | (c & 0x3F));
+		n = 3;
+	}
+	else
+	{
+		u[0] = (char)(0xF0 | (c >> 18));
+		u[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+		u[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+		u[3] = (char)(0x80 | (c & 0x3F));
+		n = 4;
+	}
+	return buf_append(xp, u, n);
+}
+
+/* At an ampersand, append what the reference stands for. */
+static int
+decode_reference(struct xmlpull *xp)
+{
+	static const struct
+	{
+		const char *name;
+		char c;
+	} entities[] = {
+		{ "lt;", '<' },
+		{ "gt;", '>' },
+		{ "amp;", '&' },
+		{ "quot;", '"' },
+		{ "apos;", '\'' },
+	};
+	const char *p = xp->cur + 1;
+	size_t i;
+	
+	if (p < xp->end && *p == '#')
+	{
+		unsigned long c = 0;
+		int base = 10, digits = 0;
+		
+		p++;
+		if (p < xp->end && *p == 'x')
+		{
+			base = 16;
+			p++;
+		}
+		for (; p < xp->end && *p != ';' ; p++, digits++)
+		{
+			int d;
+			
+			if (*p >= '0' && *p <= '9')
+				d = *p - '0';
+			else if (base == 16 && *p >= 'a' && *p <= 'f')
+				d = *p - 'a' + 10;
+			else if (base == 16 && *p >= 'A' && *p <= 'F')
+				d = *p - 'A' + 10;
+			else
+				return malformed();
+			c = c * base + d;
+			if (c > 0x10FFFF)
+				return malformed();
+		}
+		if (p >= xp->end || !digits)
+			return malformed();
+		xp->cur = p + 1;
+		return buf_append_utf8(xp, c);
+	}
+	
+	for (i = 0 ; i < sizeof (entities) / sizeof (*entities) ; i++)
+	{
+		size_t l = strlen(entities[i].name);
+		
+		if ((size_t)(xp->end - p) >= l && memcmp(p, entities[i].name, l) == 0)
+		{
+			xp->cur = p + l;
+			return buf_append(xp, &entities[i].c, 1);
+		}
+	}
+	return malformed();
+}
+
+/* Skip past the terminator, failing if it's not there. */
+static int
+skip_past(struct xmlpull *xp, const char *term)
+{
+	size_t l = strlen(term);
+	
+	while ((size_t)(xp->end - xp->cur) >= l)
+	{
+		const char *p = memchr(xp->cur, term[0], xp->end - xp->cur - l + 1);
+		
+		if (!p)
+			break;
+		if (memcmp(p, term, l) == 0)
+		{
+			xp->cur = p + l;
+			return 0;
+		}
+		xp->cur = p + 1;
+	}
+	return malformed();
+}
+
+/* A doctype can have an internal subset in brackets, which is skipped as well. */
+static int
+skip_doctype(struct xmlpull *xp)
+{
+	int nest = 0;
+	char quote = 0;
+	
+	for (; xp->cur < xp->end ; xp->cur++)
+	{
+		char c = *xp->cur;
+		
+		if (quote)
+		{
+			if (c == quote)
+				quote = 0;
+		}
+		else if (c == '"' || c == '\'')
+			quote = c;
+		else if (c == '[')
+			nest++;
+		else if (c == ']')
+			nest--;
+		else if (c == '>' && nest <= 0)
+		{
+			xp->cur++;
+			return 0;
+		}
+	}
+	return malformed();
+}
+
+static int
+read_name(struct xmlpull *xp, const char **name, size_t *len)
+{
+	const char *p = xp->cur;
+	
+	while (p < xp->end && !is_name_end(*p))
+		p++;
+	if (p == xp->cur)
+		return malformed();
+	*name = xp->cur;
+	*len = p - xp->cur;
+	xp->cur = p;
+	return 0;
+}
+
+static void
+skip_space(struct xmlpull *xp)
+{
+	while (xp->cur < xp->end && is_space(*xp->cur))
+		xp->cur++;
+}
+
+/*
+ * Character data up to the next tag, with comments, processing instructions
+ * and CDATA sections in between taken care of. Line ends are normalised to
+ * \n as the spec says.
+ */
+static int
+read_text(struct xmlpull *xp)
+{
+	xp->buf_len = 0;
+	
+	while (xp->cur < xp->end)
+	{
+		const char *p = xp->cur;
+		
+		while (p < xp->end && *p != '<' && *p != '&' && *p != '\r')
+			p++;
+		if (buf_append(xp, xp->cur, p - xp->cur))
+			return -1;
+		xp->cur = p;
+		if (p == xp->end)
+			break;
+		
+		if (*p == '\r')
+		{
+			xp->cur++;
+			if (xp->cur < xp->end && *xp->cur == '\n')
+				continue;
+			if (buf_append(xp, "\n", 1))
+				return -1;
+		}
+		else if (*p == '&')
+		{
+			if (decode_reference(xp))
+				return -1;
+		}
+		else if (starts_with(xp, "<!--"))
+		{
+			if (skip_past(xp, "-->"))
+				return -1;
+		}
+		else if (starts_with(xp, "<![CDATA["))
+		{
+			const char *data = xp->cur += 9;
+			
+			if (skip_past(xp, "]]>"))
+				return -1;
+			if (buf_append(xp, data, xp->cur - 3 - data))
+				return -1;
+		}
+		else if (starts_with(xp, "<!DOCTYPE"))
+		{
+			if (skip_doctype(xp))
+				return -1;
+		}
+		else if (starts_with(xp, "<?"))
+		{
+			if (skip_past(xp, "?>"))
+				return -1;
+		}
+		else
+			break;
+	}
+	return 0;
+}
+
+/* Attribute values have their whitespace turned into spaces, but not when given as references. */
+static int
+read_value(struct xmlpull *xp)
+{
+	char quote;
+	
+	if (xp->cur >= xp->end || (*xp->cur != '"' && *xp->cur != '\''))
+		return malformed();
+	quote = *xp->cur++;
+	
+	while (xp->cur < xp->end && *xp->cur != quote)
+	{
+		char c = *xp->cur;
+		
+		if (c == '<')
+			return malformed();
+		if (c == '&')
+		{
+			if (decode_reference(xp))
+				return -1;
+			continue;
+		}
+		if (c == '\r' && xp->cur + 1 < xp->end && xp->cur[1] == '\n')
+			xp->cur++;
+		if (is_space(c))
+			c = ' ';
+		if (buf_append(xp, &c, 1))
+			return -1;
+		xp->cur++;
+	}
+	if (xp->cur >= xp->end)
+		return malformed();
+	xp->cur++;
+	return 0;
+}
+
+static int
+read_start(struct xmlpull *xp)
+{
+	size_t i;
+	
+	if (!xp->depth && xp->root_done)
+		return malformed();
+	
+	xp->cur++;
+	if (read_name(xp, &xp->name, &xp->name_len))
+		return -1;
+	
+	xp->nattrs = 0;
+	xp->buf_len = 0;
+	for (;;)
+	{
+		struct xmlpull_attr *attr;
+		
+		skip_space(xp);
+		if (xp->cur >= xp->end)
+			return malformed();
+		if (*xp->cur == '>')
+		{
+			xp->cur++;
+			break;
+		}
+		if (starts_with(xp, "/>"))
+		{
+			xp->cur += 2;
+			xp->pending_end = 1;
+			break;
+		}
+		
+		if (xp->nattrs == xp->attrs_size)
+		{
+			size_t nsize = xp->attrs_size ? xp->attrs_size * 2 : 8;
+			struct xmlpull_attr *nattrs = realloc(xp->attrs, nsize * sizeof (*nattrs));
+			
+			if (!nattrs)
+				return -1;
+			xp->attrs = nattrs;
+			xp->attrs_size = nsize;
+		}
+		attr = &xp->attrs[xp->nattrs++];
+		
+		if (read_name(xp, &attr->name, &attr->name_len))
+			return -1;
+		skip_space(xp);
+		if (xp->cur >= xp->end || *xp->cur != '=')
+			return malformed();
+		xp->cur++;
+		skip_space(xp);
+		
+		/* Offset for now, the buffer might move. */
+		attr->value = NULL;
+		attr->value_len = xp->buf_len;
+		if (read_value(xp))
+			return -1;
+		attr->value_len = xp->buf_len - attr->value_len;
+	}
+	
+	for (i = 0, xp->buf_len = 0 ; i < xp->nattrs ; i++)
+	{
+		xp->attrs[i].value = xp->buf ? xp->buf + xp->buf_len : "";
+		xp->buf_len += xp->attrs[i].value_len;
+	}
+	
+	if (xp->depth == xp->stack_size)
+	{
+		size_t nsize = xp->stack_size ? xp->stack_size * 2 : 16;
+		struct xmlpull_span *nstack = realloc(xp->stack, nsize * sizeof (*nstack));
+		
+		if (!nstack)
+			return -1;
+		xp->stack = nstack;
+		xp->stack_size = nsize;
+	}
+	xp->stack[xp->depth].name = xp->name;
+	xp->stack[xp->depth].len = xp->name_len;
+	xp->depth++;
+	return XMLPULL_START_ELEMENT;
+}
+
+static int
+read_end(struct xmlpull *xp)
+{
+	const char *name;
+	size_t len;
+	
+	xp->cur += 2;
+	if (read_name(xp, &name, &len))
+		return -1;
+	skip_space(xp);
+	if (xp->cur >= xp->end || *xp->cur != '>')
+		return malformed();
+	xp->cur++;
+	
+	if (!xp->depth || xp->stack[xp->depth - 1].len != len || memcmp(xp->stack[xp->depth - 1].name, name, len) != 0)
+		return malformed();
+	
+	xp->name = name;
+	xp->name_len = len;
+	xp->nattrs = 0;
+	xp->pending_pop = 1;
+	if (xp->depth == 1)
+		xp->root_done = 1;
+	return XMLPULL_END_ELEMENT;
+}
+
+/* Check what the declaration says about encoding and standalone, it has to come first. */
+static int
+read_declaration(struct xmlpull *xp)
+{
+	const char *decl = xp->cur, *p;
+	size_t len;
+	
+	if (!starts_with(xp, "<?xml") || xp->end - xp->cur < 6 || !is_space(xp->cur[5]))
+		return 0;
+	if (skip_past(xp, "?>"))
+		return -1;
+	len = xp->cur - decl;
+	
+	for (p = decl ; p < decl + len ; p++)
+	{
+		const char *value;
+		char quote;
+		size_t vlen;
+		int enc;
+		
+		if (strncmp(p, "encoding", 8) == 0)
+			enc = 1;
+		else if (strncmp(p, "standalone", 10) == 0)
+			enc = 0;
+		else
+			continue;
+		
+		value = memchr(p, '=', decl + len - p);
+		if (!value)
+			return malformed();
+		for (value++ ; value < decl + len && is_space(*value) ; value++)
+			;
+		if (value >= decl + len || (*value != '"' && *value != '\''))
+			return malformed();
+		quote = *value++;
+		for (vlen = 0 ; value + vlen < decl + len && value[vlen] != quote ; vlen++)
+			;
+		p = value + vlen;
+		
+		if (enc)
+		{
+			if (!(vlen == 5 && strncasecmp(value, "utf-8", 5) == 0)
+				&& !(vlen == 4 && strncasecmp(value, "utf8", 4) == 0)
+				&& !(vlen == 8 && strncasecmp(value, "us-ascii", 8) == 0))
+			{
+				errno = ENOTSUP;
+				return -1;
+			}
+		}
+		else
+			xp->standalone = vlen == 3 && strncmp(value, "yes", 3) == 0;
+	}
+	return 0;
+}
+
+int
+xmlpull_init(struct xmlpull *xp, const void *data, size_t len)
+{
+	memset(xp, 0, sizeof (*xp));
+	xp->start = xp->cur = data;
+	xp->end = xp->cur + len;
+	xp->standalone = -1;
+	
+	if (len >= 2 && (memcmp(data, "\xFE\xFF", 2) == 0 || memcmp(data, "\xFF\xFE", 2) == 0))
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (len >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+		xp->cur += 3;
+	
+	return read_declaration(xp);
+}
+
+void
+xmlpull_free(struct xmlpull *xp)
+{
+	free(xp->stack);
+	free(xp->attrs);
+	free(xp->buf);
+	memset(xp, 0, sizeof (*xp));
+}
+
+int
+xmlpull_next(struct xmlpull *xp)
+{
+	if (xp->pending_pop)
+	{
+		xp->pending_pop = 0;
+		xp->depth--;
+	}
+	if (xp->pending_end)
+	{
+		xp->pending_end = 0;
+		xp->pending_pop = 1;
+		xp->nattrs = 0;
+		if (xp->depth == 1)
+			xp->root_done = 1;
+		return XMLPULL_END_ELEMENT;
+	}
+	
+	for (;;)
+	{
+		size_t i;
+		
+		if (read_text(xp))
+			return -1;
+		
+		if (xp->buf_len)
+		{
+			xp->text = xp->buf;
+			xp->text_len = xp->buf_len;
+			for (i = 0, xp->text_ws = 1 ; i < xp->text_len && xp->text_ws ; i++)
+				xp->text_ws = is_space(xp->text[i]);
+			
+			/* Outside of the root element only whitespace is allowed, and it's not reported. */
+			if (xp->depth)
+				return XMLPULL_TEXT;
+			if (!xp->text_ws)
+				return malformed();
+		}
+		
+		if (xp->cur >= xp->end)
+		{
+			if (xp->depth)
+				return malformed();
+			return XMLPULL_END_DOCUMENT;
+		}
+		
+		xp->markup = xp->cur;
+		if (starts_with(xp, "</"))
+			return read_end(xp);
+		return read_start(xp);
+	}
+}
+
+int
+xmlpull_skip(struct xmlpull *xp)
+{
+	size_t depth = xp->depth;
+	int ev;
+	
+	do
+	{
+		ev = xmlpull_next(xp);
+		if (ev < 0)
+			return -1;
+		if (ev == XMLPULL_END_DOCUMENT)
+			return malformed();
+	} while (ev != XMLPULL_END_ELEMENT || xp->depth != depth);
+	return 0;
+}
+
+size_t
+xmlpull_line(const struct xmlpull *xp)
+{
+	const char *p;
+	size_t line = 1;
+	
+	for (p = xp->start ; p < xp->cur ; p++)
+	{
+		if (*p == '\n')
+			line++;
+	}
+	return line;
+}
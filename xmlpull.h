@@ -0,0 +1,112 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef XMLPULL_H
+#define XMLPULL_H
+
+#include <stddef.h>
+
+/*
+ * A pull parser for the XML files the game keeps its lists in, reading
+ * straight from a mapping of the file without building a tree. Only UTF-8
+ * is handled and DTDs are not; processing instructions, comments and any
+ * doctype are skipped. Element and attribute names are spans into the
+ * input, text and attribute values are decoded into a buffer that is only
+ * valid until the next call.
+ */
+
+enum xmlpull_event
+{
+	XMLPULL_END_DOCUMENT,
+	XMLPULL_START_ELEMENT,
+	XMLPULL_END_ELEMENT,
+	XMLPULL_TEXT
+};
+
+struct xmlpull_attr
+{
+	const char *name;
+	size_t name_len;
+	const char *value;
+	size_t value_len;
+};
+
+struct xmlpull_span
+{
+	const char *name;
+	size_t len;
+};
+
+struct xmlpull
+{
+	const char *start;
+	const char *cur;
+	const char *end;
+	
+	/* From the XML declaration, -1 if not given. */
+	int standalone;
+	
+	/*
+	 * Open elements. An element is still counted in depth while its end
+	 * element event is current, root being 1.
+	 */
+	struct xmlpull_span *stack;
+	size_t depth;
+	size_t stack_size;
+	int pending_end;
+	int pending_pop;
+	int root_done;
+	
+	/*
+	 * The current event. Text is a single event even if split by comments or CDATA.
+	 * For element events markup is where the tag starts in the input, and once
+	 * the event is returned cur is right after it. An empty element tag gives
+	 * both events with the same markup.
+	 */
+	const char *markup;
+	const char *name;
+	size_t name_len;
+	struct xmlpull_attr *attrs;
+	size_t nattrs;
+	size_t attrs_size;
+	const char *text;
+	size_t text_len;
+	int text_ws;
+	
+	char *buf;
+	size_t buf_len;
+	size_t buf_size;
+};
+
+/* Fails with ENOTSUP if the input is not UTF-8, as far as can be told. */
+int xmlpull_init(struct xmlpull *xp, const void *data, size_t len);
+void xmlpull_free(struct xmlpull *xp);
+
+/* Returns the next event, or -1 with errno EINVAL if the input is malformed. */
+int xmlpull_next(struct xmlpull *xp);
+
+/* Right after a start element event, skip past the matching end element without reporting anything. */
+int xmlpull_skip(struct xmlpull *xp);
+
+/* Line number of the current position, for error messages. */
+size_t xmlpull_line(const struct xmlpull *xp);
+
+#endif /*XMLPULL_H*/
@@ -0,0 +1,603 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "zipdir.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifndef EFTYPE
+#define EFTYPE EINVAL
+#endif
+
+#define EOCD_SIG 0x06054b50
+#define EOCD_SIZE 22
+#define EOCD64_LOC_SIG 0x07064b50
+#define EOCD64_LOC_SIZE 20
+#define EOCD64_SIG 0x06064b50
+#define EOCD64_SIZE 56
+#define CDIR_SIG 0x02014b50
+#define CDIR_SIZE 46
+#define LOCAL_SIG 0x04034b50
+#define LOCAL_SIZE 30
+
+/* The EOCD comment can be up to 64k. */
+#define EOCD_SEARCH (EOCD_SIZE + 0xFFFF)
+
+#define EXTRACT_CHUNK (256 * 1024)
+
+static uint16_t
+get16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+	return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static int
+read_fully(int fd, void *buf, size_t len, off_t offset)
+{
+	unsigned char *p = buf;
+	
+	while (len)
+	{
+		ssize_t r = pread(fd, p, len, offset);
+		
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+		{
+			errno = EFTYPE;
+			return -1;
+		}
+		p += r;
+		len -= (size_t)r;
+		offset += r;
+	}
+	return 0;
+}
+
+static int
+write_fully(int fd, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	
+	while (len)
+	{
+		ssize_t r = write(fd, p, len);
+		
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= (size_t)r;
+	}
+	return 0;
+}
+
+/* Find the central directory, using the zip64 records if there are any. */
+static int
+find_cdir(int fd, uint64_t *count, uint64_t *size, uint64_t *offset)
+{
+	struct stat st;
+	unsigned char *buf;
+	size_t len;
+	ssize_t i;
+	
+	if (fstat(fd, &st))
+		return -1;
+	if (!S_ISREG(st.st_mode) || st.st_size < EOCD_SIZE)
+	{
+		errno = EFTYPE;
+		return -1;
+	}
+	
+	len = st.st_size < EOCD_SEARCH ? (size_t)st.st_size : EOCD_SEARCH;
+	if (!(buf = malloc(len)))
+		return -1;
+	if (read_fully(fd, buf, len, st.st_size - (off_t)len))
+	{
+		free(buf);
+		return -1;
+	}
+	
+	for (i = (ssize_t)len - EOCD_SIZE ; i >= 0 ; i--)
+	{
+		if (get32(buf + i) == EOCD_SIG && i + EOCD_SIZE + get16(buf + i + 20) <= (ssize_t)len)
+			break;
+	}
+	if (i < 0)
+	{
+		free(buf);
+		errno = EFTYPE;
+		return -1;
+	}
+	
+	*count = get16(buf + i + 10);
+	*size = get32(buf + i + 12);
+	*offset = get32(buf + i + 16);
+	
+	if (*count == 0xFFFF || *size == 0xFFFFFFFF || *offset == 0xFFFFFFFF)
+	{
+		off_t eocd = st.st_size - (off_t)len + i;
+		unsigned char loc[EOCD64_LOC_SIZE], rec[EOCD64_SIZE];
+		
+		if (eocd < EOCD64_LOC_SIZE
+			|| read_fully(fd, loc, sizeof(loc), eocd - EOCD64_LOC_SIZE)
+			|| get32(loc) != EOCD64_LOC_SIG
+			|| read_fully(fd, rec, sizeof(rec), (off_t)get64(loc + 8))
+			|| get32(rec) != EOCD64_SIG)
+		{
+			free(buf);
+			errno = EFTYPE;
+			return -1;
+		}
+		*count = get64(rec + 32);
+		*size = get64(rec + 40);
+		*offset = get64(rec + 48);
+	}
+	free(buf);
+	
+	if (*offset + *size > (uint64_t)st.st_size || *count > *size / CDIR_SIZE)
+	{
+		errno = EFTYPE;
+		return -1;
+	}
+	return 0;
+}
+
+/* FNV-1a over the name with ASCII upper case folded. */
+static uint32_t
+name_hash(const char *name, size_t len)
+{
+	uint32_t h = 0x811c9dc5U;
+	size_t i;
+	
+	for (i = 0 ; i < len ; i++)
+	{
+		unsigned char c = (unsigned char)name[i];
+		
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h = (h ^ c) * 0x01000193U;
+	}
+	return h;
+}
+
+static int
+name_equal(const char *a, const char *b, size_t len)
+{
+	size_t i;
+	
+	for (i = 0 ; i < len ; i++)
+	{
+		unsigned char ca = (unsigned char)a[i], cb = (unsigned char)b[i];
+		
+		if (ca >= 'A' && ca <= 'Z')
+			ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z')
+			cb += 'a' - 'A';
+		if (ca != cb)
+			return 0;
+	}
+	return 1;
+}
+
+/* Pick the 64 bit values out of the zip64 extra field, for the ones that overflowed. */
+static int
+parse_zip64(const unsigned char *extra, size_t len, struct zip_member *m, uint32_t usize, uint32_t csize, uint32_t offset)
+{
+	while (len >= 4)
+	{
+		uint16_t id = get16(extra);
+		uint16_t sz = get16(extra + 2);
+		
+		if ((size_t)sz + 4 > len)
+			break;
+		if (id == 0x0001)
+		{
+			const unsigned char *p = extra + 4, *end = p + sz;
+			
+			if (usize == 0xFFFFFFFF)
+			{
+				if (p + 8 > end)
+					return -1;
+				m->usize = get64(p);
+				p += 8;
+			}
+			if (csize == 0xFFFFFFFF)
+			{
+				if (p + 8 > end)
+					return -1;
+				m->csize = get64(p);
+				p += 8;
+			}
+			if (offset == 0xFFFFFFFF)
+			{
+				if (p + 8 > end)
+					return -1;
+				m->local_offset = get64(p);
+			}
+			return 0;
+		}
+		extra += 4 + sz;
+		len -= 4 + sz;
+	}
+	return usize == 0xFFFFFFFF || csize == 0xFFFFFFFF || offset == 0xFFFFFFFF ? -1 : 0;
+}
+
+struct zipdir *
+zipdir_open(int fd)
+{
+	uint64_t count, size, offset;
+	struct zipdir *zd;
+	unsigned char *cdir, *p, *end;
+	char *name;
+	size_t i, h;
+	
+	if (find_cdir(fd, &count, &size, &offset))
+		return NULL;
+	if (size > SIZE_MAX || !(cdir = malloc(size ? (size_t)size : 1)))
+		return NULL;
+	if (read_fully(fd, cdir, (size_t)size, (off_t)offset))
+	{
+		free(cdir);
+		return NULL;
+	}
+	
+	if (!(zd = calloc(1, sizeof(*zd)))
+		|| !(zd->members = calloc(count ? (size_t)count : 1, sizeof(*zd->members)))
+		|| !(zd->names = malloc((size_t)size))
+		|| !(zd->buckets = malloc((count ? (size_t)count : 1) * sizeof(*zd->buckets)))
+		|| !(zd->chain = malloc((count ? (size_t)count : 1) * sizeof(*zd->chain))))
+	{
+		zipdir_free(zd);
+		free(cdir);
+		return NULL;
+	}
+	zd->fd = fd;
+	zd->nbuckets = count ? (size_t)count : 1;
+	for (i = 0 ; i < zd->nbuckets ; i++)
+		zd->buckets[i] = ZIPDIR_NONE;
+	
+	/* Names are copied out nul terminated, each fits in the space of its header. */
+	p = cdir;
+	end = cdir + size;
+	name = zd->names;
+	for (i = 0 ; i < count ; i++)
+	{
+		struct zip_member *m = &zd->members[i];
+		size_t nlen, elen, clen;
+		uint32_t usize, csize, loff;
+		
+		if (p + CDIR_SIZE > end || get32(p) != CDIR_SIG)
+			goto bad;
+		nlen = get16(p + 28);
+		elen = get16(p + 30);
+		clen = get16(p + 32);
+		if (p + CDIR_SIZE + nlen + elen + clen > end)
+			goto bad;
+		
+		m->flags = get16(p + 8);
+		m->method = get16(p + 10);
+		m->crc = get32(p + 16);
+		m->csize = csize = get32(p + 20);
+		m->usize = usize = get32(p + 24);
+		m->local_offset = loff = get32(p + 42);
+		if (parse_zip64(p + CDIR_SIZE + nlen, elen, m, usize, csize, loff))
+			goto bad;
+		
+		memcpy(name, p + CDIR_SIZE, nlen);
+		name[nlen] = '\0';
+		m->name = name;
+		m->name_len = nlen;
+		name += nlen + 1;
+		
+		/* Chained in front, so a later duplicate is found first. */
+		h = name_hash(m->name, nlen) % zd->nbuckets;
+		zd->chain[i] = zd->buckets[h];
+		zd->buckets[h] = i;
+		
+		p += CDIR_SIZE + nlen + elen + clen;
+	}
+	zd->nmembers = (size_t)count;
+	free(cdir);
+	return zd;
+
+bad:
+	free(cdir);
+	zipdir_free(zd);
+	errno = EFTYPE;
+	return NULL;
+}
+
+void
+zipdir_free(struct zipdir *zd)
+{
+	if (!zd)
+		return;
+	if (zd->map)
+		munmap((void*)zd->map, zd->map_len);
+	free(zd->members);
+	free(zd->names);
+	free(zd->buckets);
+	free(zd->chain);
+	free(zd);
+}
+
+int
+zipdir_map(struct zipdir *zd)
+{
+	struct stat st;
+	void *map;
+	
+	if (zd->map)
+		return 0;
+	if (fstat(zd->fd, &st))
+		return -1;
+	if ((uint64_t)st.st_size > SIZE_MAX || st.st_size == 0)
+	{
+		errno = EFBIG;
+		return -1;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, zd->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	zd->map = map;
+	zd->map_len = (size_t)st.st_size;
+	return 0;
+}
+
+ssize_t
+zipdir_find(const struct zipdir *zd, const char *name, size_t len)
+{
+	size_t i;
+	
+	for (i = zd->buckets[name_hash(name, len) % zd->nbuckets] ; i != ZIPDIR_NONE ; i = zd->chain[i])
+	{
+		if (zd->members[i].name_len == len && name_equal(zd->members[i].name, name, len))
+			return (ssize_t)i;
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+/* The bytes at offset, from the map if there is one, otherwise read into buf. */
+static const unsigned char *
+read_input(const struct zipdir *zd, unsigned char *buf, size_t len, off_t offset)
+{
+	if (zd->map)
+	{
+		if ((uint64_t)offset > zd->map_len || len > zd->map_len - (uint64_t)offset)
+		{
+			errno = EFTYPE;
+			return NULL;
+		}
+		return zd->map + offset;
+	}
+	if (read_fully(zd->fd, buf, len, offset))
+		return NULL;
+	return buf;
+}
+
+int
+zipdir_data_offset(const struct zipdir *zd, size_t idx, off_t *offset)
+{
+	const struct zip_member *m;
+	unsigned char lhbuf[LOCAL_SIZE];
+	const unsigned char *lh;
+	
+	if (idx >= zd->nmembers)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	m = &zd->members[idx];
+	if (!(lh = read_input(zd, lhbuf, sizeof(lhbuf), (off_t)m->local_offset)))
+		return -1;
+	if (get32(lh) != LOCAL_SIG)
+	{
+		errno = EFTYPE;
+		return -1;
+	}
+	*offset = (off_t)m->local_offset + LOCAL_SIZE + get16(lh + 26) + get16(lh + 28);
+	return 0;
+}
+
+int
+zipdir_read(const struct zipdir *zd, size_t idx, zipdir_sink sink, void *ctx)
+{
+	const struct zip_member *m;
+	const unsigned char *in;
+	unsigned char *inbuf = NULL, *out = NULL;
+	uint64_t left, produced = 0;
+	uLong crc = crc32(0, Z_NULL, 0);
+	z_stream strm;
+	off_t offset;
+	int r = Z_OK, res = -1, s;
+	
+	if (idx >= zd->nmembers)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	m = &zd->members[idx];
+	if (m->flags & ZIP_FLAG_ENCRYPTED || (m->method != ZIP_METHOD_STORED && m->method != ZIP_METHOD_DEFLATED))
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (zipdir_data_offset(zd, idx, &offset))
+		return -1;
+	
+	memset(&strm, 0, sizeof(strm));
+	if (m->method == ZIP_METHOD_DEFLATED && inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	if ((!zd->map && !(inbuf = malloc(EXTRACT_CHUNK))) || !(out = malloc(EXTRACT_CHUNK)))
+		goto out;
+	
+	left = m->csize;
+	while (left || (m->method == ZIP_METHOD_DEFLATED && r != Z_STREAM_END))
+	{
+		size_t l = left > EXTRACT_CHUNK ? EXTRACT_CHUNK : (size_t)left;
+		
+		if (!(in = read_input(zd, inbuf, l, offset)))
+			goto out;
+		offset += (off_t)l;
+		left -= l;
+		
+		if (m->method == ZIP_METHOD_STORED)
+		{
+			crc = crc32(crc, in, (uInt)l);
+			produced += l;
+			if (produced > m->usize)
+				break;
+			if ((s = sink(ctx, in, l)))
+			{
+				res = s < 0 ? -1 : 1;
+				goto out;
+			}
+			continue;
+		}
+		
+		strm.next_in = (unsigned char*)in;
+		strm.avail_in = (uInt)l;
+		do
+		{
+			size_t have;
+			
+			strm.next_out = out;
+			strm.avail_out = EXTRACT_CHUNK;
+			r = inflate(&strm, Z_NO_FLUSH);
+			if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR)
+			{
+				errno = EINVAL;
+				goto out;
+			}
+			have = EXTRACT_CHUNK - strm.avail_out;
+			crc = crc32(crc, out, (uInt)have);
+			produced += have;
+			if (produced > m->usize)
+				break;
+			if (have && (s = sink(ctx, out, have)))
+			{
+				res = s < 0 ? -1 : 1;
+				goto out;
+			}
+		} while (!strm.avail_out && r != Z_STREAM_END);
+		
+		if (produced > m->usize || (r == Z_BUF_ERROR && !left))
+			break;
+	}
+	
+	if (produced != m->usize || crc != m->crc)
+	{
+		errno = EINVAL;
+		goto out;
+	}
+	res = 0;
+
+out:
+	if (m->method == ZIP_METHOD_DEFLATED)
+		inflateEnd(&strm);
+	free(inbuf);
+	free(out);
+	return res;
+}
+
+struct extract_ctx
+{
+	int outfd;
+	unsigned char *buf;
+	
+	const struct zip_member *m;
+	uint64_t out, in;
+	zipdir_progress progress;
+	void *progress_ctx;
+};
+
+static int
+extract_sink(void *ctx, const void *data, size_t len)
+{
+	struct extract_ctx *ec = ctx;
+	
+	if (ec->buf)
+	{
+		memcpy(ec->buf, data, len);
+		ec->buf += len;
+	}
+	else if (write_fully(ec->outfd, data, len))
+		return -1;
+	
+	if (ec->progress)
+	{
+		/* What's been read of the archive isn't known here, so it's taken in proportion. */
+		uint64_t in;
+		
+		ec->out += len;
+		in = ec->out >= ec->m->usize ? ec->m->csize : (uint64_t)((double)ec->out * ec->m->csize / ec->m->usize);
+		ec->progress(ec->progress_ctx, in - ec->in, len);
+		ec->in = in;
+	}
+	return 0;
+}
+
+int
+zipdir_extract(const struct zipdir *zd, size_t idx, int outfd, void *buf)
+{
+	return zipdir_extract_progress(zd, idx, outfd, buf, NULL, NULL);
+}
+
+int
+zipdir_extract_progress(const struct zipdir *zd, size_t idx, int outfd, void *buf, zipdir_progress progress, void *ctx)
+{
+	struct extract_ctx ec = { outfd, buf, NULL, 0, 0, progress, ctx };
+	
+	if (idx < zd->nmembers)
+		ec.m = &zd->members[idx];
+	return zipdir_read(zd, idx, extract_sink, &ec);
+}
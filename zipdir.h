@@ -0,0 +1,114 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef ZIPDIR_H
+#define ZIPDIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Reads the central directory of a zip file, so that members can be
+ * extracted in any order and from several threads at once, with pread on
+ * the same file descriptor or straight from a mapping of the file. Only
+ * stored and deflated members are supported.
+ */
+
+#define ZIP_FLAG_ENCRYPTED 0x0001
+#define ZIP_FLAG_UTF8 0x0800
+
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+
+struct zip_member
+{
+	const char *name;
+	size_t name_len;
+	int flags;
+	int method;
+	uint32_t crc;
+	uint64_t csize;
+	uint64_t usize;
+	uint64_t local_offset;
+};
+
+#define ZIPDIR_NONE ((size_t)-1)
+
+struct zipdir
+{
+	int fd;
+	size_t nmembers;
+	struct zip_member *members;
+	char *names;
+	
+	/* Name lookup, chained by member index. */
+	size_t nbuckets;
+	size_t *buckets;
+	size_t *chain;
+	
+	/* Set by zipdir_map. */
+	const unsigned char *map;
+	size_t map_len;
+};
+
+/* Returns NULL and sets errno on failure, EFTYPE (or EINVAL) if it's not a zip file. The fd is not closed by zipdir_free. */
+struct zipdir *zipdir_open(int fd);
+void zipdir_free(struct zipdir *zd);
+
+/* Map the whole file, so that members are read straight from memory instead of with pread. */
+int zipdir_map(struct zipdir *zd);
+
+/*
+ * Index of the member with the name, ignoring ASCII case like the game does.
+ * The last one wins if there are duplicates. Returns -1 with errno ENOENT
+ * if there's none.
+ */
+ssize_t zipdir_find(const struct zipdir *zd, const char *name, size_t len);
+
+/*
+ * Hands the member data to sink as it's extracted. A non-zero return from
+ * sink stops the extraction. If it was negative zipdir_read fails,
+ * otherwise it returns 1, without the CRC having been checked.
+ */
+typedef int (*zipdir_sink)(void *ctx, const void *data, size_t len);
+int zipdir_read(const struct zipdir *zd, size_t idx, zipdir_sink sink, void *ctx);
+
+/*
+ * Extracts the member to outfd, or into buf if it's not NULL, which then
+ * must have room for usize bytes. The CRC is checked. Returns -1 and sets
+ * errno on failure.
+ */
+int zipdir_extract(const struct zipdir *zd, size_t idx, int outfd, void *buf);
+
+/*
+ * As zipdir_extract, calling progress as each piece is written with the
+ * bytes read of the archive and written since the last call. The archive
+ * bytes are in proportion to what's written, so they are only exact once
+ * all is written.
+ */
+typedef void (*zipdir_progress)(void *ctx, uint64_t in, uint64_t out);
+int zipdir_extract_progress(const struct zipdir *zd, size_t idx, int outfd, void *buf, zipdir_progress progress, void *ctx);
+
+/* Where the member's data starts in the file, after the local header. */
+int zipdir_data_offset(const struct zipdir *zd, size_t idx, off_t *offset);
+
+#endif /*ZIPDIR_H*/
@@ -0,0 +1,672 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "zipwrite.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#endif
+
+#define EOCD_SIG 0x06054b50
+#define EOCD_SIZE 22
+#define EOCD64_LOC_SIG 0x07064b50
+#define EOCD64_LOC_SIZE 20
+#define EOCD64_SIG 0x06064b50
+#define EOCD64_SIZE 56
+#define CDIR_SIG 0x02014b50
+#define CDIR_SIZE 46
+#define LOCAL_SIG 0x04034b50
+#define LOCAL_SIZE 30
+#define ZIP64_EXTRA_LOCAL 20
+
+#define FLAG_UTF8 0x0800
+#define METHOD_STORED 0
+#define METHOD_DEFLATED 8
+
+/* Members this big get zip64 sizes, with some room for deflate making them bigger. */
+#define ZIP64_MEMBER 0xF0000000ULL
+
+/* Each chunk is deflated on its own, the window is how many are in memory at once. */
+#define CHUNK (512 * 1024)
+#define WINDOW_CHUNKS 32
+#define DICT_SIZE 32768
+
+struct chunk
+{
+	size_t member;
+	uint64_t index;
+	int last;
+	int deflate;
+	int level;
+	
+	const unsigned char *in;
+	size_t inlen;
+	unsigned char *inbuf;
+	
+	const unsigned char *dict;
+	size_t dictlen;
+	
+	unsigned char *out;
+	size_t outlen;
+	size_t outcap;
+	
+	uint32_t crc;
+	int error;
+};
+
+/* The member being read, which can span several windows. */
+struct reading
+{
+	int open;
+	int fd;
+	uint64_t size;
+	uint64_t done;
+	uint64_t index;
+	time_t mtime;
+	int stored;
+	unsigned char carry[DICT_SIZE];
+	size_t carrylen;
+};
+
+/* The member being written. */
+struct writing
+{
+	uint64_t local_offset;
+	int method;
+	int zip64;
+	uint32_t crc;
+	uint64_t csize;
+	uint64_t usize;
+	uint16_t dos_time;
+	uint16_t dos_date;
+};
+
+static void
+put16(unsigned char *p, uint16_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+	put16(p, (uint16_t)v);
+	put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+	put32(p, (uint32_t)v);
+	put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static int
+write_at(int fd, const void *buf, size_t len, uint64_t offset)
+{
+	const unsigned char *p = buf;
+	
+	while (len)
+	{
+		ssize_t r = pwrite(fd, p, len, (off_t)offset);
+		
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= (size_t)r;
+		offset += (uint64_t)r;
+	}
+	return 0;
+}
+
+static int
+read_at(int fd, void *buf, size_t len, uint64_t offset)
+{
+	unsigned char *p = buf;
+	
+	while (len)
+	{
+		ssize_t r = pread(fd, p, len, (off_t)offset);
+		
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+		{
+			/* Shrunk while being read. */
+			errno = EIO;
+			return -1;
+		}
+		p += r;
+		len -= (size_t)r;
+		offset += (uint64_t)r;
+	}
+	return 0;
+}
+
+static void
+dos_datetime(time_t t, uint16_t *dtime, uint16_t *ddate)
+{
+	struct tm tm;
+	
+	localtime_r(&t, &tm);
+	if (tm.tm_year < 80)
+	{
+		*dtime = 0;
+		*ddate = (1 << 5) | 1;
+		return;
+	}
+	*dtime = (uint16_t)(tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2);
+	*ddate = (uint16_t)((tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday);
+}
+
+static int
+name_flags(const char *name)
+{
+	for (; *name ; name++)
+	{
+		if ((unsigned char)*name >= 0x80)
+			return FLAG_UTF8;
+	}
+	return 0;
+}
+
+struct zipwrite *
+zipwrite_new(int fd, int level)
+{
+	struct zipwrite *zw = calloc(1, sizeof(*zw));
+	
+	if (!zw)
+		return NULL;
+	zw->fd = fd;
+	zw->level = level;
+	return zw;
+}
+
+void
+zipwrite_free(struct zipwrite *zw)
+{
+	size_t i;
+	
+	if (!zw)
+		return;
+	for (i = 0 ; i < zw->nentries ; i++)
+		free(zw->entries[i].name);
+	free(zw->entries);
+	free(zw);
+}
+
+static void
+deflate_chunk(void *ctx, size_t i)
+{
+	struct chunk *c = (struct chunk*)ctx + i;
+	z_stream strm;
+	int r;
+	
+	c->crc = (uint32_t)crc32(crc32(0, Z_NULL, 0), c->in, (uInt)c->inlen);
+	c->error = 0;
+	if (!c->deflate)
+		return;
+	
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, c->level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		c->error = ENOMEM;
+		return;
+	}
+	if (c->dictlen)
+		deflateSetDictionary(&strm, c->dict, (uInt)c->dictlen);
+	
+	/* A sync flush leaves the output byte aligned, so the chunks can simply be concatenated. */
+	strm.next_in = (unsigned char*)c->in;
+	strm.avail_in = (uInt)c->inlen;
+	strm.next_out = c->out;
+	strm.avail_out = (uInt)c->outcap;
+	r = deflate(&strm, c->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (c->last ? r != Z_STREAM_END : (r != Z_OK || strm.avail_in || !strm.avail_out))
+		c->error = EOVERFLOW;
+	c->outlen = c->outcap - strm.avail_out;
+	deflateEnd(&strm);
+}
+
+static int
+add_entry(struct zipwrite *zw, const char *name, const struct writing *w)
+{
+	struct zipwrite_entry *e;
+	
+	if (zw->nentries == zw->capacity)
+	{
+		size_t cap = zw->capacity ? zw->capacity * 2 : 64;
+		struct zipwrite_entry *entries = realloc(zw->entries, cap * sizeof(*entries));
+		
+		if (!entries)
+			return -1;
+		zw->entries = entries;
+		zw->capacity = cap;
+	}
+	
+	e = &zw->entries[zw->nentries];
+	if (!(e->name = strdup(name)))
+		return -1;
+	e->name_len = strlen(name);
+	e->flags = name_flags(name);
+	e->method = w->method;
+	e->crc = w->crc;
+	e->csize = w->csize;
+	e->usize = w->usize;
+	e->local_offset = w->local_offset;
+	e->dos_time = w->dos_time;
+	e->dos_date = w->dos_date;
+	zw->nentries++;
+	return 0;
+}
+
+static int
+write_local(struct zipwrite *zw, const char *name, struct writing *w)
+{
+	size_t nlen = strlen(name);
+	unsigned char hdr[LOCAL_SIZE + ZIP64_EXTRA_LOCAL];
+	size_t hlen = LOCAL_SIZE + (w->zip64 ? ZIP64_EXTRA_LOCAL : 0);
+	
+	if (nlen > 0xFFFF)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	
+	/* The sizes and CRC are filled in once the data is written. */
+	memset(hdr, 0, sizeof(hdr));
+	put32(hdr, LOCAL_SIG);
+	put16(hdr + 4, w->zip64 ? 45 : 20);
+	put16(hdr + 6, (uint16_t)name_flags(name));
+	put16(hdr + 8, (uint16_t)w->method);
+	put16(hdr + 10, w->dos_time);
+	put16(hdr + 12, w->dos_date);
+	put16(hdr + 26, (uint16_t)nlen);
+	put16(hdr + 28, w->zip64 ? ZIP64_EXTRA_LOCAL : 0);
+	
+	w->local_offset = zw->offset;
+	if (write_at(zw->fd, hdr, LOCAL_SIZE, zw->offset)
+		|| write_at(zw->fd, name, nlen, zw->offset + LOCAL_SIZE))
+		return -1;
+	if (w->zip64)
+	{
+		put16(hdr + LOCAL_SIZE, 0x0001);
+		put16(hdr + LOCAL_SIZE + 2, 16);
+		if (write_at(zw->fd, hdr + LOCAL_SIZE, ZIP64_EXTRA_LOCAL, zw->offset + LOCAL_SIZE + nlen))
+			return -1;
+	}
+	zw->offset += hlen + nlen;
+	return 0;
+}
+
+static int
+finish_local(struct zipwrite *zw, const char *name, const struct writing *w)
+{
+	unsigned char buf[16];
+	
+	put32(buf, w->crc);
+	if (w->zip64)
+	{
+		put32(buf + 4, 0xFFFFFFFF);
+		put32(buf + 8, 0xFFFFFFFF);
+		if (write_at(zw->fd, buf, 12, w->local_offset + 14))
+			return -1;
+		put64(buf, w->usize);
+		put64(buf + 8, w->csize);
+		return write_at(zw->fd, buf, 16, w->local_offset + LOCAL_SIZE + strlen(name) + 4);
+	}
+	if (w->csize > 0xFFFFFFFF || w->usize > 0xFFFFFFFF)
+	{
+		errno = EFBIG;
+		return -1;
+	}
+	put32(buf + 4, (uint32_t)w->csize);
+	put32(buf + 8, (uint32_t)w->usize);
+	return write_at(zw->fd, buf, 12, w->local_offset + 14);
+}
+
+/* Write out the chunks of a window in order, deciding on stored or deflated at the first chunk of each member. */
+static int
+write_window(struct zipwrite *zw, const struct zipwrite_member *members, struct chunk *chunks, size_t nchunks, struct reading *rd, struct writing *w)
+{
+	size_t i;
+	
+	for (i = 0 ; i < nchunks ; i++)
+	{
+		struct chunk *c = &chunks[i];
+		const struct zipwrite_member *m = &members[c->member];
+		const unsigned char *data;
+		size_t len;
+		
+		if (c->error)
+		{
+			errno = c->error;
+			return -1;
+		}
+		
+		if (c->index == 0)
+		{
+			/* Worth deflating if it saves at least a fiftieth. */
+			w->method = c->deflate && c->outlen < c->inlen - c->inlen / 50 ? METHOD_DEFLATED : METHOD_STORED;
+			w->crc = (uint32_t)crc32(0, Z_NULL, 0);
+			w->csize = w->usize = 0;
+			if (write_local(zw, m->name, w))
+				return -1;
+			if (!c->last)
+				rd->stored = w->method == METHOD_STORED;
+		}
+		
+		if (w->method == METHOD_DEFLATED)
+		{
+			data = c->out;
+			len = c->outlen;
+		}
+		else
+		{
+			data = c->in;
+			len = c->inlen;
+		}
+		if (write_at(zw->fd, data, len, zw->offset))
+			return -1;
+		zw->offset += len;
+		w->csize += len;
+		w->crc = (uint32_t)crc32_combine(w->crc, c->crc, (z_off_t)c->inlen);
+		w->usize += c->inlen;
+		
+		if (c->last && (finish_local(zw, m->name, w) || add_entry(zw, m->name, w)))
+			return -1;
+	}
+	return 0;
+}
+
+/* Start reading the next member. */
+static int
+open_member(const struct zipwrite_member *m, struct reading *rd, struct writing *w)
+{
+	struct stat st;
+	
+	memset(rd, 0, offsetof(struct reading, carry));
+	rd->open = 1;
+	rd->fd = -1;
+	rd->mtime = time(NULL);
+	if (m->path)
+	{
+		if ((rd->fd = open(m->path, O_RDONLY)) < 0)
+			return -1;
+		if (fstat(rd->fd, &st))
+		{
+			close(rd->fd);
+			rd->fd = -1;
+			return -1;
+		}
+		rd->size = (uint64_t)st.st_size;
+		rd->mtime = st.st_mtime;
+	}
+	else
+		rd->size = m->length;
+	
+	w->zip64 = rd->size >= ZIP64_MEMBER;
+	dos_datetime(rd->mtime, &w->dos_time, &w->dos_date);
+	return 0;
+}
+
+static void
+free_chunks(struct chunk *chunks)
+{
+	size_t i;
+	
+	for (i = 0 ; i < WINDOW_CHUNKS ; i++)
+	{
+		free(chunks[i].inbuf);
+		free(chunks[i].out);
+	}
+	free(chunks);
+}
+
+int
+zipwrite_add(struct zipwrite *zw, const struct zipwrite_member *members, size_t n)
+{
+	struct chunk *chunks;
+	struct reading *rd;
+	struct writing w;
+	size_t cur = 0, i, nchunks;
+	int res = -1;
+	
+	if (!(chunks = calloc(WINDOW_CHUNKS, sizeof(*chunks))))
+		return -1;
+	if (!(rd = calloc(1, sizeof(*rd))))
+	{
+		free(chunks);
+		return -1;
+	}
+	rd->fd = -1;
+	memset(&w, 0, sizeof(w));
+	for (i = 0 ; i < WINDOW_CHUNKS ; i++)
+	{
+		chunks[i].outcap = compressBound(CHUNK) + 64;
+		if (!(chunks[i].inbuf = malloc(CHUNK)) || !(chunks[i].out = malloc(chunks[i].outcap)))
+			goto out;
+	}
+	
+	while (cur < n)
+	{
+		/* Fill the window, from as many members as fit. */
+		for (nchunks = 0 ; nchunks < WINDOW_CHUNKS && cur < n ; nchunks++)
+		{
+			const struct zipwrite_member *m = &members[cur];
+			struct chunk *c = &chunks[nchunks];
+			size_t len;
+			
+			if (!rd->open && open_member(m, rd, &w))
+				goto out;
+			
+			len = rd->size - rd->done > CHUNK ? CHUNK : (size_t)(rd->size - rd->done);
+			if (m->path)
+			{
+				if (read_at(rd->fd, c->inbuf, len, rd->done))
+					goto out;
+				c->in = c->inbuf;
+			}
+			else
+				c->in = (const unsigned char*)m->data + rd->done;
+			c->inlen = len;
+			c->member = cur;
+			c->index = rd->index;
+			c->deflate = !m->store && zw->level != 0 && len && !rd->stored;
+			c->level = zw->level;
+			
+			/* Primed with what came before, in this window or the last. */
+			c->dict = NULL;
+			c->dictlen = 0;
+			if (rd->index > 0 && nchunks > 0 && chunks[nchunks - 1].member == cur)
+			{
+				const struct chunk *prev = &chunks[nchunks - 1];
+				
+				c->dictlen = prev->inlen > DICT_SIZE ? DICT_SIZE : prev->inlen;
+				c->dict = prev->in + prev->inlen - c->dictlen;
+			}
+			else if (rd->index > 0)
+			{
+				c->dict = rd->carry;
+				c->dictlen = rd->carrylen;
+			}
+			
+			rd->done += len;
+			rd->index++;
+			c->last = rd->done == rd->size;
+			if (c->last)
+			{
+				if (rd->fd >= 0)
+					close(rd->fd);
+				rd->fd = -1;
+				rd->open = 0;
+				cur++;
+			}
+		}
+
+#ifdef __APPLE__
+		dispatch_apply_f(nchunks, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), chunks, deflate_chunk);
+#else
+		for (i = 0 ; i < nchunks ; i++)
+			deflate_chunk(chunks, i);
+#endif
+
+		if (write_window(zw, members, chunks, nchunks, rd, &w))
+			goto out;
+		
+		/* The member continuing into the next window needs the end of this one. */
+		if (nchunks && !chunks[nchunks - 1].last)
+		{
+			const struct chunk *c = &chunks[nchunks - 1];
+			
+			rd->carrylen = c->inlen > DICT_SIZE ? DICT_SIZE : c->inlen;
+			memcpy(rd->carry, c->in + c->inlen - rd->carrylen, rd->carrylen);
+		}
+	}
+	res = 0;
+
+out:
+	if (rd->fd >= 0)
+		close(rd->fd);
+	free(rd);
+	free_chunks(chunks);
+	return res;
+}
+
+int
+zipwrite_finish(struct zipwrite *zw)
+{
+	uint64_t cdir_offset = zw->offset, cdir_size;
+	unsigned char hdr[CDIR_SIZE + 28], end[EOCD64_SIZE + EOCD64_LOC_SIZE + EOCD_SIZE];
+	size_t i, elen = 0;
+	int zip64_end;
+	
+	for (i = 0 ; i < zw->nentries ; i++)
+	{
+		const struct zipwrite_entry *e = &zw->entries[i];
+		unsigned char *x = hdr + CDIR_SIZE + 4;
+		int zip64 = e->usize >= 0xFFFFFFFF || e->csize >= 0xFFFFFFFF || e->local_offset >= 0xFFFFFFFF;
+		
+		memset(hdr, 0, sizeof(hdr));
+		put32(hdr, CDIR_SIG);
+		put16(hdr + 4, 3 << 8 | 45);
+		put16(hdr + 6, zip64 ? 45 : 20);
+		put16(hdr + 8, (uint16_t)e->flags);
+		put16(hdr + 10, (uint16_t)e->method);
+		put16(hdr + 12, e->dos_time);
+		put16(hdr + 14, e->dos_date);
+		put32(hdr + 16, e->crc);
+		put16(hdr + 28, (uint16_t)e->name_len);
+		put32(hdr + 38, 0100644U << 16);
+		
+		/* Only the ones that don't fit go in the extra field, in this order. */
+		if (e->usize >= 0xFFFFFFFF)
+		{
+			put64(x, e->usize);
+			x += 8;
+		}
+		if (e->csize >= 0xFFFFFFFF)
+		{
+			put64(x, e->csize);
+			x += 8;
+		}
+		if (e->local_offset >= 0xFFFFFFFF)
+		{
+			put64(x, e->local_offset);
+			x += 8;
+		}
+		put32(hdr + 20, e->csize >= 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)e->csize);
+		put32(hdr + 24, e->usize >= 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)e->usize);
+		put32(hdr + 42, e->local_offset >= 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)e->local_offset);
+		if (zip64)
+		{
+			elen = (size_t)(x - (hdr + CDIR_SIZE));
+			put16(hdr + CDIR_SIZE, 0x0001);
+			put16(hdr + CDIR_SIZE + 2, (uint16_t)(elen - 4));
+		}
+		else
+			elen = 0;
+		put16(hdr + 30, (uint16_t)elen);
+		
+		if (write_at(zw->fd, hdr, CDIR_SIZE, zw->offset)
+			|| write_at(zw->fd, e->name, e->name_len, zw->offset + CDIR_SIZE)
+			|| write_at(zw->fd, hdr + CDIR_SIZE, elen, zw->offset + CDIR_SIZE + e->name_len))
+			return -1;
+		zw->offset += CDIR_SIZE + e->name_len + elen;
+	}
+	cdir_size = zw->offset - cdir_offset;
+	
+	memset(end, 0, sizeof(end));
+	zip64_end = zw->nentries >= 0xFFFF || cdir_size >= 0xFFFFFFFF || cdir_offset >= 0xFFFFFFFF;
+	if (zip64_end)
+	{
+		unsigned char *loc = end + EOCD64_SIZE;
+		
+		put32(end, EOCD64_SIG);
+		put64(end + 4, EOCD64_SIZE - 12);
+		put16(end + 12, 3 << 8 | 45);
+		put16(end + 14, 45);
+		put64(end + 24, zw->nentries);
+		put64(end + 32, zw->nentries);
+		put64(end + 40, cdir_size);
+		put64(end + 48, cdir_offset);
+		
+		put32(loc, EOCD64_LOC_SIG);
+		put64(loc + 8, zw->offset);
+		put32(loc + 16, 1);
+	}
+	
+	{
+		unsigned char *eocd = end + (zip64_end ? EOCD64_SIZE + EOCD64_LOC_SIZE : 0);
+		
+		put32(eocd, EOCD_SIG);
+		put16(eocd + 8, zw->nentries >= 0xFFFF ? 0xFFFF : (uint16_t)zw->nentries);
+		put16(eocd + 10, zw->nentries >= 0xFFFF ? 0xFFFF : (uint16_t)zw->nentries);
+		put32(eocd + 12, cdir_size >= 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cdir_size);
+		put32(eocd + 16, cdir_offset >= 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cdir_offset);
+		
+		if (write_at(zw->fd, end, (size_t)(eocd + EOCD_SIZE - end), zw->offset))
+			return -1;
+		zw->offset += (size_t)(eocd + EOCD_SIZE - end);
+	}
+	
+	/* In case something bigger was there before. */
+	return ftruncate(zw->fd, (off_t)zw->offset);
+}
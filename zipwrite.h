@@ -0,0 +1,81 @@
+/* Copyright (c) 2010 Per Johansson, per at morth.org
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef ZIPWRITE_H
+#define ZIPWRITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Writes a zip file. Members are read a window of chunks at a time and the
+ * chunks deflated in parallel, each primed with the end of the chunk before
+ * it so the ratio stays close to deflating the member in one go. Memory use
+ * is bounded by the window, however large the members are. A member whose
+ * first chunk doesn't compress is stored instead.
+ */
+
+struct zipwrite_member
+{
+	const char *name; /* In the archive. */
+	const char *path; /* File to read, or NULL to use data. */
+	const void *data;
+	size_t length;
+	int store; /* Already compressed, don't bother trying. */
+};
+
+struct zipwrite_entry
+{
+	char *name;
+	size_t name_len;
+	int flags;
+	int method;
+	uint32_t crc;
+	uint64_t csize;
+	uint64_t usize;
+	uint64_t local_offset;
+	uint16_t dos_time;
+	uint16_t dos_date;
+};
+
+struct zipwrite
+{
+	int fd;
+	int level;
+	uint64_t offset;
+	size_t nentries;
+	size_t capacity;
+	struct zipwrite_entry *entries;
+};
+
+/* Writes to fd from its start, level as for zlib. The fd is not closed. Returns NULL and sets errno on failure. */
+struct zipwrite *zipwrite_new(int fd, int level);
+
+/* Add members in the order given. Returns -1 and sets errno on failure, the zip file is then unusable. */
+int zipwrite_add(struct zipwrite *zw, const struct zipwrite_member *members, size_t n);
+
+/* Writes the central directory. zipwrite_free must still be called. */
+int zipwrite_finish(struct zipwrite *zw);
+
+void zipwrite_free(struct zipwrite *zw);
+
+#endif /*ZIPWRITE_H*/